@@ -0,0 +1,71 @@
+#include "admission_control.hpp"
+
+#include "util.hpp"
+
+namespace mocca {
+    namespace {
+        constexpr uint32_t tokens_per_request = 1000;
+        constexpr uint32_t bucket_capacity = tokens_per_request * 10; // Burst of 10 requests
+        constexpr uint32_t refill_tokens_per_sec = tokens_per_request * 3;
+    } // namespace
+
+    admission_result admission_control::admit(const void* request, uint32_t client_ip, uint32_t now) {
+        client_bucket* client = find_or_add_client(client_ip, now);
+
+        // Clamp so that long idle periods can't overflow the refill computation.
+        uint32_t elapsed = std::min<uint32_t>(now - client->last_refill, MILLIS_PER_MIN);
+        client->tokens = std::min(bucket_capacity, client->tokens + (elapsed * refill_tokens_per_sec) / MILLIS_PER_SEC);
+        client->last_refill = now;
+
+        if (client->tokens < tokens_per_request) {
+            _stats.rate_limited++;
+            return admission_result::rate_limited;
+        }
+
+        const void** free_slot = std::find(_in_flight, _in_flight + max_in_flight, nullptr);
+        if (free_slot == _in_flight + max_in_flight) {
+            _stats.overloaded++;
+            return admission_result::overloaded;
+        }
+
+        client->tokens -= tokens_per_request;
+        *free_slot = request;
+        _stats.admitted++;
+        return admission_result::admitted;
+    }
+
+    void admission_control::finish(const void* request) {
+        const void** slot = std::find(_in_flight, _in_flight + max_in_flight, request);
+        if (slot != _in_flight + max_in_flight) {
+            *slot = nullptr;
+        }
+    }
+
+    void admission_control::on_command_collapsed() {
+        _stats.collapsed_commands++;
+    }
+
+    const admission_stats& admission_control::stats() const {
+        return _stats;
+    }
+
+    admission_control::client_bucket* admission_control::find_or_add_client(uint32_t client_ip, uint32_t now) {
+        client_bucket* oldest = &_clients[0];
+        for (client_bucket& client : _clients) {
+            if (client.in_use && client.ip == client_ip) {
+                return &client;
+            }
+            if (!client.in_use) {
+                oldest = &client;
+            } else if (oldest->in_use && now - client.last_refill > now - oldest->last_refill) {
+                oldest = &client;
+            }
+        }
+
+        oldest->in_use = true;
+        oldest->ip = client_ip;
+        oldest->tokens = bucket_capacity;
+        oldest->last_refill = now;
+        return oldest;
+    }
+} // namespace mocca
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <Arduino.h>
+
+namespace mocca {
+    enum class admission_result {
+        admitted,
+        rate_limited,
+        overloaded,
+    };
+
+    struct admission_stats {
+        uint32_t admitted = 0;
+        uint32_t rate_limited = 0;
+        uint32_t overloaded = 0;
+        uint32_t collapsed_commands = 0;
+    };
+
+    // Per client token bucket rate limiting plus a cap on how many admitted requests can be outstanding at once.
+    // Clients are tracked by IP in a small fixed table, the least recently seen client is forgotten when it fills up.
+    class admission_control {
+      public:
+        static constexpr size_t max_clients = 8;
+        static constexpr size_t max_in_flight = 4;
+
+        admission_result admit(const void* request, uint32_t client_ip, uint32_t now);
+        void finish(const void* request);
+
+        void on_command_collapsed();
+
+        const admission_stats& stats() const;
+
+      private:
+        struct client_bucket {
+            uint32_t ip = 0;
+            uint32_t tokens = 0; // In thousandths of a request
+            uint32_t last_refill = 0;
+            bool in_use = false;
+        };
+
+        client_bucket* find_or_add_client(uint32_t client_ip, uint32_t now);
+
+        client_bucket _clients[max_clients];
+        const void* _in_flight[max_in_flight] = {nullptr};
+        admission_stats _stats;
+    };
+} // namespace mocca
@@ -0,0 +1,130 @@
+#include "boiler_supervisor.hpp"
+
+#include "deep_sleep.hpp"
+#include "task_topology.hpp"
+
+namespace mocca {
+    namespace {
+        constexpr uint32_t poll_interval_millis = 10; // Upper bound on cut-off latency if an edge interrupt is missed
+        constexpr int64_t max_continuous_heat_micros = 15LL * 60 * 1000000; // A full pot takes about six minutes
+
+        constexpr uint32_t supervisor_stack_size = 2048;
+    } // namespace
+
+    bool boiler_supervisor::start(int ssr_pin, const binary_switch* water_switch, const binary_switch* pot_switch) {
+        _ssr_pin = ssr_pin;
+        _water_switch = water_switch;
+        _pot_switch = pot_switch;
+
+        pinMode(_ssr_pin, OUTPUT);
+        write_ssr(false);
+        release_deep_sleep_hold(_ssr_pin); // Only now that the pin is driven low itself
+
+        if (xTaskCreatePinnedToCore(task_main, "boiler", supervisor_stack_size, this, safety_task_priority, &_task,
+                                    control_core) != pdPASS) {
+            return false;
+        }
+
+        attachInterruptArg(digitalPinToInterrupt(_water_switch->pin()), on_switch_changed, this, CHANGE);
+        attachInterruptArg(digitalPinToInterrupt(_pot_switch->pin()), on_switch_changed, this, CHANGE);
+        return true;
+    }
+
+    void boiler_supervisor::request(bool on) {
+        portENTER_CRITICAL(&_lock);
+        bool changed = on != _requested;
+        _requested = on;
+        if (!on && _heating) {
+            // Turning off never has to wait for the task.
+            write_ssr(false);
+            _heating = false;
+        }
+        portEXIT_CRITICAL(&_lock);
+
+        // The control loop repeats its request every tick, the task only has to run for a change.
+        if (changed && _task) {
+            xTaskNotifyGive(_task);
+        }
+    }
+
+    bool boiler_supervisor::is_heating() const {
+        portENTER_CRITICAL(&_lock);
+        bool heating = _heating;
+        portEXIT_CRITICAL(&_lock);
+        return heating;
+    }
+
+    bool boiler_supervisor::heat_limit_reached() const {
+        portENTER_CRITICAL(&_lock);
+        bool reached = _heat_limit_reached;
+        portEXIT_CRITICAL(&_lock);
+        return reached;
+    }
+
+    boiler_safety_stats boiler_supervisor::get_stats() const {
+        portENTER_CRITICAL(&_lock);
+        boiler_safety_stats stats = _stats;
+        portEXIT_CRITICAL(&_lock);
+        return stats;
+    }
+
+    void boiler_supervisor::task_main(void* arg) {
+        boiler_supervisor* supervisor = static_cast<boiler_supervisor*>(arg);
+        while (true) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(poll_interval_millis));
+            supervisor->evaluate();
+        }
+    }
+
+    void IRAM_ATTR boiler_supervisor::on_switch_changed(void* arg) {
+        boiler_supervisor* supervisor = static_cast<boiler_supervisor*>(arg);
+
+        portENTER_CRITICAL_ISR(&supervisor->_lock);
+        if (supervisor->_switch_edge_micros == 0) {
+            supervisor->_switch_edge_micros = esp_timer_get_time();
+        }
+        portEXIT_CRITICAL_ISR(&supervisor->_lock);
+
+        BaseType_t higher_priority_task_woken = pdFALSE;
+        vTaskNotifyGiveFromISR(supervisor->_task, &higher_priority_task_woken);
+        portYIELD_FROM_ISR(higher_priority_task_woken);
+    }
+
+    void boiler_supervisor::evaluate() {
+        bool switches_closed = _water_switch->get_state() && _pot_switch->get_state();
+
+        portENTER_CRITICAL(&_lock);
+        int64_t now = esp_timer_get_time();
+
+        if (!_requested) {
+            _heat_limit_reached = false;
+        } else if (_heating && now - _heating_since >= max_continuous_heat_micros) {
+            _heat_limit_reached = true;
+            _stats.heat_limit_cutoffs++;
+        }
+
+        bool heat = _requested && switches_closed && !_heat_limit_reached;
+        if (heat != _heating) {
+            write_ssr(heat);
+            _heating = heat;
+
+            if (heat) {
+                _heating_since = now;
+            } else if (!switches_closed) {
+                // Without an interrupt the switch opened some time after the previous poll.
+                int64_t opened_at = _switch_edge_micros != 0 ? _switch_edge_micros : _last_evaluation_micros;
+                uint32_t cutoff_micros = esp_timer_get_time() - opened_at;
+                _stats.worst_cutoff_micros = std::max(_stats.worst_cutoff_micros, cutoff_micros);
+                _stats.sensor_cutoffs++;
+            }
+        }
+
+        _switch_edge_micros = 0;
+        _last_evaluation_micros = now;
+        portEXIT_CRITICAL(&_lock);
+    }
+
+    void boiler_supervisor::write_ssr(bool on) {
+        digitalWrite(_ssr_pin, on ? HIGH : LOW);
+    }
+} // namespace mocca
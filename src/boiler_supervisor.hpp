@@ -0,0 +1,52 @@
+#pragma once
+
+#include "util.hpp"
+
+#include <Arduino.h>
+
+namespace mocca {
+    struct boiler_safety_stats {
+        uint32_t worst_cutoff_micros = 0; // Longest time from a switch opening to the SSR turning off
+        uint32_t sensor_cutoffs = 0;      // Times the SSR was turned off by the water or pot switch
+        uint32_t heat_limit_cutoffs = 0;  // Times the SSR was turned off for heating too long
+    };
+
+    // Owns the boiler SSR pin from a high priority task on the control core. The control loop only requests heat, the
+    // supervisor turns the SSR on while both the water and pot switches are closed and the boiler hasn't been on for
+    // longer than the continuous heat limit. Switch edges wake the task from an interrupt and it also polls, so the SSR
+    // is off at most one poll interval after a switch opens no matter how long the control loop is blocked.
+    class boiler_supervisor {
+      public:
+        bool start(int ssr_pin, const binary_switch* water_switch, const binary_switch* pot_switch);
+
+        void request(bool on);
+
+        bool is_heating() const;
+
+        // Set once the continuous heat limit cut the boiler off, cleared when heat is no longer requested.
+        bool heat_limit_reached() const;
+
+        boiler_safety_stats get_stats() const;
+
+      private:
+        static void task_main(void* arg);
+        static void on_switch_changed(void* arg);
+
+        void evaluate();
+        void write_ssr(bool on);
+
+        int _ssr_pin = -1;
+        const binary_switch* _water_switch = nullptr;
+        const binary_switch* _pot_switch = nullptr;
+        TaskHandle_t _task = nullptr;
+
+        mutable portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+        bool _requested = false;
+        bool _heating = false;
+        bool _heat_limit_reached = false;
+        int64_t _heating_since = 0;
+        int64_t _switch_edge_micros = 0; // 0 if no switch changed since the last evaluation
+        int64_t _last_evaluation_micros = 0;
+        boiler_safety_stats _stats;
+    };
+} // namespace mocca
@@ -0,0 +1,394 @@
+#include "brew_history.hpp"
+
+#include "logger.hpp"
+
+#include <cinttypes>
+
+namespace mocca {
+    namespace {
+        constexpr const char* partition_label = "history";
+
+        constexpr size_t sector_size = 4096;
+        constexpr size_t sector_header_size = 16;
+        constexpr uint32_t sector_magic = 0x4d424831; // "MBH1"
+
+        // Records are 48 bits: 24 bits of time since the previous record, 12 bits of boiler time, 4 bits of kind and
+        // reason, and a CRC-8 that catches records torn by a reset in the middle of writing them.
+        constexpr size_t record_size = 6;
+        constexpr size_t records_per_sector = (sector_size - sector_header_size) / record_size;
+        constexpr uint32_t max_delta_secs = (1u << 24) - 1; // About 194 days, longer gaps start a new sector
+        constexpr uint32_t max_boiler_on_secs = (1u << 12) - 1;
+        constexpr size_t scan_batch_records = 32;
+
+        struct decoded_record {
+            uint32_t delta_secs;
+            uint32_t boiler_on_secs;
+            brew_event_kind kind;
+            uint8_t reason;
+        };
+
+        uint8_t crc8(const uint8_t* data, size_t size) {
+            uint8_t crc = 0;
+            for (size_t byte_idx = 0; byte_idx < size; byte_idx++) {
+                crc ^= data[byte_idx];
+                for (int bit = 0; bit < 8; bit++) {
+                    crc = (crc & 0x80) != 0 ? (crc << 1) ^ 0x07 : crc << 1;
+                }
+            }
+            return crc;
+        }
+
+        void encode_record(const decoded_record& record, uint8_t* out) {
+            uint64_t bits = record.delta_secs;
+            bits |= static_cast<uint64_t>(record.boiler_on_secs) << 24;
+            bits |= static_cast<uint64_t>(record.kind == brew_event_kind::ended ? 1 : 0) << 36;
+            bits |= static_cast<uint64_t>(record.reason & 0x07) << 37;
+            for (size_t byte_idx = 0; byte_idx < record_size - 1; byte_idx++) {
+                out[byte_idx] = static_cast<uint8_t>(bits >> (byte_idx * 8));
+            }
+            out[record_size - 1] = crc8(out, record_size - 1);
+        }
+
+        bool is_erased(const uint8_t* raw) {
+            for (size_t byte_idx = 0; byte_idx < record_size; byte_idx++) {
+                if (raw[byte_idx] != 0xff) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool decode_record(const uint8_t* raw, decoded_record* record) {
+            if (crc8(raw, record_size - 1) != raw[record_size - 1]) {
+                return false;
+            }
+
+            uint64_t bits = 0;
+            for (size_t byte_idx = 0; byte_idx < record_size - 1; byte_idx++) {
+                bits |= static_cast<uint64_t>(raw[byte_idx]) << (byte_idx * 8);
+            }
+            record->delta_secs = bits & max_delta_secs;
+            record->boiler_on_secs = (bits >> 24) & max_boiler_on_secs;
+            record->kind = ((bits >> 36) & 1) != 0 ? brew_event_kind::ended : brew_event_kind::started;
+            record->reason = (bits >> 37) & 0x07;
+            return true;
+        }
+    } // namespace
+
+    const char* brew_event_kind_name(brew_event_kind kind) {
+        switch (kind) {
+        case brew_event_kind::started:
+            return "started";
+        case brew_event_kind::ended:
+            return "ended";
+        default:
+            return "unknown";
+        }
+    }
+
+    const char* brew_event_reason_name(const brew_event& event) {
+        if (event.kind == brew_event_kind::started) {
+            switch (static_cast<brew_trigger>(event.reason)) {
+            case brew_trigger::manual:
+                return "manual";
+            case brew_trigger::scheduled:
+                return "scheduled";
+            case brew_trigger::remote:
+                return "remote";
+            default:
+                return "unknown";
+            }
+        }
+
+        switch (static_cast<brew_end_reason>(event.reason)) {
+        case brew_end_reason::finished:
+            return "finished";
+        case brew_end_reason::cancelled:
+            return "cancelled";
+        case brew_end_reason::no_pot:
+            return "no_pot";
+        case brew_end_reason::heat_limit:
+            return "heat_limit";
+        default:
+            return "unknown";
+        }
+    }
+
+    bool brew_history::start() {
+        static_assert(sizeof(sector_header) == sector_header_size, "Sector header layout changed");
+
+        _partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, partition_label);
+        if (!_partition) {
+            MOCCA_LOGW(brew, "No \"%s\" partition, brew history is off.", partition_label);
+            return false;
+        }
+        _sector_count = _partition->size / sector_size;
+
+        // The sector with the highest sequence is the one being appended to.
+        sector_header header;
+        for (size_t sector = 0; sector < _sector_count; sector++) {
+            if (read_header(sector, &header) && (!_has_sector || header.sequence > _sequence)) {
+                _has_sector = true;
+                _sector = sector;
+                _sequence = header.sequence;
+                _last_time = header.base_time;
+            }
+        }
+        if (!_has_sector) {
+            return true;
+        }
+
+        // Find the end of the newest sector and the time of its last record.
+        uint8_t batch[record_size * scan_batch_records];
+        _next_slot = 0;
+        bool found_end = false;
+        while (!found_end && _next_slot < records_per_sector) {
+            size_t batch_records = std::min(scan_batch_records, records_per_sector - _next_slot);
+            if (esp_partition_read(_partition, record_offset(_sector, _next_slot), batch,
+                                   batch_records * record_size) != ESP_OK) {
+                MOCCA_LOGE(brew, "Failed to read the brew history.");
+                _partition = nullptr;
+                return false;
+            }
+
+            for (size_t record_idx = 0; record_idx < batch_records; record_idx++) {
+                const uint8_t* raw = batch + record_idx * record_size;
+                if (is_erased(raw)) {
+                    found_end = true;
+                    break;
+                }
+
+                decoded_record record;
+                if (decode_record(raw, &record)) {
+                    _last_time += record.delta_secs;
+                }
+                _next_slot++;
+            }
+        }
+
+        MOCCA_LOGI(brew, "Brew history appending to sector %u of %u at record %u.", static_cast<unsigned>(_sector),
+                   static_cast<unsigned>(_sector_count), static_cast<unsigned>(_next_slot));
+        return true;
+    }
+
+    bool brew_history::append(const brew_event& event) {
+        if (!_partition) {
+            return false;
+        }
+
+        if (!_has_sector || _next_slot >= records_per_sector || event.time - _last_time > max_delta_secs) {
+            if (!open_sector(_has_sector ? (_sector + 1) % _sector_count : 0, event.time)) {
+                _stats.write_errors++;
+                return false;
+            }
+        }
+
+        // The clock may have been stepped back a little since the last record, keep the deltas unsigned.
+        decoded_record record;
+        record.delta_secs = event.time > _last_time ? event.time - _last_time : 0;
+        record.boiler_on_secs = std::min(event.boiler_on_secs, max_boiler_on_secs);
+        record.kind = event.kind;
+        record.reason = event.reason;
+
+        uint8_t raw[record_size];
+        encode_record(record, raw);
+        size_t slot = _next_slot++;
+        if (esp_partition_write(_partition, record_offset(_sector, slot), raw, record_size) != ESP_OK) {
+            _stats.write_errors++;
+            return false;
+        }
+
+        _last_time += record.delta_secs;
+        _stats.appended++;
+        return true;
+    }
+
+    brew_history_cursor brew_history::begin() const {
+        brew_history_cursor cursor;
+        if (!_partition) {
+            return cursor;
+        }
+
+        // The oldest sector is the one after the newest. Erased or stale sectors along the way are skipped by next().
+        sector_header header;
+        size_t newest = 0;
+        uint32_t newest_sequence = 0;
+        for (size_t sector = 0; sector < _sector_count; sector++) {
+            if (read_header(sector, &header) && header.sequence > newest_sequence) {
+                newest = sector;
+                newest_sequence = header.sequence;
+            }
+        }
+        if (newest_sequence == 0) {
+            return cursor;
+        }
+
+        cursor.sector = (newest + 1) % _sector_count;
+        cursor.sectors_left = _sector_count;
+        return cursor;
+    }
+
+    bool brew_history::next(brew_history_cursor* cursor, brew_event* event) const {
+        sector_header header;
+        while (cursor->sectors_left > 0) {
+            if (cursor->sequence == 0) {
+                if (read_header(cursor->sector, &header)) {
+                    cursor->sequence = header.sequence;
+                    cursor->last_time = header.base_time;
+                    cursor->slot = 0;
+                } else {
+                    cursor->slot = records_per_sector;
+                }
+            }
+
+            while (cursor->slot < records_per_sector) {
+                uint8_t raw[record_size];
+                if (esp_partition_read(_partition, record_offset(cursor->sector, cursor->slot), raw, record_size) !=
+                    ESP_OK) {
+                    cursor->sectors_left = 0;
+                    return false;
+                }
+                if (is_erased(raw)) {
+                    break;
+                }
+
+                // The writer may have moved onto this sector since its header was read.
+                if (!read_header(cursor->sector, &header) || header.sequence != cursor->sequence) {
+                    cursor->sectors_left = 0;
+                    return false;
+                }
+
+                cursor->slot++;
+                decoded_record record;
+                if (!decode_record(raw, &record)) {
+                    continue;
+                }
+
+                cursor->last_time += record.delta_secs;
+                event->time = cursor->last_time;
+                event->kind = record.kind;
+                event->reason = record.reason;
+                event->boiler_on_secs = record.boiler_on_secs;
+                return true;
+            }
+
+            cursor->sector = (cursor->sector + 1) % _sector_count;
+            cursor->sectors_left--;
+            cursor->sequence = 0;
+        }
+        return false;
+    }
+
+    brew_history_stats brew_history::get_stats() const {
+        return _stats;
+    }
+
+    bool brew_history::read_header(size_t sector, sector_header* header) const {
+        if (esp_partition_read(_partition, sector * sector_size, header, sizeof(sector_header)) != ESP_OK) {
+            return false;
+        }
+        return header->magic == sector_magic && header->sequence != 0 && header->sequence != 0xffffffff;
+    }
+
+    bool brew_history::open_sector(size_t sector, time_t base_time) {
+        if (esp_partition_erase_range(_partition, sector * sector_size, sector_size) != ESP_OK) {
+            MOCCA_LOGE(brew, "Failed to erase brew history sector %u.", static_cast<unsigned>(sector));
+            return false;
+        }
+        _stats.sector_erases++;
+
+        sector_header header = {sector_magic, _sequence + 1, static_cast<uint32_t>(base_time), 0xffffffff};
+        if (esp_partition_write(_partition, sector * sector_size, &header, sizeof(header)) != ESP_OK) {
+            MOCCA_LOGE(brew, "Failed to write brew history sector %u.", static_cast<unsigned>(sector));
+            return false;
+        }
+
+        _has_sector = true;
+        _sector = sector;
+        _sequence = header.sequence;
+        _next_slot = 0;
+        _last_time = base_time;
+        return true;
+    }
+
+    size_t brew_history::record_offset(size_t sector, size_t slot) const {
+        return sector * sector_size + sector_header_size + slot * record_size;
+    }
+
+    void brew_history_export::start(const brew_history* history, brew_history_format format) {
+        _history = history;
+        _format = format;
+        _cursor = history ? history->begin() : brew_history_cursor();
+        _header_written = false;
+        _footer_written = false;
+        _event_count = 0;
+        _line_length = 0;
+        _line_sent = 0;
+    }
+
+    size_t brew_history_export::read(char* out, size_t out_size) {
+        size_t written = 0;
+        while (written < out_size) {
+            if (_line_sent == _line_length) {
+                if (!format_next_line()) {
+                    break;
+                }
+            }
+
+            size_t length = std::min(out_size - written, _line_length - _line_sent);
+            memcpy(out + written, _line + _line_sent, length);
+            written += length;
+            _line_sent += length;
+        }
+        return written;
+    }
+
+    bool brew_history_export::format_next_line() {
+        _line_length = 0;
+        _line_sent = 0;
+
+        bool json = _format == brew_history_format::json;
+        if (!_header_written) {
+            _header_written = true;
+            _line_length = strlcpy(_line, json ? "[" : "time,event,reason,boiler_on_secs\n", sizeof(_line));
+            return true;
+        }
+
+        brew_event event;
+        if (_history && _history->next(&_cursor, &event)) {
+            uint32_t time = static_cast<uint32_t>(event.time);
+            const char* kind = brew_event_kind_name(event.kind);
+            const char* reason = brew_event_reason_name(event);
+            bool ended = event.kind == brew_event_kind::ended;
+            int length;
+            if (json) {
+                length = snprintf(_line, sizeof(_line), "%s\n{\"time\":%" PRIu32 ",\"event\":\"%s\",\"reason\":\"%s\"",
+                                  _event_count > 0 ? "," : "", time, kind, reason);
+                if (ended && length > 0 && static_cast<size_t>(length) < sizeof(_line)) {
+                    length += snprintf(_line + length, sizeof(_line) - length, ",\"boiler_on_secs\":%" PRIu32,
+                                       event.boiler_on_secs);
+                }
+                if (length > 0 && static_cast<size_t>(length) < sizeof(_line)) {
+                    length += snprintf(_line + length, sizeof(_line) - length, "}");
+                }
+            } else if (ended) {
+                length = snprintf(_line, sizeof(_line), "%" PRIu32 ",%s,%s,%" PRIu32 "\n", time, kind, reason,
+                                  event.boiler_on_secs);
+            } else {
+                length = snprintf(_line, sizeof(_line), "%" PRIu32 ",%s,%s,\n", time, kind, reason);
+            }
+            _line_length = std::min<size_t>(std::max(length, 0), sizeof(_line) - 1);
+            _event_count++;
+            return true;
+        }
+
+        if (!_footer_written) {
+            _footer_written = true;
+            if (json) {
+                _line_length = strlcpy(_line, "\n]\n", sizeof(_line));
+                return true;
+            }
+        }
+        return false;
+    }
+} // namespace mocca
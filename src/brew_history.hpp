@@ -0,0 +1,123 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_partition.h>
+
+namespace mocca {
+    enum class brew_end_reason : uint8_t {
+        finished,   // Ran out of water
+        cancelled,  // Long press, the web API or MQTT
+        no_pot,     // Pot missing for too long
+        heat_limit, // Boiler supervisor cut the heat
+    };
+
+    enum class brew_trigger : uint8_t {
+        manual,    // Brew now on the device
+        scheduled, // Wake time or alarm
+        remote,    // Web API or MQTT
+    };
+
+    enum class brew_command : uint8_t {
+        none,
+        start,
+        cancel,
+    };
+
+    enum class brew_event_kind : uint8_t {
+        started, // reason is a brew_trigger
+        ended,   // reason is a brew_end_reason
+    };
+
+    struct brew_event {
+        time_t time = 0; // UTC
+        brew_event_kind kind = brew_event_kind::started;
+        uint8_t reason = 0;
+        uint32_t boiler_on_secs = 0; // Only for ended events
+    };
+
+    const char* brew_event_kind_name(brew_event_kind kind);
+    const char* brew_event_reason_name(const brew_event& event);
+
+    struct brew_history_stats {
+        uint32_t appended = 0;
+        uint32_t sector_erases = 0;
+        uint32_t write_errors = 0;
+    };
+
+    // Position of a reader in the history. Reading only touches flash so it can happen on any task while events are
+    // being appended, a reader that the writer wraps around onto ends early.
+    struct brew_history_cursor {
+        size_t sector = 0;
+        size_t sectors_left = 0; // Including the current one
+        uint32_t sequence = 0;   // Of the current sector, 0 until its header was read
+        size_t slot = 0;
+        time_t last_time = 0;
+    };
+
+    // Brew events in a ring of flash sectors in their own partition, so that appending never rewrites persistent_data.
+    // Every sector starts with a header holding the time of its first record, each record holds the time since the one
+    // before it. Appending writes a single 6 byte record, a sector is only erased when the ring moves onto it.
+    class brew_history {
+      public:
+        bool start();
+
+        bool append(const brew_event& event);
+
+        brew_history_cursor begin() const;
+        bool next(brew_history_cursor* cursor, brew_event* event) const;
+
+        brew_history_stats get_stats() const;
+
+      private:
+        struct sector_header {
+            uint32_t magic;
+            uint32_t sequence; // One more for every sector opened, the highest is being appended to
+            uint32_t base_time;
+            uint32_t reserved;
+        };
+
+        bool read_header(size_t sector, sector_header* header) const;
+        bool open_sector(size_t sector, time_t base_time);
+        size_t record_offset(size_t sector, size_t slot) const;
+
+        const esp_partition_t* _partition = nullptr;
+        size_t _sector_count = 0;
+
+        bool _has_sector = false;
+        size_t _sector = 0; // Being appended to
+        uint32_t _sequence = 0;
+        size_t _next_slot = 0;
+        time_t _last_time = 0;
+
+        brew_history_stats _stats;
+    };
+
+    enum class brew_history_format {
+        csv,
+        json,
+    };
+
+    // Formats the history one event at a time into whatever space the caller has, so that a chunked response never
+    // holds more than a line of it in memory.
+    class brew_history_export {
+      public:
+        void start(const brew_history* history, brew_history_format format);
+
+        // Returns 0 once everything was read.
+        size_t read(char* out, size_t out_size);
+
+      private:
+        bool format_next_line();
+
+        const brew_history* _history = nullptr;
+        brew_history_format _format = brew_history_format::csv;
+        brew_history_cursor _cursor;
+        bool _header_written = false;
+        bool _footer_written = false;
+        size_t _event_count = 0;
+
+        char _line[112];
+        size_t _line_length = 0;
+        size_t _line_sent = 0;
+    };
+} // namespace mocca
@@ -0,0 +1,27 @@
+#include "brew_model.hpp"
+
+#include <cmath>
+
+namespace mocca {
+    namespace {
+        constexpr uint32_t slowest_smoothing = 4; // Once warmed up, each brew moves the estimate a quarter of the way
+    } // namespace
+
+    void brew_model::add_sample(uint32_t duration_secs) {
+        // Learn quickly from the first few brews, the defaults are only a rough guess.
+        float alpha = 1.0f / std::min(sample_count + 2, slowest_smoothing);
+
+        float delta = duration_secs - mean_secs;
+        mean_secs += alpha * delta;
+        variance = (1.0f - alpha) * (variance + alpha * delta * delta);
+        sample_count++;
+    }
+
+    float brew_model::stddev_secs() const {
+        return sqrtf(variance);
+    }
+
+    uint32_t brew_model::lead_secs() const {
+        return static_cast<uint32_t>(ceilf(mean_secs + stddev_secs()));
+    }
+} // namespace mocca
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <Arduino.h>
+
+namespace mocca {
+    // Running estimate of how long this unit takes to brew a pot, measured as boiler on time. Stored in the persistent
+    // data so that it survives reboots.
+    struct brew_model {
+        float mean_secs = 6 * 60; // A full KBGT pot takes about six minutes
+        float variance = 60 * 60;
+        uint32_t sample_count = 0;
+
+        void add_sample(uint32_t duration_secs);
+
+        float stddev_secs() const;
+
+        // How long before the ready time the boiler has to turn on. One standard deviation over the mean so that the
+        // coffee is done by the ready time on most mornings.
+        uint32_t lead_secs() const;
+    };
+} // namespace mocca
@@ -0,0 +1,25 @@
+#include "command_handoff.hpp"
+
+#include "control_loop.hpp"
+
+namespace mocca {
+    bool brew_command_handoff::post(brew_command command, int64_t received_micros) {
+        portENTER_CRITICAL(&_lock);
+        bool replaced = _command != brew_command::none;
+        _command = command;
+        _received_micros = received_micros;
+        portEXIT_CRITICAL(&_lock);
+
+        wake_control_loop();
+        return !replaced;
+    }
+
+    brew_command brew_command_handoff::take(int64_t* received_micros) {
+        portENTER_CRITICAL(&_lock);
+        brew_command command = _command;
+        *received_micros = _received_micros;
+        _command = brew_command::none;
+        portEXIT_CRITICAL(&_lock);
+        return command;
+    }
+} // namespace mocca
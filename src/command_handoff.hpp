@@ -0,0 +1,23 @@
+#pragma once
+
+#include "brew_history.hpp"
+
+#include <Arduino.h>
+
+namespace mocca {
+    // Hands brew commands from the web server task to the control loop. Only the latest one counts, a command the loop
+    // hasn't taken yet is replaced by a newer one.
+    class brew_command_handoff {
+      public:
+        // Wakes the control loop. Returns false if it replaced a command that was still pending.
+        bool post(brew_command command, int64_t received_micros);
+
+        // Returns brew_command::none if nothing is pending.
+        brew_command take(int64_t* received_micros);
+
+      private:
+        portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+        brew_command _command = brew_command::none;
+        int64_t _received_micros = 0; // When the request was handled, for request-to-boiler latency
+    };
+} // namespace mocca
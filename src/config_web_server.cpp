@@ -1,13 +1,33 @@
 #include "config_web_server.hpp"
 
+#include "control_loop.hpp"
+#include "deep_sleep.hpp"
+#include "task_topology.hpp"
 #include "util.hpp"
 
+#include <AsyncJson.h>
 #include <LittleFS.h>
 
 namespace mocca {
 
     constexpr uint16_t web_server_port = 80;
-    constexpr uint32_t network_refresh_after_request_time = MILLIS_PER_SEC * 60;
+
+    // Images for /update are signed with the key the firmware is built with, -D MOCCA_OTA_KEY=\"key\". The signature
+    // is the HMAC-SHA256 of the image's SHA-256 under the key, for example
+    //   sha256=$(sha256sum firmware.bin | cut -c1-64)
+    //   echo $sha256 | xxd -r -p | openssl dgst -sha256 -mac HMAC -macopt key:"$key" | cut -d' ' -f2
+    // and goes with the hash as ?sha256=...&signature=... Without a key updates over the web are refused.
+#if defined(MOCCA_OTA_KEY)
+    constexpr const char* ota_signing_key = MOCCA_OTA_KEY;
+#else
+    constexpr const char* ota_signing_key = nullptr;
+#endif
+
+#if MOCCA_FEATURE_DISPLAY
+    constexpr size_t max_screen_watchers = 2;
+    constexpr uint32_t screen_push_interval_millis = 100; // Changes within this are pushed together
+    constexpr uint32_t screen_task_stack_size = 3072;
+#endif
 
     static const char* auth_mode_name(wifi_auth_mode_t auth_mode) {
         switch (auth_mode) {
@@ -29,20 +49,53 @@ namespace mocca {
         }
     };
 
+    static JsonDocument network_to_json(const wifi_network_info& network) {
+        char bssid[18];
+        network.format_bssid(bssid, sizeof(bssid));
+
+        JsonDocument json;
+        json["ssid"] = network.ssid;
+        json["encryption"] = auth_mode_name(network.encryption);
+        json["bssid"] = bssid;
+        json["rssi"] = network.rssi;
+        json["channel"] = network.channel;
+        return json;
+    }
+
+    static void send_simple_json_response(AsyncWebServerRequest* request, int code, const char* failure_reason) {
+        char body[96];
+        if (failure_reason) {
+            snprintf(body, sizeof(body), "{\"status\":\"failed\",\"reason\":\"%s\"}", failure_reason);
+        } else {
+            snprintf(body, sizeof(body), "{\"status\":\"ok\"}");
+        }
+
+        AsyncWebServerResponse* response = request->beginResponse(code, "application/json", body);
+        response->addHeader("Access-Control-Allow-Origin", "*");
+        request->send(response);
+    }
+
     config_web_server::config_web_server()
         : _server(web_server_port)
-        , _wifi_connect_handler("/wifi_connect")
-        , _set_timezone_handler("/set_timezone") {
+        , _updater(&_update_flash)
+#if MOCCA_FEATURE_DISPLAY
+        , _screen_events("/screen/events")
+#endif
+    {
 
         _server.on("/wifi_networks", HTTP_GET, [this](AsyncWebServerRequest* request) {
+            if (!admit_request(request)) {
+                return;
+            }
             on_any_web_request();
 
             AsyncJsonResponse* response = new AsyncJsonResponse();
             JsonObject root = response->getRoot().to<JsonObject>();
 
             JsonArray networks_json = root["networks"].to<JsonArray>();
-            for (const wifi_network_info& network : _networks) {
-                networks_json.add(network.to_json());
+            size_t network_count = _networks.copy_networks(_network_list, wifi_scan_cache::max_networks);
+            for (size_t network_idx = 0; network_idx < network_count; network_idx++) {
+                networks_json.add(network_to_json(_network_list[network_idx]));
             }
 
             response->setLength();
@@ -50,62 +103,67 @@ namespace mocca {
             request->send(response);
         });
 
-        auto simple_json_response = [](AsyncWebServerRequest* request, int code, const char* failure_reason) {
-            AsyncJsonResponse* response = new AsyncJsonResponse();
-            JsonObject response_root = response->getRoot().to<JsonObject>();
-            if (failure_reason) {
-                response_root["status"] = "failed";
-                response_root["reason"] = failure_reason;
-            } else {
-                response_root["status"] = "ok";
-            }
-            response->setLength();
-            response->addHeader("Access-Control-Allow-Origin", "*");
-            response->setCode(code);
-            request->send(response);
-        };
-
-        _wifi_connect_handler.setMethod(HTTP_POST);
-        _wifi_connect_handler.onRequest(
-            [this, simple_json_response](AsyncWebServerRequest* request, JsonVariant& json) {
-                JsonString ssid = json["ssid"];
-                JsonString password = json["pass"];
-                if (ssid.isNull() || password.isNull()) {
-                    simple_json_response(request, 400, "null \"ssid\" or \"pass\" fields");
-                    return;
-                }
+        _server.on("/metrics", HTTP_GET, [this](AsyncWebServerRequest* request) { on_metrics_request(request); });
 
-                String ssid_copy(ssid.c_str());
-                String password_copy(password.c_str());
-                _main_thread_tasks.push_back([this, ssid_copy, password_copy]() {
-                    if (_wifi_set_callback) {
-                        _wifi_set_callback(ssid_copy.c_str(), password_copy.c_str());
-                    }
-                });
+        _server.on("/log", HTTP_GET, [this](AsyncWebServerRequest* request) { on_log_request(request); });
 
-                simple_json_response(request, 200, nullptr);
+        _server.on("/history", HTTP_GET, [this](AsyncWebServerRequest* request) { on_history_request(request); });
+
+        _server.on(
+            "/wifi_connect", HTTP_POST, [this](AsyncWebServerRequest* request) { on_wifi_connect_request(request); },
+            nullptr,
+            [this](AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total) {
+                _request_body.append(request, data, len, index, total);
             });
-        _server.addHandler(&_wifi_connect_handler);
-
-        _set_timezone_handler.setMethod(HTTP_POST);
-        _set_timezone_handler.onRequest(
-            [this, simple_json_response](AsyncWebServerRequest* request, JsonVariant& json) {
-                JsonString timezone = json["timezone"];
-                if (timezone.isNull()) {
-                    simple_json_response(request, 400, "null \"timezone\" field");
-                    return;
-                }
 
-                String timezone_copy(timezone.c_str());
-                _main_thread_tasks.push_back([this, timezone_copy]() {
-                    if (_timezone_set_callback) {
-                        _timezone_set_callback(timezone_copy.c_str());
-                    }
-                });
+        // Handlers also match sub-paths of their URI so the more specific one has to be added first.
+        _server.on("/schedule/skip_next", HTTP_POST,
+                   [this](AsyncWebServerRequest* request) { on_skip_next_wake_request(request); });
+
+        _server.on("/schedule", HTTP_GET, [this](AsyncWebServerRequest* request) { on_get_schedule_request(request); });
+
+        _server.on(
+            "/schedule", HTTP_POST, [this](AsyncWebServerRequest* request) { on_set_schedule_request(request); },
+            nullptr,
+            [this](AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total) {
+                _request_body.append(request, data, len, index, total);
+            });
+
+        _server.on("/state", HTTP_GET, [this](AsyncWebServerRequest* request) { on_get_state_request(request); });
+
+        _server.on("/brew/cancel", HTTP_POST,
+                   [this](AsyncWebServerRequest* request) { on_brew_request(request, brew_command::cancel); });
+
+        _server.on("/brew", HTTP_POST,
+                   [this](AsyncWebServerRequest* request) { on_brew_request(request, brew_command::start); });
+
+        _server.on("/wake", HTTP_GET, [this](AsyncWebServerRequest* request) { on_get_wake_request(request); });
+
+        _server.on(
+            "/wake", HTTP_PUT, [this](AsyncWebServerRequest* request) { on_set_wake_request(request); }, nullptr,
+            [this](AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total) {
+                _request_body.append(request, data, len, index, total);
+            });
+
+#if MOCCA_FEATURE_DISPLAY
+        _screen_events.onConnect([this](AsyncEventSourceClient* client) { on_screen_watcher_connected(client); });
+        _server.addHandler(&_screen_events);
+
+        _server.on("/screen", HTTP_GET, [this](AsyncWebServerRequest* request) { on_screen_request(request); });
+#endif
 
-                simple_json_response(request, 200, nullptr);
+        _server.on(
+            "/update", HTTP_POST, [this](AsyncWebServerRequest* request) { on_update_request(request); }, nullptr,
+            [this](AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total) {
+                on_update_body(request, data, len, index, total);
+            });
+
+        _server.on(
+            "/set_timezone", HTTP_POST, [this](AsyncWebServerRequest* request) { on_set_timezone_request(request); },
+            nullptr,
+            [this](AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total) {
+                _request_body.append(request, data, len, index, total);
             });
-        _server.addHandler(&_set_timezone_handler);
 
         _server.serveStatic("/", LittleFS, "/www/", "max-age=600");
     }
@@ -113,28 +171,98 @@ namespace mocca {
     void config_web_server::init() {
         LittleFS.begin(true);
 
+#if MOCCA_FEATURE_DISPLAY
+        if (xTaskCreatePinnedToCore(screen_task_main, "screen", screen_task_stack_size, this, screen_task_priority,
+                                    &_screen_task, network_core) != pdPASS) {
+            MOCCA_LOGE(web, "Failed to start the screen task.");
+            _screen_task = nullptr;
+        }
+#endif
+
         _server.begin();
     }
 
     void config_web_server::step() {
         uint32_t cur_time = millis();
-        if (cur_time < _last_request + network_refresh_after_request_time && WiFi.scanComplete() == WIFI_SCAN_FAILED) {
+        _networks.step(cur_time);
+        if (_networks.should_scan(cur_time) && WiFi.scanComplete() == WIFI_SCAN_FAILED) {
             WiFi.scanNetworks(true);
+            _networks.on_scan_started(cur_time);
         }
 
         int16_t scan_result = WiFi.scanComplete();
         if (scan_result >= 0) {
-            _networks.resize(scan_result);
-            for (int16_t network_idx = 0; network_idx < scan_result; network_idx++) {
-                _networks[network_idx].set_from_network_item(network_idx);
-            }
+            _networks.update_from_scan(scan_result, cur_time);
             WiFi.scanDelete();
         }
 
-        for (auto main_thread_task : _main_thread_tasks) {
-            main_thread_task();
+        wifi_connect_command wifi_connect;
+        bool has_wifi_connect = false;
+        set_timezone_command set_timezone;
+        bool has_set_timezone = false;
+
+        portENTER_CRITICAL(&_pending_lock);
+        if (_has_pending_wifi_connect) {
+            wifi_connect = _pending_wifi_connect;
+            has_wifi_connect = true;
+            _has_pending_wifi_connect = false;
+        }
+        if (_has_pending_set_timezone) {
+            set_timezone = _pending_set_timezone;
+            has_set_timezone = true;
+            _has_pending_set_timezone = false;
+        }
+        portEXIT_CRITICAL(&_pending_lock);
+
+        if (has_wifi_connect && _wifi_set_callback) {
+            _wifi_set_callback(wifi_connect.ssid, wifi_connect.password);
+        }
+        if (has_set_timezone && _timezone_set_callback) {
+            _timezone_set_callback(set_timezone.timezone);
+        }
+
+        set_schedule_command set_schedule;
+        bool has_set_schedule = false;
+        bool has_skip_next_wake = false;
+
+        portENTER_CRITICAL(&_pending_lock);
+        if (_has_pending_set_schedule) {
+            set_schedule = _pending_set_schedule;
+            has_set_schedule = true;
+            _has_pending_set_schedule = false;
+        }
+        has_skip_next_wake = _has_pending_skip_next_wake;
+        _has_pending_skip_next_wake = false;
+        bool has_update_ready = _has_pending_update_ready;
+        _has_pending_update_ready = false;
+        set_wake_command set_wake;
+        bool has_set_wake = _has_pending_set_wake;
+        if (has_set_wake) {
+            set_wake = _pending_set_wake;
+            _has_pending_set_wake = false;
+        }
+        portEXIT_CRITICAL(&_pending_lock);
+
+        if (has_set_schedule && _schedule_set_callback) {
+            _schedule_set_callback(set_schedule);
+        }
+        if (has_skip_next_wake && _skip_next_wake_callback) {
+            _skip_next_wake_callback();
+        }
+        if (has_update_ready && _update_ready_callback) {
+            _update_ready_callback();
+        }
+        if (has_set_wake && _wake_set_callback) {
+            _wake_set_callback(set_wake.enabled, set_wake.secs);
+        }
+    }
+
+    void config_web_server::poll_brew_commands() {
+        int64_t received_micros = 0;
+        brew_command command = _brew_commands.take(&received_micros);
+        if (command != brew_command::none && _brew_command_callback) {
+            _brew_command_callback(command, received_micros);
         }
-        _main_thread_tasks.clear();
     }
 
     void config_web_server::set_wifi_callback(wifi_connect_callback callback) {
@@ -145,25 +273,644 @@ namespace mocca {
         _timezone_set_callback = callback;
     }
 
+    void config_web_server::set_metrics_callback(metrics_callback callback) {
+        _metrics_callback = callback;
+    }
+
+    void config_web_server::set_schedule_callbacks(schedule_get_callback get_callback,
+                                                   schedule_set_callback set_callback,
+                                                   skip_next_wake_callback skip_callback) {
+        _schedule_get_callback = get_callback;
+        _schedule_set_callback = set_callback;
+        _skip_next_wake_callback = skip_callback;
+    }
+
+    void config_web_server::set_brew_history(const brew_history* history) {
+        _brew_history = history;
+    }
+
+    void config_web_server::set_update_ready_callback(update_ready_callback callback) {
+        _update_ready_callback = callback;
+    }
+
+    void config_web_server::set_brew_callbacks(state_get_callback state_callback,
+                                               brew_command_callback command_callback,
+                                               wake_set_callback wake_callback) {
+        _state_get_callback = state_callback;
+        _brew_command_callback = command_callback;
+        _wake_set_callback = wake_callback;
+    }
+
+#if MOCCA_FEATURE_DISPLAY
+    void config_web_server::set_screen_mirror(screen_mirror* mirror) {
+        _screen_mirror = mirror;
+        _screen_mirror->set_change_listener(_screen_task);
+    }
+#endif
+
+    const admission_stats& config_web_server::get_admission_stats() const {
+        return _admission.stats();
+    }
+
+    bool config_web_server::admit_request(AsyncWebServerRequest* request) {
+        switch (_admission.admit(request, request->client()->remoteIP(), millis())) {
+        case admission_result::admitted:
+            request->onDisconnect([this, request]() { on_request_disconnected(request); });
+            return true;
+
+        case admission_result::rate_limited: {
+            _request_body.release(request);
+            AsyncWebServerResponse* response =
+                request->beginResponse(429, "application/json", "{\"status\":\"failed\",\"reason\":\"rate limited\"}");
+            response->addHeader("Access-Control-Allow-Origin", "*");
+            response->addHeader("Retry-After", "1");
+            request->send(response);
+            return false;
+        }
+
+        case admission_result::overloaded:
+        default:
+            _request_body.release(request);
+            send_simple_json_response(request, 503, "busy");
+            return false;
+        }
+    }
+
+    void config_web_server::on_request_disconnected(AsyncWebServerRequest* request) {
+        _request_body.release(request);
+        _admission.finish(request);
+        if (_metrics_request == request) {
+            _metrics_request = nullptr;
+        }
+        if (_history_request == request) {
+            _history_request = nullptr;
+        }
+        if (_update_request == request) {
+            _updater.abort("upload interrupted");
+            _update_request = nullptr;
+        }
+#if MOCCA_FEATURE_DISPLAY
+        if (_screen_request == request) {
+            _screen_request = nullptr;
+        }
+#endif
+    }
+
     void config_web_server::on_any_web_request() {
-        _last_request = millis();
+        _networks.on_request(millis());
     }
 
-    void config_web_server::wifi_network_info::set_from_network_item(uint8_t network_item) {
-        ssid = WiFi.SSID(network_item);
-        encryption = WiFi.encryptionType(network_item);
-        rssi = WiFi.RSSI(network_item);
-        bssid = WiFi.BSSIDstr(network_item);
-        channel = WiFi.channel(network_item);
+    void config_web_server::on_wifi_connect_request(AsyncWebServerRequest* request) {
+        if (!admit_request(request)) {
+            return;
+        }
+        on_any_web_request();
+
+        JsonDocument json(&_json_allocator);
+        if (!parse_request_body(request, &json)) {
+            return;
+        }
+
+        wifi_connect_command command;
+        if (!copy_json_string(json["ssid"], command.ssid, sizeof(command.ssid)) ||
+            !copy_json_string(json["pass"], command.password, sizeof(command.password))) {
+            send_simple_json_response(request, 400, "missing or too long ssid or pass field");
+            return;
+        }
+
+        portENTER_CRITICAL(&_pending_lock);
+        if (_has_pending_wifi_connect) {
+            _admission.on_command_collapsed();
+        }
+        _pending_wifi_connect = command;
+        _has_pending_wifi_connect = true;
+        portEXIT_CRITICAL(&_pending_lock);
+        wake_control_loop();
+
+        send_simple_json_response(request, 200, nullptr);
     }
 
-    JsonDocument config_web_server::wifi_network_info::to_json() const {
-        JsonDocument json;
-        json["ssid"] = ssid;
-        json["encryption"] = auth_mode_name(encryption);
-        json["bssid"] = bssid;
-        json["rssi"] = rssi;
-        json["channel"] = channel;
-        return json;
+    void config_web_server::on_set_timezone_request(AsyncWebServerRequest* request) {
+        if (!admit_request(request)) {
+            return;
+        }
+        on_any_web_request();
+
+        JsonDocument json(&_json_allocator);
+        if (!parse_request_body(request, &json)) {
+            return;
+        }
+
+        set_timezone_command command;
+        if (!copy_json_string(json["timezone"], command.timezone, sizeof(command.timezone))) {
+            send_simple_json_response(request, 400, "missing or too long timezone field");
+            return;
+        }
+
+        portENTER_CRITICAL(&_pending_lock);
+        if (_has_pending_set_timezone) {
+            _admission.on_command_collapsed();
+        }
+        _pending_set_timezone = command;
+        _has_pending_set_timezone = true;
+        portEXIT_CRITICAL(&_pending_lock);
+        wake_control_loop();
+
+        send_simple_json_response(request, 200, nullptr);
+    }
+
+    void config_web_server::on_metrics_request(AsyncWebServerRequest* request) {
+        // Deliberately not an on_any_web_request(), scrapes shouldn't keep the WiFi scanning.
+        if (!admit_request(request)) {
+            return;
+        }
+        if (_metrics_request != nullptr) {
+            send_simple_json_response(request, 503, "busy");
+            return;
+        }
+
+        runtime_metrics metrics;
+        if (_metrics_callback) {
+            _metrics_callback(&metrics);
+        }
+        metrics.uptime_millis = millis();
+        metrics.web_requests = _admission.stats();
+        metrics.log = get_logger().get_stats();
+
+        _metrics_request = request;
+        _metrics_length = format_metrics(metrics, _metrics_text, sizeof(_metrics_text));
+
+        AsyncWebServerResponse* response = request->beginResponse(
+            "text/plain; version=0.0.4", _metrics_length, [this](uint8_t* buffer, size_t max_len, size_t index) {
+                size_t length = std::min(max_len, _metrics_length - index);
+                memcpy(buffer, _metrics_text + index, length);
+                return length;
+            });
+        request->send(response);
+    }
+
+    void config_web_server::on_log_request(AsyncWebServerRequest* request) {
+        if (!admit_request(request)) {
+            return;
+        }
+
+        // Whatever the logger still holds, read straight out of its buffer. The response ends early if new lines
+        // overwrite the part that hasn't been sent yet.
+        const logger& log = get_logger();
+        uint32_t start = log.oldest();
+        uint32_t end = log.newest();
+
+        AsyncWebServerResponse* response =
+            request->beginChunkedResponse("text/plain", [start, end](uint8_t* buffer, size_t max_len, size_t index) {
+                uint32_t position = start + index;
+                size_t length = std::min<size_t>(max_len, end - position);
+                return get_logger().read(position, reinterpret_cast<char*>(buffer), length);
+            });
+        request->send(response);
+    }
+
+    void config_web_server::on_history_request(AsyncWebServerRequest* request) {
+        if (!admit_request(request)) {
+            return;
+        }
+        if (_history_request != nullptr) {
+            send_simple_json_response(request, 503, "busy");
+            return;
+        }
+
+        brew_history_format format = brew_history_format::json;
+        if (request->hasParam("format")) {
+            const String& format_name = request->getParam("format")->value();
+            if (format_name == "csv") {
+                format = brew_history_format::csv;
+            } else if (format_name != "json") {
+                send_simple_json_response(request, 400, "format must be csv or json");
+                return;
+            }
+        }
+
+        _history_request = request;
+        _history_export.start(_brew_history, format);
+
+        AsyncWebServerResponse* response = request->beginChunkedResponse(
+            format == brew_history_format::csv ? "text/csv" : "application/json",
+            [this](uint8_t* buffer, size_t max_len, size_t index) {
+                return _history_export.read(reinterpret_cast<char*>(buffer), max_len);
+            });
+        response->addHeader("Access-Control-Allow-Origin", "*");
+        request->send(response);
+    }
+
+    void config_web_server::on_get_schedule_request(AsyncWebServerRequest* request) {
+        if (!admit_request(request)) {
+            return;
+        }
+
+        schedule_info schedule;
+        if (_schedule_get_callback) {
+            _schedule_get_callback(&schedule);
+        }
+
+        AsyncJsonResponse* response = new AsyncJsonResponse();
+        JsonObject root = response->getRoot().to<JsonObject>();
+
+        JsonArray alarms_json = root["alarms"].to<JsonArray>();
+        for (const wake_alarm& alarm : schedule.alarms) {
+            if (!alarm.is_used()) {
+                continue;
+            }
+            JsonObject alarm_json = alarms_json.add<JsonObject>();
+            alarm_json["minute"] = alarm.minute_of_day;
+            alarm_json["days"] = alarm.days;
+            alarm_json["enabled"] = alarm.enabled != 0;
+        }
+        root["next_wake"] = schedule.next_wake;
+        root["skip_until"] = schedule.skip_until;
+        root["deep_sleep_lead_secs"] = schedule.deep_sleep_lead_secs;
+
+        response->setLength();
+        response->addHeader("Access-Control-Allow-Origin", "*");
+        request->send(response);
+    }
+
+    void config_web_server::on_set_schedule_request(AsyncWebServerRequest* request) {
+        if (!admit_request(request)) {
+            return;
+        }
+
+        JsonDocument json(&_json_allocator);
+        if (!parse_request_body(request, &json)) {
+            return;
+        }
+
+        JsonArrayConst alarms_json = json["alarms"];
+        if (alarms_json.isNull() || alarms_json.size() > max_wake_alarms) {
+            send_simple_json_response(request, 400, "missing or too many alarms");
+            return;
+        }
+
+        set_schedule_command command;
+        for (JsonVariantConst alarm_json : alarms_json) {
+            JsonVariantConst minute = alarm_json["minute"];
+            JsonVariantConst days = alarm_json["days"];
+            if (!minute.is<uint16_t>() || minute.as<uint16_t>() >= minutes_per_day || !days.is<uint8_t>() ||
+                (days.as<uint8_t>() & ~wake_every_day) != 0 || days.as<uint8_t>() == 0) {
+                send_simple_json_response(request, 400, "alarms need a minute of the day and a days mask");
+                return;
+            }
+
+            wake_alarm& alarm = command.alarms[command.alarm_count++];
+            alarm.minute_of_day = minute.as<uint16_t>();
+            alarm.days = days.as<uint8_t>();
+            alarm.enabled = alarm_json["enabled"].is<bool>() ? alarm_json["enabled"].as<bool>() : true;
+        }
+
+        JsonVariantConst lead = json["deep_sleep_lead_secs"];
+        if (!lead.isNull()) {
+            if (!lead.is<uint32_t>() || lead.as<uint32_t>() < min_deep_sleep_lead_secs ||
+                lead.as<uint32_t>() > max_deep_sleep_lead_secs) {
+                send_simple_json_response(request, 400, "deep_sleep_lead_secs out of range");
+                return;
+            }
+            command.deep_sleep_lead_secs = lead.as<uint32_t>();
+        }
+
+        portENTER_CRITICAL(&_pending_lock);
+        if (_has_pending_set_schedule) {
+            _admission.on_command_collapsed();
+        }
+        _pending_set_schedule = command;
+        _has_pending_set_schedule = true;
+        portEXIT_CRITICAL(&_pending_lock);
+        wake_control_loop();
+
+        send_simple_json_response(request, 200, nullptr);
+    }
+
+    void config_web_server::on_skip_next_wake_request(AsyncWebServerRequest* request) {
+        if (!admit_request(request)) {
+            return;
+        }
+
+        portENTER_CRITICAL(&_pending_lock);
+        if (_has_pending_skip_next_wake) {
+            _admission.on_command_collapsed();
+        }
+        _has_pending_skip_next_wake = true;
+        portEXIT_CRITICAL(&_pending_lock);
+        wake_control_loop();
+
+        send_simple_json_response(request, 200, nullptr);
+    }
+
+    void config_web_server::on_update_body(AsyncWebServerRequest* request, const uint8_t* data, size_t len,
+                                           size_t index, size_t total) {
+        if (index == 0) {
+            // Another upload is running, this one is turned away once its body is in. So is one that may not update,
+            // nothing is written to the flash before it was admitted and its signature checked.
+            if (_update_request != nullptr || update_refusal(request) ||
+                _admission.admit(request, request->client()->remoteIP(), millis()) != admission_result::admitted) {
+                return;
+            }
+
+            // The request handler only runs once the whole image arrived, an upload that is cut short before then
+            // still has to give up the update slot.
+            _update_request = request;
+            request->onDisconnect([this, request]() { on_request_disconnected(request); });
+
+            const AsyncWebParameter* sha256 = request->getParam("sha256");
+            _updater.begin(total, sha256 ? sha256->value().c_str() : nullptr);
+        }
+
+        if (_update_request == request) {
+            _updater.write(data, len, index);
+        }
+    }
+
+    void config_web_server::on_update_request(AsyncWebServerRequest* request) {
+        // The upload was admitted when its body started.
+        if (_update_request != request) {
+            if (!admit_request(request)) {
+                return;
+            }
+
+            const char* refusal = update_refusal(request);
+            if (refusal) {
+                send_simple_json_response(request, 403, refusal);
+            } else if (_update_request == nullptr) {
+                send_simple_json_response(request, 400, "missing image");
+            } else {
+                send_simple_json_response(request, 503, "busy");
+            }
+            return;
+        }
+
+        if (!_updater.finish()) {
+            send_simple_json_response(request, 400, _updater.error());
+            return;
+        }
+
+        portENTER_CRITICAL(&_pending_lock);
+        _has_pending_update_ready = true;
+        portEXIT_CRITICAL(&_pending_lock);
+        wake_control_loop();
+
+        send_simple_json_response(request, 200, nullptr);
+    }
+
+    const char* config_web_server::update_refusal(AsyncWebServerRequest* request) const {
+        // The fallback access point is open, anyone in range could reach /update through it.
+        if ((WiFi.getMode() & WIFI_AP) && request->client()->localIP() == WiFi.softAPIP()) {
+            return "no updates over the setup access point";
+        }
+
+        const AsyncWebParameter* sha256 = request->getParam("sha256");
+        const AsyncWebParameter* signature = request->getParam("signature");
+        if (!ota_signing_key) {
+            return "updates are off in this build";
+        }
+        if (!verify_ota_signature(ota_signing_key, sha256 ? sha256->value().c_str() : nullptr,
+                                  signature ? signature->value().c_str() : nullptr)) {
+            return "missing or wrong signature";
+        }
+        return nullptr;
+    }
+
+    void config_web_server::on_get_state_request(AsyncWebServerRequest* request) {
+        if (!admit_request(request)) {
+            return;
+        }
+
+        device_state_info info;
+        if (_state_get_callback) {
+            _state_get_callback(&info);
+        }
+
+        AsyncJsonResponse* response = new AsyncJsonResponse();
+        JsonObject root = response->getRoot().to<JsonObject>();
+        root["state"] = info.state;
+        root["brewing"] = info.brewing;
+        root["heating"] = info.heating;
+        root["water"] = info.has_water;
+        root["pot"] = info.has_pot;
+        if (info.brewing) {
+            root["brew_heating_secs"] = info.brew_heating_secs;
+        }
+        root["wake"] = info.wake;
+        root["next_wake"] = info.next_wake;
+
+        response->setLength();
+        response->addHeader("Access-Control-Allow-Origin", "*");
+        request->send(response);
+    }
+
+    void config_web_server::on_brew_request(AsyncWebServerRequest* request, brew_command command) {
+        int64_t received_micros = esp_timer_get_time();
+        if (!admit_request(request)) {
+            return;
+        }
+
+        // Checked again by the control loop, this only turns away requests that are obviously wrong right now.
+        if (_state_get_callback) {
+            device_state_info info;
+            _state_get_callback(&info);
+            if (command == brew_command::start && info.brewing) {
+                send_simple_json_response(request, 409, "already brewing");
+                return;
+            }
+            if (command == brew_command::start && !info.has_water) {
+                send_simple_json_response(request, 409, "no water");
+                return;
+            }
+            if (command == brew_command::cancel && !info.brewing) {
+                send_simple_json_response(request, 409, "not brewing");
+                return;
+            }
+        }
+
+        if (!_brew_commands.post(command, received_micros)) {
+            _admission.on_command_collapsed();
+        }
+
+        send_simple_json_response(request, 200, nullptr);
+    }
+
+    void config_web_server::on_get_wake_request(AsyncWebServerRequest* request) {
+        if (!admit_request(request)) {
+            return;
+        }
+
+        device_state_info info;
+        if (_state_get_callback) {
+            _state_get_callback(&info);
+        }
+
+        AsyncJsonResponse* response = new AsyncJsonResponse();
+        JsonObject root = response->getRoot().to<JsonObject>();
+        root["enabled"] = info.wake != 0;
+        root["minute"] = info.wake_secs / SECS_PER_MIN;
+        root["wake"] = info.wake;
+
+        response->setLength();
+        response->addHeader("Access-Control-Allow-Origin", "*");
+        request->send(response);
+    }
+
+    void config_web_server::on_set_wake_request(AsyncWebServerRequest* request) {
+        if (!admit_request(request)) {
+            return;
+        }
+
+        JsonDocument json(&_json_allocator);
+        if (!parse_request_body(request, &json)) {
+            return;
+        }
+
+        set_wake_command command;
+        command.enabled = json["enabled"].is<bool>() ? json["enabled"].as<bool>() : true;
+        if (command.enabled) {
+            JsonVariantConst minute = json["minute"];
+            if (!minute.is<uint16_t>() || minute.as<uint16_t>() >= minutes_per_day) {
+                send_simple_json_response(request, 400, "missing or invalid minute of the day");
+                return;
+            }
+            command.secs = minute.as<uint16_t>() * SECS_PER_MIN;
+
+            if (_state_get_callback) {
+                device_state_info info;
+                _state_get_callback(&info);
+                if (!info.has_valid_time) {
+                    send_simple_json_response(request, 409, "clock not set");
+                    return;
+                }
+            }
+        }
+
+        portENTER_CRITICAL(&_pending_lock);
+        if (_has_pending_set_wake) {
+            _admission.on_command_collapsed();
+        }
+        _pending_set_wake = command;
+        _has_pending_set_wake = true;
+        portEXIT_CRITICAL(&_pending_lock);
+        wake_control_loop();
+
+        send_simple_json_response(request, 200, nullptr);
+    }
+
+#if MOCCA_FEATURE_DISPLAY
+    void config_web_server::on_screen_request(AsyncWebServerRequest* request) {
+        if (!admit_request(request)) {
+            return;
+        }
+        if (_screen_mirror == nullptr) {
+            send_simple_json_response(request, 404, "no display");
+            return;
+        }
+        if (_screen_request != nullptr) {
+            send_simple_json_response(request, 503, "busy");
+            return;
+        }
+
+        screen_image_format format = screen_image_format::png;
+        if (request->hasParam("format")) {
+            const String& format_name = request->getParam("format")->value();
+            if (format_name == "pbm") {
+                format = screen_image_format::pbm;
+            } else if (format_name != "png") {
+                send_simple_json_response(request, 400, "format must be png or pbm");
+                return;
+            }
+        }
+
+        // Only the copy out of the mirror holds its lock, encoding works on the snapshot and writes straight into the
+        // buffer the response is sent from.
+        uint8_t changed_pages;
+        _screen_mirror->read(_screen_frame, 0, &changed_pages);
+        _screen_image_length = encode_screen_image(_screen_frame, format, _screen_image, sizeof(_screen_image));
+        _screen_request = request;
+
+        AsyncWebServerResponse* response = request->beginResponse(
+            format == screen_image_format::pbm ? "image/x-portable-bitmap" : "image/png", _screen_image_length,
+            [this](uint8_t* buffer, size_t max_len, size_t index) {
+                size_t length = std::min(max_len, _screen_image_length - index);
+                memcpy(buffer, _screen_image + index, length);
+                return length;
+            });
+        response->addHeader("Access-Control-Allow-Origin", "*");
+        response->addHeader("Cache-Control", "no-store");
+        request->send(response);
+    }
+
+    void config_web_server::on_screen_watcher_connected(AsyncEventSourceClient* client) {
+        if (_screen_mirror == nullptr || _screen_events.count() > max_screen_watchers) {
+            client->close();
+            return;
+        }
+
+        _screen_full_push = true;
+        if (_screen_task) {
+            xTaskNotifyGive(_screen_task);
+        }
+    }
+
+    void config_web_server::screen_task_main(void* arg) {
+        config_web_server* server = static_cast<config_web_server*>(arg);
+        while (true) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            server->push_screen_changes();
+            vTaskDelay(pdMS_TO_TICKS(screen_push_interval_millis));
+        }
+    }
+
+    void config_web_server::push_screen_changes() {
+        if (_screen_mirror == nullptr || _screen_events.count() == 0) {
+            return;
+        }
+
+        // Every event is one page: its index, a space and its columns in hex, bit 0 of a column is its top row.
+        static const char hex_digits[] = "0123456789abcdef";
+        uint32_t since = _screen_full_push.exchange(false) ? 0 : _screen_pushed_frame;
+        uint8_t changed_pages;
+        _screen_pushed_frame = _screen_mirror->read(_screen_push_frame, since, &changed_pages);
+
+        for (size_t page = 0; page < screen_page_count; page++) {
+            if ((changed_pages & (1 << page)) == 0) {
+                continue;
+            }
+
+            const uint8_t* columns = _screen_push_frame + page * screen_page_size;
+            int prefix_length = snprintf(_screen_event, sizeof(_screen_event), "%u ", static_cast<unsigned>(page));
+            char* out = _screen_event + prefix_length;
+            for (size_t column = 0; column < screen_page_size; column++) {
+                *out++ = hex_digits[columns[column] >> 4];
+                *out++ = hex_digits[columns[column] & 0x0f];
+            }
+            *out = '\0';
+            _screen_events.send(_screen_event, "page", _screen_pushed_frame);
+        }
+    }
+#endif
+
+    bool config_web_server::parse_request_body(AsyncWebServerRequest* request, JsonDocument* json) {
+        // All requests are handled on the web server task so only one document uses the arena at a time.
+        DeserializationError error;
+        switch (mocca::parse_request_body(request, &_request_body, &_json_allocator, json, &error)) {
+        case body_parse_result::parsed:
+            return true;
+
+        case body_parse_result::too_large:
+            send_simple_json_response(request, 413, "request body too large");
+            return false;
+
+        case body_parse_result::busy:
+            send_simple_json_response(request, 503, "busy");
+            return false;
+
+        case body_parse_result::malformed:
+        default:
+            send_simple_json_response(request, 400, error.c_str());
+            return false;
+        }
     }
 } // namespace mocca
\ No newline at end of file
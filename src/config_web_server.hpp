@@ -1,14 +1,77 @@
 #pragma once
 
+#include "admission_control.hpp"
+#include "brew_history.hpp"
+#include "command_handoff.hpp"
+#include "features.hpp"
+#include "json_request.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "ota_partition.hpp"
+#include "persistent_data.hpp"
+#include "wifi_scan_cache.hpp"
+
+#if MOCCA_FEATURE_DISPLAY
+#include "screen_mirror.hpp"
+#endif
+
 #include <ArduinoJson.h>
-#include <AsyncJson.h>
 #include <ESPAsyncWebServer.h>
 
-#include <vector>
+#include <atomic>
+#include <functional>
 
 namespace mocca {
     using wifi_connect_callback = std::function<void(const char* ssid, const char* password)>;
     using timezone_set_callback = std::function<bool(const char* timezone)>;
+    using metrics_callback = std::function<void(runtime_metrics* metrics)>;
+
+    struct schedule_info {
+        wake_alarm alarms[max_wake_alarms];
+        time_t next_wake = 0;
+        time_t skip_until = 0;
+        uint32_t deep_sleep_lead_secs = 0;
+    };
+    using schedule_get_callback = std::function<void(schedule_info* schedule)>;
+    using skip_next_wake_callback = std::function<void(void)>;
+    using update_ready_callback = std::function<void(void)>;
+
+    struct device_state_info {
+        const char* state = "unknown";
+        bool brewing = false;
+        bool heating = false; // Boiler SSR on
+        bool has_water = false;
+        bool has_pot = false;
+        bool has_valid_time = false;
+        uint32_t brew_heating_secs = 0; // Boiler time of the current brew
+        time_t wake = 0;                // One-off brew time, 0 if none
+        uint32_t wake_secs = 0;         // Local time of day of the last one-off brew time
+        time_t next_wake = 0;           // Next brew from the one-off time or the alarms, 0 if none
+    };
+    using state_get_callback = std::function<void(device_state_info* info)>;
+    using brew_command_callback = std::function<void(brew_command command, int64_t received_micros)>;
+    using wake_set_callback = std::function<void(bool enabled, uint32_t secs)>;
+
+    struct wifi_connect_command {
+        char ssid[sizeof(persistent_data::wifi_ssid)] = {0};
+        char password[sizeof(persistent_data::wifi_password)] = {0};
+    };
+
+    struct set_timezone_command {
+        char timezone[sizeof(persistent_data::timezone)] = {0};
+    };
+
+    struct set_schedule_command {
+        wake_alarm alarms[max_wake_alarms];
+        size_t alarm_count = 0;
+        uint32_t deep_sleep_lead_secs = 0; // 0 leaves it as it is
+    };
+    using schedule_set_callback = std::function<void(const set_schedule_command& command)>;
+
+    struct set_wake_command {
+        bool enabled = false;
+        uint32_t secs = 0;
+    };
 
     class config_web_server {
       public:
@@ -17,32 +80,119 @@ namespace mocca {
         void init();
         void step();
 
+        // Hands pending brew commands to the control loop. Called right before the loop decides on the boiler so a
+        // command is applied within the tick it arrived in, whatever else step() had to do in that tick.
+        void poll_brew_commands();
+
         void set_wifi_callback(wifi_connect_callback callback);
         void set_timezone_callback(timezone_set_callback callback);
+        void set_metrics_callback(metrics_callback callback);
+        void set_schedule_callbacks(schedule_get_callback get_callback, schedule_set_callback set_callback,
+                                    skip_next_wake_callback skip_callback);
+        void set_brew_history(const brew_history* history); // Read from the web server task, only touches flash
+        void set_update_ready_callback(update_ready_callback callback);
+        void set_brew_callbacks(state_get_callback state_callback, brew_command_callback command_callback,
+                                wake_set_callback wake_callback);
+#if MOCCA_FEATURE_DISPLAY
+        void set_screen_mirror(screen_mirror* mirror); // After init(), the mirror notifies the screen task
+#endif
+
+        const admission_stats& get_admission_stats() const;
 
       private:
+        bool admit_request(AsyncWebServerRequest* request);
+        void on_request_disconnected(AsyncWebServerRequest* request);
         void on_any_web_request();
 
+        void on_wifi_connect_request(AsyncWebServerRequest* request);
+        void on_set_timezone_request(AsyncWebServerRequest* request);
+        void on_metrics_request(AsyncWebServerRequest* request);
+        void on_log_request(AsyncWebServerRequest* request);
+        void on_history_request(AsyncWebServerRequest* request);
+        void on_get_schedule_request(AsyncWebServerRequest* request);
+        void on_set_schedule_request(AsyncWebServerRequest* request);
+        void on_skip_next_wake_request(AsyncWebServerRequest* request);
+        void on_update_body(AsyncWebServerRequest* request, const uint8_t* data, size_t len, size_t index,
+                            size_t total);
+        void on_update_request(AsyncWebServerRequest* request);
+        const char* update_refusal(AsyncWebServerRequest* request) const; // Why it may not update, nullptr if it may
+        void on_get_state_request(AsyncWebServerRequest* request);
+        void on_brew_request(AsyncWebServerRequest* request, brew_command command);
+        void on_get_wake_request(AsyncWebServerRequest* request);
+        void on_set_wake_request(AsyncWebServerRequest* request);
+#if MOCCA_FEATURE_DISPLAY
+        void on_screen_request(AsyncWebServerRequest* request);
+        void on_screen_watcher_connected(AsyncEventSourceClient* client);
+        static void screen_task_main(void* arg);
+        void push_screen_changes();
+#endif
+        bool parse_request_body(AsyncWebServerRequest* request, JsonDocument* json);
+
         AsyncWebServer _server;
-        AsyncCallbackJsonWebHandler _wifi_connect_handler;
-        AsyncCallbackJsonWebHandler _set_timezone_handler;
-
-        struct wifi_network_info {
-            String ssid;
-            wifi_auth_mode_t encryption;
-            int32_t rssi;
-            String bssid;
-            int32_t channel;
-
-            void set_from_network_item(uint8_t network_item);
-            JsonDocument to_json() const;
-        };
-        std::vector<wifi_network_info> _networks;
-        uint32_t _last_request = 0;
+
+        admission_control _admission;
+        request_body_buffer _request_body;
+        fixed_json_allocator _json_allocator;
+
+        wifi_scan_cache _networks;
+        wifi_network_info _network_list[wifi_scan_cache::max_networks]; // Copy for /wifi_networks, web task only
 
         wifi_connect_callback _wifi_set_callback;
         timezone_set_callback _timezone_set_callback;
+        metrics_callback _metrics_callback;
+        schedule_get_callback _schedule_get_callback;
+        schedule_set_callback _schedule_set_callback;
+        skip_next_wake_callback _skip_next_wake_callback;
+        update_ready_callback _update_ready_callback;
+        state_get_callback _state_get_callback;
+        brew_command_callback _brew_command_callback;
+        wake_set_callback _wake_set_callback;
+        const brew_history* _brew_history = nullptr;
+
+        // Scrapes are formatted into a fixed buffer that is streamed out, one scrape at a time.
+        const AsyncWebServerRequest* _metrics_request = nullptr;
+        char _metrics_text[max_metrics_text_size];
+        size_t _metrics_length = 0;
+
+        // History exports are formatted as they are sent, one export at a time.
+        const AsyncWebServerRequest* _history_request = nullptr;
+        brew_history_export _history_export;
+
+        // Firmware uploads are written to the inactive app slot as they arrive, one upload at a time.
+        const AsyncWebServerRequest* _update_request = nullptr;
+        ota_partition_flash _update_flash;
+        ota_updater _updater;
+
+#if MOCCA_FEATURE_DISPLAY
+        // Screenshots are encoded from a snapshot of the mirror into a fixed buffer that is sent out, one at a time.
+        screen_mirror* _screen_mirror = nullptr;
+        const AsyncWebServerRequest* _screen_request = nullptr;
+        uint8_t _screen_frame[screen_buffer_size];
+        uint8_t _screen_image[max_screen_image_size];
+        size_t _screen_image_length = 0;
+
+        // Watchers of /screen/events get the pages that changed, pushed from a task of their own.
+        AsyncEventSource _screen_events;
+        TaskHandle_t _screen_task = nullptr;
+        std::atomic<bool> _screen_full_push{false}; // A new watcher needs every page
+        uint32_t _screen_pushed_frame = 0;
+        uint8_t _screen_push_frame[screen_buffer_size];
+        char _screen_event[4 + screen_page_size * 2];
+#endif
 
-        std::vector<std::function<void(void)>> _main_thread_tasks;
+        // Written by the web server task, consumed by step() on the main thread which is woken for it. A newer command
+        // replaces an older one that hasn't been handled yet.
+        portMUX_TYPE _pending_lock = portMUX_INITIALIZER_UNLOCKED;
+        wifi_connect_command _pending_wifi_connect;
+        bool _has_pending_wifi_connect = false;
+        set_timezone_command _pending_set_timezone;
+        bool _has_pending_set_timezone = false;
+        set_schedule_command _pending_set_schedule;
+        bool _has_pending_set_schedule = false;
+        bool _has_pending_skip_next_wake = false;
+        bool _has_pending_update_ready = false;
+        set_wake_command _pending_set_wake;
+        bool _has_pending_set_wake = false;
+        brew_command_handoff _brew_commands;
     };
 } // namespace mocca
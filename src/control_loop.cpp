@@ -0,0 +1,30 @@
+#include "control_loop.hpp"
+
+namespace mocca {
+    namespace {
+        TaskHandle_t control_task = nullptr;
+    } // namespace
+
+    void start_control_loop_pacing() {
+        control_task = xTaskGetCurrentTaskHandle();
+    }
+
+    void wait_for_control_loop_wake(uint32_t timeout_millis) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout_millis));
+    }
+
+    void wake_control_loop() {
+        if (control_task) {
+            xTaskNotifyGive(control_task);
+        }
+    }
+
+    void IRAM_ATTR wake_control_loop_from_isr() {
+        if (!control_task) {
+            return;
+        }
+        BaseType_t higher_priority_task_woken = pdFALSE;
+        vTaskNotifyGiveFromISR(control_task, &higher_priority_task_woken);
+        portYIELD_FROM_ISR(higher_priority_task_woken);
+    }
+} // namespace mocca
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <Arduino.h>
+
+namespace mocca {
+    // The control loop sleeps between ticks rather than spinning its core. It waits until the next tick is due and
+    // whatever hands it work sooner (input interrupts, commands from the network tasks) cuts the wait short.
+
+    // Called from the control loop task before anything may wake it.
+    void start_control_loop_pacing();
+
+    // Returns after timeout_millis or as soon as the loop is woken, whichever comes first. A wake that arrived while
+    // the loop was busy returns right away.
+    void wait_for_control_loop_wake(uint32_t timeout_millis);
+
+    void wake_control_loop();
+    void wake_control_loop_from_isr();
+} // namespace mocca
@@ -0,0 +1,122 @@
+#include "deep_sleep.hpp"
+
+#include "util.hpp"
+
+#include <driver/gpio.h>
+#include <driver/rtc_io.h>
+#include <esp_sleep.h>
+#include <sys/time.h>
+
+namespace mocca {
+    namespace {
+        constexpr uint32_t retained_state_magic = 0x4d574b31; // "MWK1"
+
+        // Lives in RTC slow memory which survives deep sleep but not power loss.
+        struct retained_state {
+            uint32_t magic;
+            time_t sleep_started;
+            char timezone_posix[64];
+            deep_sleep_stats stats;
+        };
+        RTC_DATA_ATTR retained_state retained;
+
+        bool retained_state_valid() {
+            return retained.magic == retained_state_magic;
+        }
+    } // namespace
+
+    deep_sleep_wake get_deep_sleep_wake() {
+        if (!retained_state_valid()) {
+            return deep_sleep_wake::none;
+        }
+
+        switch (esp_sleep_get_wakeup_cause()) {
+        case ESP_SLEEP_WAKEUP_TIMER:
+            return deep_sleep_wake::timer;
+        case ESP_SLEEP_WAKEUP_EXT0:
+            return deep_sleep_wake::button;
+        default:
+            return deep_sleep_wake::none;
+        }
+    }
+
+    bool restore_deep_sleep_clock(Timezone* timezone) {
+        if (!retained_state_valid()) {
+            return false;
+        }
+
+        // The system clock keeps running from the RTC timer through deep sleep.
+        time_t now = time(nullptr);
+        if (now < retained.sleep_started) {
+            return false;
+        }
+
+        UTC.setTime(now);
+        if (!timezone->setPosix(retained.timezone_posix)) {
+            return false;
+        }
+
+        retained.stats.asleep_secs += now - retained.sleep_started;
+        return true;
+    }
+
+    deep_sleep_stats get_deep_sleep_stats() {
+        return retained_state_valid() ? retained.stats : deep_sleep_stats();
+    }
+
+    void record_deep_sleep_resume(uint32_t since_wake_millis) {
+        if (retained_state_valid()) {
+            retained.stats.last_resume_millis = since_wake_millis;
+        }
+    }
+
+    void record_deep_sleep_boiler_on(uint32_t since_wake_millis) {
+        if (!retained_state_valid()) {
+            return;
+        }
+
+        deep_sleep_stats& stats = retained.stats;
+        stats.timed_boiler_ons++;
+        stats.last_boiler_on_millis = since_wake_millis;
+        uint32_t lead_millis = stats.last_lead_secs * MILLIS_PER_SEC;
+        if (since_wake_millis > lead_millis) {
+            stats.worst_boiler_on_late_millis = std::max(stats.worst_boiler_on_late_millis,
+                                                         since_wake_millis - lead_millis);
+        }
+    }
+
+    void enter_deep_sleep(Timezone* timezone, uint32_t sleep_secs, uint32_t lead_secs, int button_pin, int ssr_pin) {
+        if (!retained_state_valid()) {
+            retained = retained_state();
+            retained.magic = retained_state_magic;
+        }
+
+        // The system clock is kept in sync by sntp_client and set_time(), it keeps running through deep sleep.
+        time_t now = time(nullptr);
+        retained.sleep_started = now;
+        strlcpy(retained.timezone_posix, timezone->getPosix().c_str(), sizeof(retained.timezone_posix));
+        retained.stats.sleep_count++;
+        retained.stats.awake_secs += millis() / MILLIS_PER_SEC;
+        retained.stats.last_lead_secs = lead_secs;
+
+        esp_sleep_enable_timer_wakeup(static_cast<uint64_t>(sleep_secs) * 1000000ULL);
+
+        if (button_pin >= 0) {
+            gpio_num_t button_gpio = static_cast<gpio_num_t>(button_pin);
+            rtc_gpio_pullup_en(button_gpio);
+            rtc_gpio_pulldown_dis(button_gpio);
+            esp_sleep_enable_ext0_wakeup(button_gpio, 0);
+        }
+
+        // The pads float while the chip sleeps and through the reset after it, the SSR must not see that.
+        digitalWrite(ssr_pin, LOW);
+        gpio_hold_en(static_cast<gpio_num_t>(ssr_pin));
+        gpio_deep_sleep_hold_en();
+
+        esp_deep_sleep_start();
+    }
+
+    void release_deep_sleep_hold(int ssr_pin) {
+        gpio_hold_dis(static_cast<gpio_num_t>(ssr_pin));
+    }
+} // namespace mocca
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ezTime.h>
+
+namespace mocca {
+    enum class deep_sleep_wake {
+        none, // Regular boot
+        timer,
+        button,
+    };
+
+    // Kept in RTC memory across deep sleeps. Times since a wake are from the reset, which leaves out the ROM
+    // bootloader's few tens of milliseconds.
+    struct deep_sleep_stats {
+        uint32_t sleep_count = 0;
+        uint32_t asleep_secs = 0;
+        uint32_t awake_secs = 0;
+        uint32_t last_resume_millis = 0; // Wake to init() finished
+        uint32_t timed_boiler_ons = 0;   // Timer wakes that ended with the boiler SSR turning on
+        uint32_t last_boiler_on_millis = 0;
+        uint32_t worst_boiler_on_late_millis = 0; // Longest wake to SSR on beyond the deep sleep lead
+        uint32_t last_lead_secs = 0;              // Lead of the last deep sleep
+    };
+
+    // Bounds of the time a deep sleep ends before a brew, it has to cover the boot and the network coming back.
+    constexpr uint32_t min_deep_sleep_lead_secs = 15;
+    constexpr uint32_t max_deep_sleep_lead_secs = SECS_PER_HOUR;
+
+    // Why this boot happened. Only reports a deep sleep wake if the clock was saved before going to sleep.
+    deep_sleep_wake get_deep_sleep_wake();
+
+    // Restores the UTC clock and the timezone rules saved by enter_deep_sleep so that no network is needed to resume.
+    bool restore_deep_sleep_clock(Timezone* timezone);
+
+    deep_sleep_stats get_deep_sleep_stats();
+
+    // Record the time from the wake to init() finishing and to the boiler SSR first turning on, in millis() which
+    // counts from the wake.
+    void record_deep_sleep_resume(uint32_t since_wake_millis);
+    void record_deep_sleep_boiler_on(uint32_t since_wake_millis);
+
+    // Saves the clock and sleeps until the timer expires or the (active low) button is pressed, a button_pin of -1 only
+    // wakes on the timer. lead_secs is how long before the brew the timer expires. ssr_pin is held low until
+    // release_deep_sleep_hold() after the wake. Does not return, the chip reboots on wake.
+    void enter_deep_sleep(Timezone* timezone, uint32_t sleep_secs, uint32_t lead_secs, int button_pin, int ssr_pin);
+
+    // Lets go of the SSR pin held through deep sleep, once it is driven low again.
+    void release_deep_sleep_hold(int ssr_pin);
+} // namespace mocca
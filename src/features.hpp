@@ -0,0 +1,57 @@
+#pragma once
+
+// Build profiles. Every feature is on unless an environment in platformio.ini turns it off with -D MOCCA_FEATURE_x=0,
+// the matching sources are dropped with build_src_filter and the libraries with lib_ignore.
+#if !defined(MOCCA_FEATURE_DISPLAY)
+#define MOCCA_FEATURE_DISPLAY 1 // SSD1306 panel and the rotary encoder UI
+#endif
+#if !defined(MOCCA_FEATURE_WEB)
+#define MOCCA_FEATURE_WEB 1 // Config web server with /metrics and /log
+#endif
+#if !defined(MOCCA_FEATURE_NTP)
+#define MOCCA_FEATURE_NTP 1 // Network time, without it the time is set on the device
+#endif
+#if !defined(MOCCA_FEATURE_MQTT)
+#if defined(MOCCA_MQTT_BROKER)
+#define MOCCA_FEATURE_MQTT 1 // Telemetry and commands through the broker given with -D MOCCA_MQTT_BROKER=\"host\"
+#else
+#define MOCCA_FEATURE_MQTT 0
+#endif
+#endif
+#if !defined(MOCCA_FEATURE_SYNC)
+#if defined(MOCCA_SYNC_GROUP)
+#define MOCCA_FEATURE_SYNC 1 // Schedule sync with the other units built with the same -D MOCCA_SYNC_GROUP=\"name\"
+#else
+#define MOCCA_FEATURE_SYNC 0
+#endif
+#endif
+
+// WiFi is only brought up for something that uses it.
+#define MOCCA_FEATURE_WIFI (MOCCA_FEATURE_WEB || MOCCA_FEATURE_NTP || MOCCA_FEATURE_MQTT || MOCCA_FEATURE_SYNC)
+// Brew and wake commands from the network.
+#define MOCCA_FEATURE_REMOTE (MOCCA_FEATURE_WEB || MOCCA_FEATURE_MQTT)
+
+#if !MOCCA_FEATURE_DISPLAY && !MOCCA_FEATURE_WEB
+#error "Without the display the web server is the only way to configure the device"
+#endif
+#if !MOCCA_FEATURE_DISPLAY && !MOCCA_FEATURE_NTP
+#error "Without the display the time can only come from the network"
+#endif
+#if MOCCA_FEATURE_MQTT && !defined(MOCCA_MQTT_BROKER)
+#error "MQTT needs a broker, build with -D MOCCA_MQTT_BROKER=\"host\""
+#endif
+#if MOCCA_FEATURE_SYNC && !defined(MOCCA_SYNC_GROUP)
+#error "Schedule sync needs a group, build with -D MOCCA_SYNC_GROUP=\"name\""
+#endif
+
+#if !MOCCA_FEATURE_DISPLAY
+#define MOCCA_FEATURE_PROFILE "headless"
+#elif !MOCCA_FEATURE_WEB && !MOCCA_FEATURE_NTP
+#define MOCCA_FEATURE_PROFILE "standalone"
+#elif !MOCCA_FEATURE_WEB
+#define MOCCA_FEATURE_PROFILE "no-web"
+#elif !MOCCA_FEATURE_NTP
+#define MOCCA_FEATURE_PROFILE "no-ntp"
+#else
+#define MOCCA_FEATURE_PROFILE "full"
+#endif
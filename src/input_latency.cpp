@@ -0,0 +1,113 @@
+#include "input_latency.hpp"
+
+#include "control_loop.hpp"
+
+namespace mocca {
+    namespace {
+        // An edge that didn't lead to a handled input by then was noise or the release after a long press. Longer than
+        // a click plus OneButton's click timeout.
+        constexpr uint32_t max_edge_age_micros = 1500 * 1000;
+    } // namespace
+
+    const char* network_load_name(network_load load) {
+        switch (load) {
+        case network_load::quiet:
+            return "quiet";
+        case network_load::light:
+            return "light";
+        case network_load::heavy:
+            return "heavy";
+        default:
+            return "unknown";
+        }
+    }
+
+    void latency_histogram::add(uint32_t latency_micros) {
+        uint32_t latency_millis = latency_micros / 1000;
+        size_t bucket = 0;
+        while (bucket < latency_bucket_count - 1 && latency_millis > latency_bucket_bounds_millis[bucket]) {
+            bucket++;
+        }
+        buckets[bucket]++;
+        count++;
+        sum_millis += latency_millis;
+    }
+
+    void input_latency_tracker::start(int encoder_pin_a, int encoder_pin_b, int button_pin) {
+        // The encoder pins are counted by PCNT and the button is polled by OneButton, these interrupts only take the
+        // time and wake the control loop to handle the input.
+        attachInterruptArg(digitalPinToInterrupt(encoder_pin_a), on_encoder_edge, this, CHANGE);
+        attachInterruptArg(digitalPinToInterrupt(encoder_pin_b), on_encoder_edge, this, CHANGE);
+        attachInterruptArg(digitalPinToInterrupt(button_pin), on_button_edge, this, CHANGE);
+    }
+
+    uint32_t input_latency_tracker::take_edge(input_source source, uint32_t now_micros) {
+        uint32_t edge = _edge_micros[static_cast<size_t>(source)].exchange(0);
+        if (edge == 0 || now_micros - edge > max_edge_age_micros) {
+            return now_micros;
+        }
+        return edge;
+    }
+
+    void input_latency_tracker::on_input_handled(uint32_t edge_micros) {
+        if (!_has_unflushed_input || static_cast<int32_t>(edge_micros - _oldest_unflushed_input) < 0) {
+            _oldest_unflushed_input = edge_micros;
+        }
+        _has_unflushed_input = true;
+    }
+
+    void input_latency_tracker::on_frame_flushed(uint32_t now_micros, const char* state, network_load load) {
+        if (!_has_unflushed_input) {
+            return;
+        }
+        _has_unflushed_input = false;
+
+        state_latency* row = nullptr;
+        for (size_t state_idx = 0; state_idx < _state_count; state_idx++) {
+            if (_states[state_idx].state == state) {
+                row = &_states[state_idx];
+                break;
+            }
+        }
+
+        // The metrics are read from the web server task.
+        portENTER_CRITICAL(&_states_lock);
+        if (!row && _state_count < max_states) {
+            row = &_states[_state_count++];
+            row->state = state;
+        }
+        if (row) {
+            row->by_load[static_cast<size_t>(load)].add(now_micros - _oldest_unflushed_input);
+        }
+        portEXIT_CRITICAL(&_states_lock);
+    }
+
+    bool input_latency_tracker::copy_state(size_t idx, state_latency* out) const {
+        portENTER_CRITICAL(&_states_lock);
+        bool has_state = idx < _state_count;
+        if (has_state) {
+            *out = _states[idx];
+        }
+        portEXIT_CRITICAL(&_states_lock);
+        return has_state;
+    }
+
+    void IRAM_ATTR input_latency_tracker::on_encoder_edge(void* arg) {
+        static_cast<input_latency_tracker*>(arg)->on_edge(input_source::encoder);
+    }
+
+    void IRAM_ATTR input_latency_tracker::on_button_edge(void* arg) {
+        static_cast<input_latency_tracker*>(arg)->on_edge(input_source::button);
+    }
+
+    void IRAM_ATTR input_latency_tracker::on_edge(input_source source) {
+        // Keep the first edge of an input, bounces and later detents belong to the same one.
+        uint32_t now = micros() | 1; // Never 0, that means no edge
+        std::atomic<uint32_t>& edge = _edge_micros[static_cast<size_t>(source)];
+        uint32_t pending = edge.load();
+        if (pending == 0 || now - pending > max_edge_age_micros) {
+            edge.store(now);
+        }
+        wake_control_loop_from_isr();
+    }
+} // namespace mocca
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <atomic>
+
+namespace mocca {
+    enum class input_source : uint8_t {
+        encoder,
+        button,
+    };
+
+    constexpr size_t input_source_count = 2;
+
+    enum class network_load : uint8_t {
+        quiet, // No web requests in the last second
+        light,
+        heavy,
+    };
+
+    constexpr size_t network_load_count = 3;
+
+    const char* network_load_name(network_load load);
+
+    // Upper bounds of the latency buckets, the last bucket holds everything slower.
+    constexpr uint32_t latency_bucket_bounds_millis[] = {10, 20, 50, 100, 200, 500, 1000};
+    constexpr size_t latency_bucket_count = sizeof(latency_bucket_bounds_millis) / sizeof(uint32_t) + 1;
+
+    struct latency_histogram {
+        uint32_t buckets[latency_bucket_count] = {0};
+        uint32_t count = 0;
+        uint32_t sum_millis = 0;
+
+        void add(uint32_t latency_micros);
+    };
+
+    struct state_latency {
+        const char* state = nullptr;
+        latency_histogram by_load[network_load_count];
+    };
+
+    // Measures input-to-photon latency: from the interrupt of the first encoder or button edge behind an input to the
+    // end of the I2C flush of the first frame drawn after the input was handled. Edges are timestamped in interrupts,
+    // the control loop carries the timestamp through the input handlers and the display flush closes it out.
+    class input_latency_tracker {
+      public:
+        static constexpr size_t max_states = 12;
+
+        void start(int encoder_pin_a, int encoder_pin_b, int button_pin);
+
+        // Interrupt time of the oldest edge of the source not yet handled, now_micros if there is none.
+        uint32_t take_edge(input_source source, uint32_t now_micros);
+
+        void on_input_handled(uint32_t edge_micros);
+
+        // Records the inputs handled since the last flush. state must be a string literal, it keys the histograms.
+        void on_frame_flushed(uint32_t now_micros, const char* state, network_load load);
+
+        // For other tasks, copies the histograms of a state under the lock. False once idx is past the last state.
+        bool copy_state(size_t idx, state_latency* out) const;
+
+      private:
+        static void on_encoder_edge(void* arg);
+        static void on_button_edge(void* arg);
+
+        void on_edge(input_source source);
+
+        std::atomic<uint32_t> _edge_micros[input_source_count] = {}; // 0 when no edge is pending
+
+        bool _has_unflushed_input = false;
+        uint32_t _oldest_unflushed_input = 0;
+
+        state_latency _states[max_states];
+        size_t _state_count = 0;
+        mutable portMUX_TYPE _states_lock = portMUX_INITIALIZER_UNLOCKED;
+    };
+} // namespace mocca
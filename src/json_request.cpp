@@ -0,0 +1,144 @@
+#include "json_request.hpp"
+
+namespace mocca {
+    namespace {
+        constexpr size_t align_up(size_t size) {
+            return (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+        }
+
+        constexpr size_t block_header_size = align_up(sizeof(size_t));
+    } // namespace
+
+    void* fixed_json_allocator::allocate(size_t size) {
+        size_t block_size = block_header_size + align_up(size);
+        if (_used + block_size > sizeof(_buffer)) {
+            return nullptr;
+        }
+
+        block_header* header = reinterpret_cast<block_header*>(_buffer + _used);
+        header->size = size;
+
+        _last_block = _used;
+        _used += block_size;
+        _high_water = std::max(_high_water, _used);
+
+        return _buffer + _last_block + block_header_size;
+    }
+
+    void fixed_json_allocator::deallocate(void* ptr) {
+        // Only the most recent block can be given back, everything else is released by reset().
+        if (ptr != nullptr && header_of(ptr) == reinterpret_cast<block_header*>(_buffer + _last_block)) {
+            _used = _last_block;
+        }
+    }
+
+    void* fixed_json_allocator::reallocate(void* ptr, size_t new_size) {
+        if (ptr == nullptr) {
+            return allocate(new_size);
+        }
+
+        block_header* header = header_of(ptr);
+        if (header == reinterpret_cast<block_header*>(_buffer + _last_block)) {
+            // Grow or shrink the last block in place.
+            size_t block_size = block_header_size + align_up(new_size);
+            if (_last_block + block_size > sizeof(_buffer)) {
+                return nullptr;
+            }
+            header->size = new_size;
+            _used = _last_block + block_size;
+            _high_water = std::max(_high_water, _used);
+            return ptr;
+        }
+
+        size_t old_size = header->size;
+        void* new_ptr = allocate(new_size);
+        if (new_ptr != nullptr) {
+            memcpy(new_ptr, ptr, std::min(old_size, new_size));
+        }
+        return new_ptr;
+    }
+
+    void fixed_json_allocator::reset() {
+        _used = 0;
+        _last_block = 0;
+    }
+
+    size_t fixed_json_allocator::high_water() const {
+        return _high_water;
+    }
+
+    fixed_json_allocator::block_header* fixed_json_allocator::header_of(void* ptr) const {
+        return reinterpret_cast<block_header*>(static_cast<uint8_t*>(ptr) - block_header_size);
+    }
+
+    void request_body_buffer::append(AsyncWebServerRequest* request, const uint8_t* data, size_t len, size_t index,
+                                     size_t total) {
+        if (index == 0) {
+            if (_owner != nullptr || total > sizeof(_data)) {
+                return;
+            }
+
+            _owner = request;
+            _size = 0;
+            request->onDisconnect([this, request]() { release(request); });
+        }
+
+        if (_owner != request || index + len > sizeof(_data)) {
+            return;
+        }
+
+        memcpy(_data + index, data, len);
+        _size = std::max(_size, index + len);
+    }
+
+    void request_body_buffer::release(const AsyncWebServerRequest* request) {
+        if (_owner == request) {
+            _owner = nullptr;
+            _size = 0;
+        }
+    }
+
+    bool request_body_buffer::is_owned_by(const AsyncWebServerRequest* request) const {
+        return _owner == request;
+    }
+
+    const char* request_body_buffer::data() const {
+        return _data;
+    }
+
+    size_t request_body_buffer::size() const {
+        return _size;
+    }
+
+    body_parse_result parse_request_body(AsyncWebServerRequest* request, request_body_buffer* body,
+                                         fixed_json_allocator* allocator, JsonDocument* json,
+                                         DeserializationError* error) {
+        if (request->contentLength() > max_request_body_size) {
+            body->release(request);
+            return body_parse_result::too_large;
+        }
+        if (!body->is_owned_by(request)) {
+            return body_parse_result::busy;
+        }
+
+        allocator->reset();
+        *error = deserializeJson(*json, body->data(), body->size());
+        body->release(request);
+        return *error ? body_parse_result::malformed : body_parse_result::parsed;
+    }
+
+    bool copy_json_string(JsonVariantConst value, char* out, size_t out_size) {
+        if (!value.is<const char*>()) {
+            return false;
+        }
+
+        const char* str = value.as<const char*>();
+        size_t length = strlen(str);
+        if (length >= out_size) {
+            return false;
+        }
+
+        memcpy(out, str, length + 1);
+        return true;
+    }
+} // namespace mocca
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+
+#include <cstddef>
+
+namespace mocca {
+    constexpr size_t max_request_body_size = 512;
+    constexpr size_t json_arena_size = 2048;
+
+    enum class body_parse_result {
+        parsed,
+        too_large, // 413
+        busy,      // 503, the buffer went to another request or the body never arrived
+        malformed, // 400
+    };
+
+    // Bump allocator over a fixed buffer so that parsing request bodies never touches the heap. Only one document may
+    // use it at a time and everything is released at once by reset().
+    class fixed_json_allocator : public ArduinoJson::Allocator {
+      public:
+        void* allocate(size_t size) override;
+        void deallocate(void* ptr) override;
+        void* reallocate(void* ptr, size_t new_size) override;
+
+        void reset();
+        size_t high_water() const;
+
+      private:
+        struct block_header {
+            size_t size;
+        };
+
+        block_header* header_of(void* ptr) const;
+
+        alignas(std::max_align_t) uint8_t _buffer[json_arena_size];
+        size_t _used = 0;
+        size_t _last_block = 0;
+        size_t _high_water = 0;
+    };
+
+    // Collects the body of a single request at a time into a fixed buffer. Bodies larger than max_request_body_size or
+    // arriving while another request owns the buffer are dropped.
+    class request_body_buffer {
+      public:
+        void append(AsyncWebServerRequest* request, const uint8_t* data, size_t len, size_t index, size_t total);
+        void release(const AsyncWebServerRequest* request);
+
+        bool is_owned_by(const AsyncWebServerRequest* request) const;
+        const char* data() const;
+        size_t size() const;
+
+      private:
+        const AsyncWebServerRequest* _owner = nullptr;
+        char _data[max_request_body_size];
+        size_t _size = 0;
+    };
+
+    // Turns the body collected for a request into a document that uses the allocator, which is reset first. The buffer
+    // is released for the request whatever the result.
+    body_parse_result parse_request_body(AsyncWebServerRequest* request, request_body_buffer* body,
+                                         fixed_json_allocator* allocator, JsonDocument* json,
+                                         DeserializationError* error);
+
+    bool copy_json_string(JsonVariantConst value, char* out, size_t out_size);
+} // namespace mocca
@@ -0,0 +1,96 @@
+#include "local_time.hpp"
+
+namespace mocca {
+    namespace {
+        constexpr time_t table_days = 367;
+
+        int32_t timezone_offset_at(Timezone* timezone, time_t utc) {
+            return timezone->tzTime(utc, UTC_TIME) - utc;
+        }
+    } // namespace
+
+    void local_time_table::build(Timezone* timezone, time_t from_utc) {
+        from_utc = previousMidnight(from_utc) - SECS_PER_DAY;
+
+        _segment_count = 1;
+        _segments[0].start_utc = from_utc;
+        _segments[0].offset_secs = timezone_offset_at(timezone, from_utc);
+        _valid_until = from_utc + table_days * SECS_PER_DAY;
+
+        // Offsets change at most a couple times a year and never twice in a day, so sample daily and binary search
+        // for the second each change happened.
+        for (time_t day_start = from_utc; day_start < _valid_until && _segment_count < max_segments;
+             day_start += SECS_PER_DAY) {
+            time_t day_end = day_start + SECS_PER_DAY;
+            int32_t offset = timezone_offset_at(timezone, day_end);
+            if (offset == _segments[_segment_count - 1].offset_secs) {
+                continue;
+            }
+
+            time_t before = day_start;
+            time_t after = day_end;
+            while (after - before > 1) {
+                time_t mid = before + (after - before) / 2;
+                if (timezone_offset_at(timezone, mid) == offset) {
+                    after = mid;
+                } else {
+                    before = mid;
+                }
+            }
+
+            _segments[_segment_count].start_utc = after;
+            _segments[_segment_count].offset_secs = offset;
+            _segment_count++;
+        }
+    }
+
+    bool local_time_table::covers(time_t utc) const {
+        return _segment_count > 0 && utc >= _segments[0].start_utc && utc < _valid_until;
+    }
+
+    int32_t local_time_table::offset_at(time_t utc) const {
+        if (_segment_count == 0) {
+            return 0;
+        }
+        return _segments[segment_index_at(utc)].offset_secs;
+    }
+
+    time_t local_time_table::to_local(time_t utc) const {
+        return utc + offset_at(utc);
+    }
+
+    time_t local_time_table::to_utc(time_t local) const {
+        if (_segment_count == 0) {
+            return local;
+        }
+
+        // Segments are sorted by their local start time as well, find the last one starting at or before local.
+        const segment* found =
+            std::upper_bound(_segments + 1, _segments + _segment_count, local, [](time_t t, const segment& s) {
+                return t < s.start_utc + s.offset_secs;
+            });
+        size_t idx = (found - _segments) - 1;
+
+        // Still inside the end of the previous segment when the clocks went back, use that first occurrence.
+        if (idx > 0 && local < _segments[idx].start_utc + _segments[idx - 1].offset_secs) {
+            return local - _segments[idx - 1].offset_secs;
+        }
+
+        return local - _segments[idx].offset_secs;
+    }
+
+    time_t local_time_table::next_local_time_of_day(uint32_t secs, time_t now_utc) const {
+        time_t local = previousMidnight(to_local(now_utc)) + secs;
+        time_t utc = to_utc(local);
+        if (utc <= now_utc) {
+            utc = to_utc(local + SECS_PER_DAY);
+        }
+        return utc;
+    }
+
+    size_t local_time_table::segment_index_at(time_t utc) const {
+        const segment* found = std::upper_bound(_segments + 1, _segments + _segment_count, utc,
+                                                [](time_t t, const segment& s) { return t < s.start_utc; });
+        return (found - _segments) - 1;
+    }
+} // namespace mocca
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ezTime.h>
+
+namespace mocca {
+    // Precomputed UTC offset transitions for a timezone over the next year so that converting between UTC and local
+    // time is a binary search instead of a trip through the POSIX rules.
+    //
+    // Local times that don't exist (skipped by a spring forward) resolve to the same instant they would have had
+    // before the transition, which is the equivalent time after it (2:30 becomes 3:30). Local times that happen twice
+    // (repeated by a fall back) resolve to the first occurrence.
+    class local_time_table {
+      public:
+        static constexpr size_t max_segments = 8;
+
+        void build(Timezone* timezone, time_t from_utc);
+        bool covers(time_t utc) const;
+
+        int32_t offset_at(time_t utc) const;
+        time_t to_local(time_t utc) const;
+        time_t to_utc(time_t local) const;
+
+        // The next UTC time, strictly after now_utc, at which the local clock reads secs into the day.
+        time_t next_local_time_of_day(uint32_t secs, time_t now_utc) const;
+
+      private:
+        // A span of time with a constant offset, local = utc + offset_secs from start_utc until the next segment.
+        struct segment {
+            time_t start_utc = 0;
+            int32_t offset_secs = 0;
+        };
+
+        size_t segment_index_at(time_t utc) const;
+
+        segment _segments[max_segments];
+        size_t _segment_count = 0;
+        time_t _valid_until = 0;
+    };
+} // namespace mocca
@@ -0,0 +1,243 @@
+#include "logger.hpp"
+
+#include "task_topology.hpp"
+
+#include <cinttypes>
+#include <cstdarg>
+
+namespace mocca {
+    namespace {
+        constexpr uint32_t drain_interval_millis = 20;
+        constexpr uint32_t drain_task_stack_size = 2048;
+
+        constexpr const char* redacted_text = "***";
+
+        // Shorter values would turn up inside unrelated words, WPA2 passphrases are at least this long anyway.
+        constexpr size_t min_secret_length = 8;
+
+        constexpr size_t secret_count = static_cast<size_t>(log_secret::count);
+
+        // A secret is only redacted as a whole token, not as part of a longer word.
+        bool is_token_boundary(char c) {
+            return c == '\0' || isspace(static_cast<unsigned char>(c)) || strchr("\"'=:,;()[]{}<>", c) != nullptr;
+        }
+
+        static_assert((logger::buffer_size & (logger::buffer_size - 1)) == 0, "Log buffer size must be a power of two");
+
+        // A writer copies its line, newline included, in front of the head before it moves the head on. Reads keep
+        // this far back from the head so that the line being copied can't overwrite what they return.
+        constexpr size_t read_guard = logger::max_line_length + 1;
+
+        const char* tag_name(log_tag tag) {
+            switch (tag) {
+            case log_tag::core:
+                return "core";
+            case log_tag::input:
+                return "input";
+            case log_tag::brew:
+                return "brew";
+            case log_tag::wifi:
+                return "wifi";
+            case log_tag::time:
+                return "time";
+            case log_tag::power:
+                return "power";
+            case log_tag::web:
+                return "web";
+            case log_tag::mqtt:
+                return "mqtt";
+            default:
+                return "?";
+            }
+        }
+
+        char level_letter(int level) {
+            switch (level) {
+            case MOCCA_LOG_LEVEL_ERROR:
+                return 'E';
+            case MOCCA_LOG_LEVEL_WARN:
+                return 'W';
+            case MOCCA_LOG_LEVEL_INFO:
+                return 'I';
+            default:
+                return 'D';
+            }
+        }
+    } // namespace
+
+    bool logger::start(Print* output) {
+        _output = output;
+        return xTaskCreatePinnedToCore(task_main, "log", drain_task_stack_size, this, log_task_priority, &_task,
+                                       network_core) == pdPASS;
+    }
+
+    void logger::write(int level, log_tag tag, const char* format, ...) {
+        char line[max_line_length];
+        uint32_t now = millis();
+        int prefix_length = snprintf(line, sizeof(line), "%6" PRIu32 ".%03" PRIu32 " %c %s: ", now / 1000, now % 1000,
+                                     level_letter(level), tag_name(tag));
+
+        va_list args;
+        va_start(args, format);
+        vsnprintf(line + prefix_length, sizeof(line) - prefix_length, format, args);
+        va_end(args);
+
+        char redacted_line[max_line_length + 1];
+        size_t length = redact(line, strlen(line), redacted_line, sizeof(redacted_line) - 1);
+        redacted_line[length++] = '\n';
+
+        portENTER_CRITICAL(&_write_lock);
+        uint32_t head = _head.load(std::memory_order_relaxed);
+        bool fits = head + length - _drained.load(std::memory_order_acquire) <= buffer_size;
+        if (fits) {
+            for (size_t char_idx = 0; char_idx < length; char_idx++) {
+                _buffer[(head + char_idx) & (buffer_size - 1)] = redacted_line[char_idx];
+            }
+            _head.store(head + length, std::memory_order_release);
+        }
+        portEXIT_CRITICAL(&_write_lock);
+
+        if (!fits) {
+            _dropped++;
+            return;
+        }
+
+        _written++;
+        if (_task) {
+            xTaskNotifyGive(_task);
+        }
+    }
+
+    void logger::set_secret(log_secret secret, const char* value) {
+        bool long_enough = strlen(value) >= min_secret_length;
+
+        portENTER_CRITICAL(&_write_lock);
+        strlcpy(_secrets[static_cast<size_t>(secret)], long_enough ? value : "", sizeof(_secrets[0]));
+        portEXIT_CRITICAL(&_write_lock);
+    }
+
+    void logger::flush(uint32_t timeout_millis) {
+        uint32_t start = millis();
+        while (_drained.load() != _head.load() && millis() - start < timeout_millis) {
+            delay(1);
+        }
+    }
+
+    log_stats logger::get_stats() const {
+        log_stats stats;
+        stats.written = _written.load();
+        stats.dropped = _dropped.load();
+        return stats;
+    }
+
+    uint32_t logger::oldest() const {
+        uint32_t head = _head.load();
+        return head > buffer_size - read_guard ? head - (buffer_size - read_guard) : 0;
+    }
+
+    uint32_t logger::newest() const {
+        return _head.load();
+    }
+
+    size_t logger::read(uint32_t position, char* out, size_t out_size) const {
+        uint32_t head = _head.load(std::memory_order_acquire);
+        size_t length = std::min<size_t>(out_size, head - position);
+        if (head - position > buffer_size - read_guard) {
+            return 0;
+        }
+
+        for (size_t char_idx = 0; char_idx < length; char_idx++) {
+            out[char_idx] = _buffer[(position + char_idx) & (buffer_size - 1)];
+        }
+
+        // A writer may have wrapped around onto what was just copied.
+        if (_head.load(std::memory_order_acquire) - position > buffer_size - read_guard) {
+            return 0;
+        }
+        return length;
+    }
+
+    void logger::task_main(void* arg) {
+        logger* log = static_cast<logger*>(arg);
+        while (true) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(drain_interval_millis));
+            log->drain();
+        }
+    }
+
+    void logger::drain() {
+        uint32_t dropped = _dropped.load();
+        if (dropped != _reported_dropped) {
+            char notice[48];
+            int notice_length = snprintf(notice, sizeof(notice), "[%" PRIu32 " log lines dropped]\n",
+                                         dropped - _reported_dropped);
+            if (_output->availableForWrite() >= notice_length) {
+                _output->write(reinterpret_cast<const uint8_t*>(notice), notice_length);
+                _reported_dropped = dropped;
+            }
+        }
+
+        while (true) {
+            uint32_t drained = _drained.load(std::memory_order_relaxed);
+            uint32_t head = _head.load(std::memory_order_acquire);
+            if (drained == head) {
+                return;
+            }
+
+            // Up to the end of the buffer, the rest goes in the next pass.
+            size_t offset = drained & (buffer_size - 1);
+            size_t length = std::min<size_t>(head - drained, buffer_size - offset);
+
+            int available = _output->availableForWrite();
+            if (available <= 0) {
+                return;
+            }
+            length = std::min<size_t>(length, available);
+
+            size_t written = _output->write(reinterpret_cast<const uint8_t*>(_buffer + offset), length);
+            _drained.store(drained + written, std::memory_order_release);
+            if (written < length) {
+                return;
+            }
+        }
+    }
+
+    size_t logger::redact(const char* line, size_t length, char* out, size_t out_size) {
+        // Copied so that set_secret() can change them while this line is checked.
+        char secrets[secret_count][sizeof(_secrets[0])];
+        portENTER_CRITICAL(&_write_lock);
+        memcpy(secrets, _secrets, sizeof(secrets));
+        portEXIT_CRITICAL(&_write_lock);
+
+        size_t out_length = 0;
+        size_t char_idx = 0;
+        while (char_idx < length && out_length < out_size) {
+            size_t secret_length = 0;
+            if (char_idx == 0 || is_token_boundary(line[char_idx - 1])) {
+                for (const char* candidate : secrets) {
+                    size_t candidate_length = strlen(candidate);
+                    if (candidate_length > 0 && strncmp(line + char_idx, candidate, candidate_length) == 0 &&
+                        is_token_boundary(line[char_idx + candidate_length])) {
+                        secret_length = candidate_length;
+                        break;
+                    }
+                }
+            }
+
+            if (secret_length > 0) {
+                size_t copy_length = std::min(strlen(redacted_text), out_size - out_length);
+                memcpy(out + out_length, redacted_text, copy_length);
+                out_length += copy_length;
+                char_idx += secret_length;
+            } else {
+                out[out_length++] = line[char_idx++];
+            }
+        }
+        return out_length;
+    }
+
+    logger& get_logger() {
+        static logger instance;
+        return instance;
+    }
+} // namespace mocca
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <atomic>
+
+// Levels and tags are filtered at compile time, filtered out log calls compile to nothing and their arguments are never
+// evaluated. Override with -D MOCCA_LOG_LEVEL=MOCCA_LOG_LEVEL_DEBUG or -D MOCCA_LOG_TAGS=<mask of log_tag bits>.
+#define MOCCA_LOG_LEVEL_NONE 0
+#define MOCCA_LOG_LEVEL_ERROR 1
+#define MOCCA_LOG_LEVEL_WARN 2
+#define MOCCA_LOG_LEVEL_INFO 3
+#define MOCCA_LOG_LEVEL_DEBUG 4
+
+#if !defined(MOCCA_LOG_LEVEL)
+#define MOCCA_LOG_LEVEL MOCCA_LOG_LEVEL_INFO
+#endif
+#if !defined(MOCCA_LOG_TAGS)
+#define MOCCA_LOG_TAGS 0xffffffffu
+#endif
+
+#define MOCCA_LOG(level, tag, ...)                                                                                     \
+    do {                                                                                                               \
+        if constexpr (mocca::log_enabled(level, mocca::log_tag::tag)) {                                                \
+            mocca::get_logger().write(level, mocca::log_tag::tag, __VA_ARGS__);                                        \
+        }                                                                                                              \
+    } while (0)
+
+#define MOCCA_LOGE(tag, ...) MOCCA_LOG(MOCCA_LOG_LEVEL_ERROR, tag, __VA_ARGS__)
+#define MOCCA_LOGW(tag, ...) MOCCA_LOG(MOCCA_LOG_LEVEL_WARN, tag, __VA_ARGS__)
+#define MOCCA_LOGI(tag, ...) MOCCA_LOG(MOCCA_LOG_LEVEL_INFO, tag, __VA_ARGS__)
+#define MOCCA_LOGD(tag, ...) MOCCA_LOG(MOCCA_LOG_LEVEL_DEBUG, tag, __VA_ARGS__)
+
+namespace mocca {
+    enum class log_tag : uint8_t {
+        core,
+        input,
+        brew,
+        wifi,
+        time,
+        power,
+        web,
+        mqtt,
+    };
+
+    constexpr bool log_enabled(int level, log_tag tag) {
+        return level <= MOCCA_LOG_LEVEL && ((MOCCA_LOG_TAGS >> static_cast<uint32_t>(tag)) & 1) != 0;
+    }
+
+    // Values that are replaced by "***" wherever they show up in a log line as a whole word. Values too short to tell
+    // apart from ordinary words aren't redacted.
+    enum class log_secret : uint8_t {
+        wifi_password,
+        count,
+    };
+
+    struct log_stats {
+        uint32_t written = 0;
+        uint32_t dropped = 0; // Lines that didn't fit in the buffer because the output fell behind
+    };
+
+    // Formats log lines into a ring buffer that a low priority task drains to the output, writing only as much as the
+    // output can take without blocking. Writers never wait on the output, when the buffer is full lines are dropped and
+    // counted. The drained part of the buffer is kept until it gets overwritten so the recent log can be read back.
+    //
+    // Formatting and redaction happen outside any lock, only copying the finished line into the ring takes a short
+    // spinlock. A lock-free reserve-then-commit ring would have to publish lines in reservation order, so a writer
+    // preempted between the two would hold up every line after it, and a higher priority writer on the same core
+    // would spin on it forever. The copy is at most max_line_length + 1 bytes, a few hundred cycles.
+    class logger {
+      public:
+        static constexpr size_t buffer_size = 4096; // Must be a power of two
+        static constexpr size_t max_line_length = 160;
+
+        bool start(Print* output);
+
+        void write(int level, log_tag tag, const char* format, ...) __attribute__((format(printf, 4, 5)));
+
+        void set_secret(log_secret secret, const char* value);
+
+        // Waits for the buffer to drain, only for when the output is about to go away.
+        void flush(uint32_t timeout_millis);
+
+        log_stats get_stats() const;
+
+        // Positions count bytes ever written and wrap around. Text between oldest() and newest() can be read back,
+        // read() returns 0 once the requested position has been, or is about to be, overwritten.
+        uint32_t oldest() const;
+        uint32_t newest() const;
+        size_t read(uint32_t position, char* out, size_t out_size) const;
+
+      private:
+        static void task_main(void* arg);
+
+        void drain();
+        size_t redact(const char* line, size_t length, char* out, size_t out_size);
+
+        Print* _output = nullptr;
+        TaskHandle_t _task = nullptr;
+
+        char _buffer[buffer_size];
+        std::atomic<uint32_t> _head{0};    // Next position to write
+        std::atomic<uint32_t> _drained{0}; // Everything before this reached the output
+        portMUX_TYPE _write_lock = portMUX_INITIALIZER_UNLOCKED; // Only between writers, and the secrets
+
+        char _secrets[static_cast<size_t>(log_secret::count)][64] = {{0}};
+
+        std::atomic<uint32_t> _written{0};
+        std::atomic<uint32_t> _dropped{0};
+        uint32_t _reported_dropped = 0;
+    };
+
+    logger& get_logger();
+} // namespace mocca
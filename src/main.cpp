@@ -1,12 +1,16 @@
+#include "logger.hpp"
 #include "mocca_wake.hpp"
+#include "task_topology.hpp"
 
 #include <Arduino.h>
 #include <EEPROM.h>
 
 static mocca::mocca_wake wake(USBSerial);
 
+#if MOCCA_FEATURE_DISPLAY
 static constexpr int i2c_sda_pin = 13;
 static constexpr int i2c_scl_pin = 15;
+#endif
 
 static constexpr int encoder_pin_a = 2;
 static constexpr int encoder_pin_b = 3;
@@ -20,18 +24,29 @@ static constexpr int boiler_ssr_pin = 6;
 static constexpr size_t eeprom_size = sizeof(mocca::persistent_data);
 static constexpr int eeprom_persistent_data_addr = 0;
 
+// The Arduino core would otherwise keep a new image as soon as it starts, mocca_wake does it after its health check.
+extern "C" bool verifyRollbackLater() {
+    return true;
+}
+
 void setup() {
     USBSerial.begin(9600);
 
+    if (!mocca::get_logger().start(&USBSerial)) {
+        USBSerial.println("Failed to start the logger.");
+    }
+
     if (!EEPROM.begin(eeprom_size)) {
-        USBSerial.println("EEPROM::begin failed.");
+        MOCCA_LOGE(core, "EEPROM::begin failed.");
     }
 
+#if MOCCA_FEATURE_DISPLAY
     Wire.setPins(i2c_sda_pin, i2c_scl_pin);
+#endif
 
     if (!wake.init(encoder_pin_a, encoder_pin_b, encoder_button_pin, water_switch_pin, pot_switch_pin, boiler_ssr_pin,
                    eeprom_persistent_data_addr)) {
-        USBSerial.println("mocca_wake::init failed.");
+        MOCCA_LOGE(core, "mocca_wake::init failed.");
         while (true) {
             delay(1000);
         }
@@ -0,0 +1,300 @@
+#include "metrics.hpp"
+
+#include "features.hpp"
+
+#include <cinttypes>
+#include <cstdarg>
+
+namespace mocca {
+    namespace {
+        constexpr size_t max_state_label_length = 16;
+        constexpr size_t truncated_notice_size = 96; // Kept free for the mocca_metrics_truncated gauge
+
+        static_assert(sizeof("mocca_input_latency_seconds_bucket{state=\"\",le=\"0.000\"} 4294967295\n") - 1 +
+                              max_state_label_length <=
+                          max_metrics_line_length,
+                      "Input latency lines are longer than the metrics buffer is sized for");
+
+        // Writes whole printf() calls or nothing, once one doesn't fit the rest are dropped too so that the output
+        // stays valid up to where it ends.
+        class metrics_writer {
+          public:
+            metrics_writer(char* out, size_t out_size)
+                : _out(out)
+                , _size(out_size)
+                , _limit(out_size > truncated_notice_size ? out_size - truncated_notice_size : 0) {}
+
+            void printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+                if (_truncated) {
+                    return;
+                }
+
+                va_list args;
+                va_start(args, format);
+                int written = _length < _limit ? vsnprintf(_out + _length, _limit - _length, format, args) : -1;
+                va_end(args);
+
+                if (written < 0 || _length + written >= _limit) {
+                    _truncated = true;
+                    _out[_length] = '\0';
+                    return;
+                }
+                _length += written;
+            }
+
+            // Always fits, in the space kept free for it.
+            size_t finish() {
+                int written = snprintf(_out + _length, _size - _length,
+                                       "# HELP mocca_metrics_truncated 1 if metrics were left out for lack of room.\n"
+                                       "# TYPE mocca_metrics_truncated gauge\nmocca_metrics_truncated %d\n",
+                                       _truncated);
+                if (written > 0) {
+                    _length = std::min(_length + written, _size - 1);
+                }
+                return _length;
+            }
+
+            bool truncated() const {
+                return _truncated;
+            }
+
+            void gauge(const char* name, const char* help, int64_t value) {
+                printf("# HELP %s %s\n# TYPE %s gauge\n%s %" PRId64 "\n", name, help, name, name, value);
+            }
+
+            void gauge(const char* name, const char* help, float value) {
+                printf("# HELP %s %s\n# TYPE %s gauge\n%s %.6f\n", name, help, name, name, value);
+            }
+
+            void counter(const char* name, const char* help, uint32_t value) {
+                printf("# HELP %s %s\n# TYPE %s counter\n%s %" PRIu32 "\n", name, help, name, name, value);
+            }
+
+          private:
+            char* _out;
+            size_t _size;
+            size_t _limit;
+            size_t _length = 0;
+            bool _truncated = false;
+        };
+
+#if MOCCA_FEATURE_DISPLAY
+        void add_histogram(latency_histogram* into, const latency_histogram& from) {
+            for (size_t bucket_idx = 0; bucket_idx < latency_bucket_count; bucket_idx++) {
+                into->buckets[bucket_idx] += from.buckets[bucket_idx];
+            }
+            into->count += from.count;
+            into->sum_millis += from.sum_millis;
+        }
+#endif
+    } // namespace
+
+    void remote_command_stats::add(uint32_t ssr_micros) {
+        timed++;
+        total_ssr_micros += ssr_micros;
+        last_ssr_micros = ssr_micros;
+        worst_ssr_micros = std::max(worst_ssr_micros, ssr_micros);
+    }
+
+    size_t format_metrics(const runtime_metrics& metrics, char* out, size_t out_size) {
+        if (out_size == 0) {
+            return 0;
+        }
+        out[0] = '\0';
+
+        metrics_writer writer(out, out_size);
+
+        writer.gauge("mocca_uptime_seconds", "Time since boot.", metrics.uptime_millis / 1000.0f);
+        writer.gauge("mocca_boot_seconds", "Time taken to initialize after reset.", metrics.boot_millis / 1000.0f);
+        writer.gauge("mocca_heap_free_bytes", "Free heap.", static_cast<int64_t>(ESP.getFreeHeap()));
+        writer.gauge("mocca_heap_largest_free_block_bytes", "Largest allocatable heap block.",
+                     static_cast<int64_t>(ESP.getMaxAllocHeap()));
+        writer.gauge("mocca_loop_iterations_per_second", "Control loop rate.",
+                     static_cast<int64_t>(metrics.loop_iterations_per_sec));
+#if MOCCA_FEATURE_DISPLAY
+        writer.gauge("mocca_render_seconds", "Duration of the last frame's drawing.", metrics.render_micros / 1e6f);
+        writer.gauge("mocca_flush_seconds", "Duration of the last display flush.", metrics.flush_micros / 1e6f);
+        writer.counter("mocca_display_flushes_total", "Frames sent to the display.", metrics.display_flushes);
+#endif
+        writer.gauge("mocca_wifi_rssi_dbm", "Signal strength of the connected network.",
+                     static_cast<int64_t>(metrics.wifi_rssi));
+        writer.counter("mocca_wifi_reconnects_total", "WiFi connections established.", metrics.wifi_reconnects);
+#if MOCCA_FEATURE_NTP
+        writer.gauge("mocca_ntp_sync_age_seconds", "Time since the last NTP sync, -1 if never synced.",
+                     static_cast<int64_t>(metrics.ntp_sync_age_secs));
+        writer.gauge("mocca_ntp_offset_seconds", "Clock correction applied by the last NTP sync.",
+                     metrics.ntp_offset_micros / 1e6f);
+        writer.gauge("mocca_ntp_drift_ppm", "Estimated clock crystal drift, positive when running fast.",
+                     metrics.ntp_drift_ppm);
+        writer.gauge("mocca_ntp_sync_interval_seconds", "Time between NTP syncs.",
+                     static_cast<int64_t>(metrics.ntp_sync_interval_secs));
+#endif
+        writer.counter("mocca_persistent_data_commits_total", "Persistent data writes to flash.",
+                       metrics.persistent_data_commits);
+        writer.gauge("mocca_boiler_on_seconds_total", "Total time the boiler SSR has been on.",
+                     metrics.boiler_on_millis / 1000.0f);
+        writer.gauge("mocca_boiler_worst_cutoff_seconds",
+                     "Longest time from a water or pot switch opening to the boiler SSR turning off.",
+                     metrics.boiler_safety.worst_cutoff_micros / 1e6f);
+        writer.counter("mocca_boiler_sensor_cutoffs_total", "Boiler cut-offs by the water or pot switch.",
+                       metrics.boiler_safety.sensor_cutoffs);
+        writer.counter("mocca_boiler_heat_limit_cutoffs_total", "Boiler cut-offs for heating too long.",
+                       metrics.boiler_safety.heat_limit_cutoffs);
+
+        writer.gauge("mocca_brew_lead_seconds", "How long before the ready time scheduled brews start.",
+                     static_cast<int64_t>(metrics.brew_lead_secs));
+        writer.gauge("mocca_brew_duration_stddev_seconds", "Spread of measured brew durations.",
+                     metrics.brew_duration_stddev_secs);
+        writer.gauge("mocca_brew_ready_error_seconds", "Actual minus predicted ready time of the last scheduled brew.",
+                     static_cast<int64_t>(metrics.last_ready_error_secs));
+        writer.gauge("mocca_brew_pot_removed_after_seconds",
+                     "Time from the last brew finishing to the pot being removed, -1 if not yet.",
+                     static_cast<int64_t>(metrics.last_pot_removed_after_secs));
+        writer.counter("mocca_brew_history_events_total", "Brew events appended to the history since boot.",
+                       metrics.brew_history.appended);
+        writer.counter("mocca_brew_history_sector_erases_total", "Brew history flash sectors erased since boot.",
+                       metrics.brew_history.sector_erases);
+        writer.counter("mocca_brew_history_write_errors_total", "Brew events that couldn't be written to flash.",
+                       metrics.brew_history.write_errors);
+
+        writer.counter("mocca_remote_brew_commands_total", "Brew commands from the web API or MQTT applied.",
+                       metrics.remote_commands.applied);
+        writer.counter("mocca_remote_brew_commands_ignored_total",
+                       "Brew commands from the web API or MQTT that no longer applied when handled.",
+                       metrics.remote_commands.ignored);
+        writer.printf("# HELP mocca_remote_brew_ssr_latency_seconds Brew command request to the boiler SSR switching.\n"
+                      "# TYPE mocca_remote_brew_ssr_latency_seconds summary\n");
+        writer.printf("mocca_remote_brew_ssr_latency_seconds_sum %.6f\n",
+                      metrics.remote_commands.total_ssr_micros / 1e6);
+        writer.printf("mocca_remote_brew_ssr_latency_seconds_count %" PRIu32 "\n", metrics.remote_commands.timed);
+        writer.gauge("mocca_remote_brew_ssr_last_latency_seconds", "Latency of the last timed brew command.",
+                     metrics.remote_commands.last_ssr_micros / 1e6f);
+        writer.gauge("mocca_remote_brew_ssr_worst_latency_seconds", "Longest brew command latency since boot.",
+                     metrics.remote_commands.worst_ssr_micros / 1e6f);
+
+        writer.printf("# HELP mocca_state Current state.\n# TYPE mocca_state gauge\nmocca_state{state=\"%s\"} 1\n",
+                      metrics.state);
+
+        writer.printf("# HELP mocca_http_requests_total Config web server requests by admission result.\n"
+                      "# TYPE mocca_http_requests_total counter\n");
+        writer.printf("mocca_http_requests_total{result=\"admitted\"} %" PRIu32 "\n", metrics.web_requests.admitted);
+        writer.printf("mocca_http_requests_total{result=\"rate_limited\"} %" PRIu32 "\n",
+                      metrics.web_requests.rate_limited);
+        writer.printf("mocca_http_requests_total{result=\"overloaded\"} %" PRIu32 "\n",
+                      metrics.web_requests.overloaded);
+        writer.counter("mocca_http_collapsed_commands_total", "Pending commands replaced by a newer one.",
+                       metrics.web_requests.collapsed_commands);
+
+        writer.counter("mocca_log_lines_total", "Log lines written.", metrics.log.written);
+        writer.counter("mocca_log_dropped_lines_total", "Log lines dropped because the output fell behind.",
+                       metrics.log.dropped);
+
+        writer.printf("# HELP mocca_power_tier_seconds_total Time spent in each power tier.\n"
+                      "# TYPE mocca_power_tier_seconds_total counter\n");
+        for (size_t tier_idx = 0; tier_idx < power_tier_count; tier_idx++) {
+            writer.printf("mocca_power_tier_seconds_total{tier=\"%s\"} %.3f\n",
+                          power_tier_name(static_cast<power_tier>(tier_idx)),
+                          metrics.power.tier_millis[tier_idx] / 1000.0f);
+        }
+        writer.counter("mocca_power_tier_changes_total", "Power tier changes.", metrics.power.tier_changes);
+        writer.gauge("mocca_power_worst_wake_seconds", "Longest time taken to restore the active power tier.",
+                     metrics.power.worst_wake_micros / 1e6f);
+
+        writer.counter("mocca_deep_sleeps_total", "Deep sleeps until a brew.", metrics.deep_sleep.sleep_count);
+        writer.counter("mocca_deep_sleep_asleep_seconds_total", "Time spent in deep sleep.",
+                       metrics.deep_sleep.asleep_secs);
+        writer.counter("mocca_deep_sleep_awake_seconds_total", "Time spent awake before each deep sleep.",
+                       metrics.deep_sleep.awake_secs);
+        writer.gauge("mocca_deep_sleep_resume_seconds", "Wake from the last deep sleep to being initialized.",
+                     metrics.deep_sleep.last_resume_millis / 1000.0f);
+        writer.gauge("mocca_deep_sleep_lead_seconds", "How long before the brew the last deep sleep ended.",
+                     static_cast<int64_t>(metrics.deep_sleep.last_lead_secs));
+        writer.counter("mocca_deep_sleep_boiler_ons_total", "Timer wakes from deep sleep timed to the boiler SSR on.",
+                       metrics.deep_sleep.timed_boiler_ons);
+        writer.gauge("mocca_deep_sleep_wake_to_boiler_on_seconds",
+                     "Wake from the last timed deep sleep to the boiler SSR turning on.",
+                     metrics.deep_sleep.last_boiler_on_millis / 1000.0f);
+        writer.gauge("mocca_deep_sleep_worst_boiler_on_late_seconds",
+                     "Longest wake to boiler SSR on beyond the deep sleep lead.",
+                     metrics.deep_sleep.worst_boiler_on_late_millis / 1000.0f);
+
+#if MOCCA_FEATURE_MQTT
+        writer.counter("mocca_mqtt_connects_total", "Sessions established with the MQTT broker.",
+                       metrics.mqtt.connects);
+        writer.counter("mocca_mqtt_connection_losses_total", "Failed MQTT connection attempts and dropped sessions.",
+                       metrics.mqtt.connection_losses);
+        writer.counter("mocca_mqtt_published_total", "MQTT messages written out, QoS 1 ones once acknowledged.",
+                       metrics.mqtt.published);
+        writer.counter("mocca_mqtt_retries_total", "QoS 1 messages sent again after a lost connection.",
+                       metrics.mqtt.retries);
+        writer.counter("mocca_mqtt_dropped_total", "MQTT messages pushed out of the full offline queue.",
+                       metrics.mqtt.dropped);
+        writer.counter("mocca_mqtt_received_total", "MQTT messages received.", metrics.mqtt.received);
+        writer.gauge("mocca_mqtt_queued_bytes", "Bytes waiting in the MQTT queue.",
+                     static_cast<int64_t>(metrics.mqtt.queued_bytes));
+#endif
+
+#if MOCCA_FEATURE_SYNC
+        writer.counter("mocca_sync_packets_sent_total", "Schedule sync packets multicast.", metrics.sync.sent);
+        writer.counter("mocca_sync_packets_received_total", "Schedule sync packets received from the group.",
+                       metrics.sync.received);
+        writer.counter("mocca_sync_records_applied_total", "Newer schedule records taken from the group.",
+                       metrics.sync.applied);
+        writer.counter("mocca_sync_local_changes_total", "Schedule changes made on this unit.",
+                       metrics.sync.local_changes);
+        writer.counter("mocca_sync_malformed_total", "Schedule sync packets that failed to parse.",
+                       metrics.sync.malformed);
+        writer.gauge("mocca_sync_peers", "Other units of the sync group heard from recently.",
+                     static_cast<int64_t>(metrics.sync.peers));
+#endif
+
+#if MOCCA_FEATURE_DISPLAY
+        // One histogram per state across all loads, and only the sum and count per load, so the series stay bounded.
+        if (metrics.input_latency) {
+            writer.printf("# HELP mocca_input_latency_seconds Encoder or button edge to the end of the flush of the "
+                          "first frame after it was handled.\n# TYPE mocca_input_latency_seconds histogram\n");
+            latency_histogram by_load[network_load_count];
+            state_latency latency;
+            for (size_t state_idx = 0; metrics.input_latency->copy_state(state_idx, &latency); state_idx++) {
+                latency_histogram histogram;
+                for (size_t load_idx = 0; load_idx < network_load_count; load_idx++) {
+                    add_histogram(&histogram, latency.by_load[load_idx]);
+                    add_histogram(&by_load[load_idx], latency.by_load[load_idx]);
+                }
+                if (histogram.count == 0) {
+                    continue;
+                }
+
+                char labels[32];
+                snprintf(labels, sizeof(labels), "state=\"%.*s\"", static_cast<int>(max_state_label_length),
+                         latency.state);
+                uint32_t cumulative = 0;
+                for (size_t bucket_idx = 0; bucket_idx < latency_bucket_count - 1; bucket_idx++) {
+                    cumulative += histogram.buckets[bucket_idx];
+                    writer.printf("mocca_input_latency_seconds_bucket{%s,le=\"%.3f\"} %" PRIu32 "\n", labels,
+                                  latency_bucket_bounds_millis[bucket_idx] / 1000.0f, cumulative);
+                }
+                writer.printf("mocca_input_latency_seconds_bucket{%s,le=\"+Inf\"} %" PRIu32 "\n", labels,
+                              histogram.count);
+                writer.printf("mocca_input_latency_seconds_sum{%s} %.3f\n", labels, histogram.sum_millis / 1000.0f);
+                writer.printf("mocca_input_latency_seconds_count{%s} %" PRIu32 "\n", labels, histogram.count);
+            }
+
+            writer.printf("# HELP mocca_input_latency_by_load_seconds Input latency by network load, all states.\n"
+                          "# TYPE mocca_input_latency_by_load_seconds summary\n");
+            for (size_t load_idx = 0; load_idx < network_load_count; load_idx++) {
+                const char* load = network_load_name(static_cast<network_load>(load_idx));
+                writer.printf("mocca_input_latency_by_load_seconds_sum{load=\"%s\"} %.3f\n", load,
+                              by_load[load_idx].sum_millis / 1000.0f);
+                writer.printf("mocca_input_latency_by_load_seconds_count{load=\"%s\"} %" PRIu32 "\n", load,
+                              by_load[load_idx].count);
+            }
+        }
+#endif
+
+        if (writer.truncated()) {
+            MOCCA_LOGW(web, "Metrics don't fit in %u bytes, the rest were left out.", static_cast<unsigned>(out_size));
+        }
+        return writer.finish();
+    }
+} // namespace mocca
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "admission_control.hpp"
+#include "boiler_supervisor.hpp"
+#include "brew_history.hpp"
+#include "deep_sleep.hpp"
+#include "input_latency.hpp"
+#include "logger.hpp"
+#include "mqtt_client.hpp"
+#include "power_manager.hpp"
+#include "schedule_sync.hpp"
+
+#include <Arduino.h>
+
+namespace mocca {
+    // Brew commands from the web API or MQTT and how long they took to reach the boiler SSR, from the request being
+    // handled to the SSR switching. Only commands that switched the SSR are timed, a brew started without the pot
+    // doesn't.
+    struct remote_command_stats {
+        uint32_t applied = 0;
+        uint32_t ignored = 0; // No longer applicable by the time the control loop got to them
+        uint32_t timed = 0;
+        uint64_t total_ssr_micros = 0;
+        uint32_t last_ssr_micros = 0;
+        uint32_t worst_ssr_micros = 0;
+
+        void add(uint32_t ssr_micros);
+    };
+
+    struct runtime_metrics {
+        uint32_t uptime_millis = 0;
+        uint32_t boot_millis = 0; // Until init() finished
+        uint32_t loop_iterations_per_sec = 0;
+        uint32_t render_micros = 0; // Most recent frame
+        uint32_t flush_micros = 0;  // Most recent I2C flush
+        uint32_t display_flushes = 0;
+        int32_t wifi_rssi = 0;
+        uint32_t wifi_reconnects = 0;
+        int32_t ntp_sync_age_secs = -1; // -1 if never synced
+        int64_t ntp_offset_micros = 0;  // Correction applied by the last sync
+        float ntp_drift_ppm = 0;
+        uint32_t ntp_sync_interval_secs = 0;
+        uint32_t persistent_data_commits = 0;
+        uint32_t boiler_on_millis = 0;
+        uint32_t brew_lead_secs = 0;
+        float brew_duration_stddev_secs = 0;
+        int32_t last_ready_error_secs = 0;        // Actual minus predicted ready time of the last scheduled brew
+        int32_t last_pot_removed_after_secs = -1; // How long the pot sat after the last brew finished
+        const char* state = "unknown";
+
+        admission_stats web_requests;
+        boiler_safety_stats boiler_safety;
+        log_stats log;
+        power_stats power;
+        deep_sleep_stats deep_sleep;
+        brew_history_stats brew_history;
+        remote_command_stats remote_commands;
+        mqtt_stats mqtt;
+        sync_stats sync;
+        const input_latency_tracker* input_latency = nullptr; // Read live, histograms are copied under its lock
+    };
+
+    // Worst case of format_metrics(), to size its buffer by. The fixed metrics come to about 10.2 kB with every feature
+    // on, the input latency adds a histogram per state and a sum and count per network load.
+    constexpr size_t fixed_metrics_budget = 12 * 1024;
+    constexpr size_t max_metrics_line_length = 96; // Longest sample line, label values are cut to fit
+    constexpr size_t input_latency_metrics_budget =
+        512 + (input_latency_tracker::max_states * (latency_bucket_count + 2) + network_load_count * 2) *
+                  max_metrics_line_length;
+    constexpr size_t max_metrics_text_size = fixed_metrics_budget + input_latency_metrics_budget;
+
+    // Formats the metrics in the Prometheus text exposition format. Returns the number of characters written. Output
+    // that doesn't fit ends after the last metric line that did, followed by mocca_metrics_truncated 1.
+    size_t format_metrics(const runtime_metrics& metrics, char* out, size_t out_size);
+} // namespace mocca
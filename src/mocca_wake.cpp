@@ -1,43 +1,194 @@
 #include "mocca_wake.hpp"
 
+#include "control_loop.hpp"
+
 #include <EEPROM.h>
-#include <WiFi.h>
+#include <cinttypes>
 #include <functional>
+#include <sys/time.h>
 
 namespace mocca {
     namespace {
-        constexpr uint8_t display_width = 128;
-        constexpr uint8_t display_height = 64;
-        constexpr uint8_t display_i2c_addr = 0x3C;
-
-        constexpr const char* default_wifi_ssid = "";
-        constexpr const char* default_wifi_password = "";
+#if !defined(MOCCA_WIFI_SSID)
+#define MOCCA_WIFI_SSID ""
+#endif
+#if !defined(MOCCA_WIFI_PASSWORD)
+#define MOCCA_WIFI_PASSWORD ""
+#endif
+        // Builds without the web server can't be given credentials later, they come from the build flags.
+        constexpr const char* default_wifi_ssid = MOCCA_WIFI_SSID;
+        constexpr const char* default_wifi_password = MOCCA_WIFI_PASSWORD;
         constexpr const char* default_timezone = "America/Toronto";
         constexpr uint32_t default_wake_secs = 8 * SECS_PER_HOUR; // 8am
 
-        constexpr const char* config_ap_ssid = "MoccaWake";
+#if MOCCA_FEATURE_WIFI
+        // Only useful for reaching the config web server, builds without it stay off the air until connected.
+        constexpr const char* config_ap_ssid = MOCCA_FEATURE_WEB ? "MoccaWake" : nullptr;
+#endif
 
-        constexpr const char* spash_screen_text = "MoccaWake";
+        constexpr const char* log_time_format = "D Y-m-d g:i a";
 
         constexpr uint32_t no_input_to_idle_millis = MILLIS_PER_SEC * 8;  // 8 sec
         constexpr uint32_t no_input_to_sleep_millis = MILLIS_PER_MIN * 5; // 5 mins
+        constexpr uint32_t no_input_to_dim_millis = MILLIS_PER_SEC * 8;   // Idle screen drops to the idle power tier
+
+#if !defined(MOCCA_DEEP_SLEEP_LEAD_SECS)
+#define MOCCA_DEEP_SLEEP_LEAD_SECS 60
+#endif
+        // Deep sleep ends this long before a scheduled brew unless /schedule set another lead.
+        constexpr uint32_t default_deep_sleep_lead_secs = MOCCA_DEEP_SLEEP_LEAD_SECS;
+        static_assert(default_deep_sleep_lead_secs >= min_deep_sleep_lead_secs &&
+                          default_deep_sleep_lead_secs <= max_deep_sleep_lead_secs,
+                      "MOCCA_DEEP_SLEEP_LEAD_SECS out of range");
+        constexpr uint32_t min_deep_sleep_secs = SECS_PER_MIN * 2; // Not worth rebooting for shorter sleeps
+        constexpr uint32_t deep_sleep_log_flush_millis = 200;
+
+        constexpr uint32_t update_restart_delay_millis = MILLIS_PER_SEC; // Lets the upload response reach the client
+
+#if MOCCA_FEATURE_NTP
+#if !defined(MOCCA_NTP_PORT)
+#define MOCCA_NTP_PORT 123
+#endif
+#if defined(MOCCA_NTP_SERVER)
+        // Build with -D MOCCA_NTP_SERVER=\"192.168.1.2\" -D MOCCA_NTP_PORT=12300 to sync against a local stand-in.
+        constexpr sntp_server ntp_servers[] = {{MOCCA_NTP_SERVER, MOCCA_NTP_PORT}};
+#else
+        constexpr sntp_server ntp_servers[] = {
+            {"time.cloudflare.com", MOCCA_NTP_PORT},
+            {"time.google.com", MOCCA_NTP_PORT},
+            {"pool.ntp.org", MOCCA_NTP_PORT},
+        };
+#endif
+#else
+#if !defined(MOCCA_POSIX_TIMEZONE)
+#define MOCCA_POSIX_TIMEZONE "EST5EDT,M3.2.0,M11.1.0" // default_timezone
+#endif
+        // Looking up a timezone by name needs the internet, isolated builds use a fixed rule instead.
+        constexpr const char* posix_timezone = MOCCA_POSIX_TIMEZONE;
+#endif
+
+#if MOCCA_FEATURE_MQTT
+#if !defined(MOCCA_MQTT_PORT)
+#define MOCCA_MQTT_PORT 1883
+#endif
+        // Build with -D MOCCA_MQTT_BROKER=\"192.168.1.2\" to use a local broker, topics are under mocca/<device id>
+        // unless -D MOCCA_MQTT_TOPIC_PREFIX=\"kitchen/coffee\" says otherwise.
+        constexpr const char* mqtt_broker = MOCCA_MQTT_BROKER;
+        constexpr uint16_t mqtt_port = MOCCA_MQTT_PORT;
+#endif
+
+#if MOCCA_FEATURE_SYNC
+#if !defined(MOCCA_SYNC_PORT)
+#define MOCCA_SYNC_PORT 4587
+#endif
+        // Units built with the same -D MOCCA_SYNC_GROUP=\"kitchen\" share their schedule, the multicast address is
+        // site-local and never leaves the LAN.
+        constexpr const char* sync_group = MOCCA_SYNC_GROUP;
+        const IPAddress sync_group_address(239, 255, 77, 87);
+        constexpr uint16_t sync_port = MOCCA_SYNC_PORT;
+#endif
+
+#if MOCCA_FEATURE_REMOTE
+        constexpr uint32_t metrics_snapshot_millis = MILLIS_PER_SEC; // Scrapes and health reports see metrics this old
+#endif
+
+        // ezTime keeps its own clock from millis(), it is brought back in line with the system clock this often.
+        constexpr uint32_t clock_update_millis = MILLIS_PER_SEC * 10;
+
+#if MOCCA_FEATURE_WIFI
+        constexpr uint32_t timezone_retry_millis = MILLIS_PER_MIN; // After the stored timezone failed to look up
+#endif
+
+        constexpr uint32_t min_brew_sample_secs = SECS_PER_MIN; // Shorter brews are not used to learn brew times
 
-        constexpr uint32_t wifi_wait_millis = MILLIS_PER_SEC * 5; // 5 sec
-        constexpr uint32_t time_sync_wait_secs = 5;               // 5 sec
+        constexpr uint32_t stop_brew_with_no_pot_millis =
+            MILLIS_PER_MIN * 10; // If no pot is present while brewing for 10 minutes, stop the brew
+
+#if MOCCA_FEATURE_DISPLAY
+        constexpr uint8_t display_width = 128;
+        constexpr uint8_t display_height = 64;
+        constexpr uint8_t display_i2c_addr = 0x3C;
+
+        constexpr const char* spash_screen_text = "MoccaWake";
 
         constexpr uint32_t rotary_time_step = SECS_PER_MIN * 10; // 10 minutes per step
         constexpr uint32_t rotary_count_divisor = 2;             // For half-quad mode
+        constexpr uint32_t button_tick_millis = 10;              // While OneButton is following a press
 
-        constexpr uint32_t stop_brew_with_no_pot_millis =
-            MILLIS_PER_MIN * 10; // If no pot is present while brewing for 10 minutes, stop the brew
+        constexpr uint32_t heavy_network_load_requests_per_sec = 5; // Web requests per second, any request is light
 
         // 8x8 notification bar icons
         constexpr unsigned char wifi_icon[] = {0x00, 0x3c, 0x42, 0x81, 0x3c, 0x42, 0x18, 0x18};
         constexpr unsigned char pot_icon[] = {0x38, 0xff, 0x7d, 0x7d, 0x7d, 0x7f, 0x7c, 0x7c};
         constexpr unsigned char water_icon[] = {0x10, 0x38, 0x38, 0x7c, 0x7c, 0xfe, 0x7c, 0x38};
 
+        constexpr size_t wifi_icon_slot = 0;
+        constexpr size_t water_icon_slot = 1;
+        constexpr size_t pot_icon_slot = 2;
+
+        constexpr int32_t hint_height = 8;  // One line of size 1 text
+        constexpr int32_t arrow_width = 12; // One character of size 2 text
+
+        enum class menu_action : uint8_t {
+            clear_brew,
+            skip_next,
+            add_alarm,
+            add_alarm_days, // Argument is the days
+            edit_alarms,
+            clear_alarms,
+            reset,
+            low_power_on,
+            low_power_off,
+            set_time,
+            status,
+        };
+
+        constexpr rotary_menu_item menu_item(const char* label, menu_action action, uint8_t argument = 0) {
+            return {label, static_cast<uint8_t>(action), argument, nullptr};
+        }
+
+        constexpr rotary_menu_item submenu_item(const char* label, const rotary_menu_page* submenu) {
+            return {label, 0, 0, submenu};
+        }
+
+        constexpr rotary_menu_item back_item = {"Back", rotary_menu::back_action, 0, nullptr};
+
+        constexpr rotary_menu_item alarm_menu_items[] = {
+            menu_item("Add alarm", menu_action::add_alarm),
+            menu_item("Edit alarms", menu_action::edit_alarms),
+            menu_item("Clear alarms", menu_action::clear_alarms),
+            back_item,
+        };
+        constexpr rotary_menu_page alarm_menu = make_menu_page(alarm_menu_items);
+
+        constexpr rotary_menu_item settings_menu_items[] = {
+            menu_item("Low power on", menu_action::low_power_on),
+            menu_item("Low power off", menu_action::low_power_off),
+            menu_item("Set time", menu_action::set_time),
+            menu_item("Reset", menu_action::reset),
+            back_item,
+        };
+        constexpr rotary_menu_page settings_menu = make_menu_page(settings_menu_items);
+
+        constexpr rotary_menu_item main_menu_items[] = {
+            menu_item("Clear brew", menu_action::clear_brew),
+            menu_item("Skip next", menu_action::skip_next),
+            submenu_item("Alarms", &alarm_menu),
+            submenu_item("Settings", &settings_menu),
+            menu_item("Status", menu_action::status),
+        };
+        constexpr rotary_menu_page main_menu = make_menu_page(main_menu_items);
+
+        constexpr rotary_menu_item alarm_days_menu_items[] = {
+            menu_item("Every day", menu_action::add_alarm_days, wake_every_day),
+            menu_item("Weekdays", menu_action::add_alarm_days, wake_weekdays),
+            menu_item("Weekends", menu_action::add_alarm_days, wake_weekends),
+        };
+        constexpr rotary_menu_page alarm_days_menu = make_menu_page(alarm_days_menu_items);
+#endif
+
         void init_default_data(persistent_data* data) {
-            memset(data, 0, sizeof(persistent_data));
+            *data = persistent_data(); // Also the current layout number
             strcpy(data->wifi_ssid, default_wifi_ssid);
             strcpy(data->wifi_password, default_wifi_password);
             strcpy(data->timezone, default_timezone);
@@ -60,39 +211,83 @@ namespace mocca {
                 return "status";
             case state::brew:
                 return "brew";
+            case state::alarm_time_set:
+                return "alarm_time_set";
+            case state::alarm_days_set:
+                return "alarm_days_set";
+            case state::alarm_list:
+                return "alarm_list";
             default:
                 return "unknown";
             }
         }
     } // namespace
 
-    mocca_wake::mocca_wake(Stream& log)
-        : _log(log)
+    mocca_wake::mocca_wake(Stream& console)
+        : _console(console)
+#if MOCCA_FEATURE_DISPLAY
         , _display(display_width, display_height, &Wire)
-        , _encoder() {
+        , _encoder()
+        , _main_label(2, text_alignment::center, text_alignment::center)
+        , _left_arrow(2, text_alignment::left, text_alignment::center)
+        , _right_arrow(2, text_alignment::right, text_alignment::center)
+        , _hint(1, text_alignment::left, text_alignment::bottom)
+        , _status_text(1, text_alignment::left, text_alignment::center)
+#endif
+    {
+#if MOCCA_FEATURE_DISPLAY
         _time_input.set_time_step(rotary_time_step);
+        _notification_bar.icons().set_icon(wifi_icon_slot, wifi_icon);
+        _notification_bar.icons().set_icon(water_icon_slot, water_icon);
+        _notification_bar.icons().set_icon(pot_icon_slot, pot_icon);
+#endif
     }
 
     bool mocca_wake::init(int encoder_pin_a, int encoder_pin_b, int encoder_button_pin, int water_switch_pin,
                           int pot_switch_pin, int boiler_ssr_pin, int persistent_data_addr) {
+        start_control_loop_pacing(); // setup() runs on the loop task as well
+        _boot_check.start();
+
+#if MOCCA_FEATURE_DISPLAY
         if (!_display.begin(SSD1306_SWITCHCAPVCC, display_i2c_addr)) {
-            _log.println("SSD1306 allocation failed");
+            MOCCA_LOGE(core, "SSD1306 allocation failed.");
+            _boot_check.fail("no display");
             return false;
         }
         _display.setTextColor(SSD1306_WHITE);
+        _power.start(&_display, millis());
+        _encoder_button_pin = encoder_button_pin;
+#else
+        _power.start(nullptr, millis());
+#endif
 
         _persistent_data_addr = persistent_data_addr;
         _boiler_ssr_pin = boiler_ssr_pin;
 
+        // Time comes from sntp_client or is set on the device, keep ezTime from querying NTP on its own.
+        ezt::setInterval(0);
+#if !MOCCA_FEATURE_NTP
+        _timezone.setPosix(posix_timezone);
+#endif
+
+        // When waking from deep sleep the clock is restored from RTC memory and the network is brought up later so
+        // that a scheduled brew isn't held up by WiFi and NTP.
+        deep_sleep_wake resume_wake = get_deep_sleep_wake();
+        bool resuming = resume_wake != deep_sleep_wake::none;
+
         struct init_step {
             const char* name;
+            bool run_on_resume;
             std::function<bool(void)> function;
         };
         init_step init_steps[] = {
             {
                 "Initializing peripherals...",
+                true,
                 [&]() {
+#if MOCCA_FEATURE_DISPLAY
                     _encoder.attachHalfQuad(encoder_pin_a, encoder_pin_b);
+                    _input_latency.start(encoder_pin_a, encoder_pin_b, encoder_button_pin);
 
                     _encoder_button.setup(encoder_button_pin, INPUT_PULLUP, true);
                     _encoder_button.setClickMs(200);
@@ -114,94 +309,267 @@ namespace mocca {
                             wake->on_encoder_button_long_pressed();
                         },
                         this);
+#endif
 
                     _water_switch.init(water_switch_pin, INPUT_PULLUP, true);
                     _pot_switch.init(pot_switch_pin, INPUT_PULLUP, true);
 
-                    pinMode(_boiler_ssr_pin, OUTPUT);
-                    set_boiler_state(false);
+                    if (!_boiler_supervisor.start(_boiler_ssr_pin, &_water_switch, &_pot_switch)) {
+                        MOCCA_LOGE(brew, "Failed to start the boiler supervisor.");
+                        return false;
+                    }
 
                     return true;
                 },
             },
             {
                 "Reading persistent data...",
+                true,
                 [&]() {
-                    EEPROM.get(_persistent_data_addr, _data);
-                    if (!_data.crc_is_valid()) {
-                        _log.println("Persistant data CRC missmatch. Resetting to default.");
+                    persistent_data stored;
+                    EEPROM.get(_persistent_data_addr, stored);
+                    uint32_t layout = migrate_persistent_data(stored, &_data);
+                    if (layout == 0) {
+                        MOCCA_LOGW(core, "Persistant data CRC missmatch. Resetting to default.");
                         init_default_data(&_data);
                         save_persistent_data();
+                    } else if (layout != persistent_data_layout) {
+                        MOCCA_LOGI(core, "Persistent data migrated from layout %" PRIu32 " to %" PRIu32 ".", layout,
+                                   persistent_data_layout);
+                        save_persistent_data();
                     }
 
+                    // Brews still run without a history, the partition only exists after a full flash.
+                    _brew_history.start();
+#if MOCCA_FEATURE_SYNC
+                    init_sync();
+#endif
+
                     return true;
                 },
             },
+#if MOCCA_FEATURE_WIFI
             {
-                "Connecting to WiFi...",
-                [&]() {
-                    connect_to_wifi_or_fallback_to_ap(_data.wifi_ssid, _data.wifi_password, wifi_wait_millis,
-                                                      config_ap_ssid);
-                    return true;
-                },
-            },
-            {
-                "Synchronizing time...",
+                "Starting WiFi...",
+                false,
                 [&]() {
-                    if (is_wifi_connected()) {
-                        synchronize_time(time_sync_wait_secs);
-                    }
+                    // Connects in the background, the time is synchronized once it's up.
+                    start_wifi();
                     return true;
                 },
             },
+#endif
+#if MOCCA_FEATURE_WEB
             {
                 "Start web server...",
+                false,
                 [&]() {
-                    _config_web_server.init();
-                    _config_web_server.set_wifi_callback([this](const char* ssid, const char* password) {
-                        connect_to_wifi_or_fallback_to_ap(ssid, password, wifi_wait_millis, config_ap_ssid);
-                    });
-                    _config_web_server.set_timezone_callback(
-                        [this](const char* timezone) { return set_timezone(timezone); });
+                    start_web_server();
                     return true;
                 },
             },
+#endif
         };
 
         constexpr size_t init_step_count = sizeof(init_steps) / sizeof(*init_steps);
         for (size_t step_idx = 0; step_idx < init_step_count; step_idx++) {
             const init_step& step = init_steps[step_idx];
-            draw_init_screen(step.name, step_idx, init_step_count);
+            if (resuming) {
+                if (!step.run_on_resume) {
+                    _network_pending = true;
+                    continue;
+                }
+            } else {
+#if MOCCA_FEATURE_DISPLAY
+                draw_init_screen(step.name, step_idx, init_step_count);
+#endif
+            }
             if (!step.function()) {
+                _boot_check.fail(step.name);
                 return false;
             }
         }
 
+        if (resuming) {
+            resume_from_deep_sleep(resume_wake);
+        }
+
+        _metrics.boot_millis = millis();
+        if (resuming) {
+            record_deep_sleep_resume(_metrics.boot_millis);
+        }
+        MOCCA_LOGI(core, "Booted the %s profile in %" PRIu32 " ms.", MOCCA_FEATURE_PROFILE, _metrics.boot_millis);
+
         return true;
     }
 
+#if MOCCA_FEATURE_WEB
+    void mocca_wake::start_web_server() {
+        _config_web_server.init();
+        _config_web_server.set_wifi_callback(
+            [this](const char* ssid, const char* password) { _wifi.connect(ssid, password, false); });
+        _config_web_server.set_timezone_callback([this](const char* timezone) { return set_timezone(timezone); });
+        _config_web_server.set_metrics_callback([this](runtime_metrics* metrics) { fill_metrics(metrics); });
+        _config_web_server.set_schedule_callbacks(
+            [this](schedule_info* schedule) {
+                std::copy(std::begin(_data.wake_alarms), std::end(_data.wake_alarms), schedule->alarms);
+                schedule->next_wake = _wake_schedule.next_wake();
+                schedule->skip_until = _data.skip_wakes_until;
+                schedule->deep_sleep_lead_secs = deep_sleep_lead_secs();
+            },
+            [this](const set_schedule_command& command) {
+                set_wake_alarms(command.alarms, command.alarm_count);
+                if (command.deep_sleep_lead_secs != 0) {
+                    set_deep_sleep_lead(command.deep_sleep_lead_secs);
+                }
+            },
+            [this]() { skip_next_wake(); });
+        _config_web_server.set_brew_history(&_brew_history);
+        _config_web_server.set_update_ready_callback([this]() {
+            _update_restart_pending = true;
+            _update_ready_time = millis();
+        });
+        _config_web_server.set_brew_callbacks(
+            [this](device_state_info* info) { fill_device_state(info); },
+            [this](brew_command command, int64_t received_micros) { on_remote_brew_command(command, received_micros); },
+            [this](bool enabled, uint32_t secs) { on_remote_wake_set(enabled, secs); });
+#if MOCCA_FEATURE_DISPLAY
+        _config_web_server.set_screen_mirror(&_screen_mirror);
+#endif
+    }
+#endif
+
+    void mocca_wake::start_network() {
+        _network_pending = false;
+
+#if MOCCA_FEATURE_WIFI
+        start_wifi();
+#endif
+#if MOCCA_FEATURE_WEB
+        start_web_server();
+#endif
+    }
+
+    void mocca_wake::resume_from_deep_sleep(deep_sleep_wake wake) {
+        if (!restore_deep_sleep_clock(&_timezone)) {
+            MOCCA_LOGW(power, "Failed to restore the clock after deep sleep.");
+            start_network();
+            return;
+        }
+        _has_valid_time = true;
+        update_wake_schedule();
+
+        deep_sleep_stats stats = get_deep_sleep_stats();
+        uint32_t total_secs = stats.asleep_secs + stats.awake_secs;
+        MOCCA_LOGI(power,
+                   "Resumed from deep sleep (%s) in %" PRIu32 " ms. Asleep %" PRIu32 "%% of the time over %" PRIu32
+                   " sleeps.",
+                   wake == deep_sleep_wake::timer ? "timer" : "button", static_cast<uint32_t>(millis()),
+                   total_secs > 0 ? (stats.asleep_secs * 100) / total_secs : 0, stats.sleep_count);
+
+        // A timer wake happens shortly before a brew, keep the display dark until then.
+        transition_to_state(wake == deep_sleep_wake::timer ? state::sleep : state::idle);
+        _boiler_on_after_wake_pending = wake == deep_sleep_wake::timer;
+    }
+
+    void mocca_wake::try_enter_deep_sleep() {
+        if (!_data.low_power_enabled || !_has_valid_time || !_wake_schedule.has_next_wake()) {
+            return;
+        }
+        // Waking up is a reset, which the bootloader takes as a new image failing its first boot.
+        if (_boot_check.is_pending()) {
+            return;
+        }
+
+        uint32_t lead_secs = deep_sleep_lead_secs();
+        time_t secs_until_wake = _wake_schedule.next_wake() - _data.brew.lead_secs() - ezt::now();
+        if (secs_until_wake < static_cast<time_t>(lead_secs + min_deep_sleep_secs)) {
+            return;
+        }
+
+        uint32_t sleep_secs = secs_until_wake - lead_secs;
+        MOCCA_LOGI(power, "Deep sleeping for %" PRIu32 " s.", sleep_secs);
+        get_logger().flush(deep_sleep_log_flush_millis);
+
+        set_boiler_state(false);
+#if MOCCA_FEATURE_DISPLAY
+        _display.ssd1306_command(SSD1306_DISPLAYOFF);
+#endif
+#if MOCCA_FEATURE_MQTT
+        _mqtt.stop(); // Says goodbye, queued events don't survive the reset
+#endif
+#if MOCCA_FEATURE_WIFI
+        WiFi.disconnect(true);
+#endif
+
+        enter_deep_sleep(&_timezone, sleep_secs, lead_secs, _encoder_button_pin, _boiler_ssr_pin);
+    }
+
+    uint32_t mocca_wake::deep_sleep_lead_secs() const {
+        return _data.deep_sleep_lead_secs != 0 ? _data.deep_sleep_lead_secs : default_deep_sleep_lead_secs;
+    }
+
+    void mocca_wake::set_deep_sleep_lead(uint32_t secs) {
+        if (secs == deep_sleep_lead_secs()) {
+            return;
+        }
+        MOCCA_LOGI(power, "Deep sleep lead set to %" PRIu32 " s.", secs);
+        _data.deep_sleep_lead_secs = secs;
+        save_persistent_data();
+    }
+
     void mocca_wake::step() {
         bool boiler_should_be_on = false;
 
+        _loop_iterations++;
+        uint32_t loop_rate_window = millis() - _loop_rate_window_start;
+        if (loop_rate_window >= MILLIS_PER_SEC) {
+            _metrics.loop_iterations_per_sec = (_loop_iterations * MILLIS_PER_SEC) / loop_rate_window;
+            _loop_iterations = 0;
+            _loop_rate_window_start = millis();
+#if MOCCA_FEATURE_DISPLAY
+            update_network_load();
+#endif
+        }
+
+        if (_network_pending && _state != state::brew) {
+            start_network();
+        }
+
+        update_boot_check();
+
+#if MOCCA_FEATURE_WEB
         _config_web_server.step();
+#endif
 
+        handle_serial_commands();
+
+#if MOCCA_FEATURE_DISPLAY
         _encoder_button.tick();
+#endif
 
-        if (_wifi_connected != (WiFi.status() == WL_CONNECTED)) {
-            _wifi_connected = !_wifi_connected;
-            if (_wifi_connected) {
-                on_wifi_connected();
-            } else {
-                on_wifi_disconnected();
-            }
+#if MOCCA_FEATURE_WIFI
+        _wifi.step();
+        poll_timezone_lookup();
+#endif
+
+#if MOCCA_FEATURE_NTP
+        if (_sntp.step()) {
+            on_time_synced();
+        }
+#endif
+        if (_has_valid_time && millis() - _last_clock_update >= clock_update_millis) {
+            update_clock_from_system();
         }
 
+#if MOCCA_FEATURE_DISPLAY
         int64_t encoder_count = _encoder.getCount() / rotary_count_divisor;
         if (encoder_count != _last_encoder_count) {
             int delta = encoder_count - _last_encoder_count;
-            on_encoder_changed(delta);
+            on_encoder_changed(delta, _input_latency.take_edge(input_source::encoder, micros()));
             _last_encoder_count = encoder_count;
         }
+#endif
 
         uint32_t millis_since_last_input = millis() - _last_input_time;
 
@@ -210,51 +578,71 @@ namespace mocca {
         }
         uint32_t millis_since_pot = millis() - _last_pot_time;
 
+        // Scheduled times are when the coffee should be ready, start early enough to get there.
+        if (_has_valid_time && _wake_schedule.is_due(ezt::now() + _data.brew.lead_secs())) {
+            on_wake();
+        }
+
+        if (_awaiting_pot_removal && !has_pot()) {
+            _awaiting_pot_removal = false;
+            _metrics.last_pot_removed_after_secs = (millis() - _brew_finished_time) / MILLIS_PER_SEC;
+            MOCCA_LOGI(brew, "Pot removed %" PRId32 " s after the brew finished.",
+                       _metrics.last_pot_removed_after_secs);
+        }
+
+#if MOCCA_FEATURE_MQTT
+        // Commands arrive from in here, right where the web server's get applied.
+        _mqtt.report_switches(has_water(), has_pot());
+        _mqtt.step(millis(), _has_valid_time ? ezt::now() : 0);
+#endif
+#if MOCCA_FEATURE_SYNC
+        _sync.step(millis(), _has_valid_time ? ezt::now() : 0);
+#endif
+#if MOCCA_FEATURE_WEB
+        _config_web_server.poll_brew_commands();
+#endif
+#if MOCCA_FEATURE_REMOTE
+        publish_snapshots();
+#endif
+
+        update_power_tier();
+
         switch (_state) {
         case state::sleep:
+            try_enter_deep_sleep();
             break;
         case state::idle:
             if (millis_since_last_input >= no_input_to_sleep_millis) {
                 transition_to_state(state::sleep);
-                break;
             }
-            draw_idle_screen();
             break;
         case state::wake_set:
-            if (millis_since_last_input >= no_input_to_idle_millis) {
-                transition_to_state(state::idle);
-                break;
-            }
-            draw_wake_set_screen();
-            break;
         case state::time_set:
-            if (millis_since_last_input >= no_input_to_idle_millis) {
-                transition_to_state(state::idle);
-                break;
-            }
-            draw_time_set_screen();
-            break;
+        case state::alarm_time_set:
         case state::menu:
-            if (millis_since_last_input >= no_input_to_idle_millis) {
-                transition_to_state(state::idle);
-                break;
-            }
-            draw_menu_screen();
-            break;
+        case state::alarm_days_set:
+        case state::alarm_list:
         case state::status:
             if (millis_since_last_input >= no_input_to_idle_millis) {
                 transition_to_state(state::idle);
-                break;
             }
-            draw_status_screen();
             break;
         case state::brew:
             if (!has_water()) {
+                end_brew(brew_end_reason::finished);
                 transition_to_state(state::idle);
                 break;
             }
 
             if (!has_pot() && millis_since_pot >= stop_brew_with_no_pot_millis) {
+                end_brew(brew_end_reason::no_pot);
+                transition_to_state(state::idle);
+                break;
+            }
+
+            if (_boiler_supervisor.heat_limit_reached()) {
+                MOCCA_LOGW(brew, "Boiler on for too long, stopping the brew.");
+                end_brew(brew_end_reason::heat_limit);
                 transition_to_state(state::idle);
                 break;
             }
@@ -262,67 +650,228 @@ namespace mocca {
             if (has_pot()) {
                 boiler_should_be_on = true;
             }
-
-            draw_brew_screen();
             break;
         }
 
+#if MOCCA_FEATURE_DISPLAY
+        uint32_t frame_start = micros();
+        _flushed_this_frame = false;
+
+        draw_screen();
+
+        if (_flushed_this_frame) {
+            _metrics.render_micros = micros() - frame_start - _metrics.flush_micros;
+        }
+#endif
+
         set_boiler_state(boiler_should_be_on);
+
+        // Times the brew a timer wake was for, until the SSR turns on or the brew is over or gone without it.
+        if (_boiler_on_after_wake_pending) {
+            if (_boiler_supervisor.is_heating()) {
+                uint32_t since_wake = millis();
+                record_deep_sleep_boiler_on(since_wake);
+                MOCCA_LOGI(power, "Boiler on %" PRIu32 " ms after the deep sleep wake.", since_wake);
+                _boiler_on_after_wake_pending = false;
+            } else if (_state != state::sleep && _state != state::brew) {
+                _boiler_on_after_wake_pending = false;
+            }
+        }
+
+#if MOCCA_FEATURE_REMOTE
+        // The supervisor preempts this task as soon as heat is requested, the SSR is where the command left it by now.
+        if (_remote_command_micros != 0) {
+            if (_boiler_supervisor.is_heating() != _remote_command_was_heating) {
+                uint32_t ssr_micros = esp_timer_get_time() - _remote_command_micros;
+                _metrics.remote_commands.add(ssr_micros);
+                MOCCA_LOGD(brew, "Brew command reached the boiler in %" PRIu32 " us.", ssr_micros);
+            }
+            _remote_command_micros = 0;
+        }
+#endif
+
+        wait_for_next_tick();
+    }
+
+    void mocca_wake::wait_for_next_tick() {
+        uint32_t interval = _power.loop_interval_millis();
+#if MOCCA_FEATURE_DISPLAY
+        // OneButton only sees a press through its debounce and click timeouts if it keeps getting ticks.
+        if (!_encoder_button.isIdle()) {
+            interval = std::min(interval, button_tick_millis);
+        }
+#endif
+        wait_for_control_loop_wake(interval);
+    }
+
+    void mocca_wake::update_boot_check() {
+        bool can_restart = _state != state::brew;
+
+#if MOCCA_FEATURE_WIFI
+        // A new image has to keep the device reachable, otherwise there is no way to update it again. Credentials it
+        // lost don't excuse it if the image before it was connected.
+        bool must_connect = _boot_check.previous_image_reachable() || _data.wifi_ssid[0] != '\0';
+        bool healthy = !must_connect || _wifi.is_connected();
+#else
+        bool healthy = true;
+#endif
+        _boot_check.step(millis(), healthy, can_restart);
+
+        if (_update_restart_pending && can_restart && millis() - _update_ready_time >= update_restart_delay_millis) {
+            MOCCA_LOGI(core, "Restarting into the new image.");
+#if MOCCA_FEATURE_WIFI
+            _boot_check.prepare_restart(_wifi.is_connected() || _data.wifi_known_good);
+#endif
+            set_boiler_state(false);
+            get_logger().flush(deep_sleep_log_flush_millis);
+            ESP.restart();
+        }
+    }
+
+#if MOCCA_FEATURE_DISPLAY
+    void mocca_wake::draw_screen() {
+        switch (_state) {
+        case state::sleep:
+            break;
+        case state::idle:
+            draw_idle_screen();
+            break;
+        case state::wake_set:
+            draw_wake_set_screen();
+            break;
+        case state::time_set:
+        case state::alarm_time_set:
+            draw_time_set_screen();
+            break;
+        case state::menu:
+        case state::alarm_days_set:
+        case state::alarm_list:
+            draw_menu_screen();
+            break;
+        case state::status:
+            draw_status_screen();
+            break;
+        case state::brew:
+            draw_brew_screen();
+            break;
+        }
     }
 
     void mocca_wake::draw_init_screen(const char* step_name, size_t step_index, size_t step_count) {
-        _display.clearDisplay();
+        if (step_index == 0) {
+            box content_area = layout_frame();
+            box hint_area(content_area.x, content_area.bottom() - hint_height, content_area.w, hint_height);
+            box main_area(content_area.x, content_area.y, content_area.w, hint_area.y - content_area.y);
+            _main_label.layout(main_area);
+            _screen.add(&_main_label);
+            _hint.layout(hint_area);
+            _screen.add(&_hint);
+        }
 
-        box full_screen_area(0, 0, _display.width(), _display.height());
+        update_notification_bar();
+        _main_label.set_text(spash_screen_text);
+        _hint.set_text(step_name);
 
-        box content_area;
-        draw_notification_bar(full_screen_area, &content_area);
+        render_screen();
+    }
 
-        _display.setTextSize(1);
-        draw_aligned_text(&_display, step_name, text_alignment::left, text_alignment::bottom, content_area);
+    box mocca_wake::layout_frame() {
+        _display.clearDisplay();
+        _screen.clear();
 
-        _display.setTextSize(2);
-        draw_aligned_text(&_display, spash_screen_text, text_alignment::center, text_alignment::center, content_area);
+        // Every screen shares the notification bar on top, the bottom row is kept for the time to idle bar.
+        box bar_area(0, 0, _display.width(), notification_bar_widget::height);
+        _notification_bar.layout(bar_area);
+        _screen.add(&_notification_bar);
 
-        _display.display();
+        return box(0, bar_area.bottom(), _display.width(), _display.height() - 1 - bar_area.bottom());
     }
 
-    void mocca_wake::draw_notification_bar(const box& area, box* out_content_area) {
-        auto draw_notification_icon = [](Adafruit_GFX* display, int16_t* cursor, const uint8_t bitmap8x8[]) {
-            display->drawBitmap(*cursor, 0, bitmap8x8, 8, 8, SSD1306_WHITE, SSD1306_BLACK);
-            *cursor += 10;
+    void mocca_wake::layout_screen() {
+        if (_state == state::sleep) {
+            _screen.clear();
+            return;
+        }
+
+        box content_area = layout_frame();
+        box hint_area(content_area.x, content_area.bottom() - hint_height, content_area.w, hint_height);
+        box main_area(content_area.x, content_area.y, content_area.w, hint_area.y - content_area.y);
+
+        auto add = [this](widget* widget, const box& area) {
+            widget->layout(area);
+            _screen.add(widget);
         };
 
-        int16_t notification_icon_cursor = 0;
-        if (WiFi.status() == WL_CONNECTED) {
-            draw_notification_icon(&_display, &notification_icon_cursor, wifi_icon);
-        }
-        if (has_water()) {
-            draw_notification_icon(&_display, &notification_icon_cursor, water_icon);
-        }
-        if (has_pot()) {
-            draw_notification_icon(&_display, &notification_icon_cursor, pot_icon);
+        switch (_state) {
+        case state::idle: {
+            box arrow_area(main_area.x, main_area.y, arrow_width, main_area.h);
+            add(&_left_arrow, arrow_area);
+            arrow_area.x = main_area.right() - arrow_width;
+            add(&_right_arrow, arrow_area);
+            add(&_main_label, box(main_area.x + arrow_width, main_area.y, main_area.w - 2 * arrow_width, main_area.h));
+            add(&_hint, hint_area);
+        } break;
+        case state::wake_set:
+            add(&_time_input, main_area);
+            add(&_hint, hint_area);
+            break;
+        case state::time_set:
+        case state::alarm_time_set:
+            add(&_time_input, content_area);
+            break;
+        case state::menu:
+        case state::alarm_days_set:
+            add(&_menu, content_area);
+            break;
+        case state::alarm_list:
+            add(&_alarm_list, content_area);
+            break;
+        case state::status:
+            add(&_status_text, content_area);
+            break;
+        case state::brew:
+            add(&_main_label, main_area);
+            add(&_hint, hint_area);
+            break;
+        default:
+            break;
         }
 
-        String current_time_text;
-        if (_has_valid_time) {
-            time_t current_time = _timezone.now();
-            const char* time_format_string = (current_time % 2 == 0) ? "g i a" : "g:i a";
-            current_time_text = _timezone.dateTime(current_time, time_format_string);
-        } else {
-            current_time_text = (ezt::now() % 2 != 0) ? "0:00" : " ";
+        switch (_state) {
+        case state::wake_set:
+        case state::time_set:
+        case state::alarm_time_set:
+        case state::menu:
+        case state::alarm_days_set:
+        case state::alarm_list:
+            add(&_idle_bar, box(0, _display.height() - 1, _display.width(), 1));
+            _idle_bar.set_progress(0, 1);
+            break;
+        default:
+            break;
         }
+    }
 
-        _display.setTextSize(1);
-        box text_area =
-            draw_aligned_text(&_display, current_time_text.c_str(), text_alignment::right, text_alignment::top, area);
+    void mocca_wake::render_screen() {
+        if (_screen.render(&_display)) {
+            flush_display();
+        }
+    }
 
-        *out_content_area = area;
-        out_content_area->y += text_area.h;
-        out_content_area->h -= text_area.h;
+    void mocca_wake::update_notification_bar() {
+        icon_row_widget& icons = _notification_bar.icons();
+#if MOCCA_FEATURE_WIFI
+        bool wifi_connecting = _wifi.state() == wifi_connection_state::connecting;
+        icons.set_visible(wifi_icon_slot,
+                          _wifi.is_connected() || (wifi_connecting && (millis() / MILLIS_PER_SEC) % 2 == 0));
+#endif
+        icons.set_visible(water_icon_slot, has_water());
+        icons.set_visible(pot_icon_slot, has_pot());
+
+        _notification_bar.clock().set_time(&_timezone, _has_valid_time);
     }
 
-    void mocca_wake::draw_time_to_idle_bar() {
+    void mocca_wake::update_time_to_idle_bar() {
         constexpr uint32_t idle_timeout = no_input_to_idle_millis;
         constexpr uint32_t max_idle_bar_duration =
             MILLIS_PER_SEC * 1; // Start drawing the idle timeout bar 2 seconds before idleing.
@@ -330,214 +879,425 @@ namespace mocca {
         uint32_t idle_bar_start = std::min(max_idle_bar_duration, idle_timeout);
         uint32_t millis_since_last_input = millis() - _last_input_time;
         uint32_t time_to_idle = idle_timeout - millis_since_last_input;
-        if (time_to_idle > idle_bar_start) {
-            return;
-        }
-
-        uint32_t bar_length = (_display.width() * time_to_idle) / idle_bar_start;
-        _display.drawLine(0, _display.height() - 1, bar_length, _display.height() - 1, SSD1306_WHITE);
+        _idle_bar.set_progress(time_to_idle > idle_bar_start ? 0 : time_to_idle, idle_bar_start);
     }
 
     void mocca_wake::draw_sleep_screen() {
         _display.clearDisplay();
-        _display.display();
+        flush_display();
     }
 
     void mocca_wake::draw_idle_screen() {
-        _display.clearDisplay();
+        update_notification_bar();
 
-        box full_screen_area(0, 0, _display.width(), _display.height());
-        box content_area;
-        draw_notification_bar(full_screen_area, &content_area);
-
-        if (_data.current_wake > _timezone.now()) {
-            String time_text = _timezone.dateTime(_data.current_wake, "g:i a");
-            _display.setTextSize(2);
-            draw_aligned_text(&_display, ">", text_alignment::left, text_alignment::center, content_area);
-            draw_aligned_text(&_display, time_text.c_str(), text_alignment::center, text_alignment::center,
-                              content_area);
-            draw_aligned_text(&_display, "<", text_alignment::right, text_alignment::center, content_area);
+        if (_wake_schedule.has_next_wake()) {
+            _main_label.set_text(local_date_time(_wake_schedule.next_wake(), "g:i a").c_str());
+            _left_arrow.set_text(">");
+            _right_arrow.set_text("<");
         } else {
-            _display.setTextSize(2);
-            draw_aligned_text(&_display, "Ready", text_alignment::center, text_alignment::center, content_area);
+            _main_label.set_text("Ready");
+            _left_arrow.set_text("");
+            _right_arrow.set_text("");
         }
+        _hint.set_text("Press to brew");
 
-        _display.setTextSize(1);
-        draw_aligned_text(&_display, "Press to brew", text_alignment::left, text_alignment::bottom, content_area);
-
-        _display.display();
+        render_screen();
     }
 
     void mocca_wake::draw_wake_set_screen() {
-        _display.clearDisplay();
-
-        box full_screen_area(0, 0, _display.width(), _display.height());
-        box content_area;
-        draw_notification_bar(full_screen_area, &content_area);
-
-        _time_input.draw(&_display, content_area);
-
-        if (_time_input.is_on_default_option()) {
-            _display.setTextSize(1);
-            draw_aligned_text(&_display, "Scroll to change time", text_alignment::left, text_alignment::bottom,
-                              content_area);
-        }
-
-        draw_time_to_idle_bar();
+        update_notification_bar();
+        _hint.set_text(_time_input.is_on_default_option() ? "Scroll to change time" : "");
+        update_time_to_idle_bar();
 
-        _display.display();
+        render_screen();
     }
 
     void mocca_wake::draw_time_set_screen() {
-        _display.clearDisplay();
-
-        box full_screen_area(0, 0, _display.width(), _display.height());
-        box content_area;
-        draw_notification_bar(full_screen_area, &content_area);
-
-        _time_input.draw(&_display, content_area);
-
-        draw_time_to_idle_bar();
+        update_notification_bar();
+        update_time_to_idle_bar();
 
-        _display.display();
+        render_screen();
     }
 
     void mocca_wake::draw_menu_screen() {
-        _display.clearDisplay();
-
-        box full_screen_area(0, 0, _display.width(), _display.height());
-        box content_area;
-        draw_notification_bar(full_screen_area, &content_area);
-
-        _menu.draw(&_display, content_area);
+        update_notification_bar();
+        update_time_to_idle_bar();
 
-        draw_time_to_idle_bar();
-
-        _display.display();
+        render_screen();
     }
 
     void mocca_wake::draw_status_screen() {
-        _display.clearDisplay();
-
-        box full_screen_area(0, 0, _display.width(), _display.height());
-        box content_area;
-        draw_notification_bar(full_screen_area, &content_area);
+        update_notification_bar();
 
         String status_text;
 
+#if MOCCA_FEATURE_WIFI
         wifi_mode_t wifi_mode = WiFi.getMode();
-        if (wifi_mode == WIFI_MODE_STA || wifi_mode == WIFI_MODE_APSTA) {
+        switch (_wifi.state()) {
+        case wifi_connection_state::off:
+            break;
+        case wifi_connection_state::connected:
             status_text += "SSID: " + WiFi.SSID() + "\n";
             status_text += "IP: " + WiFi.localIP().toString() + "\n";
+            break;
+        case wifi_connection_state::connecting:
+            status_text += "SSID: " + String(_wifi.ssid()) + "\n";
+            status_text += "Connecting (" + String(_wifi.attempt()) + ")...\n";
+            break;
+        case wifi_connection_state::retry_wait:
+            status_text += "SSID: " + String(_wifi.ssid()) + "\n";
+            status_text += "Retry in " + String((_wifi.millis_until_retry() + MILLIS_PER_SEC - 1) / MILLIS_PER_SEC) +
+                           " s\n";
+            break;
         }
         if (wifi_mode == WIFI_MODE_AP || wifi_mode == WIFI_MODE_APSTA) {
             status_text += "SSID: " + WiFi.softAPSSID() + "\n";
             status_text += "IP: " + WiFi.softAPIP().toString() + "\n";
         }
+#endif
         status_text += "Timezone: " + _timezone.getTimezoneName() + "\n";
 
-        _display.setTextSize(1);
-        draw_aligned_text(&_display, status_text.c_str(), text_alignment::left, text_alignment::center, content_area);
+        _status_text.set_text(status_text.c_str());
 
-        _display.display();
+        render_screen();
     }
 
     void mocca_wake::draw_brew_screen() {
-        _display.clearDisplay();
+        update_notification_bar();
+        _main_label.set_text(has_pot() ? "Brewing" : "Paused");
+        _hint.set_text("Long press to cancel");
 
-        box full_screen_area(0, 0, _display.width(), _display.height());
-        box content_area;
-        draw_notification_bar(full_screen_area, &content_area);
-
-        _display.setTextSize(2);
-        const char* display_text = has_pot() ? "Brewing" : "Paused";
-        draw_aligned_text(&_display, display_text, text_alignment::center, text_alignment::center, content_area);
-
-        _display.setTextSize(1);
-        draw_aligned_text(&_display, "Long press to cancel", text_alignment::left, text_alignment::bottom,
-                          content_area);
-
-        _display.display();
+        render_screen();
     }
+#endif
 
     void mocca_wake::set_time(time_t time) {
         _timezone.setTime(time);
+
+        // The system clock is the reference everything else follows.
+        timeval now_tv = {ezt::now(), 0};
+        settimeofday(&now_tv, nullptr);
+
         _has_valid_time = true;
+        update_wake_schedule();
     }
 
     bool mocca_wake::set_timezone(const char* timezone) {
-        _log.printf("Setting timezone to %s...", _data.timezone);
-        if (!_timezone.setLocation(_data.timezone)) {
-            _log.println(" failed.");
-            return false;
-        }
-        _log.printf(" done. Set timezone is %s.\n", _timezone.getTimezoneName().c_str());
-
-        if (strcmp(_data.timezone, timezone) != 0) {
-            strcpy(_data.timezone, timezone);
-            save_persistent_data();
+        if (is_posix_timezone(timezone)) {
+            if (!_timezone.setPosix(timezone)) {
+                MOCCA_LOGW(time, "Setting timezone to %s failed.", timezone);
+                return false;
+            }
+            apply_timezone(timezone);
+            return true;
         }
 
-        // TODO: If a wake up was set. Reset it.
+#if MOCCA_FEATURE_WIFI
+        // Applied from poll_timezone_lookup() once the rules are in.
+        MOCCA_LOGI(time, "Looking up timezone %s.", timezone);
+        _timezone_lookup.request(timezone);
         return true;
+#else
+        MOCCA_LOGW(time, "Timezone %s needs a lookup, only POSIX rules work without the network.", timezone);
+        return false;
+#endif
     }
 
-    bool mocca_wake::synchronize_time(uint16_t timeout_secs) {
-        _has_valid_time = false;
-        _log.print("Waiting for time sync...");
-        if (!ezt::waitForSync(time_sync_wait_secs)) {
-            _log.println(" failed.");
-            return false;
+    void mocca_wake::apply_timezone(const char* timezone) {
+        MOCCA_LOGI(time, "Timezone set to %s.", timezone);
+
+        bool data_changed = false;
+        if (strcmp(_data.timezone, timezone) != 0) {
+            strlcpy(_data.timezone, timezone, sizeof(_data.timezone));
+            data_changed = true;
+#if MOCCA_FEATURE_SYNC
+            _sync.on_local_change(sync_record::timezone);
+#endif
         }
-        _log.println(" done.");
 
-        if (!set_timezone(_data.timezone)) {
-            return false;
+#if MOCCA_FEATURE_NTP
+        // The synced clock only makes for valid local time together with the rules.
+        if (!_has_valid_time && _sntp.has_synced()) {
+            _has_valid_time = true;
+        }
+#endif
+
+        time_t now = ezt::now();
+        _local_time.build(&_timezone, now);
+
+        // A pending brew keeps its wall clock time in the new timezone.
+        if (_data.current_wake > now) {
+            time_t current_wake = _local_time.next_local_time_of_day(_data.last_wake_secs, now);
+            if (current_wake != _data.current_wake) {
+                _data.current_wake = current_wake;
+                data_changed = true;
+#if MOCCA_FEATURE_SYNC
+                _sync.on_local_change(sync_record::wake);
+#endif
+            }
         }
 
-        _has_valid_time = true;
-        return true;
+        if (data_changed) {
+            save_persistent_data();
+        }
+
+        update_wake_schedule();
     }
 
-    void mocca_wake::connect_to_wifi_or_fallback_to_ap(const char* ssid, const char* pass, uint32_t timeout_millis,
-                                                       const char* fallback_ap_name) {
-        WiFi.disconnect();
-        WiFi.mode(WIFI_STA);
-        WiFi.begin(ssid, pass);
-        _log.printf("WiFi connecting to \"%s\" (pass \"%s\")...", ssid, pass);
-        uint8_t wifi_status = WiFi.waitForConnectResult(timeout_millis);
-        _wifi_connected = (wifi_status == WL_CONNECTED);
-        if (_wifi_connected) {
-            _log.printf(" connected. IP: %s.\n", WiFi.localIP().toString().c_str());
-
-            if (strcmp(_data.wifi_ssid, ssid) != 0 || strcmp(_data.wifi_password, pass)) {
-                strcpy(_data.wifi_ssid, ssid);
-                strcpy(_data.wifi_password, pass);
-                save_persistent_data();
-            }
+#if MOCCA_FEATURE_NTP
+    void mocca_wake::on_time_synced() {
+        sntp_stats stats = _sntp.get_stats();
+        MOCCA_LOGI(time,
+                   "Time synced. Offset %" PRId64 " us, delay %" PRIu32 " us, drift %.2f ppm, next sync in %" PRIu32
+                   " s.",
+                   stats.last_offset_micros, stats.last_delay_micros, stats.drift_ppm, stats.sync_interval_secs);
 
+        update_clock_from_system();
+
+        if (!_has_valid_time) {
+            // The time counts as valid once the stored timezone applies.
+            set_timezone(_data.timezone);
             return;
         }
 
-        _log.printf(" failed. Starting WiFi access point \"%s\".", fallback_ap_name);
-        WiFi.mode(WIFI_AP);
-        WiFi.softAP(fallback_ap_name);
-        _log.printf(" IP: %s.\n", WiFi.softAPIP().toString().c_str());
+        update_wake_schedule();
     }
+#endif
 
-    bool mocca_wake::is_wifi_connected() const {
-        return _wifi_connected;
+    void mocca_wake::update_clock_from_system() {
+        timeval now_tv;
+        gettimeofday(&now_tv, nullptr);
+        UTC.setTime(now_tv.tv_sec, now_tv.tv_usec / 1000);
+        _last_clock_update = millis();
     }
 
+#if MOCCA_FEATURE_WIFI
+    void mocca_wake::start_wifi() {
+#if MOCCA_FEATURE_NTP
+        _sntp.set_servers(ntp_servers, sizeof(ntp_servers) / sizeof(*ntp_servers));
+#endif
+
+#if MOCCA_FEATURE_MQTT
+        init_mqtt();
+#endif
+
+        if (!_timezone_lookup.start()) {
+            MOCCA_LOGE(time, "Failed to start the timezone lookup task.");
+        }
+
+        _wifi.init(config_ap_ssid);
+        _wifi.set_connected_callback([this]() { on_wifi_connected(); });
+        _wifi.set_disconnected_callback([this]() { on_wifi_disconnected(); });
+
+        MOCCA_LOGI(wifi, "Connecting to \"%s\".", _data.wifi_ssid);
+        _wifi.connect(_data.wifi_ssid, _data.wifi_password, _data.wifi_known_good != 0);
+    }
+#endif
+
     void mocca_wake::save_persistent_data() {
-        _log.println("Saving persistent data.");
+        MOCCA_LOGD(core, "Saving persistent data.");
         _data.update_crc();
         EEPROM.put(_persistent_data_addr, _data);
         EEPROM.commit();
+        _metrics.persistent_data_commits++;
+    }
+
+#if MOCCA_FEATURE_DISPLAY
+    void mocca_wake::flush_display() {
+        uint32_t flush_start = micros();
+        _display.display();
+        uint32_t flush_end = micros();
+#if MOCCA_FEATURE_WEB
+        // The buffer is exactly what the display shows until the next frame starts drawing.
+        _screen_mirror.publish(_display.getBuffer());
+#endif
+        _metrics.flush_micros = flush_end - flush_start;
+        _metrics.display_flushes++;
+        _input_latency.on_frame_flushed(flush_end, state_name(_state), _network_load);
+        _flushed_this_frame = true;
+    }
+#endif
+
+#if MOCCA_FEATURE_MQTT
+    void mocca_wake::init_mqtt() {
+        // The NIC specific half of the MAC tells devices apart on a shared broker.
+        uint32_t device_id = (ESP.getEfuseMac() >> 24) & 0xffffff;
+        char client_id[16];
+        snprintf(client_id, sizeof(client_id), "mocca-%06" PRIx32, device_id);
+#if defined(MOCCA_MQTT_TOPIC_PREFIX)
+        const char* topic_prefix = MOCCA_MQTT_TOPIC_PREFIX;
+#else
+        char topic_prefix[16];
+        snprintf(topic_prefix, sizeof(topic_prefix), "mocca/%06" PRIx32, device_id);
+#endif
+
+        _mqtt.init(topic_prefix, client_id);
+        _mqtt.set_command_callbacks(
+            [this](brew_command command, int64_t received_micros) { on_remote_brew_command(command, received_micros); },
+            [this](bool enabled, uint32_t secs) { on_remote_wake_set(enabled, secs); },
+            [this](const char* timezone) { return set_timezone(timezone); });
+        _mqtt.set_health_callback([this](runtime_metrics* metrics) { fill_metrics(metrics); });
+    }
+#endif
+
+#if MOCCA_FEATURE_SYNC
+    void mocca_wake::init_sync() {
+        uint32_t node_id = ESP.getEfuseMac() >> 16; // Low half of the MAC, unique on the LAN
+        _sync.init(sync_group, node_id, &_data);
+        _sync.set_callbacks(
+            [this](time_t wake, uint32_t wake_secs) { apply_synced_wake(wake, wake_secs); },
+            [this](const wake_alarm* alarms, size_t alarm_count) { set_wake_alarms(alarms, alarm_count); },
+            [this](const char* timezone) { return apply_synced_timezone(timezone); },
+            [this]() { save_persistent_data(); });
+        MOCCA_LOGI(core, "Syncing the schedule with group \"%s\" as node %08" PRIx32 ".", sync_group, node_id);
+    }
+
+    bool mocca_wake::apply_synced_timezone(const char* timezone) {
+        // The group already looked it up, the stored name has to match the synced version even before the rules are
+        // in. A failed lookup is retried from the stored name.
+        strlcpy(_data.timezone, timezone, sizeof(_data.timezone));
+        save_persistent_data();
+        return set_timezone(timezone);
+    }
+
+    void mocca_wake::apply_synced_wake(time_t wake, uint32_t wake_secs) {
+        MOCCA_LOGI(brew, "Brew time from the group: %s",
+                   wake != 0 ? local_date_time(wake, log_time_format).c_str() : "none");
+
+        _data.current_wake = wake;
+        _data.last_wake_secs = wake_secs;
+        save_persistent_data();
+        update_wake_schedule();
+    }
+#endif
+
+#if MOCCA_FEATURE_REMOTE
+    void mocca_wake::publish_snapshots() {
+#if MOCCA_FEATURE_WEB
+        // Small and what clients poll after a command, so it is fresh every tick.
+        device_state_info info;
+        build_device_state(&info);
+        portENTER_CRITICAL(&_snapshot_lock);
+        _state_snapshot = info;
+        portEXIT_CRITICAL(&_snapshot_lock);
+#endif
+
+        uint32_t now = millis();
+        if (_has_metrics_snapshot && now - _last_metrics_snapshot < metrics_snapshot_millis) {
+            return;
+        }
+        _has_metrics_snapshot = true;
+        _last_metrics_snapshot = now;
+
+        runtime_metrics metrics;
+        build_metrics(&metrics);
+        portENTER_CRITICAL(&_snapshot_lock);
+        _metrics_snapshot = metrics;
+        portEXIT_CRITICAL(&_snapshot_lock);
+    }
+
+    void mocca_wake::fill_metrics(runtime_metrics* metrics) {
+        // Called from the web server task too.
+        portENTER_CRITICAL(&_snapshot_lock);
+        *metrics = _metrics_snapshot;
+        portEXIT_CRITICAL(&_snapshot_lock);
+    }
+
+    void mocca_wake::build_metrics(runtime_metrics* metrics) {
+        *metrics = _metrics;
+        metrics->state = state_name(_state);
+        metrics->boiler_on_millis = boiler_on_millis();
+        metrics->boiler_safety = _boiler_supervisor.get_stats();
+        metrics->brew_lead_secs = _data.brew.lead_secs();
+        metrics->brew_duration_stddev_secs = _data.brew.stddev_secs();
+        if (_wifi.is_connected()) {
+            metrics->wifi_rssi = WiFi.RSSI();
+        }
+#if MOCCA_FEATURE_NTP
+        sntp_stats sntp = _sntp.get_stats();
+        if (sntp.last_sync != 0) {
+            metrics->ntp_sync_age_secs = ezt::now() - sntp.last_sync;
+        }
+        metrics->ntp_offset_micros = sntp.last_offset_micros;
+        metrics->ntp_drift_ppm = sntp.drift_ppm;
+        metrics->ntp_sync_interval_secs = sntp.sync_interval_secs;
+#endif
+        metrics->power = _power.get_stats(millis());
+        metrics->deep_sleep = get_deep_sleep_stats();
+        metrics->brew_history = _brew_history.get_stats();
+#if MOCCA_FEATURE_MQTT
+        metrics->mqtt = _mqtt.get_stats();
+#endif
+#if MOCCA_FEATURE_SYNC
+        metrics->sync = _sync.get_stats();
+#endif
+#if MOCCA_FEATURE_DISPLAY
+        metrics->input_latency = &_input_latency;
+#endif
+    }
+
+#if MOCCA_FEATURE_WEB
+    void mocca_wake::fill_device_state(device_state_info* info) {
+        // Called from the web server task like fill_metrics.
+        portENTER_CRITICAL(&_snapshot_lock);
+        *info = _state_snapshot;
+        portEXIT_CRITICAL(&_snapshot_lock);
     }
 
-    void mocca_wake::on_encoder_changed(int delta) {
-        //_log.printf("Encoder changed: %d\n", delta);
+    void mocca_wake::build_device_state(device_state_info* info) {
+        info->state = state_name(_state);
+        info->brewing = _state == state::brew;
+        info->heating = _boiler_supervisor.is_heating();
+        info->has_water = has_water();
+        info->has_pot = has_pot();
+        info->has_valid_time = _has_valid_time;
+        if (info->brewing) {
+            info->brew_heating_secs = (boiler_on_millis() - _brew_boiler_on_start) / MILLIS_PER_SEC;
+        }
+        info->wake = _data.current_wake;
+        info->wake_secs = _data.last_wake_secs;
+        info->next_wake = _wake_schedule.next_wake();
+    }
+#endif
+
+    void mocca_wake::on_remote_brew_command(brew_command command, int64_t received_micros) {
+        // Same transitions as brewing now or a long press on the device.
+        bool brewing = _state == state::brew;
+        if ((command == brew_command::start) == brewing || (command == brew_command::start && !has_water())) {
+            MOCCA_LOGW(brew, "Ignoring the remote %s in state %s.", command == brew_command::start ? "brew" : "cancel",
+                       state_name(_state));
+            _metrics.remote_commands.ignored++;
+            return;
+        }
+
+        _metrics.remote_commands.applied++;
+        _remote_command_micros = received_micros;
+        _remote_command_was_heating = _boiler_supervisor.is_heating();
+
+        if (command == brew_command::start) {
+            MOCCA_LOGI(brew, "Brew started remotely.");
+            start_brew(brew_trigger::remote);
+        } else {
+            MOCCA_LOGI(brew, "Brew cancelled remotely.");
+            end_brew(brew_end_reason::cancelled);
+            transition_to_state(state::idle);
+        }
+    }
+
+    void mocca_wake::on_remote_wake_set(bool enabled, uint32_t secs) {
+        if (!enabled) {
+            reset_brew_time();
+        } else if (_has_valid_time) {
+            set_brew_time(secs);
+        } else {
+            MOCCA_LOGW(brew, "Ignoring the remote brew time, the clock isn't set.");
+        }
+    }
+#endif
+
+#if MOCCA_FEATURE_DISPLAY
+    void mocca_wake::on_encoder_changed(int delta, uint32_t edge_micros) {
+        MOCCA_LOGD(input, "Encoder changed: %d", delta);
 
         switch (_state) {
         case state::sleep:
@@ -547,18 +1307,23 @@ namespace mocca {
             _time_input.on_encoder_changed(delta);
             break;
         case state::time_set:
+        case state::alarm_time_set:
             _time_input.on_encoder_changed(delta);
             break;
         case state::menu:
+        case state::alarm_days_set:
             _menu.on_encoder_changed(delta);
             break;
+        case state::alarm_list:
+            _alarm_list.on_encoder_changed(delta, millis());
+            break;
         }
 
-        on_any_input();
+        on_any_input(edge_micros);
     }
 
     void mocca_wake::on_encoder_button_clicked() {
-        _log.println("Encoder button clicked.");
+        MOCCA_LOGD(input, "Encoder button clicked.");
 
         switch (_state) {
         case state::sleep:
@@ -567,7 +1332,7 @@ namespace mocca {
             break;
         case state::wake_set:
             if (_time_input.is_on_default_option()) {
-                transition_to_state(state::brew);
+                start_brew(brew_trigger::manual);
             } else {
                 set_brew_time(_time_input.get_current_time());
                 transition_to_state(state::idle);
@@ -577,44 +1342,153 @@ namespace mocca {
             set_time(previousMidnight(_timezone.now()) + _time_input.get_current_time());
             transition_to_state(state::idle);
             break;
+        case state::alarm_time_set:
+            _new_alarm_secs = _time_input.get_current_time();
+            transition_to_state(state::alarm_days_set);
+            break;
         case state::menu:
+        case state::alarm_days_set:
             _menu.on_encoder_clicked();
             break;
+        case state::alarm_list:
+            toggle_wake_alarm(alarm_slot(_alarm_list.selected()));
+            _alarm_list.invalidate();
+            break;
         }
 
-        on_any_input();
+        on_any_input(_input_latency.take_edge(input_source::button, micros()));
     }
 
     void mocca_wake::on_encoder_button_double_clicked() {
-        _log.println("Encoder button double clicked.");
-        on_any_input();
+        MOCCA_LOGD(input, "Encoder button double clicked.");
+        on_any_input(_input_latency.take_edge(input_source::button, micros()));
     }
 
     void mocca_wake::on_encoder_button_long_pressed() {
-        _log.println("Encoder button long pressed.");
+        MOCCA_LOGD(input, "Encoder button long pressed.");
 
         switch (_state) {
         case state::sleep:
         case state::idle:
             transition_to_state(state::menu);
             break;
+        case state::menu:
+            if (!_menu.back()) {
+                transition_to_state(state::idle);
+            }
+            break;
+        case state::alarm_list:
+            transition_to_state(state::idle);
+            break;
         case state::brew:
+            end_brew(brew_end_reason::cancelled);
             transition_to_state(state::idle);
             break;
         }
 
-        on_any_input();
+        on_any_input(_input_latency.take_edge(input_source::button, micros()));
     }
 
-    void mocca_wake::on_any_input() {
+    void mocca_wake::on_any_input(uint32_t edge_micros) {
         _last_input_time = millis();
+        _input_latency.on_input_handled(edge_micros);
+        // Back to full power before this loop's frame is drawn.
+        update_power_tier();
     }
 
+    void mocca_wake::update_network_load() {
+#if MOCCA_FEATURE_WEB
+        const admission_stats& stats = _config_web_server.get_admission_stats();
+        uint32_t request_count = stats.admitted + stats.rate_limited + stats.overloaded;
+        uint32_t requests_per_sec = request_count - _last_web_request_count;
+        _last_web_request_count = request_count;
+
+        if (requests_per_sec >= heavy_network_load_requests_per_sec) {
+            _network_load = network_load::heavy;
+        } else if (requests_per_sec > 0) {
+            _network_load = network_load::light;
+        } else {
+            _network_load = network_load::quiet;
+        }
+#endif
+    }
+#endif
+
+    power_tier mocca_wake::desired_power_tier() const {
+        switch (_state) {
+        case state::sleep:
+            return power_tier::sleep;
+        case state::idle:
+            return millis() - _last_input_time < no_input_to_dim_millis ? power_tier::active : power_tier::idle;
+        default:
+            return power_tier::active;
+        }
+    }
+
+    void mocca_wake::update_power_tier() {
+        _power.set_tier(desired_power_tier(), millis());
+    }
+
+#if MOCCA_FEATURE_WIFI
     void mocca_wake::on_wifi_connected() {
-        synchronize_time(time_sync_wait_secs);
+        MOCCA_LOGI(wifi, "Connected to \"%s\". IP: %s.", _wifi.ssid(), WiFi.localIP().toString().c_str());
+        _metrics.wifi_reconnects++;
+
+        if (strcmp(_data.wifi_ssid, _wifi.ssid()) != 0 || strcmp(_data.wifi_password, _wifi.password()) != 0 ||
+            !_data.wifi_known_good) {
+            strlcpy(_data.wifi_ssid, _wifi.ssid(), sizeof(_data.wifi_ssid));
+            strlcpy(_data.wifi_password, _wifi.password(), sizeof(_data.wifi_password));
+            _data.wifi_known_good = 1;
+            save_persistent_data();
+        }
+
+#if MOCCA_FEATURE_NTP
+        _sntp.start();
+#endif
+#if MOCCA_FEATURE_MQTT
+        _mqtt.start(mqtt_broker, mqtt_port);
+#endif
+#if MOCCA_FEATURE_SYNC
+        _sync.start(sync_group_address, sync_port);
+#endif
     }
 
-    void mocca_wake::on_wifi_disconnected() {}
+    void mocca_wake::on_wifi_disconnected() {
+        MOCCA_LOGI(wifi, "Disconnected.");
+#if MOCCA_FEATURE_NTP
+        _sntp.stop();
+#endif
+#if MOCCA_FEATURE_MQTT
+        _mqtt.stop();
+#endif
+#if MOCCA_FEATURE_SYNC
+        _sync.stop();
+#endif
+    }
+
+    void mocca_wake::poll_timezone_lookup() {
+        char name[timezone_lookup::max_name_length + 1];
+        char posix[timezone_lookup::max_posix_length + 1];
+        if (_timezone_lookup.take_result(name, sizeof(name), posix, sizeof(posix))) {
+            if (posix[0] != '\0' && _timezone.setPosix(posix)) {
+                apply_timezone(name);
+            } else {
+                MOCCA_LOGW(time, "Setting timezone to %s failed.", name);
+                // Only the stored one is worth trying again, a rejected new one is dropped.
+                if (strcmp(name, _data.timezone) == 0) {
+                    _timezone_retry_pending = true;
+                    _timezone_retry_time = millis();
+                }
+            }
+        }
+
+        if (_timezone_retry_pending && _wifi.is_connected() &&
+            millis() - _timezone_retry_time >= timezone_retry_millis) {
+            _timezone_retry_pending = false;
+            set_timezone(_data.timezone);
+        }
+    }
+#endif
 
     bool mocca_wake::has_water() const {
         return _water_switch.get_state();
@@ -624,42 +1498,288 @@ namespace mocca {
         return _pot_switch.get_state();
     }
 
+    uint32_t mocca_wake::boiler_on_millis() const {
+        uint32_t on_millis = _metrics.boiler_on_millis;
+        if (_boiler_on) {
+            on_millis += millis() - _boiler_on_since;
+        }
+        return on_millis;
+    }
+
     void mocca_wake::set_boiler_state(bool on) {
-        digitalWrite(_boiler_ssr_pin, on ? HIGH : LOW);
+        if (on != _boiler_on) {
+            if (_boiler_on) {
+                _metrics.boiler_on_millis += millis() - _boiler_on_since;
+            } else {
+                _boiler_on_since = millis();
+            }
+            _boiler_on = on;
+        }
+
+        _boiler_supervisor.request(on);
     }
 
-    void mocca_wake::reset_brew_time() {}
+    void mocca_wake::start_brew(brew_trigger trigger) {
+        if (_state == state::brew) {
+            return; // A second start would restart the brew's accounting and log it twice
+        }
+        transition_to_state(state::brew);
+        record_brew_event(brew_event_kind::started, static_cast<uint8_t>(trigger), 0);
+    }
 
-    void mocca_wake::set_brew_time(uint32_t secs) {
-        // Find the next time_t that this "secs" will happen
-        time_t now = _timezone.now();
-        time_t t = previousMidnight(now) + secs;
-        if (t < now) {
-            t += SECS_PER_DAY;
+    void mocca_wake::end_brew(brew_end_reason reason) {
+        uint32_t boiler_secs = (boiler_on_millis() - _brew_boiler_on_start) / MILLIS_PER_SEC;
+        MOCCA_LOGI(brew, "Brew ended after %" PRIu32 " s of heating.", boiler_secs);
+        record_brew_event(brew_event_kind::ended, static_cast<uint8_t>(reason), boiler_secs);
+
+        // Cancelled brews and brews started without water say nothing about how long a pot takes.
+        if (reason != brew_end_reason::finished || boiler_secs < min_brew_sample_secs) {
+            return;
+        }
+
+        _data.brew.add_sample(boiler_secs);
+        save_persistent_data();
+
+        if (_brew_ready_target != 0) {
+            _metrics.last_ready_error_secs = ezt::now() - _brew_ready_target;
+            MOCCA_LOGI(brew,
+                       "Coffee ready %" PRId32 " s from the scheduled time. Next brews start %" PRIu32 " s early.",
+                       _metrics.last_ready_error_secs, _data.brew.lead_secs());
         }
 
-        _log.print("Setting brew time to: ");
-        _log.println(_timezone.dateTime(t));
+        _awaiting_pot_removal = true;
+        _brew_finished_time = millis();
+    }
+
+    void mocca_wake::record_brew_event(brew_event_kind kind, uint8_t reason, uint32_t boiler_on_secs) {
+        brew_event event;
+        event.time = ezt::now();
+        event.kind = kind;
+        event.reason = reason;
+        event.boiler_on_secs = boiler_on_secs;
+#if MOCCA_FEATURE_MQTT
+        _mqtt.report_brew_event(event);
+#endif
+
+        // Events are stored by time, without a clock there is nothing to place them at.
+        if (!_has_valid_time) {
+            return;
+        }
+        if (!_brew_history.append(event)) {
+            MOCCA_LOGW(brew, "Failed to record the brew %s.", brew_event_kind_name(kind));
+        }
+    }
+
+    void mocca_wake::reset_brew_time() {
+        MOCCA_LOGI(brew, "Clearing brew time.");
+
+        _data.current_wake = 0;
+#if MOCCA_FEATURE_SYNC
+        _sync.on_local_change(sync_record::wake);
+#endif
+        save_persistent_data();
+        update_wake_schedule();
+    }
+
+    void mocca_wake::set_brew_time(uint32_t secs) {
+        time_t t = _local_time.next_local_time_of_day(secs, ezt::now());
+
+        MOCCA_LOGI(brew, "Setting brew time to: %s", local_date_time(t, log_time_format).c_str());
 
         _data.current_wake = t;
         _data.last_wake_secs = secs;
+#if MOCCA_FEATURE_SYNC
+        _sync.on_local_change(sync_record::wake);
+#endif
+        save_persistent_data();
+        update_wake_schedule();
+    }
+
+    void mocca_wake::update_wake_schedule() {
+        time_t now = ezt::now();
+        if (!_local_time.covers(now) || !_local_time.covers(now + SECS_PER_WEEK + SECS_PER_DAY)) {
+            _local_time.build(&_timezone, now);
+        }
+
+        _wake_schedule.recompute(_data.wake_alarms, max_wake_alarms, _data.current_wake, _data.skip_wakes_until, now,
+                                 _local_time);
+    }
+
+    String mocca_wake::local_date_time(time_t utc, const char* format) {
+        return _timezone.dateTime(_local_time.to_local(utc), format);
+    }
+
+    void mocca_wake::on_wake() {
+        time_t ready_target = _wake_schedule.next_wake();
+
+        // The wake fires its brew lead early and would stay due until its time, so it is used up right away.
+        _data.skip_wakes_until = std::max(_data.skip_wakes_until, ready_target);
+        save_persistent_data();
+
+        if (_state == state::brew) {
+            MOCCA_LOGI(brew, "Already brewing, nothing to start for: %s",
+                       local_date_time(ready_target, log_time_format).c_str());
+        } else {
+            MOCCA_LOGI(brew, "Starting brew to be ready at: %s",
+                       local_date_time(ready_target, log_time_format).c_str());
+            start_brew(brew_trigger::scheduled);
+            _brew_ready_target = ready_target;
+        }
+
+        update_wake_schedule();
+    }
+
+    void mocca_wake::skip_next_wake() {
+        if (!_wake_schedule.has_next_wake()) {
+            return;
+        }
+
+        MOCCA_LOGI(brew, "Skipping brew at: %s", local_date_time(_wake_schedule.next_wake(), log_time_format).c_str());
+
+        _data.skip_wakes_until = _wake_schedule.next_wake();
+        save_persistent_data();
+        update_wake_schedule();
+    }
+
+    bool mocca_wake::add_wake_alarm(uint32_t secs, uint8_t days) {
+        for (wake_alarm& alarm : _data.wake_alarms) {
+            if (!alarm.is_used()) {
+                alarm.minute_of_day = secs / SECS_PER_MIN;
+                alarm.days = days;
+                alarm.enabled = true;
+#if MOCCA_FEATURE_SYNC
+                _sync.on_local_change(sync_record::alarms);
+#endif
+                save_persistent_data();
+                update_wake_schedule();
+                return true;
+            }
+        }
+
+        MOCCA_LOGW(brew, "No free wake alarm slots.");
+        return false;
+    }
+
+    void mocca_wake::set_wake_alarms(const wake_alarm* alarms, size_t alarm_count) {
+        alarm_count = std::min(alarm_count, max_wake_alarms);
+        for (size_t alarm_idx = 0; alarm_idx < max_wake_alarms; alarm_idx++) {
+            _data.wake_alarms[alarm_idx] = alarm_idx < alarm_count ? alarms[alarm_idx] : wake_alarm();
+        }
+#if MOCCA_FEATURE_SYNC
+        _sync.on_local_change(sync_record::alarms);
+#endif
+        save_persistent_data();
+        update_wake_schedule();
+    }
+
+    void mocca_wake::clear_wake_alarms() {
+        set_wake_alarms(nullptr, 0);
+    }
+
+    void mocca_wake::toggle_wake_alarm(size_t slot) {
+        if (slot >= max_wake_alarms) {
+            return;
+        }
+
+        _data.wake_alarms[slot].enabled = !_data.wake_alarms[slot].enabled;
+#if MOCCA_FEATURE_SYNC
+        _sync.on_local_change(sync_record::alarms);
+#endif
         save_persistent_data();
+        update_wake_schedule();
+    }
 
-        // TODO: Make the wake up event
+    bool mocca_wake::has_wake_alarms() const {
+        return std::any_of(std::begin(_data.wake_alarms), std::end(_data.wake_alarms),
+                           [](const wake_alarm& alarm) { return alarm.is_used(); });
     }
 
     void mocca_wake::reset_settings() {
         init_default_data(&_data);
+#if MOCCA_FEATURE_SYNC
+        _sync.adopt_local_values(); // Takes the group's schedule back once connected
+#endif
         save_persistent_data();
-        connect_to_wifi_or_fallback_to_ap(_data.wifi_ssid, _data.wifi_password, wifi_wait_millis, config_ap_ssid);
+        update_wake_schedule();
+#if MOCCA_FEATURE_WIFI
+        _wifi.connect(_data.wifi_ssid, _data.wifi_password, _data.wifi_known_good != 0);
+#endif
+    }
+
+    void mocca_wake::handle_serial_commands() {
+        while (_console.available() > 0) {
+            switch (_console.read()) {
+            case 't':
+                _task_monitor.print_stats(_console);
+                break;
+#if MOCCA_FEATURE_WEB
+            case 'w': {
+                const admission_stats& stats = _config_web_server.get_admission_stats();
+                _console.printf("Web requests admitted: %" PRIu32 ", rate limited: %" PRIu32 ", overloaded: %" PRIu32
+                                ", collapsed commands: %" PRIu32 "\n",
+                                stats.admitted, stats.rate_limited, stats.overloaded, stats.collapsed_commands);
+            } break;
+#endif
+            case 'p': {
+                power_stats stats = _power.get_stats(millis());
+                for (size_t tier_idx = 0; tier_idx < power_tier_count; tier_idx++) {
+                    _console.printf("Power tier %s: %" PRIu32 " s\n",
+                                    power_tier_name(static_cast<power_tier>(tier_idx)),
+                                    stats.tier_millis[tier_idx] / MILLIS_PER_SEC);
+                }
+                _console.printf("Power tier changes: %" PRIu32 ", worst wake: %" PRIu32 " us\n", stats.tier_changes,
+                                stats.worst_wake_micros);
+            } break;
+#if MOCCA_FEATURE_DISPLAY
+            case 'l': {
+                state_latency row;
+                for (size_t state_idx = 0; _input_latency.copy_state(state_idx, &row); state_idx++) {
+                    for (size_t load_idx = 0; load_idx < network_load_count; load_idx++) {
+                        const latency_histogram& histogram = row.by_load[load_idx];
+                        if (histogram.count == 0) {
+                            continue;
+                        }
+                        _console.printf("Input latency %s/%s: %" PRIu32 " inputs, mean %" PRIu32 " ms, buckets",
+                                        row.state, network_load_name(static_cast<network_load>(load_idx)),
+                                        histogram.count, histogram.sum_millis / histogram.count);
+                        for (uint32_t bucket : histogram.buckets) {
+                            _console.printf(" %" PRIu32, bucket);
+                        }
+                        _console.printf("\n");
+                    }
+                }
+            } break;
+#endif
+            }
+        }
     }
 
     void mocca_wake::transition_to_state(state new_state) {
-        _log.printf("Transition %s to %s\n", state_name(_state), state_name(new_state));
+        MOCCA_LOGI(core, "Transition %s to %s.", state_name(_state), state_name(new_state));
         _state = new_state;
+#if MOCCA_FEATURE_MQTT
+        _mqtt.report_state(state_name(_state));
+#endif
 
         // Reset the last input time so that we don't transition multiple states too quickly.
         _last_input_time = millis();
+        update_power_tier();
+
+        if (_state == state::brew) {
+            _brew_boiler_on_start = boiler_on_millis();
+            _brew_ready_target = 0;
+            _awaiting_pot_removal = false;
+        }
+
+#if MOCCA_FEATURE_DISPLAY
+        enter_screen();
+#endif
+    }
+
+#if MOCCA_FEATURE_DISPLAY
+    void mocca_wake::enter_screen() {
+        // Layout only changes with the state, frames after this redraw just the widgets whose content changed.
+        layout_screen();
 
         switch (_state) {
         case state::sleep:
@@ -676,34 +1796,119 @@ namespace mocca {
             _time_input.set_current_time(now - previousMidnight(now), nullptr);
         } break;
 
-        case state::menu: {
-            std::vector<rotary_menu_option> options;
-            if (_data.current_wake > _timezone.now()) {
-                options.push_back({
-                    "Clear brew",
-                    [this]() {
-                        reset_brew_time();
-                        transition_to_state(state::idle);
-                    },
-                });
-            }
-            options.push_back({"Reset", [this]() {
-                                   reset_settings();
-                                   transition_to_state(state::idle);
-                               }});
-            options.push_back({
-                "Set time",
-                [this]() { transition_to_state(state::time_set); },
-            });
-            options.push_back({
-                "Status",
-                [this]() { transition_to_state(state::status); },
-            });
-            _menu.set_menu_options(std::move(options), 0);
-        } break;
+        case state::menu:
+            _menu.open(&main_menu, this);
+            break;
 
-        case state::brew:
+        case state::alarm_time_set:
+            _time_input.set_current_time(_data.last_wake_secs, nullptr);
+            break;
+
+        case state::alarm_days_set:
+            _menu.open(&alarm_days_menu, this);
+            break;
+
+        case state::alarm_list:
+            _alarm_list.open(this);
             break;
         }
     }
+
+    bool mocca_wake::is_menu_item_visible(uint8_t action) const {
+        switch (static_cast<menu_action>(action)) {
+        case menu_action::clear_brew:
+            return _data.current_wake > ezt::now();
+        case menu_action::skip_next:
+            return _wake_schedule.has_next_wake();
+        case menu_action::edit_alarms:
+        case menu_action::clear_alarms:
+            return has_wake_alarms();
+        case menu_action::low_power_on:
+            return !_data.low_power_enabled;
+        case menu_action::low_power_off:
+            return _data.low_power_enabled;
+        default:
+            return true;
+        }
+    }
+
+    void mocca_wake::on_menu_item_clicked(uint8_t action, uint8_t argument) {
+        switch (static_cast<menu_action>(action)) {
+        case menu_action::clear_brew:
+            reset_brew_time();
+            transition_to_state(state::idle);
+            break;
+        case menu_action::skip_next:
+            skip_next_wake();
+            transition_to_state(state::idle);
+            break;
+        case menu_action::add_alarm:
+            transition_to_state(state::alarm_time_set);
+            break;
+        case menu_action::add_alarm_days:
+            add_wake_alarm(_new_alarm_secs, argument);
+            transition_to_state(state::idle);
+            break;
+        case menu_action::edit_alarms:
+            transition_to_state(state::alarm_list);
+            break;
+        case menu_action::clear_alarms:
+            clear_wake_alarms();
+            transition_to_state(state::idle);
+            break;
+        case menu_action::reset:
+            reset_settings();
+            transition_to_state(state::idle);
+            break;
+        case menu_action::low_power_on:
+        case menu_action::low_power_off:
+            _data.low_power_enabled = static_cast<menu_action>(action) == menu_action::low_power_on;
+            save_persistent_data();
+            transition_to_state(state::idle);
+            break;
+        case menu_action::set_time:
+            transition_to_state(state::time_set);
+            break;
+        case menu_action::status:
+            transition_to_state(state::status);
+            break;
+        }
+    }
+
+    size_t mocca_wake::list_size() const {
+        return std::count_if(std::begin(_data.wake_alarms), std::end(_data.wake_alarms),
+                             [](const wake_alarm& alarm) { return alarm.is_used(); });
+    }
+
+    void mocca_wake::list_label(size_t row, char* out, size_t out_size) const {
+        size_t slot = alarm_slot(row);
+        if (slot >= max_wake_alarms) {
+            strlcpy(out, "", out_size);
+            return;
+        }
+
+        const wake_alarm& alarm = _data.wake_alarms[slot];
+        uint32_t hour = alarm.minute_of_day / 60;
+        uint32_t minute = alarm.minute_of_day % 60;
+        const char* days = "Custom";
+        if (alarm.days == wake_every_day) {
+            days = "Every day";
+        } else if (alarm.days == wake_weekdays) {
+            days = "Weekdays";
+        } else if (alarm.days == wake_weekends) {
+            days = "Weekends";
+        }
+        snprintf(out, out_size, "%c %2" PRIu32 ":%02" PRIu32 " %s %s", alarm.enabled ? '*' : ' ',
+                 hour % 12 == 0 ? 12 : hour % 12, minute, hour < 12 ? "am" : "pm", days);
+    }
+
+    size_t mocca_wake::alarm_slot(size_t row) const {
+        for (size_t slot = 0; slot < max_wake_alarms; slot++) {
+            if (_data.wake_alarms[slot].is_used() && row-- == 0) {
+                return slot;
+            }
+        }
+        return max_wake_alarms;
+    }
+#endif
 } // namespace mocca
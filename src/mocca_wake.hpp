@@ -1,13 +1,42 @@
 #pragma once
 
-#include "config_web_server.hpp"
+#include "boiler_supervisor.hpp"
+#include "brew_history.hpp"
+#include "deep_sleep.hpp"
+#include "features.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "ota_partition.hpp"
 #include "persistent_data.hpp"
-#include "rotary_menu.hpp"
+#include "power_manager.hpp"
+#include "task_monitor.hpp"
+#include "timezone_lookup.hpp"
 #include "util.hpp"
 
+#if MOCCA_FEATURE_DISPLAY
+#include "input_latency.hpp"
+#include "rotary_menu.hpp"
+#include "widgets.hpp"
+
 #include <Adafruit_SSD1306.h>
 #include <ESP32Encoder.h>
 #include <OneButton.h>
+#endif
+#if MOCCA_FEATURE_WEB
+#include "config_web_server.hpp"
+#endif
+#if MOCCA_FEATURE_NTP
+#include "sntp_client.hpp"
+#endif
+#if MOCCA_FEATURE_WIFI
+#include "wifi_manager.hpp"
+#endif
+#if MOCCA_FEATURE_MQTT
+#include "mqtt_bridge.hpp"
+#endif
+#if MOCCA_FEATURE_SYNC
+#include "schedule_sync.hpp"
+#endif
 
 namespace mocca {
     enum class state {
@@ -18,21 +47,34 @@ namespace mocca {
         menu,
         status,
         brew,
+        alarm_time_set,
+        alarm_days_set,
+        alarm_list,
     };
 
-    class mocca_wake {
+    class mocca_wake
+#if MOCCA_FEATURE_DISPLAY
+        : private rotary_menu_handler,
+          private rotary_list_source
+#endif
+    {
       public:
-        mocca_wake(Stream& log);
+        mocca_wake(Stream& console);
 
         bool init(int encoder_pin_a, int encoder_pin_b, int encoder_button_pin, int water_switch_pin,
                   int pot_switch_pin, int boiler_ssr_pin, int persistent_data_addr);
 
+        // Ends by sleeping until the next tick is due or something needs the loop sooner.
         void step();
 
       private:
+#if MOCCA_FEATURE_DISPLAY
         void draw_init_screen(const char* step_name, size_t step_index, size_t step_count);
-        void draw_notification_bar(const box& area, box* out_content_area);
-        void draw_time_to_idle_bar();
+        box layout_frame(); // Returns the content area
+        void layout_screen();
+        void render_screen();
+        void update_notification_bar();
+        void update_time_to_idle_bar();
         void draw_sleep_screen();
         void draw_idle_screen();
         void draw_wake_set_screen();
@@ -40,61 +82,203 @@ namespace mocca {
         void draw_menu_screen();
         void draw_status_screen();
         void draw_brew_screen();
+        void draw_screen();
+        void enter_screen();
+        void flush_display();
+
+        void on_encoder_changed(int delta, uint32_t edge_micros);
+        void on_encoder_button_clicked();
+        void on_encoder_button_double_clicked();
+        void on_encoder_button_long_pressed();
+        void on_any_input(uint32_t edge_micros); // Interrupt time of the edge behind the input
+        void update_network_load();
+#endif
 
         void set_time(time_t time);
-        bool synchronize_time(uint16_t timeout_secs);
-        bool set_timezone(const char* timezone);
-        void connect_to_wifi_or_fallback_to_ap(const char* ssid, const char* pass, uint32_t timeout_millis,
-                                               const char* fallback_ap_name);
-        bool is_wifi_connected() const;
+        void update_clock_from_system();
+        bool set_timezone(const char* timezone); // Names apply once looked up, returns false if it can't be
+        void apply_timezone(const char* timezone);
 
         void save_persistent_data();
 
-        void on_encoder_changed(int delta);
-        void on_encoder_button_clicked();
-        void on_encoder_button_double_clicked();
-        void on_encoder_button_long_pressed();
-        void on_any_input();
+        power_tier desired_power_tier() const;
+        void update_power_tier();
 
+#if MOCCA_FEATURE_NTP
+        void on_time_synced();
+#endif
+#if MOCCA_FEATURE_WIFI
+        void start_wifi();
         void on_wifi_connected();
         void on_wifi_disconnected();
+        void poll_timezone_lookup();
+#endif
+#if MOCCA_FEATURE_WEB
+        void start_web_server();
+        void build_device_state(device_state_info* info);
+        void fill_device_state(device_state_info* info);
+#endif
+#if MOCCA_FEATURE_MQTT
+        void init_mqtt();
+#endif
+#if MOCCA_FEATURE_SYNC
+        void init_sync();
+        bool apply_synced_timezone(const char* timezone);
+        void apply_synced_wake(time_t wake, uint32_t wake_secs);
+#endif
+#if MOCCA_FEATURE_REMOTE
+        void publish_snapshots();
+        void build_metrics(runtime_metrics* metrics);
+        void fill_metrics(runtime_metrics* metrics);
+        void on_remote_brew_command(brew_command command, int64_t received_micros);
+        void on_remote_wake_set(bool enabled, uint32_t secs);
+#endif
 
         bool has_water() const;
         bool has_pot() const;
 
         void set_boiler_state(bool on);
+        uint32_t boiler_on_millis() const;
+
+        void start_brew(brew_trigger trigger);
+        void end_brew(brew_end_reason reason);
+        void record_brew_event(brew_event_kind kind, uint8_t reason, uint32_t boiler_on_secs);
 
         void reset_brew_time();
         void set_brew_time(uint32_t secs);
 
+        void update_wake_schedule();
+        String local_date_time(time_t utc, const char* format);
+        void on_wake();
+        void skip_next_wake();
+        bool add_wake_alarm(uint32_t secs, uint8_t days);
+        void set_wake_alarms(const wake_alarm* alarms, size_t alarm_count);
+        void clear_wake_alarms();
+        void toggle_wake_alarm(size_t slot);
+        bool has_wake_alarms() const;
+
         void reset_settings();
 
+        void start_network();
+        void resume_from_deep_sleep(deep_sleep_wake wake);
+        void try_enter_deep_sleep();
+        uint32_t deep_sleep_lead_secs() const;
+        void set_deep_sleep_lead(uint32_t secs);
+        void update_boot_check();
+        void wait_for_next_tick();
+
+        void handle_serial_commands();
+
         void transition_to_state(state new_state);
 
-        Stream& _log;
+#if MOCCA_FEATURE_DISPLAY
+        bool is_menu_item_visible(uint8_t action) const override;
+        void on_menu_item_clicked(uint8_t action, uint8_t argument) override;
+
+        size_t list_size() const override;
+        void list_label(size_t row, char* out, size_t out_size) const override;
+        size_t alarm_slot(size_t row) const; // Slot of the row-th used alarm, max_wake_alarms if there is none
+#endif
+
+        Stream& _console; // Serial commands, log output goes through the logger
 
         int _persistent_data_addr = 0;
         persistent_data _data;
 
-        Adafruit_SSD1306 _display;
-        int64_t _last_encoder_count = 0;
-        ESP32Encoder _encoder;
-        OneButton _encoder_button;
         binary_switch _water_switch;
         binary_switch _pot_switch;
         int _boiler_ssr_pin = -1;
+        boiler_supervisor _boiler_supervisor;
+        brew_history _brew_history;
+        power_manager _power;
+        ota_boot_check _boot_check;
+        bool _update_restart_pending = false; // A verified update is waiting for the brew to finish
+        uint32_t _update_ready_time = 0;
+        int _encoder_button_pin = -1; // Also wakes from deep sleep, -1 without the rotary UI
         uint32_t _last_input_time = 0;
         uint32_t _last_pot_time = 0;
 
+#if MOCCA_FEATURE_DISPLAY
+        Adafruit_SSD1306 _display;
+        int64_t _last_encoder_count = 0;
+        ESP32Encoder _encoder;
+        OneButton _encoder_button;
+        input_latency_tracker _input_latency;
+        network_load _network_load = network_load::quiet;
+        uint32_t _last_web_request_count = 0;
+
         rotary_time_input _time_input;
         rotary_menu _menu;
+        rotary_list _alarm_list;
 
-        Timezone _timezone;
+        widget_screen _screen;
+        notification_bar_widget _notification_bar;
+        label_widget _main_label;
+        label_widget _left_arrow;
+        label_widget _right_arrow;
+        label_widget _hint;
+        label_widget _status_text;
+        progress_bar_widget _idle_bar;
+        bool _flushed_this_frame = false;
+#if MOCCA_FEATURE_WEB
+        screen_mirror _screen_mirror; // What the display shows, for /screen
+#endif
+#endif
 
-        bool _wifi_connected = false;
+        wake_schedule _wake_schedule;
+        uint32_t _new_alarm_secs = 0;
+
+        Timezone _timezone;
+        local_time_table _local_time;
+        uint32_t _last_clock_update = 0;
         bool _has_valid_time = false;
+        bool _network_pending = false; // Network start deferred after resuming from deep sleep
+        bool _boiler_on_after_wake_pending = false; // Timer wake from deep sleep whose brew hasn't heated yet
 
+#if MOCCA_FEATURE_NTP
+        sntp_client _sntp;
+#endif
+#if MOCCA_FEATURE_WIFI
+        wifi_manager _wifi;
+        timezone_lookup _timezone_lookup;
+        bool _timezone_retry_pending = false; // The stored timezone couldn't be looked up
+        uint32_t _timezone_retry_time = 0;
+#endif
+#if MOCCA_FEATURE_WEB
         config_web_server _config_web_server;
+#endif
+#if MOCCA_FEATURE_MQTT
+        mqtt_bridge _mqtt;
+#endif
+#if MOCCA_FEATURE_SYNC
+        schedule_sync _sync;
+#endif
+#if MOCCA_FEATURE_REMOTE
+        int64_t _remote_command_micros = 0; // Request time of a brew command applied this tick, 0 if none
+        bool _remote_command_was_heating = false;
+
+        // Built on the control loop and copied out by the web server task under the lock.
+        portMUX_TYPE _snapshot_lock = portMUX_INITIALIZER_UNLOCKED;
+        runtime_metrics _metrics_snapshot;
+        bool _has_metrics_snapshot = false;
+        uint32_t _last_metrics_snapshot = 0;
+#if MOCCA_FEATURE_WEB
+        device_state_info _state_snapshot;
+#endif
+#endif
+
+        task_monitor _task_monitor;
+
+        runtime_metrics _metrics;
+        uint32_t _loop_iterations = 0;
+        uint32_t _loop_rate_window_start = 0;
+        bool _boiler_on = false;
+        uint32_t _boiler_on_since = 0;
+
+        uint32_t _brew_boiler_on_start = 0; // boiler_on_millis() when the current brew started
+        time_t _brew_ready_target = 0;      // When a scheduled brew should be done, 0 for manual brews
+        bool _awaiting_pot_removal = false;
+        uint32_t _brew_finished_time = 0;
 
         state _state = state::idle;
     };
@@ -0,0 +1,202 @@
+#include "mqtt_bridge.hpp"
+
+#include "logger.hpp"
+#include "persistent_data.hpp"
+#include "util.hpp"
+#include "wake_schedule.hpp"
+
+#include <cinttypes>
+#include <cstdarg>
+
+namespace mocca {
+    namespace {
+        constexpr uint16_t keep_alive_secs = 60;
+        constexpr uint32_t batch_window = MILLIS_PER_SEC * 2; // Events this close together go out as one message
+        constexpr uint32_t health_interval = MILLIS_PER_MIN;
+        constexpr size_t max_event_length = 64;
+        constexpr size_t max_command_payload = sizeof(persistent_data::timezone) - 1;
+    } // namespace
+
+    mqtt_bridge::mqtt_bridge()
+        : _client(&_transport) {}
+
+    void mqtt_bridge::init(const char* topic_prefix, const char* client_id) {
+        snprintf(_status_topic, sizeof(_status_topic), "%s/status", topic_prefix);
+        snprintf(_events_topic, sizeof(_events_topic), "%s/events", topic_prefix);
+        snprintf(_health_topic, sizeof(_health_topic), "%s/health", topic_prefix);
+        _command_prefix_length = snprintf(_command_filter, sizeof(_command_filter), "%s/cmd/", topic_prefix);
+        strlcat(_command_filter, "+", sizeof(_command_filter));
+        strlcpy(_client_id, client_id, sizeof(_client_id));
+
+        _client.set_session(_client_id, keep_alive_secs, _status_topic);
+        _client.subscribe(_command_filter);
+        _client.set_message_callback([this](const char* topic, const uint8_t* payload, size_t size, bool retained) {
+            on_message(topic, payload, size, retained);
+        });
+    }
+
+    void mqtt_bridge::set_command_callbacks(mqtt_brew_command_callback brew_callback,
+                                            mqtt_wake_set_callback wake_callback,
+                                            mqtt_timezone_callback timezone_callback) {
+        _brew_callback = brew_callback;
+        _wake_callback = wake_callback;
+        _timezone_callback = timezone_callback;
+    }
+
+    void mqtt_bridge::set_health_callback(mqtt_health_callback callback) {
+        _health_callback = callback;
+    }
+
+    void mqtt_bridge::start(const char* host, uint16_t port) {
+        MOCCA_LOGI(mqtt, "Publishing to %s:%u as %s.", host, port, _client_id);
+        _client.start(host, port);
+    }
+
+    void mqtt_bridge::stop() {
+        _client.stop();
+    }
+
+    void mqtt_bridge::report_state(const char* state) {
+        add_event("\"state\",\"%s\"", state);
+    }
+
+    void mqtt_bridge::report_switches(bool has_water, bool has_pot) {
+        if (!_has_switches || has_water != _has_water) {
+            add_event("\"water\",%d", has_water);
+        }
+        if (!_has_switches || has_pot != _has_pot) {
+            add_event("\"pot\",%d", has_pot);
+        }
+        _has_switches = true;
+        _has_water = has_water;
+        _has_pot = has_pot;
+    }
+
+    void mqtt_bridge::report_brew_event(const brew_event& event) {
+        if (event.kind == brew_event_kind::ended) {
+            add_event("\"brew\",\"ended\",\"%s\",%" PRIu32, brew_event_reason_name(event), event.boiler_on_secs);
+        } else {
+            add_event("\"brew\",\"started\",\"%s\"", brew_event_reason_name(event));
+        }
+    }
+
+    void mqtt_bridge::step(uint32_t now, time_t utc) {
+        _utc = utc;
+
+        if (_events_length > 0 && now - _batch_start >= batch_window) {
+            flush_events();
+        }
+        if (_health_callback && _client.is_connected() && now - _last_health >= health_interval) {
+            publish_health(now);
+        }
+
+        _client.step(now);
+    }
+
+    mqtt_stats mqtt_bridge::get_stats() const {
+        return _client.get_stats();
+    }
+
+    void mqtt_bridge::add_event(const char* format, ...) {
+        uint32_t now = millis();
+
+        char event[max_event_length];
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(event, sizeof(event), format, args);
+        va_end(args);
+        if (length < 0 || static_cast<size_t>(length) >= sizeof(event)) {
+            return;
+        }
+
+        // [ms,...] plus the separating comma.
+        if (_events_length + length + 16 > sizeof(_events)) {
+            flush_events();
+        }
+        if (_events_length == 0) {
+            _batch_start = now;
+        }
+        _events_length += snprintf(_events + _events_length, sizeof(_events) - _events_length, "%s[%" PRIu32 ",%s]",
+                                   _events_length > 0 ? "," : "", now, event);
+    }
+
+    void mqtt_bridge::flush_events() {
+        // The receiver places events with up and time, the clock may only get set after the first events.
+        char payload[sizeof(_events) + 64];
+        int length = snprintf(payload, sizeof(payload), "{\"up\":%" PRIu32 ",\"time\":%" PRId64 ",\"events\":[%s]}",
+                              static_cast<uint32_t>(millis()), static_cast<int64_t>(_utc), _events);
+        _client.publish(_events_topic, reinterpret_cast<const uint8_t*>(payload), length, mqtt_qos::at_least_once,
+                        false);
+
+        _events_length = 0;
+        _events[0] = '\0';
+    }
+
+    void mqtt_bridge::publish_health(uint32_t now) {
+        _last_health = now;
+
+        runtime_metrics metrics;
+        _health_callback(&metrics);
+        mqtt_stats mqtt = _client.get_stats();
+
+        char payload[320];
+        int length = snprintf(
+            payload, sizeof(payload),
+            "{\"up\":%" PRIu32 ",\"heap\":%" PRIu32 ",\"rssi\":%" PRId32 ",\"loop_hz\":%" PRIu32
+            ",\"boiler_ms\":%" PRIu32 ",\"log_dropped\":%" PRIu32 ",\"remote_commands\":%" PRIu32
+            ",\"mqtt\":{\"connects\":%" PRIu32 ",\"losses\":%" PRIu32 ",\"retries\":%" PRIu32 ",\"dropped\":%" PRIu32
+            ",\"queued\":%" PRIu32 "}}",
+            now, ESP.getFreeHeap(), metrics.wifi_rssi, metrics.loop_iterations_per_sec, metrics.boiler_on_millis,
+            metrics.log.dropped, metrics.remote_commands.applied, mqtt.connects, mqtt.connection_losses, mqtt.retries,
+            mqtt.dropped, mqtt.queued_bytes);
+        if (length > 0 && static_cast<size_t>(length) < sizeof(payload)) {
+            _client.publish(_health_topic, reinterpret_cast<const uint8_t*>(payload), length, mqtt_qos::at_most_once,
+                            false);
+        }
+    }
+
+    void mqtt_bridge::on_message(const char* topic, const uint8_t* payload, size_t size, bool retained) {
+        if (strncmp(topic, _command_filter, _command_prefix_length) != 0) {
+            return;
+        }
+        const char* command = topic + _command_prefix_length;
+
+        // A retained command would replay with every reconnect.
+        if (retained) {
+            MOCCA_LOGW(mqtt, "Ignoring the retained %s command.", command);
+            return;
+        }
+        if (size > max_command_payload) {
+            MOCCA_LOGW(mqtt, "Ignoring the %s command, its payload is too long.", command);
+            return;
+        }
+        char argument[max_command_payload + 1];
+        memcpy(argument, payload, size);
+        argument[size] = '\0';
+
+        MOCCA_LOGI(mqtt, "Command %s \"%s\".", command, argument);
+        if (strcmp(command, "brew") == 0 || strcmp(command, "cancel") == 0) {
+            if (_brew_callback) {
+                _brew_callback(command[0] == 'b' ? brew_command::start : brew_command::cancel, esp_timer_get_time());
+            }
+        } else if (strcmp(command, "wake") == 0) {
+            char* end = nullptr;
+            long minute = strtol(argument, &end, 10);
+            if (strcmp(argument, "off") == 0) {
+                if (_wake_callback) {
+                    _wake_callback(false, 0);
+                }
+            } else if (end == argument || *end != '\0' || minute < 0 || minute >= minutes_per_day) {
+                MOCCA_LOGW(mqtt, "Wake needs a minute of the day or \"off\".");
+            } else if (_wake_callback) {
+                _wake_callback(true, minute * SECS_PER_MIN);
+            }
+        } else if (strcmp(command, "timezone") == 0) {
+            if (_timezone_callback) {
+                _timezone_callback(argument);
+            }
+        } else {
+            MOCCA_LOGW(mqtt, "Unknown command %s.", command);
+        }
+    }
+} // namespace mocca
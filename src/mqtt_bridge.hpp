@@ -0,0 +1,82 @@
+#pragma once
+
+#include "brew_history.hpp"
+#include "metrics.hpp"
+#include "mqtt_client.hpp"
+#include "mqtt_transport.hpp"
+
+#include <Arduino.h>
+
+#include <functional>
+
+namespace mocca {
+    using mqtt_brew_command_callback = std::function<void(brew_command command, int64_t received_micros)>;
+    using mqtt_wake_set_callback = std::function<void(bool enabled, uint32_t secs)>;
+    using mqtt_timezone_callback = std::function<bool(const char* timezone)>;
+    using mqtt_health_callback = std::function<void(runtime_metrics* metrics)>;
+
+    // Device telemetry and commands over MQTT, alongside the web API. Under the topic prefix:
+    //
+    //   status       retained "online", "offline" once the device drops off
+    //   events       QoS 1 batches of state changes, switch edges and brew events, times in ms since boot
+    //   health       QoS 0 counters, every minute while connected
+    //   cmd/brew     starts a brew, cmd/cancel cancels it
+    //   cmd/wake     minute of the day for the one-off brew time, "off" clears it
+    //   cmd/timezone timezone name
+    //
+    // Events wait in the client's queue while the broker is unreachable. Commands don't, sessions are clean so a brew
+    // command never fires hours after it was sent.
+    class mqtt_bridge {
+      public:
+        mqtt_bridge();
+
+        void init(const char* topic_prefix, const char* client_id);
+        void set_command_callbacks(mqtt_brew_command_callback brew_callback, mqtt_wake_set_callback wake_callback,
+                                   mqtt_timezone_callback timezone_callback);
+        void set_health_callback(mqtt_health_callback callback);
+
+        // Follows the network.
+        void start(const char* host, uint16_t port);
+        void stop();
+
+        void report_state(const char* state);
+        void report_switches(bool has_water, bool has_pot); // Every tick, only edges are reported
+        void report_brew_event(const brew_event& event);
+
+        // utc is 0 while the clock isn't set.
+        void step(uint32_t now, time_t utc);
+
+        mqtt_stats get_stats() const;
+
+      private:
+        void add_event(const char* format, ...) __attribute__((format(printf, 2, 3)));
+        void flush_events();
+        void publish_health(uint32_t now);
+        void on_message(const char* topic, const uint8_t* payload, size_t size, bool retained);
+
+        socket_transport _transport;
+        mqtt_client _client;
+
+        char _status_topic[mqtt_client::max_topic_length] = {0};
+        char _events_topic[mqtt_client::max_topic_length] = {0};
+        char _health_topic[mqtt_client::max_topic_length] = {0};
+        char _command_filter[mqtt_client::max_topic_length] = {0};
+        size_t _command_prefix_length = 0; // Of the filter without the wildcard
+        char _client_id[24] = {0};
+
+        mqtt_brew_command_callback _brew_callback;
+        mqtt_wake_set_callback _wake_callback;
+        mqtt_timezone_callback _timezone_callback;
+        mqtt_health_callback _health_callback;
+
+        char _events[512] = {0}; // Comma separated events of the open batch
+        size_t _events_length = 0;
+        uint32_t _batch_start = 0;
+        time_t _utc = 0;
+        bool _has_switches = false;
+        bool _has_water = false;
+        bool _has_pot = false;
+
+        uint32_t _last_health = 0;
+    };
+} // namespace mocca
@@ -0,0 +1,585 @@
+#include "mqtt_client.hpp"
+
+#include "logger.hpp"
+#include "util.hpp"
+
+namespace mocca {
+    namespace {
+        constexpr uint32_t connect_timeout = MILLIS_PER_SEC * 10; // TCP handshake and CONNACK each
+        constexpr uint32_t ack_timeout = MILLIS_PER_SEC * 10;
+        constexpr uint32_t min_retry_delay = MILLIS_PER_SEC * 2;
+        constexpr uint32_t max_retry_delay = MILLIS_PER_SEC * 64;
+        constexpr size_t max_reads_per_step = 4; // Keeps a chatty broker from stalling the control loop
+
+        constexpr size_t entry_header_size = 2;
+        constexpr size_t max_remaining_length_size = 4;
+
+        constexpr uint8_t packet_connect = 1;
+        constexpr uint8_t packet_connack = 2;
+        constexpr uint8_t packet_publish = 3;
+        constexpr uint8_t packet_puback = 4;
+        constexpr uint8_t packet_subscribe = 8;
+        constexpr uint8_t packet_suback = 9;
+        constexpr uint8_t packet_pingreq = 12;
+        constexpr uint8_t packet_pingresp = 13;
+        constexpr uint8_t packet_disconnect = 14;
+
+        constexpr uint8_t publish_dup = 0x08;
+        constexpr uint8_t publish_qos_mask = 0x06;
+        constexpr uint8_t publish_retain = 0x01;
+        constexpr uint8_t subscribe_flags = 0x02; // Required by the spec
+
+        constexpr uint8_t connect_clean_session = 0x02;
+        constexpr uint8_t connect_will = 0x04;
+        constexpr uint8_t connect_will_qos_1 = 0x08;
+        constexpr uint8_t connect_will_retain = 0x20;
+        constexpr uint8_t protocol_level = 4; // 3.1.1
+
+        constexpr char status_online[] = "online";
+        constexpr char status_offline[] = "offline";
+        constexpr size_t max_status_packet_size =
+            1 + max_remaining_length_size + 2 + mqtt_client::max_topic_length + sizeof(status_offline) - 1;
+
+        size_t remaining_length_size(size_t length) {
+            size_t size = 1;
+            while (length >= 128) {
+                length /= 128;
+                size++;
+            }
+            return size;
+        }
+
+        uint8_t* put_remaining_length(uint8_t* out, size_t length) {
+            do {
+                uint8_t byte = length % 128;
+                length /= 128;
+                *out++ = length > 0 ? byte | 0x80 : byte;
+            } while (length > 0);
+            return out;
+        }
+
+        // Returns 1 once the fixed header is complete, 0 if more bytes are needed and -1 if it's malformed.
+        int decode_fixed_header(const uint8_t* data, size_t size, size_t* remaining, size_t* header_size) {
+            size_t length = 0;
+            size_t multiplier = 1;
+            for (size_t idx = 1; idx <= max_remaining_length_size; idx++) {
+                if (idx >= size) {
+                    return 0;
+                }
+                length += (data[idx] & 0x7f) * multiplier;
+                if ((data[idx] & 0x80) == 0) {
+                    *remaining = length;
+                    *header_size = idx + 1;
+                    return 1;
+                }
+                multiplier *= 128;
+            }
+            return -1;
+        }
+
+        uint16_t read_u16(const uint8_t* data) {
+            return (data[0] << 8) | data[1];
+        }
+
+        uint8_t* put_u16(uint8_t* out, uint16_t value) {
+            *out++ = value >> 8;
+            *out++ = value & 0xff;
+            return out;
+        }
+
+        uint8_t* put_string(uint8_t* out, const char* string, size_t length) {
+            out = put_u16(out, length);
+            memcpy(out, string, length);
+            return out + length;
+        }
+    } // namespace
+
+    mqtt_client::mqtt_client(mqtt_transport* transport)
+        : _transport(transport) {}
+
+    void mqtt_client::set_session(const char* client_id, uint16_t keep_alive_secs, const char* status_topic) {
+        _client_id = client_id;
+        _keep_alive_secs = keep_alive_secs;
+        _status_topic = status_topic;
+    }
+
+    void mqtt_client::set_message_callback(mqtt_message_callback callback) {
+        _message_callback = callback;
+    }
+
+    bool mqtt_client::subscribe(const char* topic_filter) {
+        if (_subscription_count >= max_subscriptions) {
+            return false;
+        }
+        _subscriptions[_subscription_count++] = topic_filter;
+        return true;
+    }
+
+    void mqtt_client::start(const char* host, uint16_t port) {
+        _host = host;
+        _port = port;
+        _retry_delay = 0; // First attempt right away
+        _state = session_state::waiting;
+        _state_since = millis();
+    }
+
+    void mqtt_client::stop() {
+        if (_state == session_state::stopped) {
+            return;
+        }
+
+        // Best effort, the broker only publishes the will if the connection breaks without a DISCONNECT.
+        if (_state == session_state::connected) {
+            uint8_t packet[max_status_packet_size + 2];
+            size_t size = _status_topic ? encode_status(packet, status_offline) : 0;
+            packet[size++] = packet_disconnect << 4;
+            packet[size++] = 0;
+            _transport->write(packet, size);
+        }
+        end_session();
+        _state = session_state::stopped;
+    }
+
+    bool mqtt_client::publish(const char* topic, const uint8_t* payload, size_t size, mqtt_qos qos, bool retain) {
+        size_t topic_length = strlen(topic);
+        size_t remaining = 2 + topic_length + (qos == mqtt_qos::at_least_once ? 2 : 0) + size;
+        size_t packet_size = 1 + remaining_length_size(remaining) + remaining;
+        size_t entry_size = entry_header_size + packet_size;
+
+        // Make room by dropping the oldest messages, except for the head once it's on its way.
+        size_t keep = (_head_written > 0 || _head_awaiting_ack) ? entry_header_size + head_size() : 0;
+        while (queue_size - _queue_used < entry_size) {
+            if (_queue_used <= keep) {
+                _stats.dropped++;
+                return false;
+            }
+            drop_queued(keep);
+            _stats.dropped++;
+        }
+
+        uint8_t* out = _queue + _queue_used;
+        out = put_u16(out, packet_size);
+        *out++ = (packet_publish << 4) | (static_cast<uint8_t>(qos) << 1) | (retain ? publish_retain : 0);
+        out = put_remaining_length(out, remaining);
+        out = put_string(out, topic, topic_length);
+        if (qos == mqtt_qos::at_least_once) {
+            out = put_u16(out, next_packet_id());
+        }
+        memcpy(out, payload, size);
+        _queue_used += entry_size;
+        _stats.queued_bytes = _queue_used;
+        return true;
+    }
+
+    void mqtt_client::step(uint32_t now) {
+        switch (_state) {
+        case session_state::stopped:
+            return;
+
+        case session_state::waiting:
+            if (now - _state_since >= _retry_delay) {
+                begin_session(now);
+            }
+            return;
+
+        case session_state::connecting: {
+            mqtt_link link = _transport->state();
+            if (link == mqtt_link::closed) {
+                lose_session(now, "connection failed");
+                return;
+            }
+            if (link == mqtt_link::connecting) {
+                if (now - _state_since >= connect_timeout) {
+                    lose_session(now, "connection timed out");
+                }
+                return;
+            }
+
+            if (!add_connect()) {
+                lose_session(now, "CONNECT too large");
+                return;
+            }
+            _state = session_state::awaiting_connack;
+            _state_since = now;
+            break;
+        }
+
+        case session_state::awaiting_connack:
+            if (now - _state_since >= connect_timeout) {
+                lose_session(now, "no CONNACK");
+                return;
+            }
+            break;
+
+        case session_state::connected: {
+            uint32_t keep_alive = _keep_alive_secs * MILLIS_PER_SEC;
+            if (_head_awaiting_ack && now - _head_sent_at >= ack_timeout) {
+                lose_session(now, "no PUBACK");
+                return;
+            }
+            if (_ping_outstanding && now - _ping_sent_at >= keep_alive) {
+                lose_session(now, "no PINGRESP");
+                return;
+            }
+            if (keep_alive > 0 && !_ping_outstanding && now - _last_output >= keep_alive / 2) {
+                const uint8_t ping[] = {packet_pingreq << 4, 0};
+                if (add_control(ping, sizeof(ping))) {
+                    _ping_outstanding = true;
+                    _ping_sent_at = now;
+                }
+            }
+            break;
+        }
+        }
+
+        if (read_input(now)) {
+            write_output(now);
+        }
+        _stats.queued_bytes = _queue_used;
+    }
+
+    bool mqtt_client::is_connected() const {
+        return _state == session_state::connected;
+    }
+
+    mqtt_stats mqtt_client::get_stats() const {
+        return _stats;
+    }
+
+    void mqtt_client::begin_session(uint32_t now) {
+        MOCCA_LOGD(mqtt, "Connecting to %s:%u.", _host, _port);
+        _state = session_state::connecting;
+        _state_since = now;
+        _last_output = now;
+        if (!_transport->connect(_host, _port)) {
+            lose_session(now, "couldn't start connecting");
+        }
+    }
+
+    void mqtt_client::lose_session(uint32_t now, const char* reason) {
+        if (_state == session_state::connected) {
+            MOCCA_LOGW(mqtt, "Lost the connection to %s:%u: %s.", _host, _port, reason);
+        } else {
+            MOCCA_LOGD(mqtt, "Connecting to %s:%u failed: %s.", _host, _port, reason);
+        }
+        _stats.connection_losses++;
+        end_session();
+
+        _retry_delay = _retry_delay == 0 ? min_retry_delay : std::min(_retry_delay * 2, max_retry_delay);
+        _state = session_state::waiting;
+        _state_since = now;
+    }
+
+    void mqtt_client::end_session() {
+        _transport->close();
+
+        // The broker may have the head message already, so a QoS 1 head goes out again flagged as a duplicate.
+        if (_queue_used > 0 && _head_written > 0) {
+            uint8_t* packet = _queue + entry_header_size;
+            if (packet[0] & publish_qos_mask) {
+                packet[0] |= publish_dup;
+                _stats.retries++;
+            }
+        }
+        _head_written = 0;
+        _head_awaiting_ack = false;
+
+        _control_used = 0;
+        _control_written = 0;
+        _input_used = 0;
+        _input_skip = 0;
+        _ping_outstanding = false;
+    }
+
+    bool mqtt_client::add_connect() {
+        uint8_t packet[sizeof(_control)];
+        size_t client_id_length = strlen(_client_id);
+        size_t status_topic_length = _status_topic ? strlen(_status_topic) : 0;
+        size_t remaining = 2 + 4 + 1 + 1 + 2 + 2 + client_id_length;
+        if (_status_topic) {
+            remaining += 2 + status_topic_length + 2 + sizeof(status_offline) - 1;
+        }
+        if (1 + max_remaining_length_size + remaining > sizeof(packet)) {
+            MOCCA_LOGE(mqtt, "CONNECT doesn't fit, shorten the client id or status topic.");
+            return false;
+        }
+
+        uint8_t* out = packet;
+        *out++ = packet_connect << 4;
+        out = put_remaining_length(out, remaining);
+        out = put_string(out, "MQTT", 4);
+        *out++ = protocol_level;
+        *out++ = connect_clean_session | (_status_topic ? connect_will | connect_will_qos_1 | connect_will_retain : 0);
+        out = put_u16(out, _keep_alive_secs);
+        out = put_string(out, _client_id, client_id_length);
+        if (_status_topic) {
+            out = put_string(out, _status_topic, status_topic_length);
+            out = put_string(out, status_offline, sizeof(status_offline) - 1);
+        }
+        return add_control(packet, out - packet);
+    }
+
+    void mqtt_client::on_connack(uint32_t now) {
+        MOCCA_LOGI(mqtt, "Connected to %s:%u.", _host, _port);
+        _state = session_state::connected;
+        _state_since = now;
+        _retry_delay = 0;
+        _stats.connects++;
+
+        for (size_t idx = 0; idx < _subscription_count; idx++) {
+            uint8_t packet[1 + max_remaining_length_size + 2 + 2 + max_topic_length + 1];
+            size_t filter_length = strlen(_subscriptions[idx]);
+            if (filter_length > max_topic_length) {
+                MOCCA_LOGE(mqtt, "Topic filter %s is too long.", _subscriptions[idx]);
+                continue;
+            }
+
+            uint8_t* out = packet;
+            *out++ = (packet_subscribe << 4) | subscribe_flags;
+            out = put_remaining_length(out, 2 + 2 + filter_length + 1);
+            out = put_u16(out, next_packet_id());
+            out = put_string(out, _subscriptions[idx], filter_length);
+            *out++ = static_cast<uint8_t>(mqtt_qos::at_least_once);
+            add_control(packet, out - packet);
+        }
+
+        if (_status_topic) {
+            uint8_t packet[max_status_packet_size];
+            add_control(packet, encode_status(packet, status_online));
+        }
+    }
+
+    void mqtt_client::write_output(uint32_t now) {
+        while (true) {
+            // A head packet partly written has to be finished before anything else can go out.
+            bool head_in_progress = _head_written > 0 && !_head_awaiting_ack;
+
+            if (!head_in_progress && _control_written < _control_used) {
+                int written = _transport->write(_control + _control_written, _control_used - _control_written);
+                if (written < 0) {
+                    lose_session(now, "write failed");
+                    return;
+                }
+                if (written > 0) {
+                    _last_output = now;
+                }
+                _control_written += written;
+                if (_control_written < _control_used) {
+                    return;
+                }
+                _control_used = 0;
+                _control_written = 0;
+                continue;
+            }
+
+            if (_state != session_state::connected || _queue_used == 0 || _head_awaiting_ack) {
+                return;
+            }
+
+            size_t size = head_size();
+            const uint8_t* packet = _queue + entry_header_size;
+            int written = _transport->write(packet + _head_written, size - _head_written);
+            if (written < 0) {
+                lose_session(now, "write failed");
+                return;
+            }
+            if (written > 0) {
+                _last_output = now;
+            }
+            _head_written += written;
+            if (_head_written < size) {
+                return;
+            }
+
+            if (packet[0] & publish_qos_mask) {
+                _head_awaiting_ack = true;
+                _head_sent_at = now;
+            } else {
+                drop_queued(0);
+                _head_written = 0;
+                _stats.published++;
+            }
+        }
+    }
+
+    bool mqtt_client::read_input(uint32_t now) {
+        for (size_t reads = 0; reads < max_reads_per_step; reads++) {
+            int received = _transport->read(_input + _input_used, sizeof(_input) - _input_used);
+            if (received < 0) {
+                lose_session(now, "closed by the broker");
+                return false;
+            }
+            if (received == 0) {
+                return true;
+            }
+
+            if (_input_skip > 0) {
+                size_t skipped = std::min(_input_skip, static_cast<size_t>(received));
+                memmove(_input, _input + skipped, received - skipped);
+                _input_skip -= skipped;
+                received -= skipped;
+            }
+            _input_used += received;
+
+            size_t offset = 0;
+            while (offset < _input_used) {
+                size_t remaining;
+                size_t header_size;
+                int header = decode_fixed_header(_input + offset, _input_used - offset, &remaining, &header_size);
+                if (header < 0) {
+                    lose_session(now, "malformed packet");
+                    return false;
+                }
+                if (header == 0) {
+                    break;
+                }
+
+                size_t packet_size = header_size + remaining;
+                if (packet_size > sizeof(_input)) {
+                    MOCCA_LOGW(mqtt, "Skipping a %u byte packet.", static_cast<unsigned>(packet_size));
+                    _input_skip = packet_size - (_input_used - offset);
+                    offset = _input_used;
+                    break;
+                }
+                if (_input_used - offset < packet_size) {
+                    break;
+                }
+                if (!handle_packet(now, _input + offset, packet_size, header_size)) {
+                    return false;
+                }
+                offset += packet_size;
+            }
+
+            memmove(_input, _input + offset, _input_used - offset);
+            _input_used -= offset;
+        }
+        return true;
+    }
+
+    bool mqtt_client::handle_packet(uint32_t now, const uint8_t* packet, size_t size, size_t header_size) {
+        const uint8_t* body = packet + header_size;
+        size_t body_size = size - header_size;
+
+        switch (packet[0] >> 4) {
+        case packet_connack:
+            if (_state != session_state::awaiting_connack || body_size < 2) {
+                lose_session(now, "unexpected CONNACK");
+                return false;
+            }
+            if (body[1] != 0) {
+                MOCCA_LOGW(mqtt, "Broker refused the connection: %u.", body[1]);
+                lose_session(now, "refused");
+                return false;
+            }
+            on_connack(now);
+            return true;
+
+        case packet_puback:
+            if (body_size >= 2 && _head_awaiting_ack && read_u16(body) == head_packet_id()) {
+                drop_queued(0);
+                _head_written = 0;
+                _head_awaiting_ack = false;
+                _stats.published++;
+            }
+            return true;
+
+        case packet_suback:
+            if (body_size >= 3 && body[2] == 0x80) {
+                MOCCA_LOGW(mqtt, "Broker refused a subscription.");
+            }
+            return true;
+
+        case packet_publish:
+            handle_publish(packet, size, header_size);
+            return true;
+
+        case packet_pingresp:
+            _ping_outstanding = false;
+            return true;
+
+        default:
+            return true;
+        }
+    }
+
+    void mqtt_client::handle_publish(const uint8_t* packet, size_t size, size_t header_size) {
+        const uint8_t* body = packet + header_size;
+        size_t body_size = size - header_size;
+        uint8_t qos = (packet[0] & publish_qos_mask) >> 1;
+        size_t id_size = qos > 0 ? 2 : 0;
+        if (body_size < 2) {
+            return;
+        }
+        size_t topic_length = read_u16(body);
+        if (2 + topic_length + id_size > body_size) {
+            return;
+        }
+
+        // Subscriptions ask for QoS 1 at most, so the broker never sends QoS 2.
+        if (qos > 0) {
+            uint8_t puback[] = {packet_puback << 4, 2, 0, 0};
+            memcpy(puback + 2, body + 2 + topic_length, 2);
+            add_control(puback, sizeof(puback));
+        }
+
+        _stats.received++;
+        if (topic_length >= max_topic_length || !_message_callback) {
+            return;
+        }
+        char topic[max_topic_length];
+        memcpy(topic, body + 2, topic_length);
+        topic[topic_length] = '\0';
+
+        size_t payload_offset = 2 + topic_length + id_size;
+        _message_callback(topic, body + payload_offset, body_size - payload_offset, packet[0] & publish_retain);
+    }
+
+    bool mqtt_client::add_control(const uint8_t* packet, size_t size) {
+        if (sizeof(_control) - _control_used < size) {
+            MOCCA_LOGW(mqtt, "No room for control packet %u.", packet[0] >> 4);
+            return false;
+        }
+        memcpy(_control + _control_used, packet, size);
+        _control_used += size;
+        return true;
+    }
+
+    // Status updates skip the queue, they describe the session rather than the device.
+    size_t mqtt_client::encode_status(uint8_t* out, const char* status) const {
+        size_t topic_length = std::min(strlen(_status_topic), max_topic_length);
+        size_t status_length = strlen(status);
+
+        uint8_t* start = out;
+        *out++ = (packet_publish << 4) | publish_retain;
+        out = put_remaining_length(out, 2 + topic_length + status_length);
+        out = put_string(out, _status_topic, topic_length);
+        memcpy(out, status, status_length);
+        return out + status_length - start;
+    }
+
+    uint16_t mqtt_client::next_packet_id() {
+        uint16_t id = _next_packet_id++;
+        if (_next_packet_id == 0) {
+            _next_packet_id = 1; // 0 isn't a valid id
+        }
+        return id;
+    }
+
+    size_t mqtt_client::head_size() const {
+        return read_u16(_queue);
+    }
+
+    uint16_t mqtt_client::head_packet_id() const {
+        const uint8_t* packet = _queue + entry_header_size;
+        size_t remaining;
+        size_t header_size;
+        decode_fixed_header(packet, head_size(), &remaining, &header_size);
+        return read_u16(packet + header_size + 2 + read_u16(packet + header_size));
+    }
+
+    void mqtt_client::drop_queued(size_t offset) {
+        size_t entry_size = entry_header_size + read_u16(_queue + offset);
+        memmove(_queue + offset, _queue + offset + entry_size, _queue_used - offset - entry_size);
+        _queue_used -= entry_size;
+    }
+} // namespace mocca
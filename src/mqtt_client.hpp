@@ -0,0 +1,125 @@
+#pragma once
+
+#include "mqtt_transport.hpp"
+
+#include <Arduino.h>
+
+#include <functional>
+
+namespace mocca {
+    enum class mqtt_qos : uint8_t {
+        at_most_once = 0,
+        at_least_once = 1,
+    };
+
+    struct mqtt_stats {
+        uint32_t connects = 0;
+        uint32_t connection_losses = 0; // Failed attempts and dropped sessions
+        uint32_t published = 0;         // Written out, and acknowledged for QoS 1
+        uint32_t retries = 0;           // QoS 1 messages sent again after a lost connection
+        uint32_t dropped = 0;           // Pushed out of a full queue
+        uint32_t received = 0;
+        uint32_t queued_bytes = 0;
+    };
+
+    using mqtt_message_callback =
+        std::function<void(const char* topic, const uint8_t* payload, size_t size, bool retained)>;
+
+    // MQTT 3.1.1 client that never blocks, step() does whatever the transport allows right now and returns.
+    //
+    // Published messages are encoded straight into a bounded queue that outlives the connection: offline they pile up,
+    // once the queue is full the oldest ones make room. Messages leave in order with at most one QoS 1 message waiting
+    // for its acknowledgement. If the acknowledgement doesn't come the connection is dropped and the message sent
+    // again, flagged as a duplicate, once a new session is up. Subscriptions are renewed with every session.
+    class mqtt_client {
+      public:
+        static constexpr size_t queue_size = 4096;
+        static constexpr size_t max_subscriptions = 2;
+        static constexpr size_t max_topic_length = 96;
+
+        explicit mqtt_client(mqtt_transport* transport);
+
+        // All strings must outlive the client. Every session publishes a retained "online" to status_topic, the broker
+        // replaces it with "offline" once the session is lost.
+        void set_session(const char* client_id, uint16_t keep_alive_secs, const char* status_topic);
+        void set_message_callback(mqtt_message_callback callback);
+        bool subscribe(const char* topic_filter);
+
+        // Connects and keeps reconnecting until stop().
+        void start(const char* host, uint16_t port);
+        void stop();
+
+        bool publish(const char* topic, const uint8_t* payload, size_t size, mqtt_qos qos, bool retain);
+
+        void step(uint32_t now);
+
+        bool is_connected() const;
+        mqtt_stats get_stats() const;
+
+      private:
+        enum class session_state : uint8_t {
+            stopped,
+            waiting, // For the next attempt
+            connecting,
+            awaiting_connack,
+            connected,
+        };
+
+        void begin_session(uint32_t now);
+        void lose_session(uint32_t now, const char* reason);
+        void end_session();
+        void on_connack(uint32_t now);
+
+        void write_output(uint32_t now);
+        bool read_input(uint32_t now);
+        bool handle_packet(uint32_t now, const uint8_t* packet, size_t size, size_t header_size);
+        void handle_publish(const uint8_t* packet, size_t size, size_t header_size);
+
+        bool add_connect();
+        bool add_control(const uint8_t* packet, size_t size);
+        size_t encode_status(uint8_t* out, const char* status) const;
+        uint16_t next_packet_id();
+
+        size_t head_size() const;
+        uint16_t head_packet_id() const;
+        void drop_queued(size_t offset);
+
+        mqtt_transport* _transport;
+        const char* _host = nullptr;
+        uint16_t _port = 0;
+
+        const char* _client_id = "";
+        uint16_t _keep_alive_secs = 60;
+        const char* _status_topic = nullptr;
+        const char* _subscriptions[max_subscriptions] = {nullptr};
+        size_t _subscription_count = 0;
+        mqtt_message_callback _message_callback;
+
+        session_state _state = session_state::stopped;
+        uint32_t _state_since = 0;
+        uint32_t _retry_delay = 0;
+        uint16_t _next_packet_id = 1;
+
+        // Entries are a 2 byte size followed by the encoded PUBLISH packet, the head entry goes out first.
+        uint8_t _queue[queue_size];
+        size_t _queue_used = 0;
+        size_t _head_written = 0;        // Bytes of the head entry's packet written in this session
+        bool _head_awaiting_ack = false; // Head is a QoS 1 packet written in full
+        uint32_t _head_sent_at = 0;
+
+        // CONNECT, SUBSCRIBE, PUBACK and PINGREQ, written between queued packets.
+        uint8_t _control[192];
+        size_t _control_used = 0;
+        size_t _control_written = 0;
+
+        uint8_t _input[512];
+        size_t _input_used = 0;
+        size_t _input_skip = 0; // Rest of a packet too large to buffer
+
+        uint32_t _last_output = 0;
+        bool _ping_outstanding = false;
+        uint32_t _ping_sent_at = 0;
+
+        mqtt_stats _stats;
+    };
+} // namespace mocca
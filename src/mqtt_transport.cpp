@@ -0,0 +1,175 @@
+#include "mqtt_transport.hpp"
+
+#include "logger.hpp"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <lwip/dns.h>
+#include <lwip/sockets.h>
+#include <lwip/tcpip.h>
+#include <unistd.h>
+
+namespace mocca {
+    socket_transport::~socket_transport() {
+        close();
+    }
+
+    bool socket_transport::connect(const char* host, uint16_t port) {
+        close();
+        _host = host;
+        _port = port;
+
+        in_addr literal;
+        if (inet_pton(AF_INET, host, &literal) == 1) {
+            return open_socket(literal.s_addr);
+        }
+
+        portENTER_CRITICAL(&_resolve_lock);
+        _resolved = false;
+        _resolve_failed = false;
+        portEXIT_CRITICAL(&_resolve_lock);
+
+        _resolving = tcpip_callback(resolve_on_tcpip_thread, this) == ERR_OK;
+        return _resolving;
+    }
+
+    mqtt_link socket_transport::state() {
+        if (_resolving) {
+            portENTER_CRITICAL(&_resolve_lock);
+            bool resolved = _resolved;
+            bool failed = _resolve_failed;
+            uint32_t address = _address;
+            portEXIT_CRITICAL(&_resolve_lock);
+
+            if (failed) {
+                MOCCA_LOGW(mqtt, "Failed to resolve %s.", _host);
+                _resolving = false;
+                return mqtt_link::closed;
+            }
+            if (!resolved) {
+                return mqtt_link::connecting;
+            }
+
+            _resolving = false;
+            if (!open_socket(address)) {
+                return mqtt_link::closed;
+            }
+        }
+
+        if (_socket < 0) {
+            return mqtt_link::closed;
+        }
+        if (_connected) {
+            return mqtt_link::connected;
+        }
+
+        // A non-blocking connect is done once the socket turns writable, SO_ERROR tells whether it worked.
+        fd_set writable;
+        FD_ZERO(&writable);
+        FD_SET(_socket, &writable);
+        timeval no_wait = {0, 0};
+        int ready = select(_socket + 1, nullptr, &writable, nullptr, &no_wait);
+        if (ready == 0) {
+            return mqtt_link::connecting;
+        }
+
+        int error = 0;
+        socklen_t error_size = sizeof(error);
+        if (ready < 0 || getsockopt(_socket, SOL_SOCKET, SO_ERROR, &error, &error_size) != 0 || error != 0) {
+            MOCCA_LOGD(mqtt, "Connecting to %s:%u failed: %d.", _host, _port, error);
+            close();
+            return mqtt_link::closed;
+        }
+
+        _connected = true;
+        return mqtt_link::connected;
+    }
+
+    int socket_transport::write(const uint8_t* data, size_t size) {
+        if (!_connected) {
+            return -1;
+        }
+
+        int written = send(_socket, data, size, MSG_DONTWAIT);
+        if (written < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        return written;
+    }
+
+    int socket_transport::read(uint8_t* data, size_t size) {
+        if (!_connected) {
+            return -1;
+        }
+
+        int received = recv(_socket, data, size, MSG_DONTWAIT);
+        if (received == 0) {
+            return -1; // Closed by the broker
+        }
+        if (received < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        return received;
+    }
+
+    void socket_transport::close() {
+        _resolving = false;
+        _connected = false;
+        if (_socket >= 0) {
+            ::close(_socket);
+            _socket = -1;
+        }
+    }
+
+    void socket_transport::resolve_on_tcpip_thread(void* arg) {
+        socket_transport* transport = static_cast<socket_transport*>(arg);
+
+        ip_addr_t address;
+        err_t err =
+            dns_gethostbyname_addrtype(transport->_host, &address, on_resolved, transport, LWIP_DNS_ADDRTYPE_IPV4);
+        if (err == ERR_OK) {
+            on_resolved(transport->_host, &address, transport);
+        } else if (err != ERR_INPROGRESS) {
+            on_resolved(transport->_host, nullptr, transport);
+        }
+    }
+
+    void socket_transport::on_resolved(const char* name, const ip_addr_t* address, void* arg) {
+        socket_transport* transport = static_cast<socket_transport*>(arg);
+
+        portENTER_CRITICAL(&transport->_resolve_lock);
+        if (address) {
+            transport->_address = ip4_addr_get_u32(ip_2_ip4(address));
+            transport->_resolved = true;
+        } else {
+            transport->_resolve_failed = true;
+        }
+        portEXIT_CRITICAL(&transport->_resolve_lock);
+    }
+
+    bool socket_transport::open_socket(uint32_t address) {
+        _socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (_socket < 0) {
+            MOCCA_LOGW(mqtt, "Failed to create a socket: %d.", errno);
+            return false;
+        }
+
+        int flags = fcntl(_socket, F_GETFL, 0);
+        fcntl(_socket, F_SETFL, flags | O_NONBLOCK);
+
+        // Messages are batched already, small command acknowledgements shouldn't wait for more data.
+        int no_delay = 1;
+        setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+        sockaddr_in broker = {};
+        broker.sin_family = AF_INET;
+        broker.sin_port = htons(_port);
+        broker.sin_addr.s_addr = address;
+        if (::connect(_socket, reinterpret_cast<sockaddr*>(&broker), sizeof(broker)) != 0 && errno != EINPROGRESS) {
+            MOCCA_LOGW(mqtt, "Failed to connect to %s:%u: %d.", _host, _port, errno);
+            close();
+            return false;
+        }
+        return true;
+    }
+} // namespace mocca
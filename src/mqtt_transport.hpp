@@ -0,0 +1,55 @@
+#pragma once
+
+#include <Arduino.h>
+#include <lwip/ip_addr.h>
+
+namespace mocca {
+    enum class mqtt_link : uint8_t {
+        closed,
+        connecting, // Resolving the broker or waiting for the TCP handshake
+        connected,
+    };
+
+    // Byte stream to the broker. Nothing here may block, every call does what can be done right away and returns.
+    class mqtt_transport {
+      public:
+        virtual ~mqtt_transport() = default;
+
+        virtual bool connect(const char* host, uint16_t port) = 0;
+        virtual mqtt_link state() = 0;
+        virtual int write(const uint8_t* data, size_t size) = 0; // Bytes taken, -1 if the connection failed
+        virtual int read(uint8_t* data, size_t size) = 0;        // Bytes read, 0 if none yet, -1 if closed
+        virtual void close() = 0;
+    };
+
+    // TCP over a non-blocking lwIP socket. Host names are resolved on the lwIP thread like sntp_client does, the socket
+    // calls themselves are plain BSD sockets.
+    class socket_transport : public mqtt_transport {
+      public:
+        ~socket_transport() override;
+
+        bool connect(const char* host, uint16_t port) override;
+        mqtt_link state() override;
+        int write(const uint8_t* data, size_t size) override;
+        int read(uint8_t* data, size_t size) override;
+        void close() override;
+
+      private:
+        static void resolve_on_tcpip_thread(void* arg);
+        static void on_resolved(const char* name, const ip_addr_t* address, void* arg);
+
+        bool open_socket(uint32_t address); // IPv4, network byte order
+
+        const char* _host = nullptr;
+        uint16_t _port = 0;
+        int _socket = -1;
+        bool _connected = false;
+
+        // Written by the lwIP thread while resolving.
+        portMUX_TYPE _resolve_lock = portMUX_INITIALIZER_UNLOCKED;
+        bool _resolving = false;
+        bool _resolved = false;
+        bool _resolve_failed = false;
+        uint32_t _address = 0;
+    };
+} // namespace mocca
@@ -0,0 +1,134 @@
+#include "ota_partition.hpp"
+
+#include "logger.hpp"
+#include "util.hpp"
+
+#include <cinttypes>
+
+namespace mocca {
+    namespace {
+        constexpr uint32_t min_probation_millis = MILLIS_PER_MIN;      // Healthy for this long keeps the new image
+        constexpr uint32_t max_probation_millis = MILLIS_PER_MIN * 10; // Never healthy by then rolls it back
+        constexpr uint32_t roll_back_log_flush_millis = 200;
+
+        constexpr uint32_t restart_handoff_magic = 0x4d57524e; // "MWRN"
+
+        // Survives a software reset but not power loss, unlike RTC_DATA_ATTR it isn't reloaded by the bootloader.
+        struct restart_handoff {
+            uint32_t magic;
+            bool reachable;
+        };
+        RTC_NOINIT_ATTR restart_handoff handoff;
+    } // namespace
+
+    size_t ota_partition_flash::capacity() const {
+        const esp_partition_t* partition = esp_ota_get_next_update_partition(nullptr);
+        return partition ? partition->size : 0;
+    }
+
+    bool ota_partition_flash::begin() {
+        _partition = esp_ota_get_next_update_partition(nullptr);
+        if (!_partition) {
+            MOCCA_LOGE(core, "No app slot to update.");
+            return false;
+        }
+
+        esp_err_t err = esp_ota_begin(_partition, OTA_WITH_SEQUENTIAL_WRITES, &_handle);
+        if (err != ESP_OK) {
+            MOCCA_LOGE(core, "esp_ota_begin failed: %d.", err);
+            _partition = nullptr;
+            return false;
+        }
+        return true;
+    }
+
+    bool ota_partition_flash::write(const uint8_t* data, size_t size) {
+        esp_err_t err = esp_ota_write(_handle, data, size);
+        if (err != ESP_OK) {
+            MOCCA_LOGE(core, "esp_ota_write failed: %d.", err);
+            return false;
+        }
+        return true;
+    }
+
+    bool ota_partition_flash::finish() {
+        // Also checks the image header and the checksum appended by the build.
+        esp_err_t err = esp_ota_end(_handle);
+        if (err != ESP_OK) {
+            MOCCA_LOGE(core, "esp_ota_end failed: %d.", err);
+            _partition = nullptr;
+            return false;
+        }
+
+        err = esp_ota_set_boot_partition(_partition);
+        _partition = nullptr;
+        if (err != ESP_OK) {
+            MOCCA_LOGE(core, "esp_ota_set_boot_partition failed: %d.", err);
+            return false;
+        }
+        return true;
+    }
+
+    void ota_partition_flash::abort() {
+        if (_partition) {
+            esp_ota_abort(_handle);
+            _partition = nullptr;
+        }
+    }
+
+    void ota_boot_check::start() {
+        esp_ota_img_states_t state;
+        _pending = esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK &&
+                   state == ESP_OTA_IMG_PENDING_VERIFY;
+        if (_pending) {
+            _previous_reachable = handoff.magic == restart_handoff_magic && handoff.reachable;
+            MOCCA_LOGI(core, "First boot of a new image, rolling back unless healthy within %" PRIu32 " s.",
+                       max_probation_millis / MILLIS_PER_SEC);
+        }
+        handoff.magic = 0;
+    }
+
+    void ota_boot_check::prepare_restart(bool reachable) {
+        handoff.magic = restart_handoff_magic;
+        handoff.reachable = reachable;
+    }
+
+    bool ota_boot_check::previous_image_reachable() const {
+        return _previous_reachable;
+    }
+
+    void ota_boot_check::step(uint32_t now, bool healthy, bool can_restart) {
+        if (!_pending) {
+            return;
+        }
+
+        if (healthy && now >= min_probation_millis) {
+            _pending = false;
+            esp_ota_mark_app_valid_cancel_rollback();
+            MOCCA_LOGI(core, "New image passed its health check.");
+        } else if (now >= max_probation_millis && can_restart) {
+            roll_back("not healthy in time");
+        }
+    }
+
+    void ota_boot_check::fail(const char* reason) {
+        if (_pending) {
+            roll_back(reason);
+        }
+    }
+
+    bool ota_boot_check::is_pending() const {
+        return _pending;
+    }
+
+    void ota_boot_check::roll_back(const char* reason) {
+        MOCCA_LOGE(core, "New image failed its health check (%s), rolling back.", reason);
+        get_logger().flush(roll_back_log_flush_millis);
+
+        // Only returns if there is no previous image to go back to, keep running this one then.
+        esp_ota_mark_app_invalid_rollback_and_reboot();
+        _pending = false;
+        esp_ota_mark_app_valid_cancel_rollback();
+        MOCCA_LOGE(core, "No previous image to roll back to.");
+    }
+} // namespace mocca
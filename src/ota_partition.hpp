@@ -0,0 +1,46 @@
+#pragma once
+
+#include "ota_updater.hpp"
+
+#include <esp_ota_ops.h>
+
+namespace mocca {
+    // Writes updates to whichever app slot isn't running. Sectors are erased as they are written rather than the whole
+    // slot up front, so the flash is never held for longer than one sector erase while brewing.
+    class ota_partition_flash : public ota_flash {
+      public:
+        size_t capacity() const override;
+        bool begin() override;
+        bool write(const uint8_t* data, size_t size) override;
+        bool finish() override;
+        void abort() override;
+
+      private:
+        const esp_partition_t* _partition = nullptr;
+        esp_ota_handle_t _handle = 0;
+    };
+
+    // The first boot of a new image is on probation. It is kept once it has run long enough and was healthy, an image
+    // that fails to start, crashes before then or never becomes healthy is rolled back to the previous one.
+    class ota_boot_check {
+      public:
+        void start();
+
+        // Tells the new image whether this one was reachable over the network, just before restarting into it. Kept in
+        // RTC memory so that it doesn't depend on the persistent data the new image may not understand.
+        void prepare_restart(bool reachable);
+        bool previous_image_reachable() const; // False if the previous image didn't say, e.g. after a power cycle
+
+        // Rolls back only when restart is allowed, a brew in progress is never interrupted.
+        void step(uint32_t now, bool healthy, bool can_restart);
+        void fail(const char* reason);
+
+        bool is_pending() const;
+
+      private:
+        void roll_back(const char* reason);
+
+        bool _pending = false;
+        bool _previous_reachable = false;
+    };
+} // namespace mocca
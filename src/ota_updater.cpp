@@ -0,0 +1,211 @@
+#include "ota_updater.hpp"
+
+#include "logger.hpp"
+
+namespace mocca {
+    namespace {
+        int hex_digit_value(char c) {
+            if (c >= '0' && c <= '9') {
+                return c - '0';
+            }
+            if (c >= 'a' && c <= 'f') {
+                return c - 'a' + 10;
+            }
+            if (c >= 'A' && c <= 'F') {
+                return c - 'A' + 10;
+            }
+            return -1;
+        }
+
+        bool parse_sha256_hex(const char* hex, uint8_t* out) {
+            if (!hex || strlen(hex) != ota_sha256_size * 2) {
+                return false;
+            }
+            for (size_t byte_idx = 0; byte_idx < ota_sha256_size; byte_idx++) {
+                int high = hex_digit_value(hex[byte_idx * 2]);
+                int low = hex_digit_value(hex[byte_idx * 2 + 1]);
+                if (high < 0 || low < 0) {
+                    return false;
+                }
+                out[byte_idx] = (high << 4) | low;
+            }
+            return true;
+        }
+
+        void hmac_sha256(const char* key, const uint8_t* data, size_t size, uint8_t* out) {
+            constexpr size_t block_size = 64;
+            uint8_t key_block[block_size] = {0};
+            size_t key_length = strlen(key);
+            mbedtls_sha256_context sha256;
+            mbedtls_sha256_init(&sha256);
+            if (key_length > block_size) {
+                mbedtls_sha256_starts(&sha256, 0);
+                mbedtls_sha256_update(&sha256, reinterpret_cast<const uint8_t*>(key), key_length);
+                mbedtls_sha256_finish(&sha256, key_block);
+            } else {
+                memcpy(key_block, key, key_length);
+            }
+
+            uint8_t pad[block_size];
+            for (size_t byte_idx = 0; byte_idx < block_size; byte_idx++) {
+                pad[byte_idx] = key_block[byte_idx] ^ 0x36;
+            }
+            uint8_t inner[ota_sha256_size];
+            mbedtls_sha256_starts(&sha256, 0);
+            mbedtls_sha256_update(&sha256, pad, block_size);
+            mbedtls_sha256_update(&sha256, data, size);
+            mbedtls_sha256_finish(&sha256, inner);
+
+            for (size_t byte_idx = 0; byte_idx < block_size; byte_idx++) {
+                pad[byte_idx] = key_block[byte_idx] ^ 0x5c;
+            }
+            mbedtls_sha256_starts(&sha256, 0);
+            mbedtls_sha256_update(&sha256, pad, block_size);
+            mbedtls_sha256_update(&sha256, inner, sizeof(inner));
+            mbedtls_sha256_finish(&sha256, out);
+            mbedtls_sha256_free(&sha256);
+        }
+    } // namespace
+
+    bool verify_ota_signature(const char* key, const char* sha256_hex, const char* signature_hex) {
+        uint8_t sha256[ota_sha256_size];
+        uint8_t signature[ota_sha256_size];
+        if (!key || !*key || !parse_sha256_hex(sha256_hex, sha256) || !parse_sha256_hex(signature_hex, signature)) {
+            return false;
+        }
+
+        uint8_t expected[ota_sha256_size];
+        hmac_sha256(key, sha256, sizeof(sha256), expected);
+
+        // Takes as long however much of it matches.
+        uint8_t difference = 0;
+        for (size_t byte_idx = 0; byte_idx < ota_sha256_size; byte_idx++) {
+            difference |= expected[byte_idx] ^ signature[byte_idx];
+        }
+        return difference == 0;
+    }
+
+    ota_updater::ota_updater(ota_flash* flash)
+        : _flash(flash) {
+        mbedtls_sha256_init(&_sha256);
+    }
+
+    bool ota_updater::begin(size_t image_size, const char* sha256_hex) {
+        if (_status == ota_status::receiving) {
+            abort("replaced by a new update");
+        }
+
+        _status = ota_status::failed;
+        if (!parse_sha256_hex(sha256_hex, _expected_sha256)) {
+            _error = "sha256 must be 64 hex digits";
+            return false;
+        }
+        if (image_size == 0 || image_size > _flash->capacity()) {
+            _error = "image doesn't fit the update slot";
+            return false;
+        }
+        if (!_flash->begin()) {
+            _error = "failed to start writing the update slot";
+            return false;
+        }
+
+        mbedtls_sha256_starts(&_sha256, 0);
+        _image_size = image_size;
+        _received = 0;
+        _chunk_used = 0;
+        _error = nullptr;
+        _status = ota_status::receiving;
+        MOCCA_LOGI(core, "Receiving a %u byte update.", static_cast<unsigned>(image_size));
+        return true;
+    }
+
+    bool ota_updater::write(const uint8_t* data, size_t size, size_t offset) {
+        if (_status != ota_status::receiving) {
+            return false;
+        }
+        if (offset != _received || size > _image_size - _received) {
+            abort("image data out of order or too long");
+            return false;
+        }
+
+        mbedtls_sha256_update(&_sha256, data, size);
+        _received += size;
+
+        while (size > 0) {
+            size_t length = std::min(size, chunk_size - _chunk_used);
+            memcpy(_chunk + _chunk_used, data, length);
+            _chunk_used += length;
+            data += length;
+            size -= length;
+
+            if (_chunk_used == chunk_size && !write_chunk()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool ota_updater::finish() {
+        if (_status != ota_status::receiving) {
+            return false;
+        }
+        if (_received != _image_size) {
+            abort("image incomplete");
+            return false;
+        }
+        if (_chunk_used > 0 && !write_chunk()) {
+            return false;
+        }
+
+        uint8_t sha256[ota_sha256_size];
+        mbedtls_sha256_finish(&_sha256, sha256);
+        if (memcmp(sha256, _expected_sha256, ota_sha256_size) != 0) {
+            abort("sha256 mismatch");
+            return false;
+        }
+
+        if (!_flash->finish()) {
+            _status = ota_status::failed;
+            _error = "image rejected by the bootloader checks";
+            MOCCA_LOGW(core, "Update failed: %s.", _error);
+            return false;
+        }
+
+        _status = ota_status::ready;
+        MOCCA_LOGI(core, "Update verified, it boots on the next restart.");
+        return true;
+    }
+
+    void ota_updater::abort(const char* reason) {
+        if (_status != ota_status::receiving) {
+            return;
+        }
+
+        _flash->abort();
+        _status = ota_status::failed;
+        _error = reason;
+        MOCCA_LOGW(core, "Update failed after %u bytes: %s.", static_cast<unsigned>(_received), reason);
+    }
+
+    ota_status ota_updater::status() const {
+        return _status;
+    }
+
+    const char* ota_updater::error() const {
+        return _error;
+    }
+
+    size_t ota_updater::received() const {
+        return _received;
+    }
+
+    bool ota_updater::write_chunk() {
+        size_t length = _chunk_used;
+        _chunk_used = 0;
+        if (!_flash->write(_chunk, length)) {
+            abort("failed to write the update slot");
+            return false;
+        }
+        return true;
+    }
+} // namespace mocca
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <Arduino.h>
+#include <mbedtls/sha256.h>
+
+namespace mocca {
+    constexpr size_t ota_sha256_size = 32;
+
+    // Whether signature_hex is the HMAC-SHA256 under key of the image hash given as sha256_hex, so that only someone
+    // holding the key can have an image flashed. Both are 64 hex digits in either case.
+    bool verify_ota_signature(const char* key, const char* sha256_hex, const char* signature_hex);
+
+    // Where an update image is written. ota_partition_flash writes the inactive app slot, anything else (a buffer on
+    // the host) can stand in for it to exercise ota_updater.
+    class ota_flash {
+      public:
+        virtual ~ota_flash() = default;
+
+        virtual size_t capacity() const = 0; // Largest image that fits
+        virtual bool begin() = 0;
+        virtual bool write(const uint8_t* data, size_t size) = 0; // In order, whole chunks except for the last one
+        virtual bool finish() = 0;                                // Checks the image and boots it next time
+        virtual void abort() = 0;
+    };
+
+    enum class ota_status : uint8_t {
+        idle,
+        receiving,
+        ready, // Boots on the next restart
+        failed,
+    };
+
+    // Streams an image of known size and SHA-256 to an ota_flash as it arrives, without ever holding more than one
+    // chunk of it. Any gap, overrun, flash error or hash mismatch aborts the update and leaves the running image as
+    // the one that boots.
+    class ota_updater {
+      public:
+        static constexpr size_t chunk_size = 4096; // One flash sector
+
+        explicit ota_updater(ota_flash* flash);
+
+        bool begin(size_t image_size, const char* sha256_hex);
+        bool write(const uint8_t* data, size_t size, size_t offset);
+        bool finish();
+        void abort(const char* reason);
+
+        ota_status status() const;
+        const char* error() const; // Why the last update failed
+        size_t received() const;
+
+      private:
+        bool write_chunk();
+
+        ota_flash* _flash;
+        ota_status _status = ota_status::idle;
+        const char* _error = nullptr;
+
+        size_t _image_size = 0;
+        size_t _received = 0;
+        uint8_t _expected_sha256[ota_sha256_size] = {0};
+        mbedtls_sha256_context _sha256;
+
+        uint8_t _chunk[chunk_size];
+        size_t _chunk_used = 0;
+    };
+} // namespace mocca
@@ -1,8 +1,30 @@
 #include "persistent_data.hpp"
 
+#include <cstddef>
+
 namespace mocca {
     namespace {
-        uint32_t compute_peristen_data_crc(const persistent_data* data) {
+        // Where each layout ended, oldest first. The data is padded out like the struct was back then.
+        constexpr size_t layout_ends[] = {
+            offsetof(persistent_data, wake_alarms),       // 1: WiFi, timezone and the one-off wake
+            offsetof(persistent_data, low_power_enabled), // 2: weekly wake alarms
+            offsetof(persistent_data, brew),              // 3: deep sleep
+            offsetof(persistent_data, sync_versions),     // 4: brew model
+            offsetof(persistent_data, layout),            // 5: schedule sync
+            offsetof(persistent_data, deep_sleep_lead_secs), // 6: layout number
+            offsetof(persistent_data, wifi_known_good),      // 7: deep sleep lead
+            sizeof(persistent_data),                         // 8: known good WiFi credentials
+        };
+        constexpr size_t layout_count = sizeof(layout_ends) / sizeof(*layout_ends);
+        constexpr uint32_t first_numbered_layout = 6;
+
+        static_assert(layout_count == persistent_data_layout, "Add the new layout to layout_ends");
+
+        constexpr size_t padded_size(size_t end) {
+            return (end + alignof(persistent_data) - 1) / alignof(persistent_data) * alignof(persistent_data);
+        }
+
+        uint32_t compute_peristen_data_crc(const persistent_data* data, size_t size = sizeof(persistent_data)) {
             constexpr uint32_t crc_table[16] = {
                 0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
                 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
@@ -11,7 +33,7 @@ namespace mocca {
             const uint8_t* raw_data = reinterpret_cast<const uint8_t*>(data);
 
             uint32_t crc = ~0L;
-            for (const uint8_t* byte = raw_data + sizeof(uint32_t); byte < raw_data + sizeof(persistent_data); byte++) {
+            for (const uint8_t* byte = raw_data + sizeof(uint32_t); byte < raw_data + size; byte++) {
                 crc = crc_table[(crc ^ (*byte)) & 0x0f] ^ (crc >> 4);
                 crc = crc_table[(crc ^ ((*byte) >> 4)) & 0x0f] ^ (crc >> 4);
                 crc = ~crc;
@@ -28,4 +50,25 @@ namespace mocca {
     void persistent_data::update_crc() {
         crc = compute_peristen_data_crc(this);
     }
+
+    uint32_t migrate_persistent_data(const persistent_data& stored, persistent_data* data) {
+        // Newest first, the older layouts are only told apart by which size their CRC covers.
+        for (uint32_t layout = layout_count; layout > 0; layout--) {
+            if (layout >= first_numbered_layout && stored.layout != layout) {
+                continue;
+            }
+            size_t end = layout_ends[layout - 1];
+            if (compute_peristen_data_crc(&stored, padded_size(end)) != stored.crc) {
+                continue;
+            }
+
+            *data = persistent_data();
+            memcpy(reinterpret_cast<uint8_t*>(data) + sizeof(uint32_t),
+                   reinterpret_cast<const uint8_t*>(&stored) + sizeof(uint32_t), end - sizeof(uint32_t));
+            data->layout = persistent_data_layout;
+            data->update_crc();
+            return layout;
+        }
+        return 0;
+    }
 } // namespace mocca
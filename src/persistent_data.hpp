@@ -1,9 +1,25 @@
 #pragma once
 
+#include "brew_model.hpp"
+#include "wake_schedule.hpp"
+
 #include <Arduino.h>
 #include <ezTime.h>
 
 namespace mocca {
+    // Fields are only ever appended to persistent_data, each addition bumps the layout so that
+    // migrate_persistent_data() can carry older data over.
+    constexpr uint32_t persistent_data_layout = 8;
+
+    constexpr size_t sync_record_count = 3;
+
+    // Version of a record replicated by schedule_sync.
+    struct sync_version {
+        uint32_t counter = 0; // 0 until a unit of the group changed the record
+        uint32_t origin = 0;  // Node that made the change
+        uint32_t hash = 0;    // Of the value it was made with
+    };
+
     struct persistent_data {
         uint32_t crc = 0;
         char wifi_ssid[32] = {0};
@@ -11,8 +27,20 @@ namespace mocca {
         char timezone[64] = {0};
         time_t current_wake = 0;
         uint32_t last_wake_secs = 0; // Seconds into the day that the last wake was set.
+        wake_alarm wake_alarms[max_wake_alarms];
+        time_t skip_wakes_until = 0;
+        uint8_t low_power_enabled = 0; // Deep sleep between wakes
+        brew_model brew;
+        sync_version sync_versions[sync_record_count];
+        uint32_t layout = persistent_data_layout; // Layouts before 6 didn't store it
+        uint16_t deep_sleep_lead_secs = 0;        // How long before a brew deep sleep ends, 0 for the build default
+        uint8_t wifi_known_good = 0;              // The stored credentials have connected before
 
         bool crc_is_valid() const;
         void update_crc();
     };
+
+    // Finds which layout stored holds, as read back from EEPROM, and copies it into data with the fields that layout
+    // didn't have yet left at their defaults. Returns the layout, 0 if stored isn't valid data of any layout.
+    uint32_t migrate_persistent_data(const persistent_data& stored, persistent_data* data);
 } // namespace mocca
\ No newline at end of file
@@ -0,0 +1,137 @@
+#include "power_manager.hpp"
+
+#include "features.hpp"
+#include "logger.hpp"
+
+#if MOCCA_FEATURE_DISPLAY
+#include <Adafruit_SSD1306.h>
+#endif
+#if MOCCA_FEATURE_WIFI
+#include <WiFi.h>
+#endif
+#include <cinttypes>
+
+namespace mocca {
+    namespace {
+        constexpr uint32_t active_cpu_mhz = 240;
+        constexpr uint32_t low_power_cpu_mhz = 80; // Lowest clock the WiFi driver still works at
+
+        // Input wakes the loop right away, these bound how stale everything it only polls can get.
+        constexpr uint32_t loop_interval_millis_by_tier[power_tier_count] = {
+            10,  // active: animations and OneButton's debouncing
+            50,  // idle: the clock on the screen
+            100, // sleep: serial commands and MQTT
+        };
+
+        constexpr uint8_t charge_pump_enable = 0x14;
+        constexpr uint8_t charge_pump_disable = 0x10;
+
+        size_t tier_index(power_tier tier) {
+            return static_cast<size_t>(tier);
+        }
+    } // namespace
+
+    const char* power_tier_name(power_tier tier) {
+        switch (tier) {
+        case power_tier::active:
+            return "active";
+        case power_tier::idle:
+            return "idle";
+        case power_tier::sleep:
+            return "sleep";
+        default:
+            return "unknown";
+        }
+    }
+
+    void power_manager::start(Adafruit_SSD1306* display, uint32_t now) {
+        _display = display;
+        _tier = power_tier::active;
+        _tier_since = now;
+        setCpuFrequencyMhz(active_cpu_mhz);
+#if MOCCA_FEATURE_WIFI
+        WiFi.setSleep(WIFI_PS_NONE);
+#endif
+    }
+
+    void power_manager::set_tier(power_tier tier, uint32_t now) {
+        if (tier == _tier) {
+            return;
+        }
+
+        uint32_t change_start = micros();
+
+        // Panel first when waking so that the frame drawn right after is visible, last when going down.
+        if (tier == power_tier::active) {
+            apply_display(tier);
+        }
+
+        setCpuFrequencyMhz(tier == power_tier::active ? active_cpu_mhz : low_power_cpu_mhz);
+
+#if MOCCA_FEATURE_WIFI
+        switch (tier) {
+        case power_tier::active:
+            WiFi.setSleep(WIFI_PS_NONE);
+            break;
+        case power_tier::idle:
+            WiFi.setSleep(WIFI_PS_MIN_MODEM);
+            break;
+        case power_tier::sleep:
+            WiFi.setSleep(WIFI_PS_MAX_MODEM);
+            break;
+        }
+#endif
+
+        if (tier != power_tier::active) {
+            apply_display(tier);
+        }
+
+        if (tier == power_tier::active) {
+            _stats.worst_wake_micros = std::max(_stats.worst_wake_micros, micros() - change_start);
+        }
+
+        MOCCA_LOGD(power, "Power tier %s to %s after %" PRIu32 " ms.", power_tier_name(_tier), power_tier_name(tier),
+                   now - _tier_since);
+
+        _stats.tier_millis[tier_index(_tier)] += now - _tier_since;
+        _stats.tier_changes++;
+        _tier = tier;
+        _tier_since = now;
+    }
+
+    power_tier power_manager::tier() const {
+        return _tier;
+    }
+
+    uint32_t power_manager::loop_interval_millis() const {
+        return loop_interval_millis_by_tier[tier_index(_tier)];
+    }
+
+    power_stats power_manager::get_stats(uint32_t now) const {
+        power_stats stats = _stats;
+        stats.tier_millis[tier_index(_tier)] += now - _tier_since;
+        return stats;
+    }
+
+    void power_manager::apply_display(power_tier tier) {
+#if MOCCA_FEATURE_DISPLAY
+        if (!_display) {
+            return;
+        }
+
+        if (tier == power_tier::sleep) {
+            _display->ssd1306_command(SSD1306_DISPLAYOFF);
+            _display->ssd1306_command(SSD1306_CHARGEPUMP);
+            _display->ssd1306_command(charge_pump_disable);
+            return;
+        }
+
+        if (_tier == power_tier::sleep) {
+            _display->ssd1306_command(SSD1306_CHARGEPUMP);
+            _display->ssd1306_command(charge_pump_enable);
+            _display->ssd1306_command(SSD1306_DISPLAYON);
+        }
+        _display->dim(tier == power_tier::idle);
+#endif
+    }
+} // namespace mocca
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <Arduino.h>
+
+class Adafruit_SSD1306;
+
+namespace mocca {
+    enum class power_tier : uint8_t {
+        active, // Brewing or someone is using the device: full clock, full brightness, WiFi always listening
+        idle,   // Showing the clock: reduced clock, dimmed panel, WiFi modem sleep
+        sleep,  // Nothing to show: reduced clock, panel and its charge pump off, deepest modem sleep
+    };
+
+    constexpr size_t power_tier_count = 3;
+
+    const char* power_tier_name(power_tier tier);
+
+    struct power_stats {
+        uint32_t tier_millis[power_tier_count] = {0}; // Time spent in each tier
+        uint32_t tier_changes = 0;
+        uint32_t worst_wake_micros = 0; // Longest time taken to get back to the active tier
+    };
+
+    // Applies the display, CPU clock and WiFi power settings of a tier. Only does work when the tier changes, so it is
+    // cheap to call every loop. Must be called from the task that draws to the display. Without a display only the CPU
+    // clock and WiFi follow the tier.
+    class power_manager {
+      public:
+        void start(Adafruit_SSD1306* display, uint32_t now);
+
+        void set_tier(power_tier tier, uint32_t now);
+        power_tier tier() const;
+
+        // Longest the control loop sleeps between ticks in the current tier, which also paces its frames.
+        uint32_t loop_interval_millis() const;
+
+        power_stats get_stats(uint32_t now) const;
+
+      private:
+        void apply_display(power_tier tier);
+
+        Adafruit_SSD1306* _display = nullptr;
+        power_tier _tier = power_tier::active;
+        uint32_t _tier_since = 0;
+        power_stats _stats;
+    };
+} // namespace mocca
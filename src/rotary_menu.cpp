@@ -18,12 +18,21 @@ namespace mocca {
         constexpr size_t text_size = 2;
         constexpr size_t character_width = 6 * text_size;
         constexpr size_t half_character_pad = character_width / 2;
+
+        constexpr int32_t list_character_width = 6;
+        constexpr int32_t list_row_height = 9; // 8 pixel font plus a line of spacing
+        constexpr int32_t list_scroll_bar_width = 2;
+
+        constexpr uint32_t acceleration_reset_millis = 150; // A pause this long drops back to one row per detent
+        constexpr uint32_t acceleration_rate_divisor = 40;  // Rows per detent grow with the square of the turn rate
+        constexpr size_t min_detents_per_list = 20;         // Even flat out the whole list takes this many detents
     } // namespace
 
     void rotary_time_input::set_current_time(uint32_t seconds, const char* default_option) {
         _seconds = seconds;
         _default_option = default_option ? default_option : "";
         _on_default_option = default_option != nullptr;
+        invalidate();
     }
 
     bool rotary_time_input::is_on_default_option() const {
@@ -45,87 +54,248 @@ namespace mocca {
         } else {
             _seconds = advance_selected_item(_seconds, delta * _step, SECS_PER_DAY);
         }
+        invalidate();
     }
 
-    void rotary_time_input::draw(Adafruit_SSD1306* display, const box& area) {
+    void rotary_time_input::draw(Adafruit_SSD1306* display) {
+        const box& area = bounds();
 
-        String cur_option = _default_option;
+        String cur_option;
         if (!_on_default_option) {
             time_t t = previousMidnight(ezt::now()) + _seconds;
             cur_option = ezt::dateTime(t, "g:i a");
         }
 
         display->setTextSize(2);
-        box center_text_area =
-            draw_aligned_text(display, cur_option.c_str(), text_alignment::right, text_alignment::center, area);
+        box center_text_area = draw_aligned_text(display, _on_default_option ? _default_option : cur_option.c_str(),
+                                                 text_alignment::right, text_alignment::center, area);
 
         box carat_area(area.x, area.y, center_text_area.x - half_character_pad - area.x, area.h);
         draw_aligned_text(display, ">", text_alignment::right, text_alignment::center, carat_area);
     }
 
-    void rotary_menu::set_menu_options(std::vector<rotary_menu_option>&& options, uint32_t selected_option) {
-        _menu_options = std::move(options);
-        if (!_menu_options.empty()) {
-            _selected_option = selected_option % _menu_options.size();
-        } else {
-            _selected_option = 0;
-        }
+    void rotary_menu::open(const rotary_menu_page* page, rotary_menu_handler* handler) {
+        _handler = handler;
+        _pages[0] = page;
+        _depth = 1;
+        select_first_visible();
+        invalidate();
+    }
 
-        _max_option_length = 0;
-        for (const rotary_menu_option& option : _menu_options) {
-            _max_option_length = std::max(_max_option_length, option.display_text.length());
+    bool rotary_menu::back() {
+        if (_depth <= 1) {
+            return false;
         }
+
+        _depth--;
+        invalidate();
+        return true;
     }
 
     void rotary_menu::on_encoder_changed(int delta) {
-        if (_menu_options.empty()) {
+        if (!select_visible()) {
             return;
         }
 
-        _selected_option = advance_selected_item(_selected_option, delta, _menu_options.size());
+        _selected[_depth - 1] = advance_visible(_selected[_depth - 1], delta);
+        invalidate();
     }
 
     void rotary_menu::on_encoder_clicked() {
-        if (_menu_options.empty()) {
+        if (!select_visible()) {
             return;
         }
 
-        rotary_menu_callback callback = _menu_options[_selected_option].callback;
-        if (callback) {
-            callback();
+        const rotary_menu_item& item = page().items[_selected[_depth - 1]];
+        if (item.submenu) {
+            if (_depth < max_depth) {
+                _pages[_depth++] = item.submenu;
+                select_first_visible();
+                invalidate();
+            }
+        } else if (item.action == back_action) {
+            back();
+        } else {
+            // The handler may reopen the menu, don't touch the item after this.
+            _handler->on_menu_item_clicked(item.action, item.argument);
         }
     }
 
-    void rotary_menu::draw(Adafruit_SSD1306* display, const box& area) {
-        if (_menu_options.empty()) {
+    void rotary_menu::draw(Adafruit_SSD1306* display) {
+        const box& area = bounds();
+        if (!select_visible()) {
             return;
         }
 
-        const String& cur_option = _menu_options[_selected_option].display_text;
-        size_t cur_option_padding = ((_max_option_length - cur_option.length()) * character_width) + half_character_pad;
+        size_t selected = _selected[_depth - 1];
+        const char* cur_option = page().items[selected].label;
+        size_t cur_option_padding =
+            ((page().max_label_length - label_length(cur_option)) * character_width) + half_character_pad;
 
         display->setTextSize(text_size);
         box offset_area(area.x, area.y, area.w - cur_option_padding, area.h);
         box center_text_area =
-            draw_aligned_text(display, cur_option.c_str(), text_alignment::right, text_alignment::center, offset_area);
+            draw_aligned_text(display, cur_option, text_alignment::right, text_alignment::center, offset_area);
 
         box carat_area(area.x, area.y, center_text_area.x - half_character_pad - area.x, area.h);
         draw_aligned_text(display, ">", text_alignment::right, text_alignment::center, carat_area);
 
-        if (_menu_options.size() >= 2) {
+        size_t prev_index = advance_visible(selected, -1);
+        if (prev_index != selected) {
             uint16_t other_option_text_left = center_text_area.x + half_character_pad;
             box area_above(other_option_text_left, area.y, area.right() - other_option_text_left,
                            center_text_area.y - area.y);
 
-            uint32_t prev_index = advance_selected_item(_selected_option, -1, _menu_options.size());
-            const String& prev_option = _menu_options[prev_index].display_text;
-            draw_aligned_text(display, prev_option.c_str(), text_alignment::left, text_alignment::bottom, area_above);
+            const char* prev_option = page().items[prev_index].label;
+            draw_aligned_text(display, prev_option, text_alignment::left, text_alignment::bottom, area_above);
 
-            uint32_t next_index = advance_selected_item(_selected_option, 1, _menu_options.size());
-            const String& next_option = _menu_options[next_index].display_text;
+            size_t next_index = advance_visible(selected, 1);
+            const char* next_option = page().items[next_index].label;
             box area_below(other_option_text_left, center_text_area.bottom(), area.right() - other_option_text_left,
                            area.bottom() - center_text_area.bottom());
-            draw_aligned_text(display, next_option.c_str(), text_alignment::left, text_alignment::bottom, area_below);
+            draw_aligned_text(display, next_option, text_alignment::left, text_alignment::bottom, area_below);
         }
     }
+
+    const rotary_menu_page& rotary_menu::page() const {
+        return *_pages[_depth - 1];
+    }
+
+    bool rotary_menu::is_visible(size_t item_idx) const {
+        const rotary_menu_item& item = page().items[item_idx];
+        return item.submenu || item.action == back_action || _handler->is_menu_item_visible(item.action);
+    }
+
+    bool rotary_menu::select_visible() {
+        if (_depth == 0) {
+            return false;
+        }
+        // Visibility can change while the menu is open.
+        if (!is_visible(_selected[_depth - 1])) {
+            select_first_visible();
+        }
+        return is_visible(_selected[_depth - 1]);
+    }
+
+    size_t rotary_menu::advance_visible(size_t item_idx, int delta) const {
+        int step = delta < 0 ? -1 : 1;
+        for (int remaining = delta < 0 ? -delta : delta; remaining > 0; remaining--) {
+            // At most one full lap, the item we started from is visible.
+            for (size_t tries = 0; tries < page().item_count; tries++) {
+                item_idx = advance_selected_item(item_idx, step, page().item_count);
+                if (is_visible(item_idx)) {
+                    break;
+                }
+            }
+        }
+        return item_idx;
+    }
+
+    void rotary_menu::select_first_visible() {
+        _selected[_depth - 1] = 0;
+        for (size_t item_idx = 0; item_idx < page().item_count; item_idx++) {
+            if (is_visible(item_idx)) {
+                _selected[_depth - 1] = item_idx;
+                return;
+            }
+        }
+    }
+
+    void rotary_list::open(const rotary_list_source* source, size_t selected) {
+        _source = source;
+        _selected = selected;
+        _first_row = 0;
+        _turn_rate = 0;
+        invalidate();
+    }
+
+    size_t rotary_list::selected() const {
+        return _selected;
+    }
+
+    bool rotary_list::is_empty() const {
+        return !_source || _source->list_size() == 0;
+    }
+
+    void rotary_list::on_encoder_changed(int delta, uint32_t now) {
+        if (is_empty()) {
+            return;
+        }
+
+        // Long lists stop at the ends, wrapping around at speed would be disorienting.
+        int64_t target = static_cast<int64_t>(_selected) + accelerated_delta(delta, now);
+        int64_t last_row = static_cast<int64_t>(_source->list_size()) - 1;
+        size_t selected = static_cast<size_t>(std::min(std::max(target, int64_t(0)), last_row));
+        if (selected != _selected) {
+            _selected = selected;
+            invalidate();
+        }
+    }
+
+    void rotary_list::draw(Adafruit_SSD1306* display) {
+        const box& area = bounds();
+        if (is_empty()) {
+            return;
+        }
+
+        size_t size = _source->list_size();
+        size_t row_count = std::max<int32_t>(area.h / list_row_height, 1);
+
+        // The source may have shrunk since the last frame.
+        _selected = std::min(_selected, size - 1);
+        if (_selected < _first_row) {
+            _first_row = _selected;
+        } else if (_selected >= _first_row + row_count) {
+            _first_row = _selected - row_count + 1;
+        }
+        _first_row = std::min(_first_row, size > row_count ? size - row_count : 0);
+
+        int32_t text_w = area.w - list_scroll_bar_width - 1;
+        size_t max_columns = std::min<size_t>(std::max<int32_t>(text_w / list_character_width, 0), max_label_length);
+
+        display->setTextSize(1);
+        display->setTextWrap(false);
+        size_t last_row = std::min(_first_row + row_count, size);
+        for (size_t row = _first_row; row < last_row; row++) {
+            // Fixed width font, cutting the label at a column count is all the measuring needed.
+            char label[max_label_length + 1];
+            _source->list_label(row, label, sizeof(label));
+            label[max_columns] = '\0';
+
+            int32_t row_y = area.y + static_cast<int32_t>(row - _first_row) * list_row_height;
+            display->setCursor(area.x + 1, row_y + 1);
+            display->print(label);
+            if (row == _selected) {
+                display->fillRect(area.x, row_y, text_w, list_row_height, SSD1306_INVERSE);
+            }
+        }
+        display->setTextWrap(true);
+
+        if (size > row_count) {
+            int32_t bar_x = area.right() - list_scroll_bar_width;
+            int32_t thumb_h = std::max<int32_t>(area.h * row_count / size, 2);
+            int32_t thumb_y = area.y + static_cast<int32_t>((area.h - thumb_h) * _first_row / (size - row_count));
+            display->fillRect(bar_x, thumb_y, list_scroll_bar_width, thumb_h, SSD1306_WHITE);
+        }
+    }
+
+    int32_t rotary_list::accelerated_delta(int delta, uint32_t now) {
+        uint32_t detents = delta < 0 ? -delta : delta;
+        uint32_t since_last_turn = now - _last_turn;
+        _last_turn = now;
+
+        if (since_last_turn >= acceleration_reset_millis) {
+            _turn_rate = 0;
+            return delta;
+        }
+
+        uint32_t rate = detents * MILLIS_PER_SEC / std::max<uint32_t>(since_last_turn, 1);
+        _turn_rate = (_turn_rate * 3 + rate) / 4;
+
+        // Short lists never accelerate so that every detent is still one row.
+        uint32_t max_rows_per_detent = std::max<size_t>(_source->list_size() / min_detents_per_list, 1);
+        uint32_t rows_per_detent = std::min(std::max(_turn_rate * _turn_rate / acceleration_rate_divisor, uint32_t(1)),
+                                            max_rows_per_detent);
+        return static_cast<int32_t>(rows_per_detent) * delta;
+    }
 } // namespace mocca
@@ -1,16 +1,15 @@
 #pragma once
 
 #include "util.hpp"
+#include "widgets.hpp"
 
 #include <Adafruit_SSD1306.h>
 #include <Arduino.h>
 
-#include <functional>
-#include <vector>
-#include <optional>
+#include <algorithm>
 
 namespace mocca {
-    class rotary_time_input {
+    class rotary_time_input : public widget {
       public:
         void set_current_time(uint32_t seconds, const char* default_option);
         bool is_on_default_option() const;
@@ -20,34 +19,114 @@ namespace mocca {
 
         void on_encoder_changed(int delta);
 
-        void draw(Adafruit_SSD1306* display, const box& area);
+      protected:
+        void draw(Adafruit_SSD1306* display) override;
 
       private:
-        String _default_option;
+        const char* _default_option = "";
         bool _on_default_option = false;
         uint32_t _step = 1;
         uint32_t _seconds = 0;
     };
 
-    using rotary_menu_callback = std::function<void(void)>;
+    struct rotary_menu_page;
 
-    struct rotary_menu_option {
-        String display_text;
-        rotary_menu_callback callback;
+    struct rotary_menu_item {
+        const char* label;
+        uint8_t action = 0;                       // Handed to the handler when clicked
+        uint8_t argument = 0;                     // Handed along with the action
+        const rotary_menu_page* submenu = nullptr; // Opened instead of running an action
     };
 
-    class rotary_menu {
+    constexpr size_t label_length(const char* label) {
+        size_t length = 0;
+        while (label[length] != '\0') {
+            length++;
+        }
+        return length;
+    }
+
+    struct rotary_menu_page {
+        const rotary_menu_item* items;
+        size_t item_count;
+        size_t max_label_length; // Used to line the labels up, hidden items included so the menu doesn't jump around
+    };
+
+    template <size_t item_count>
+    constexpr rotary_menu_page make_menu_page(const rotary_menu_item (&items)[item_count]) {
+        size_t max_length = 0;
+        for (size_t item_idx = 0; item_idx < item_count; item_idx++) {
+            max_length = std::max(max_length, label_length(items[item_idx].label));
+        }
+        return {items, item_count, max_length};
+    }
+
+    // Decides what a menu shows and does. Items are identified by their action so that the menu description can live
+    // in flash.
+    class rotary_menu_handler {
       public:
-        void set_menu_options(std::vector<rotary_menu_option>&& options, uint32_t selected_option = 0);
+        virtual bool is_menu_item_visible(uint8_t action) const = 0;
+        virtual void on_menu_item_clicked(uint8_t action, uint8_t argument) = 0;
+    };
+
+    // Navigates a static tree of menu pages. Opening and moving around menus never allocates.
+    class rotary_menu : public widget {
+      public:
+        static constexpr size_t max_depth = 4;
+        static constexpr uint8_t back_action = 0xff; // Returns to the parent page
+
+        void open(const rotary_menu_page* page, rotary_menu_handler* handler);
+        bool back(); // Returns false if already on the top page
 
         void on_encoder_changed(int delta);
         void on_encoder_clicked();
 
-        void draw(Adafruit_SSD1306* display, const box& area);
+      protected:
+        void draw(Adafruit_SSD1306* display) override;
 
       private:
-        std::vector<rotary_menu_option> _menu_options;
-        size_t _max_option_length = 0;
-        uint32_t _selected_option = 0;
+        const rotary_menu_page& page() const;
+        bool is_visible(size_t item_idx) const;
+        bool select_visible();
+        size_t advance_visible(size_t item_idx, int delta) const;
+        void select_first_visible();
+
+        rotary_menu_handler* _handler = nullptr;
+        const rotary_menu_page* _pages[max_depth] = {nullptr};
+        size_t _selected[max_depth] = {0};
+        size_t _depth = 0;
+    };
+
+    // Supplies the rows of a rotary_list. Labels are only asked for rows that are on screen, so a source can describe
+    // thousands of entries without holding any of them in memory.
+    class rotary_list_source {
+      public:
+        virtual size_t list_size() const = 0;
+        virtual void list_label(size_t row, char* out, size_t out_size) const = 0;
+    };
+
+    // Scrolling list for selections too long for rotary_menu. Only the rows on screen are fetched and drawn, so a frame
+    // costs the same for ten entries as for ten thousand. Turning the encoder quickly moves several rows per detent.
+    class rotary_list : public widget {
+      public:
+        static constexpr size_t max_label_length = 32;
+
+        void open(const rotary_list_source* source, size_t selected = 0);
+        size_t selected() const;
+        bool is_empty() const;
+
+        void on_encoder_changed(int delta, uint32_t now);
+
+      protected:
+        void draw(Adafruit_SSD1306* display) override;
+
+      private:
+        int32_t accelerated_delta(int delta, uint32_t now);
+
+        const rotary_list_source* _source = nullptr;
+        size_t _selected = 0;
+        size_t _first_row = 0; // Topmost row on screen
+        uint32_t _last_turn = 0;
+        uint32_t _turn_rate = 0; // Smoothed detents per second
     };
-} // namespace mocca
\ No newline at end of file
+} // namespace mocca
@@ -0,0 +1,455 @@
+#include "schedule_sync.hpp"
+
+#include "logger.hpp"
+#include "util.hpp"
+
+#include <cinttypes>
+
+namespace mocca {
+    namespace {
+        constexpr uint8_t packet_magic[] = {'M', 'W'};
+        constexpr uint8_t protocol_version = 1;
+        constexpr uint8_t packet_digest = 1; // Versions of every record
+        constexpr uint8_t packet_record = 2; // One record with its version and value
+
+        constexpr size_t header_size = sizeof(packet_magic) + 1 + 1 + 4 + 4; // Magic, protocol, type, group, node
+        constexpr size_t version_size = 12;
+        constexpr size_t max_value_size = sizeof(persistent_data::timezone) - 1;
+        constexpr size_t max_packet_size = header_size + 1 + version_size + 2 + max_value_size;
+
+        constexpr uint32_t digest_interval = MILLIS_PER_SEC * 15;
+        constexpr uint32_t digest_jitter = MILLIS_PER_SEC * 5; // Keeps units that booted together from lining up
+        constexpr uint32_t peer_timeout = (digest_interval + digest_jitter) * 3;
+        constexpr uint32_t repeat_delay = 250; // Second copy of a local change in case the first one got lost
+        constexpr uint32_t max_reply_delay = 100;
+        constexpr uint32_t send_token_millis = 100; // At most 10 packets a second
+        constexpr uint32_t max_send_tokens = 8;
+        constexpr size_t max_receives_per_step = 8;
+
+        constexpr uint32_t fnv_offset_basis = 2166136261u;
+        constexpr uint32_t fnv_prime = 16777619u;
+
+        uint32_t fnv1a(const uint8_t* data, size_t size) {
+            uint32_t hash = fnv_offset_basis;
+            for (size_t idx = 0; idx < size; idx++) {
+                hash = (hash ^ data[idx]) * fnv_prime;
+            }
+            return hash;
+        }
+
+        bool is_due(uint32_t now, uint32_t due) {
+            return static_cast<int32_t>(now - due) >= 0;
+        }
+
+        const char* record_name(sync_record record) {
+            switch (record) {
+            case sync_record::wake:
+                return "wake";
+            case sync_record::alarms:
+                return "alarms";
+            case sync_record::timezone:
+                return "timezone";
+            default:
+                return "?";
+            }
+        }
+
+        bool is_newer(const sync_version& version, const sync_version& other) {
+            return version.counter != other.counter ? version.counter > other.counter : version.origin > other.origin;
+        }
+
+        uint8_t* put_u16(uint8_t* out, uint16_t value) {
+            *out++ = value >> 8;
+            *out++ = value;
+            return out;
+        }
+
+        uint8_t* put_u32(uint8_t* out, uint32_t value) {
+            out = put_u16(out, value >> 16);
+            return put_u16(out, value);
+        }
+
+        uint16_t read_u16(const uint8_t* data) {
+            return (data[0] << 8) | data[1];
+        }
+
+        uint32_t read_u32(const uint8_t* data) {
+            return (static_cast<uint32_t>(read_u16(data)) << 16) | read_u16(data + 2);
+        }
+
+        uint8_t* put_version(uint8_t* out, const sync_version& version) {
+            out = put_u32(out, version.counter);
+            out = put_u32(out, version.origin);
+            return put_u32(out, version.hash);
+        }
+
+        sync_version read_version(const uint8_t* data) {
+            sync_version version;
+            version.counter = read_u32(data);
+            version.origin = read_u32(data + 4);
+            version.hash = read_u32(data + 8);
+            return version;
+        }
+    } // namespace
+
+    void schedule_sync::init(const char* group, uint32_t node_id, persistent_data* data) {
+        _group = fnv1a(reinterpret_cast<const uint8_t*>(group), strlen(group));
+        _node = node_id;
+        _data = data;
+        adopt_local_values();
+    }
+
+    void schedule_sync::set_callbacks(sync_wake_callback wake_callback, sync_alarms_callback alarms_callback,
+                                      sync_timezone_callback timezone_callback, sync_save_callback save_callback) {
+        _wake_callback = wake_callback;
+        _alarms_callback = alarms_callback;
+        _timezone_callback = timezone_callback;
+        _save_callback = save_callback;
+    }
+
+    void schedule_sync::start(const IPAddress& group_address, uint16_t port) {
+        if (!_udp.beginMulticast(group_address, port)) {
+            MOCCA_LOGW(core, "Failed to join the sync group.");
+            return;
+        }
+        _running = true;
+        _send_tokens = max_send_tokens;
+        _last_token = millis();
+        _digest_pending = true;
+    }
+
+    void schedule_sync::stop() {
+        if (!_running) {
+            return;
+        }
+        _udp.stop();
+        _running = false;
+        _pending_records = 0;
+        _repeat_records = 0;
+    }
+
+    void schedule_sync::on_local_change(sync_record record) {
+        if (!_data) {
+            return;
+        }
+        size_t idx = static_cast<size_t>(record);
+        uint32_t hash = value_hash(record);
+        sync_version& version = _data->sync_versions[idx];
+        if (hash == version.hash) {
+            return;
+        }
+
+        version.counter = std::max<uint32_t>(version.counter + 1, _utc);
+        version.origin = _node;
+        version.hash = hash;
+        _stats.local_changes++;
+
+        uint32_t now = millis();
+        schedule_record(record, now);
+        _repeat_records |= 1 << idx;
+        _repeat_due = now + repeat_delay;
+    }
+
+    void schedule_sync::adopt_local_values() {
+        for (size_t idx = 0; idx < sync_record_count; idx++) {
+            sync_version& version = _data->sync_versions[idx];
+            if (version.counter == 0) {
+                version.origin = 0;
+                version.hash = value_hash(static_cast<sync_record>(idx));
+            }
+        }
+    }
+
+    void schedule_sync::step(uint32_t now, time_t utc) {
+        _utc = utc;
+        if (!_running) {
+            return;
+        }
+
+        receive_packets(now);
+        expire_peers(now);
+
+        if (_repeat_records != 0 && is_due(now, _repeat_due)) {
+            for (size_t idx = 0; idx < sync_record_count; idx++) {
+                if (_repeat_records & (1 << idx)) {
+                    schedule_record(static_cast<sync_record>(idx), now);
+                }
+            }
+            _repeat_records = 0;
+        }
+
+        for (size_t idx = 0; idx < sync_record_count; idx++) {
+            if ((_pending_records & (1 << idx)) && is_due(now, _record_due[idx]) && take_send_token(now)) {
+                _pending_records &= ~(1 << idx);
+                send_record(static_cast<sync_record>(idx));
+            }
+        }
+
+        if ((_digest_pending || is_due(now, _next_digest)) && take_send_token(now)) {
+            _digest_pending = false;
+            _next_digest = now + digest_interval + random(digest_jitter);
+            send_digest();
+        }
+    }
+
+    sync_stats schedule_sync::get_stats() const {
+        return _stats;
+    }
+
+    size_t schedule_sync::encode_value(sync_record record, uint8_t* out) const {
+        uint8_t* start = out;
+        switch (record) {
+        case sync_record::wake: {
+            // Absolute, so units agree on the brew even while their clocks or timezones don't.
+            uint64_t wake = static_cast<uint64_t>(_data->current_wake);
+            out = put_u32(out, wake >> 32);
+            out = put_u32(out, wake);
+            out = put_u32(out, _data->last_wake_secs);
+            break;
+        }
+        case sync_record::alarms:
+            for (const wake_alarm& alarm : _data->wake_alarms) {
+                out = put_u16(out, alarm.minute_of_day);
+                *out++ = alarm.days;
+                *out++ = alarm.enabled;
+            }
+            break;
+        case sync_record::timezone: {
+            size_t length = strnlen(_data->timezone, max_value_size);
+            memcpy(out, _data->timezone, length);
+            out += length;
+            break;
+        }
+        }
+        return out - start;
+    }
+
+    uint32_t schedule_sync::value_hash(sync_record record) const {
+        uint8_t value[max_value_size];
+        return fnv1a(value, encode_value(record, value));
+    }
+
+    bool schedule_sync::apply_value(sync_record record, const uint8_t* value, size_t size) {
+        switch (record) {
+        case sync_record::wake:
+            if (size != 12) {
+                return false;
+            }
+            if (_wake_callback) {
+                uint64_t wake = (static_cast<uint64_t>(read_u32(value)) << 32) | read_u32(value + 4);
+                _wake_callback(static_cast<time_t>(wake), read_u32(value + 8));
+            }
+            return true;
+
+        case sync_record::alarms: {
+            if (size != max_wake_alarms * 4) {
+                return false;
+            }
+            wake_alarm alarms[max_wake_alarms];
+            for (size_t idx = 0; idx < max_wake_alarms; idx++) {
+                const uint8_t* encoded = value + idx * 4;
+                alarms[idx].minute_of_day = read_u16(encoded);
+                alarms[idx].days = encoded[2];
+                alarms[idx].enabled = encoded[3];
+            }
+            if (_alarms_callback) {
+                _alarms_callback(alarms, max_wake_alarms);
+            }
+            return true;
+        }
+
+        case sync_record::timezone: {
+            char timezone[max_value_size + 1];
+            memcpy(timezone, value, size);
+            timezone[size] = '\0';
+            return !_timezone_callback || _timezone_callback(timezone);
+        }
+        }
+        return false;
+    }
+
+    void schedule_sync::receive_packets(uint32_t now) {
+        for (size_t received = 0; received < max_receives_per_step; received++) {
+            int size = _udp.parsePacket();
+            if (size <= 0) {
+                return;
+            }
+
+            uint8_t packet[max_packet_size];
+            if (static_cast<size_t>(size) > sizeof(packet) || _udp.read(packet, size) != size ||
+                static_cast<size_t>(size) < header_size || memcmp(packet, packet_magic, sizeof(packet_magic)) != 0 ||
+                packet[2] != protocol_version) {
+                _stats.malformed++;
+                continue;
+            }
+
+            uint32_t group = read_u32(packet + 4);
+            uint32_t node = read_u32(packet + 8);
+            if (group != _group || node == _node) {
+                continue; // Another group, or our own packet looped back
+            }
+
+            _stats.received++;
+            note_peer(node, now);
+            if (packet[3] == packet_digest) {
+                handle_digest(now, packet + header_size, size - header_size);
+            } else if (packet[3] == packet_record) {
+                handle_record(now, node, packet + header_size, size - header_size);
+            } else {
+                _stats.malformed++;
+            }
+        }
+    }
+
+    void schedule_sync::handle_digest(uint32_t now, const uint8_t* body, size_t size) {
+        if (size != sync_record_count * version_size) {
+            _stats.malformed++;
+            return;
+        }
+
+        for (size_t idx = 0; idx < sync_record_count; idx++) {
+            sync_version theirs = read_version(body + idx * version_size);
+            const sync_version& ours = _data->sync_versions[idx];
+            if (is_newer(ours, theirs)) {
+                schedule_record(static_cast<sync_record>(idx), now + random(max_reply_delay));
+            } else if (is_newer(theirs, ours)) {
+                _digest_pending = true; // Whoever has it answers with the record
+            }
+        }
+    }
+
+    void schedule_sync::handle_record(uint32_t now, uint32_t node, const uint8_t* body, size_t size) {
+        if (size < 1 + version_size + 2 || body[0] >= sync_record_count) {
+            _stats.malformed++;
+            return;
+        }
+        size_t idx = body[0];
+        sync_record record = static_cast<sync_record>(idx);
+        sync_version theirs = read_version(body + 1);
+        size_t value_size = read_u16(body + 1 + version_size);
+        const uint8_t* value = body + 1 + version_size + 2;
+        if (size != 1 + version_size + 2 + value_size || value_size > max_value_size ||
+            fnv1a(value, value_size) != theirs.hash) {
+            _stats.malformed++;
+            return;
+        }
+
+        sync_version& ours = _data->sync_versions[idx];
+        if (is_newer(ours, theirs)) {
+            schedule_record(record, now + random(max_reply_delay)); // Set the sender straight
+            return;
+        }
+        if (!is_newer(theirs, ours)) {
+            _pending_records &= ~(1 << idx); // Someone else answered already
+            return;
+        }
+
+        // Versions first, applying the value ends in on_local_change() which must see it as current.
+        _pending_records &= ~(1 << idx);
+        sync_version previous = ours;
+        ours = theirs;
+        if (theirs.hash == value_hash(record)) {
+            if (_save_callback) {
+                _save_callback();
+            }
+        } else {
+            MOCCA_LOGI(core, "Taking the %s from node %08" PRIx32 ".", record_name(record), node);
+            if (!apply_value(record, value, value_size)) {
+                // Asked for again with the next digest.
+                MOCCA_LOGW(core, "Failed to apply the %s from node %08" PRIx32 ".", record_name(record), node);
+                ours = previous;
+                return;
+            }
+        }
+        _stats.applied++;
+    }
+
+    void schedule_sync::schedule_record(sync_record record, uint32_t due) {
+        size_t idx = static_cast<size_t>(record);
+        if (!(_pending_records & (1 << idx)) || is_due(_record_due[idx], due)) {
+            _record_due[idx] = due;
+        }
+        _pending_records |= 1 << idx;
+    }
+
+    bool schedule_sync::take_send_token(uint32_t now) {
+        uint32_t earned = (now - _last_token) / send_token_millis;
+        if (earned > 0) {
+            _send_tokens = std::min(_send_tokens + earned, max_send_tokens);
+            _last_token += earned * send_token_millis;
+        }
+        if (_send_tokens == 0) {
+            return false;
+        }
+        _send_tokens--;
+        return true;
+    }
+
+    size_t schedule_sync::begin_packet(uint8_t* out, uint8_t type) const {
+        uint8_t* start = out;
+        memcpy(out, packet_magic, sizeof(packet_magic));
+        out += sizeof(packet_magic);
+        *out++ = protocol_version;
+        *out++ = type;
+        out = put_u32(out, _group);
+        out = put_u32(out, _node);
+        return out - start;
+    }
+
+    void schedule_sync::send_packet(const uint8_t* packet, size_t size) {
+        if (!_udp.beginMulticastPacket() || _udp.write(packet, size) != size || !_udp.endPacket()) {
+            MOCCA_LOGD(core, "Failed to send a sync packet.");
+            return;
+        }
+        _stats.sent++;
+    }
+
+    void schedule_sync::send_digest() {
+        uint8_t packet[header_size + sync_record_count * version_size];
+        uint8_t* out = packet + begin_packet(packet, packet_digest);
+        for (const sync_version& version : _data->sync_versions) {
+            out = put_version(out, version);
+        }
+        send_packet(packet, out - packet);
+    }
+
+    void schedule_sync::send_record(sync_record record) {
+        size_t idx = static_cast<size_t>(record);
+        uint8_t packet[max_packet_size];
+        uint8_t* out = packet + begin_packet(packet, packet_record);
+        *out++ = idx;
+        out = put_version(out, _data->sync_versions[idx]);
+        size_t value_size = encode_value(record, out + 2);
+        out = put_u16(out, value_size);
+        send_packet(packet, out + value_size - packet);
+    }
+
+    void schedule_sync::note_peer(uint32_t node, uint32_t now) {
+        peer* free_slot = nullptr;
+        for (peer& slot : _peers) {
+            if (slot.node == node) {
+                slot.last_seen = now;
+                return;
+            }
+            if (slot.node == 0 && !free_slot) {
+                free_slot = &slot;
+            }
+        }
+        if (free_slot) {
+            MOCCA_LOGI(core, "Sync peer %08" PRIx32 " joined.", node);
+            free_slot->node = node;
+            free_slot->last_seen = now;
+            _stats.peers++;
+        }
+    }
+
+    void schedule_sync::expire_peers(uint32_t now) {
+        for (peer& slot : _peers) {
+            if (slot.node != 0 && now - slot.last_seen >= peer_timeout) {
+                MOCCA_LOGI(core, "Sync peer %08" PRIx32 " left.", slot.node);
+                slot.node = 0;
+                _stats.peers--;
+            }
+        }
+    }
+} // namespace mocca
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "persistent_data.hpp"
+#include "wake_schedule.hpp"
+
+#include <Arduino.h>
+#include <WiFiUdp.h>
+
+#include <functional>
+
+namespace mocca {
+    enum class sync_record : uint8_t {
+        wake,   // One-off brew time
+        alarms, // Weekly wake alarms
+        timezone,
+    };
+
+    struct sync_stats {
+        uint32_t sent = 0;
+        uint32_t received = 0;
+        uint32_t applied = 0; // Newer records taken from peers
+        uint32_t local_changes = 0;
+        uint32_t malformed = 0;
+        uint32_t peers = 0;
+    };
+
+    using sync_wake_callback = std::function<void(time_t wake, uint32_t wake_secs)>;
+    using sync_alarms_callback = std::function<void(const wake_alarm* alarms, size_t alarm_count)>;
+    using sync_timezone_callback = std::function<bool(const char* timezone)>;
+    using sync_save_callback = std::function<void(void)>;
+
+    // Keeps the schedule and timezone of a group of units on the LAN in sync over UDP multicast, without a server.
+    //
+    // Every record carries a version, a change takes the larger of the old counter plus one and the UTC time, ties go
+    // to the higher node id, so all units agree on the last writer. Changes are multicast right away and once more a
+    // moment later. Every unit also multicasts the versions it holds every 15 s or so: a peer with something newer
+    // answers with the record, a peer that is behind asks by answering with its own versions. Answers are spread over
+    // a short random delay and the first one silences the rest, a token bucket caps what a unit sends.
+    class schedule_sync {
+      public:
+        static constexpr size_t max_peers = 8;
+
+        // The values are read from data, their versions live there too so they survive restarts.
+        void init(const char* group, uint32_t node_id, persistent_data* data);
+        void set_callbacks(sync_wake_callback wake_callback, sync_alarms_callback alarms_callback,
+                           sync_timezone_callback timezone_callback, sync_save_callback save_callback);
+
+        // Follows the network, start() asks the group for anything newer right away.
+        void start(const IPAddress& group_address, uint16_t port);
+        void stop();
+
+        // Call after changing a record's value in data, before saving it. Does nothing if the value is what the
+        // current version says, which also keeps values applied from peers from echoing back.
+        void on_local_change(sync_record record);
+
+        // Takes the current values as unversioned, e.g. after a settings reset, so anything a peer has wins.
+        void adopt_local_values();
+
+        // utc is 0 while the clock isn't set.
+        void step(uint32_t now, time_t utc);
+
+        sync_stats get_stats() const;
+
+      private:
+        struct peer {
+            uint32_t node = 0; // 0 for a free slot
+            uint32_t last_seen = 0;
+        };
+
+        size_t encode_value(sync_record record, uint8_t* out) const;
+        uint32_t value_hash(sync_record record) const;
+        bool apply_value(sync_record record, const uint8_t* value, size_t size);
+
+        void receive_packets(uint32_t now);
+        void handle_digest(uint32_t now, const uint8_t* body, size_t size);
+        void handle_record(uint32_t now, uint32_t node, const uint8_t* body, size_t size);
+        void schedule_record(sync_record record, uint32_t due);
+
+        bool take_send_token(uint32_t now);
+        size_t begin_packet(uint8_t* out, uint8_t type) const;
+        void send_packet(const uint8_t* packet, size_t size);
+        void send_digest();
+        void send_record(sync_record record);
+
+        void note_peer(uint32_t node, uint32_t now);
+        void expire_peers(uint32_t now);
+
+        WiFiUDP _udp;
+        bool _running = false;
+
+        persistent_data* _data = nullptr;
+        uint32_t _group = 0; // Hash of the group name
+        uint32_t _node = 0;
+        time_t _utc = 0;
+
+        sync_wake_callback _wake_callback;
+        sync_alarms_callback _alarms_callback;
+        sync_timezone_callback _timezone_callback;
+        sync_save_callback _save_callback;
+
+        uint8_t _pending_records = 0; // One bit per record to send once due
+        uint32_t _record_due[sync_record_count] = {0};
+        uint8_t _repeat_records = 0;
+        uint32_t _repeat_due = 0;
+        bool _digest_pending = false;
+        uint32_t _next_digest = 0;
+
+        uint32_t _send_tokens = 0;
+        uint32_t _last_token = 0;
+
+        peer _peers[max_peers];
+        sync_stats _stats;
+    };
+} // namespace mocca
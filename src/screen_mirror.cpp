@@ -0,0 +1,185 @@
+#include "screen_mirror.hpp"
+
+namespace mocca {
+    namespace {
+        constexpr size_t screen_row_size = screen_width / 8;
+
+        constexpr uint8_t png_signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        constexpr uint8_t png_bit_depth = 1;
+        constexpr uint8_t png_color_type_grayscale = 0;
+        constexpr uint8_t zlib_header[] = {0x78, 0x01}; // Deflate, 32 KB window, no dictionary
+        constexpr uint8_t deflate_final_stored_block = 0x01;
+
+        // Row y as 1 bit per pixel, leftmost pixel in the most significant bit, lit pixels set.
+        uint8_t row_byte(const uint8_t* frame, size_t y, size_t byte_idx) {
+            const uint8_t* columns = frame + (y / 8) * screen_page_size + byte_idx * 8;
+            uint8_t row_bit = 1 << (y % 8);
+            uint8_t value = 0;
+            for (size_t column = 0; column < 8; column++) {
+                value = (value << 1) | ((columns[column] & row_bit) ? 1 : 0);
+            }
+            return value;
+        }
+
+        uint32_t crc32_update(uint32_t crc, uint8_t byte) {
+            crc ^= byte;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+            }
+            return crc;
+        }
+
+        class png_writer {
+          public:
+            explicit png_writer(uint8_t* out)
+                : _out(out) {}
+
+            void put(uint8_t byte) {
+                _out[_length++] = byte;
+                _crc = crc32_update(_crc, byte);
+            }
+
+            void put_u32(uint32_t value) {
+                put(value >> 24);
+                put(value >> 16);
+                put(value >> 8);
+                put(value);
+            }
+
+            void begin_chunk(const char* type, uint32_t length) {
+                put_u32(length);
+                _crc = 0xffffffff;
+                for (size_t idx = 0; idx < 4; idx++) {
+                    put(type[idx]);
+                }
+            }
+
+            void end_chunk() {
+                put_u32(~_crc);
+            }
+
+            void put_raw(const uint8_t* data, size_t size) {
+                memcpy(_out + _length, data, size);
+                _length += size;
+            }
+
+            size_t length() const {
+                return _length;
+            }
+
+          private:
+            uint8_t* _out;
+            size_t _length = 0;
+            uint32_t _crc = 0xffffffff;
+        };
+
+        size_t encode_pbm(const uint8_t* frame, uint8_t* out) {
+            int length = sprintf(reinterpret_cast<char*>(out), "P4\n%u %u\n", static_cast<unsigned>(screen_width),
+                                 static_cast<unsigned>(screen_height));
+            for (size_t y = 0; y < screen_height; y++) {
+                for (size_t byte_idx = 0; byte_idx < screen_row_size; byte_idx++) {
+                    out[length++] = ~row_byte(frame, y, byte_idx); // PBM has black as 1
+                }
+            }
+            return length;
+        }
+
+        size_t encode_png(const uint8_t* frame, uint8_t* out) {
+            png_writer png(out);
+            png.put_raw(png_signature, sizeof(png_signature));
+
+            png.begin_chunk("IHDR", 13);
+            png.put_u32(screen_width);
+            png.put_u32(screen_height);
+            png.put(png_bit_depth);
+            png.put(png_color_type_grayscale);
+            png.put(0); // Deflate
+            png.put(0); // Adaptive filtering, every row uses none
+            png.put(0); // Not interlaced
+            png.end_chunk();
+
+            // Fits in one TCP segment uncompressed, a single stored block beats carrying a compressor around.
+            constexpr uint16_t raw_size = screen_height * (1 + screen_row_size);
+            png.begin_chunk("IDAT", sizeof(zlib_header) + 5 + raw_size + 4);
+            for (uint8_t byte : zlib_header) {
+                png.put(byte);
+            }
+            png.put(deflate_final_stored_block);
+            png.put(raw_size & 0xff);
+            png.put(raw_size >> 8);
+            png.put(~raw_size & 0xff);
+            png.put((~raw_size >> 8) & 0xff);
+
+            uint32_t adler_a = 1;
+            uint32_t adler_b = 0;
+            for (size_t y = 0; y < screen_height; y++) {
+                for (size_t byte_idx = 0; byte_idx <= screen_row_size; byte_idx++) {
+                    uint8_t byte = byte_idx == 0 ? 0 : row_byte(frame, y, byte_idx - 1); // Filter type none first
+                    png.put(byte);
+                    adler_a = (adler_a + byte) % 65521;
+                    adler_b = (adler_b + adler_a) % 65521;
+                }
+            }
+            png.put_u32((adler_b << 16) | adler_a);
+            png.end_chunk();
+
+            png.begin_chunk("IEND", 0);
+            png.end_chunk();
+            return png.length();
+        }
+    } // namespace
+
+    void screen_mirror::publish(const uint8_t* buffer) {
+        bool changed = false;
+
+        portENTER_CRITICAL(&_lock);
+        uint32_t frame_number = _frame_number + 1;
+        for (size_t page = 0; page < screen_page_count; page++) {
+            size_t offset = page * screen_page_size;
+            if (memcmp(_frame + offset, buffer + offset, screen_page_size) != 0) {
+                memcpy(_frame + offset, buffer + offset, screen_page_size);
+                _page_frames[page] = frame_number;
+                changed = true;
+            }
+        }
+        if (changed) {
+            _frame_number = frame_number;
+        }
+        TaskHandle_t listener = _listener;
+        portEXIT_CRITICAL(&_lock);
+
+        if (changed && listener) {
+            xTaskNotifyGive(listener);
+        }
+    }
+
+    void screen_mirror::set_change_listener(TaskHandle_t task) {
+        portENTER_CRITICAL(&_lock);
+        _listener = task;
+        portEXIT_CRITICAL(&_lock);
+    }
+
+    uint32_t screen_mirror::read(uint8_t* out, uint32_t since, uint8_t* changed_pages) const {
+        *changed_pages = 0;
+
+        portENTER_CRITICAL(&_lock);
+        for (size_t page = 0; page < screen_page_count; page++) {
+            if (since == 0 || _page_frames[page] > since) {
+                size_t offset = page * screen_page_size;
+                memcpy(out + offset, _frame + offset, screen_page_size);
+                *changed_pages |= 1 << page;
+            }
+        }
+        uint32_t frame_number = _frame_number;
+        portEXIT_CRITICAL(&_lock);
+
+        return frame_number;
+    }
+
+    size_t encode_screen_image(const uint8_t* frame, screen_image_format format, uint8_t* out, size_t out_size) {
+        if (out_size < max_screen_image_size) {
+            return 0;
+        }
+        return format == screen_image_format::pbm ? encode_pbm(frame, out) : encode_png(frame, out);
+    }
+} // namespace mocca
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <Arduino.h>
+
+namespace mocca {
+    constexpr size_t screen_width = 128;
+    constexpr size_t screen_height = 64;
+    constexpr size_t screen_page_count = screen_height / 8; // SSD1306 pages are 8 rows high, one byte per column
+    constexpr size_t screen_page_size = screen_width;
+    constexpr size_t screen_buffer_size = screen_page_size * screen_page_count;
+
+    enum class screen_image_format : uint8_t {
+        pbm,
+        png,
+    };
+
+    // PNG with the rows stored uncompressed is the larger of the two.
+    constexpr size_t max_screen_image_size =
+        8 + (12 + 13) + (12 + 2 + 5 + screen_height * (1 + screen_width / 8) + 4) + 12;
+
+    // Copy of the last frame flushed to the display, so it can be watched remotely. The control loop publishes a frame
+    // right after flushing it, reads from any task always get whole frames. Every page remembers the frame it last
+    // changed in so watchers can fetch just the pages that changed since they last looked.
+    class screen_mirror {
+      public:
+        void publish(const uint8_t* buffer);
+
+        // Notified whenever a published frame changed anything.
+        void set_change_listener(TaskHandle_t task);
+
+        // Copies the pages that changed after frame since, all of them if since is 0, to their place in out. Returns
+        // the current frame, changed_pages gets a bit set for every page copied.
+        uint32_t read(uint8_t* out, uint32_t since, uint8_t* changed_pages) const;
+
+      private:
+        mutable portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+        uint8_t _frame[screen_buffer_size] = {0};
+        uint32_t _frame_number = 0;
+        uint32_t _page_frames[screen_page_count] = {0};
+        TaskHandle_t _listener = nullptr;
+    };
+
+    // Encodes a frame as a 1-bit image with lit pixels white. Returns its size, 0 if out is too small.
+    size_t encode_screen_image(const uint8_t* frame, screen_image_format format, uint8_t* out, size_t out_size);
+} // namespace mocca
@@ -0,0 +1,371 @@
+#include "sntp_client.hpp"
+
+#include "util.hpp"
+
+#include <lwip/dns.h>
+#include <lwip/tcpip.h>
+#include <sys/time.h>
+
+namespace mocca {
+    namespace {
+        constexpr uint16_t local_port = 2390;
+        constexpr size_t packet_size = 48;
+        constexpr uint32_t ntp_to_unix_secs = 2208988800UL; // 1900 to 1970
+
+        constexpr uint32_t resolve_timeout = MILLIS_PER_SEC * 3;
+        constexpr uint32_t query_timeout = MILLIS_PER_SEC * 2;
+
+        constexpr uint32_t min_sync_interval = MILLIS_PER_MIN * 5;
+        constexpr uint32_t max_sync_interval = MILLIS_PER_MIN * 60 * 8;
+        constexpr uint32_t min_retry_delay = MILLIS_PER_SEC * 15;
+
+        constexpr int64_t step_threshold_micros = 128000; // Larger offsets step the clock, like ntpd
+        constexpr int64_t good_offset_micros = 20000;     // Below this the interval between rounds grows
+        constexpr int64_t poor_offset_micros = 100000;    // Above this it shrinks
+
+        constexpr uint32_t drift_correction_interval = MILLIS_PER_MIN;
+        constexpr uint32_t min_drift_sample_millis = MILLIS_PER_MIN * 4; // Shorter spans are dominated by jitter
+        constexpr float drift_gain = 0.5f;
+        constexpr float max_drift_ppm = 500.0f;
+
+        int64_t now_micros() {
+            timeval tv;
+            gettimeofday(&tv, nullptr);
+            return static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+        }
+
+        timeval micros_to_timeval(int64_t micros) {
+            timeval tv;
+            tv.tv_sec = micros / 1000000;
+            tv.tv_usec = micros % 1000000;
+            return tv;
+        }
+
+        uint32_t read_be32(const uint8_t* data) {
+            return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) |
+                   (static_cast<uint32_t>(data[2]) << 8) | data[3];
+        }
+
+        void write_be32(uint8_t* data, uint32_t value) {
+            data[0] = value >> 24;
+            data[1] = value >> 16;
+            data[2] = value >> 8;
+            data[3] = value;
+        }
+
+        int64_t ntp_to_micros(const uint8_t* timestamp) {
+            // Unsigned wrap keeps this right until 2106.
+            uint32_t unix_secs = read_be32(timestamp) - ntp_to_unix_secs;
+            uint64_t fraction = read_be32(timestamp + 4);
+            return static_cast<int64_t>(unix_secs) * 1000000 + static_cast<int64_t>((fraction * 1000000) >> 32);
+        }
+
+        void micros_to_ntp(int64_t micros, uint8_t* timestamp) {
+            write_be32(timestamp, static_cast<uint32_t>(micros / 1000000) + ntp_to_unix_secs);
+            write_be32(timestamp + 4, static_cast<uint32_t>(((micros % 1000000) << 32) / 1000000));
+        }
+
+        int64_t ntp_short_to_micros(const uint8_t* value) {
+            return (static_cast<int64_t>(read_be32(value)) * 1000000) >> 16;
+        }
+    } // namespace
+
+    void sntp_client::set_servers(const sntp_server* servers, size_t server_count) {
+        _server_count = std::min(server_count, max_servers);
+        for (size_t server_idx = 0; server_idx < _server_count; server_idx++) {
+            _servers[server_idx] = server_slot();
+            _servers[server_idx].client = this;
+            _servers[server_idx].server = servers[server_idx];
+        }
+    }
+
+    void sntp_client::start() {
+        if (_running) {
+            return;
+        }
+
+        _running = true;
+        _udp.begin(local_port);
+        begin_round();
+    }
+
+    void sntp_client::stop() {
+        if (!_running) {
+            return;
+        }
+
+        _running = false;
+        _state = round_state::idle;
+        _udp.stop();
+    }
+
+    bool sntp_client::step() {
+        if (_has_synced && millis() - _last_drift_correction >= drift_correction_interval) {
+            correct_drift();
+        }
+
+        if (!_running) {
+            return false;
+        }
+
+        switch (_state) {
+        case round_state::idle:
+            if (millis() - _round_start >= _round_delay) {
+                begin_round();
+            }
+            break;
+        case round_state::resolving:
+            if (all_resolved() || millis() - _round_start >= resolve_timeout) {
+                send_requests();
+            }
+            break;
+        case round_state::querying: {
+            receive_responses();
+
+            bool all_answered = true;
+            for (size_t server_idx = 0; server_idx < _server_count; server_idx++) {
+                const server_slot& slot = _servers[server_idx];
+                all_answered &= slot.answered || slot.request_micros == 0;
+            }
+
+            if (all_answered || millis() - _query_start >= query_timeout) {
+                _state = round_state::idle;
+                return finish_round();
+            }
+            break;
+        }
+        }
+        return false;
+    }
+
+    bool sntp_client::has_synced() const {
+        return _has_synced;
+    }
+
+    sntp_stats sntp_client::get_stats() const {
+        return _stats;
+    }
+
+    void sntp_client::resolve_on_tcpip_thread(void* arg) {
+        server_slot* slot = static_cast<server_slot*>(arg);
+
+        ip_addr_t address;
+        err_t err =
+            dns_gethostbyname_addrtype(slot->server.host, &address, on_resolved, slot, LWIP_DNS_ADDRTYPE_IPV4);
+        if (err == ERR_OK) {
+            on_resolved(slot->server.host, &address, slot);
+        } else if (err != ERR_INPROGRESS) {
+            on_resolved(slot->server.host, nullptr, slot);
+        }
+    }
+
+    void sntp_client::on_resolved(const char* name, const ip_addr_t* address, void* arg) {
+        server_slot* slot = static_cast<server_slot*>(arg);
+
+        portENTER_CRITICAL(&slot->client->_resolve_lock);
+        if (address) {
+            slot->address = ip4_addr_get_u32(ip_2_ip4(address));
+            slot->resolved = true;
+        } else {
+            slot->resolve_failed = true;
+        }
+        portEXIT_CRITICAL(&slot->client->_resolve_lock);
+    }
+
+    void sntp_client::begin_round() {
+        _state = round_state::resolving;
+        _round_start = millis();
+
+        for (size_t server_idx = 0; server_idx < _server_count; server_idx++) {
+            server_slot& slot = _servers[server_idx];
+
+            portENTER_CRITICAL(&_resolve_lock);
+            slot.resolved = false;
+            slot.resolve_failed = false;
+            portEXIT_CRITICAL(&_resolve_lock);
+            slot.request_micros = 0;
+            slot.answered = false;
+
+            IPAddress literal;
+            if (literal.fromString(slot.server.host)) {
+                slot.address = static_cast<uint32_t>(literal);
+                slot.resolved = true;
+            } else if (tcpip_callback(resolve_on_tcpip_thread, &slot) != ERR_OK) {
+                slot.resolve_failed = true;
+            }
+        }
+    }
+
+    bool sntp_client::all_resolved() {
+        bool done = true;
+        portENTER_CRITICAL(&_resolve_lock);
+        for (size_t server_idx = 0; server_idx < _server_count; server_idx++) {
+            done &= _servers[server_idx].resolved || _servers[server_idx].resolve_failed;
+        }
+        portEXIT_CRITICAL(&_resolve_lock);
+        return done;
+    }
+
+    void sntp_client::send_requests() {
+        _state = round_state::querying;
+        _query_start = millis();
+
+        for (size_t server_idx = 0; server_idx < _server_count; server_idx++) {
+            server_slot& slot = _servers[server_idx];
+
+            portENTER_CRITICAL(&_resolve_lock);
+            bool resolved = slot.resolved;
+            portEXIT_CRITICAL(&_resolve_lock);
+            if (!resolved) {
+                continue;
+            }
+
+            uint8_t packet[packet_size] = {0};
+            packet[0] = 0x23; // LI 0, version 4, client mode
+
+            // The server echoes the transmit timestamp back, it identifies the answer to this request.
+            slot.request_micros = now_micros();
+            micros_to_ntp(slot.request_micros, slot.request_timestamp);
+            memcpy(packet + 40, slot.request_timestamp, sizeof(slot.request_timestamp));
+
+            if (!_udp.beginPacket(IPAddress(slot.address), slot.server.port)) {
+                slot.request_micros = 0;
+                continue;
+            }
+            _udp.write(packet, sizeof(packet));
+            if (!_udp.endPacket()) {
+                slot.request_micros = 0;
+            }
+        }
+    }
+
+    void sntp_client::receive_responses() {
+        while (_udp.parsePacket() > 0) {
+            uint8_t packet[packet_size];
+            if (_udp.read(packet, sizeof(packet)) != static_cast<int>(sizeof(packet))) {
+                continue;
+            }
+            int64_t receive_micros = now_micros();
+
+            uint32_t remote_address = static_cast<uint32_t>(_udp.remoteIP());
+            uint16_t remote_port = _udp.remotePort();
+
+            server_slot* slot = nullptr;
+            for (size_t server_idx = 0; server_idx < _server_count; server_idx++) {
+                server_slot& candidate = _servers[server_idx];
+                if (candidate.request_micros != 0 && !candidate.answered && candidate.address == remote_address &&
+                    candidate.server.port == remote_port &&
+                    memcmp(packet + 24, candidate.request_timestamp, sizeof(candidate.request_timestamp)) == 0) {
+                    slot = &candidate;
+                    break;
+                }
+            }
+            if (!slot) {
+                continue;
+            }
+
+            uint8_t leap = packet[0] >> 6;
+            uint8_t mode = packet[0] & 0x07;
+            uint8_t stratum = packet[1];
+            if (leap == 3 || mode != 4 || stratum == 0 || stratum > 15) {
+                // Unsynchronized server or kiss-o'-death.
+                continue;
+            }
+
+            int64_t server_receive = ntp_to_micros(packet + 32);
+            int64_t server_transmit = ntp_to_micros(packet + 40);
+
+            slot->answered = true;
+            slot->offset_micros = ((server_receive - slot->request_micros) + (server_transmit - receive_micros)) / 2;
+            slot->delay_micros =
+                std::max<int64_t>((receive_micros - slot->request_micros) - (server_transmit - server_receive), 0);
+            slot->distance_micros =
+                slot->delay_micros / 2 + ntp_short_to_micros(packet + 4) / 2 + ntp_short_to_micros(packet + 8);
+        }
+    }
+
+    bool sntp_client::finish_round() {
+        const server_slot* best = nullptr;
+        for (size_t server_idx = 0; server_idx < _server_count; server_idx++) {
+            const server_slot& slot = _servers[server_idx];
+            if (slot.answered && (!best || slot.distance_micros < best->distance_micros)) {
+                best = &slot;
+            }
+        }
+
+        if (!best) {
+            _stats.failed_rounds++;
+            // Never wait longer than a regular round would have.
+            uint32_t max_retry_delay = _has_synced ? _sync_interval : min_sync_interval;
+            _retry_delay = std::min(std::max(_retry_delay * 2, min_retry_delay), max_retry_delay);
+            _round_delay = _retry_delay;
+            return false;
+        }
+
+        _stats.last_delay_micros = best->delay_micros;
+        apply_offset(best->offset_micros);
+
+        _retry_delay = 0;
+        _round_delay = _sync_interval;
+        return true;
+    }
+
+    void sntp_client::apply_offset(int64_t offset_micros) {
+        uint32_t now = millis();
+        int64_t abs_offset = offset_micros < 0 ? -offset_micros : offset_micros;
+
+        if (!_has_synced || abs_offset >= step_threshold_micros) {
+            timeval zero = {0, 0};
+            adjtime(&zero, nullptr);
+
+            timeval tv = micros_to_timeval(now_micros() + offset_micros);
+            settimeofday(&tv, nullptr);
+
+            _sync_interval = min_sync_interval;
+        } else {
+            // Whatever is left after the drift correction since the last sync is a drift estimation error.
+            uint32_t since_last_sync = now - _last_sync_millis;
+            if (since_last_sync >= min_drift_sample_millis) {
+                float residual_ppm = -static_cast<float>(offset_micros) * 1000.0f / since_last_sync;
+                _drift_ppm = std::min(std::max(_drift_ppm + residual_ppm * drift_gain, -max_drift_ppm), max_drift_ppm);
+            }
+
+            timeval outstanding;
+            adjtime(nullptr, &outstanding);
+            timeval delta = micros_to_timeval(static_cast<int64_t>(outstanding.tv_sec) * 1000000 +
+                                              outstanding.tv_usec + offset_micros);
+            adjtime(&delta, nullptr);
+
+            if (abs_offset < good_offset_micros) {
+                _sync_interval = std::min(_sync_interval * 2, max_sync_interval);
+            } else if (abs_offset > poor_offset_micros) {
+                _sync_interval = std::max(_sync_interval / 2, min_sync_interval);
+            }
+        }
+
+        _has_synced = true;
+        _last_sync_millis = now;
+        _last_drift_correction = now;
+
+        _stats.syncs++;
+        _stats.last_offset_micros = offset_micros;
+        _stats.drift_ppm = _drift_ppm;
+        _stats.sync_interval_secs = _sync_interval / MILLIS_PER_SEC;
+        _stats.last_sync = time(nullptr);
+    }
+
+    void sntp_client::correct_drift() {
+        uint32_t now = millis();
+        int64_t correction_micros = static_cast<int64_t>(-_drift_ppm * (now - _last_drift_correction) / 1000.0f);
+        _last_drift_correction = now;
+        if (correction_micros == 0) {
+            return;
+        }
+
+        timeval outstanding;
+        adjtime(nullptr, &outstanding);
+        timeval delta = micros_to_timeval(static_cast<int64_t>(outstanding.tv_sec) * 1000000 + outstanding.tv_usec +
+                                          correction_micros);
+        adjtime(&delta, nullptr);
+    }
+} // namespace mocca
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiUdp.h>
+#include <lwip/ip_addr.h>
+
+namespace mocca {
+    struct sntp_server {
+        const char* host; // Name or dotted IPv4 address
+        uint16_t port;
+    };
+
+    struct sntp_stats {
+        uint32_t syncs = 0;
+        uint32_t failed_rounds = 0;
+        int64_t last_offset_micros = 0; // Correction applied by the last sync
+        uint32_t last_delay_micros = 0; // Round trip to the selected server
+        float drift_ppm = 0;            // Estimated crystal error, positive when the local clock runs fast
+        uint32_t sync_interval_secs = 0;
+        time_t last_sync = 0; // 0 if never synced
+    };
+
+    // Keeps the system clock in sync with a few SNTP servers without ever blocking. Each round resolves and queries all
+    // servers at once and keeps the answer with the shortest synchronization distance. Small offsets are slewed with
+    // adjtime(), only the first sync and large jumps step the clock. Offsets measured between rounds estimate the
+    // crystal drift which is then corrected continuously, so the interval between rounds can grow to hours.
+    class sntp_client {
+      public:
+        static constexpr size_t max_servers = 4;
+
+        void set_servers(const sntp_server* servers, size_t server_count);
+
+        // Follows the network, start() begins a round right away.
+        void start();
+        void stop();
+
+        // Returns true if a round finished and corrected the clock.
+        bool step();
+
+        bool has_synced() const;
+        sntp_stats get_stats() const;
+
+      private:
+        enum class round_state {
+            idle,
+            resolving,
+            querying,
+        };
+
+        struct server_slot {
+            sntp_client* client = nullptr;
+            sntp_server server = {nullptr, 0};
+
+            // Written by the lwIP thread while resolving.
+            uint32_t address = 0;
+            bool resolved = false;
+            bool resolve_failed = false;
+
+            uint8_t request_timestamp[8] = {0};
+            int64_t request_micros = 0;
+            bool answered = false;
+            int64_t offset_micros = 0;
+            int64_t delay_micros = 0;
+            int64_t distance_micros = 0;
+        };
+
+        static void resolve_on_tcpip_thread(void* arg);
+        static void on_resolved(const char* name, const ip_addr_t* address, void* arg);
+
+        void begin_round();
+        bool all_resolved();
+        void send_requests();
+        void receive_responses();
+        bool finish_round();
+        void apply_offset(int64_t offset_micros);
+        void correct_drift();
+
+        server_slot _servers[max_servers];
+        size_t _server_count = 0;
+        portMUX_TYPE _resolve_lock = portMUX_INITIALIZER_UNLOCKED;
+
+        WiFiUDP _udp;
+        bool _running = false;
+        round_state _state = round_state::idle;
+        uint32_t _round_start = 0;
+        uint32_t _query_start = 0;
+        uint32_t _round_delay = 0;
+
+        bool _has_synced = false;
+        uint32_t _last_sync_millis = 0;
+        uint32_t _sync_interval = 0;
+        uint32_t _retry_delay = 0;
+
+        float _drift_ppm = 0;
+        uint32_t _last_drift_correction = 0;
+
+        sntp_stats _stats;
+    };
+} // namespace mocca
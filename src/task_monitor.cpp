@@ -0,0 +1,53 @@
+#include "task_monitor.hpp"
+
+namespace mocca {
+    void task_monitor::print_stats(Print& out) {
+#if configUSE_TRACE_FACILITY
+        uint32_t total_run_time = 0;
+        UBaseType_t task_count = uxTaskGetSystemState(_task_status, max_tasks, &total_run_time);
+        uint32_t elapsed_run_time = total_run_time - _total_run_time;
+
+        out.printf("%-16s %4s %4s %6s %6s\n", "task", "core", "prio", "cpu%", "stack");
+        for (UBaseType_t task_idx = 0; task_idx < task_count; task_idx++) {
+            const TaskStatus_t& status = _task_status[task_idx];
+
+            int core = -1;
+#    if configTASKLIST_INCLUDE_COREID
+            if (status.xCoreID != tskNO_AFFINITY) {
+                core = status.xCoreID;
+            }
+#    endif
+
+            float cpu_percent = -1.0f;
+#    if configGENERATE_RUN_TIME_STATS
+            if (elapsed_run_time > 0) {
+                uint32_t task_run_time = status.ulRunTimeCounter - previous_run_time(status.xHandle);
+                cpu_percent = (100.0f * task_run_time) / elapsed_run_time;
+            }
+#    endif
+
+            out.printf("%-16s %4d %4u %6.1f %6u\n", status.pcTaskName, core,
+                       static_cast<unsigned>(status.uxCurrentPriority), cpu_percent,
+                       static_cast<unsigned>(status.usStackHighWaterMark));
+        }
+
+        _sample_count = task_count;
+        for (UBaseType_t task_idx = 0; task_idx < task_count; task_idx++) {
+            _samples[task_idx].handle = _task_status[task_idx].xHandle;
+            _samples[task_idx].run_time = _task_status[task_idx].ulRunTimeCounter;
+        }
+        _total_run_time = total_run_time;
+#else
+        out.println("Task stats unavailable, FreeRTOS trace facility is disabled.");
+#endif
+    }
+
+    uint32_t task_monitor::previous_run_time(TaskHandle_t handle) const {
+        for (size_t sample_idx = 0; sample_idx < _sample_count; sample_idx++) {
+            if (_samples[sample_idx].handle == handle) {
+                return _samples[sample_idx].run_time;
+            }
+        }
+        return 0;
+    }
+} // namespace mocca
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <Arduino.h>
+
+namespace mocca {
+    // Prints per task CPU usage since the previous call and minimum free stack. CPU usage needs FreeRTOS run time stats
+    // and is left out when the SDK is built without them.
+    class task_monitor {
+      public:
+        void print_stats(Print& out);
+
+      private:
+        static constexpr size_t max_tasks = 24;
+
+        struct task_sample {
+            TaskHandle_t handle = nullptr;
+            uint32_t run_time = 0;
+        };
+
+        uint32_t previous_run_time(TaskHandle_t handle) const;
+
+        TaskStatus_t _task_status[max_tasks];
+        task_sample _samples[max_tasks];
+        size_t _sample_count = 0;
+        uint32_t _total_run_time = 0;
+    };
+} // namespace mocca
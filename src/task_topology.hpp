@@ -0,0 +1,30 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Where every long running task lives. Core 0 belongs to the WiFi/lwIP stack and everything network facing, core 1 to
+// the control loop (input, boiler decisions and rendering) so that web traffic can never preempt it.
+//
+// The async_tcp task is created by the web server library, its placement comes from the CONFIG_ASYNC_TCP_* build flags
+// in platformio.ini which must agree with the values here.
+namespace mocca {
+    constexpr BaseType_t network_core = 0;
+    constexpr UBaseType_t network_task_priority = 3;  // Below the WiFi driver and lwIP tasks on the same core
+    constexpr UBaseType_t log_task_priority = 1;      // Drains the log whenever nothing else needs the core
+    constexpr UBaseType_t screen_task_priority = 1;   // Pushes display changes to remote watchers
+    constexpr UBaseType_t timezone_task_priority = 1; // Looks up timezone names, mostly waiting on the network
+
+    constexpr BaseType_t control_core = 1;
+    constexpr UBaseType_t control_task_priority = 1; // Arduino loopTask
+    constexpr UBaseType_t safety_task_priority = 10; // Boiler supervisor, preempts the control loop immediately
+} // namespace mocca
+
+#if defined(CONFIG_ASYNC_TCP_RUNNING_CORE)
+static_assert(CONFIG_ASYNC_TCP_RUNNING_CORE == mocca::network_core, "async_tcp must run on the network core");
+#endif
+#if defined(CONFIG_ASYNC_TCP_PRIORITY)
+static_assert(CONFIG_ASYNC_TCP_PRIORITY == mocca::network_task_priority, "async_tcp priority out of sync");
+#endif
+#if defined(CONFIG_ARDUINO_RUNNING_CORE)
+static_assert(CONFIG_ARDUINO_RUNNING_CORE == mocca::control_core, "loopTask must run on the control core");
+#endif
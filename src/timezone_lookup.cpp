@@ -0,0 +1,75 @@
+#include "timezone_lookup.hpp"
+
+#include "task_topology.hpp"
+
+#include <ezTime.h>
+
+namespace mocca {
+    namespace {
+        constexpr uint32_t lookup_task_stack_size = 4096;
+    } // namespace
+
+    bool is_posix_timezone(const char* timezone) {
+        // Location names have a slash or no offset, the rules always have an offset.
+        return strchr(timezone, '/') == nullptr && strpbrk(timezone, "0123456789") != nullptr;
+    }
+
+    bool timezone_lookup::start() {
+        return xTaskCreatePinnedToCore(task_main, "timezone", lookup_task_stack_size, this, timezone_task_priority,
+                                       &_task, network_core) == pdPASS;
+    }
+
+    void timezone_lookup::request(const char* name) {
+        portENTER_CRITICAL(&_lock);
+        strlcpy(_requested, name, sizeof(_requested));
+        _has_request = true;
+        portEXIT_CRITICAL(&_lock);
+
+        if (_task) {
+            xTaskNotifyGive(_task);
+        }
+    }
+
+    bool timezone_lookup::take_result(char* name, size_t name_size, char* posix, size_t posix_size) {
+        portENTER_CRITICAL(&_lock);
+        bool has_result = _has_result;
+        if (has_result) {
+            strlcpy(name, _result_name, name_size);
+            strlcpy(posix, _result_posix, posix_size);
+            _has_result = false;
+        }
+        portEXIT_CRITICAL(&_lock);
+        return has_result;
+    }
+
+    void timezone_lookup::task_main(void* arg) {
+        timezone_lookup* lookup = static_cast<timezone_lookup*>(arg);
+        while (true) {
+            lookup->look_up(); // Also one requested before the task started
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+    }
+
+    void timezone_lookup::look_up() {
+        char name[max_name_length + 1];
+        portENTER_CRITICAL(&_lock);
+        bool has_request = _has_request;
+        strlcpy(name, _requested, sizeof(name));
+        _has_request = false;
+        portEXIT_CRITICAL(&_lock);
+
+        if (!has_request) {
+            return;
+        }
+
+        // A Timezone of its own, the one the control loop uses only ever gets the finished rules.
+        Timezone timezone;
+        String posix = timezone.setLocation(name) ? timezone.getPosix() : String();
+
+        portENTER_CRITICAL(&_lock);
+        strlcpy(_result_name, name, sizeof(_result_name));
+        strlcpy(_result_posix, posix.c_str(), sizeof(_result_posix));
+        _has_result = true;
+        portEXIT_CRITICAL(&_lock);
+    }
+} // namespace mocca
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <Arduino.h>
+
+namespace mocca {
+    // Whether a timezone is given as POSIX TZ rules ("EST5EDT,M3.2.0,M11.1.0") rather than a location name
+    // ("America/Toronto"). Rules apply right away, names have to be looked up.
+    bool is_posix_timezone(const char* timezone);
+
+    // Looks up the rules of timezone names on a task of its own. ezTime's setLocation() waits on a server for up to
+    // seconds, which the control loop can't afford while the request may come from the network at any time.
+    class timezone_lookup {
+      public:
+        static constexpr size_t max_name_length = 63;
+        static constexpr size_t max_posix_length = 63;
+
+        bool start();
+
+        // Replaces a lookup that hasn't started yet.
+        void request(const char* name);
+
+        // Returns true once for every finished lookup, posix is empty if it failed.
+        bool take_result(char* name, size_t name_size, char* posix, size_t posix_size);
+
+      private:
+        static void task_main(void* arg);
+
+        void look_up();
+
+        TaskHandle_t _task = nullptr;
+
+        portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+        char _requested[max_name_length + 1] = {0};
+        bool _has_request = false;
+        char _result_name[max_name_length + 1] = {0};
+        char _result_posix[max_posix_length + 1] = {0};
+        bool _has_result = false;
+    };
+} // namespace mocca
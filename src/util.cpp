@@ -1,5 +1,11 @@
 #include "util.hpp"
 
+#include "features.hpp"
+
+#if MOCCA_FEATURE_DISPLAY
+#include <Adafruit_SSD1306.h>
+#endif
+
 namespace mocca {
     box::box()
         : x(0)
@@ -21,6 +27,7 @@ namespace mocca {
         return y + h;
     }
 
+#if MOCCA_FEATURE_DISPLAY
     box draw_aligned_text(Adafruit_SSD1306* display, const char* text, text_alignment horizontal_alignment,
                           text_alignment vertical_alignment, const box& area) {
 
@@ -54,6 +61,7 @@ namespace mocca {
 
         return print_area;
     }
+#endif
 
     binary_switch::binary_switch() {}
 
@@ -66,4 +74,8 @@ namespace mocca {
     bool binary_switch::get_state() const {
         return digitalRead(_pin) == _pressed_state;
     }
+
+    int binary_switch::pin() const {
+        return _pin;
+    }
 } // namespace mocca
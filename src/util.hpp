@@ -1,8 +1,9 @@
 #pragma once
 
-#include <Adafruit_SSD1306.h>
 #include <ezTime.h>
 
+class Adafruit_SSD1306;
+
 namespace mocca {
 #define MILLIS_PER_SEC (1000)
 #define MILLIS_PER_MIN (MILLIS_PER_SEC * SECS_PER_MIN)
@@ -56,6 +57,7 @@ namespace mocca {
         void init(uint8_t pin, uint8_t mode, bool active_low);
 
         bool get_state() const;
+        int pin() const;
 
       private:
         int _pin = -1;
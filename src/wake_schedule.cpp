@@ -0,0 +1,66 @@
+#include "wake_schedule.hpp"
+
+namespace mocca {
+    namespace {
+        constexpr uint8_t days_per_week = 7;
+        constexpr uint8_t epoch_weekday = 4; // 1970-01-01 was a Thursday
+    } // namespace
+
+    bool wake_alarm::is_used() const {
+        return days != 0;
+    }
+
+    bool wake_alarm::fires_on(uint8_t weekday) const {
+        return enabled && (days & (1 << weekday)) != 0;
+    }
+
+    uint8_t weekday_of(time_t t) {
+        return ((t / SECS_PER_DAY) + epoch_weekday) % days_per_week;
+    }
+
+    void wake_schedule::recompute(const wake_alarm* alarms, size_t alarm_count, time_t one_shot, time_t skip_until,
+                                  time_t now, const local_time_table& local_time) {
+        time_t earliest = std::max(now, skip_until);
+
+        _next_wake = 0;
+        if (one_shot > earliest) {
+            _next_wake = one_shot;
+        }
+
+        // Every alarm fires at least once a week so looking one week and a day ahead always finds the next one.
+        time_t today = previousMidnight(local_time.to_local(now));
+        uint8_t today_weekday = weekday_of(today);
+        for (uint8_t day = 0; day <= days_per_week; day++) {
+            time_t day_start = today + day * SECS_PER_DAY;
+            uint8_t weekday = (today_weekday + day) % days_per_week;
+
+            for (size_t alarm_idx = 0; alarm_idx < alarm_count; alarm_idx++) {
+                const wake_alarm& alarm = alarms[alarm_idx];
+                if (!alarm.fires_on(weekday)) {
+                    continue;
+                }
+
+                time_t t = local_time.to_utc(day_start + alarm.minute_of_day * SECS_PER_MIN);
+                if (t > earliest && (_next_wake == 0 || t < _next_wake)) {
+                    _next_wake = t;
+                }
+            }
+
+            if (_next_wake != 0 && local_time.to_local(_next_wake) < day_start + SECS_PER_DAY) {
+                break;
+            }
+        }
+    }
+
+    bool wake_schedule::is_due(time_t now) const {
+        return _next_wake != 0 && now >= _next_wake;
+    }
+
+    bool wake_schedule::has_next_wake() const {
+        return _next_wake != 0;
+    }
+
+    time_t wake_schedule::next_wake() const {
+        return _next_wake;
+    }
+} // namespace mocca
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "local_time.hpp"
+
+#include <Arduino.h>
+#include <ezTime.h>
+
+namespace mocca {
+    constexpr size_t max_wake_alarms = 8;
+    constexpr uint16_t minutes_per_day = SECS_PER_DAY / SECS_PER_MIN;
+
+    constexpr uint8_t wake_every_day = 0x7f;
+    constexpr uint8_t wake_weekdays = 0x3e;
+    constexpr uint8_t wake_weekends = 0x41;
+
+    // Packed into 4 bytes so that the whole schedule fits in the persistent data.
+    struct wake_alarm {
+        uint16_t minute_of_day = 0;
+        uint8_t days = 0; // One bit per weekday, bit 0 is Sunday. A slot with no days is unused.
+        uint8_t enabled = 0;
+
+        bool is_used() const;
+        bool fires_on(uint8_t weekday) const;
+    };
+
+    uint8_t weekday_of(time_t t);
+
+    // Keeps the time of the next wake up so that the loop only compares against a single timestamp. The schedule is a
+    // set of weekly alarms in local time plus an optional one-shot wake, wakes at or before skip_until are skipped.
+    // All time_t values are UTC.
+    class wake_schedule {
+      public:
+        void recompute(const wake_alarm* alarms, size_t alarm_count, time_t one_shot, time_t skip_until, time_t now,
+                       const local_time_table& local_time);
+
+        bool is_due(time_t now) const;
+        bool has_next_wake() const;
+        time_t next_wake() const;
+
+      private:
+        time_t _next_wake = 0;
+    };
+} // namespace mocca
@@ -0,0 +1,160 @@
+#include "widgets.hpp"
+
+namespace mocca {
+    namespace {
+        constexpr int32_t icon_size = 8;
+        constexpr int32_t icon_spacing = 10;
+    } // namespace
+
+    void widget::layout(const box& bounds) {
+        _bounds = bounds;
+        _dirty = true;
+    }
+
+    const box& widget::bounds() const {
+        return _bounds;
+    }
+
+    void widget::invalidate() {
+        _dirty = true;
+    }
+
+    bool widget::is_dirty() const {
+        return _dirty;
+    }
+
+    bool widget::render(Adafruit_SSD1306* display) {
+        if (!_dirty) {
+            return false;
+        }
+
+        display->fillRect(_bounds.x, _bounds.y, _bounds.w, _bounds.h, SSD1306_BLACK);
+        draw(display);
+        _dirty = false;
+        return true;
+    }
+
+    label_widget::label_widget(uint8_t text_size, text_alignment horizontal_alignment,
+                               text_alignment vertical_alignment)
+        : _text_size(text_size)
+        , _horizontal_alignment(horizontal_alignment)
+        , _vertical_alignment(vertical_alignment) {}
+
+    void label_widget::set_text(const char* text) {
+        if (strncmp(_text, text, max_text_length) == 0) {
+            return;
+        }
+
+        strlcpy(_text, text, sizeof(_text));
+        invalidate();
+    }
+
+    void label_widget::draw(Adafruit_SSD1306* display) {
+        display->setTextSize(_text_size);
+        draw_aligned_text(display, _text, _horizontal_alignment, _vertical_alignment, bounds());
+    }
+
+    clock_widget::clock_widget()
+        : label_widget(1, text_alignment::right, text_alignment::top) {}
+
+    void clock_widget::set_time(Timezone* timezone, bool is_valid) {
+        time_t now = is_valid ? timezone->now() : ezt::now();
+        if (now == _shown_time && is_valid == _shown_valid) {
+            return;
+        }
+        _shown_time = now;
+        _shown_valid = is_valid;
+
+        if (is_valid) {
+            set_text(timezone->dateTime(now, now % 2 == 0 ? "g i a" : "g:i a").c_str());
+        } else {
+            set_text(now % 2 != 0 ? "0:00" : " ");
+        }
+    }
+
+    void icon_row_widget::set_icon(size_t slot, const uint8_t* bitmap8x8) {
+        _icons[slot] = bitmap8x8;
+        invalidate();
+    }
+
+    void icon_row_widget::set_visible(size_t slot, bool is_visible) {
+        uint8_t visible = is_visible ? _visible | (1 << slot) : _visible & ~(1 << slot);
+        if (visible != _visible) {
+            _visible = visible;
+            invalidate();
+        }
+    }
+
+    void icon_row_widget::draw(Adafruit_SSD1306* display) {
+        int32_t cursor = bounds().x;
+        for (size_t slot = 0; slot < max_icons; slot++) {
+            if (_icons[slot] && (_visible & (1 << slot))) {
+                display->drawBitmap(cursor, bounds().y, _icons[slot], icon_size, icon_size, SSD1306_WHITE,
+                                    SSD1306_BLACK);
+                cursor += icon_spacing;
+            }
+        }
+    }
+
+    void notification_bar_widget::layout(const box& bounds) {
+        widget::layout(bounds);
+
+        int32_t icons_width = icon_row_widget::max_icons * icon_spacing;
+        _icons.layout(box(bounds.x, bounds.y, icons_width, bounds.h));
+        _clock.layout(box(bounds.x + icons_width, bounds.y, bounds.w - icons_width, bounds.h));
+    }
+
+    bool notification_bar_widget::render(Adafruit_SSD1306* display) {
+        bool drew_icons = _icons.render(display);
+        bool drew_clock = _clock.render(display);
+        return drew_icons || drew_clock;
+    }
+
+    icon_row_widget& notification_bar_widget::icons() {
+        return _icons;
+    }
+
+    clock_widget& notification_bar_widget::clock() {
+        return _clock;
+    }
+
+    void notification_bar_widget::draw(Adafruit_SSD1306* display) {
+        // Everything is drawn by the children.
+    }
+
+    void progress_bar_widget::set_progress(uint32_t value, uint32_t max_value) {
+        int32_t filled_width = 0;
+        if (max_value > 0) {
+            filled_width = static_cast<int32_t>((static_cast<uint32_t>(bounds().w) * std::min(value, max_value)) /
+                                                max_value);
+        }
+        if (filled_width != _filled_width) {
+            _filled_width = filled_width;
+            invalidate();
+        }
+    }
+
+    void progress_bar_widget::draw(Adafruit_SSD1306* display) {
+        if (_filled_width > 0) {
+            display->fillRect(bounds().x, bounds().y, _filled_width, bounds().h, SSD1306_WHITE);
+        }
+    }
+
+    void widget_screen::clear() {
+        _widget_count = 0;
+    }
+
+    void widget_screen::add(widget* widget) {
+        if (_widget_count < max_widgets) {
+            _widgets[_widget_count++] = widget;
+        }
+    }
+
+    bool widget_screen::render(Adafruit_SSD1306* display) {
+        bool drew = false;
+        for (size_t widget_idx = 0; widget_idx < _widget_count; widget_idx++) {
+            drew |= _widgets[widget_idx]->render(display);
+        }
+        return drew;
+    }
+} // namespace mocca
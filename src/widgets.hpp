@@ -0,0 +1,126 @@
+#pragma once
+
+#include "util.hpp"
+
+#include <Adafruit_SSD1306.h>
+#include <Arduino.h>
+#include <ezTime.h>
+
+namespace mocca {
+    // Retained-mode screen element. Bounds are assigned once when a screen is laid out, after that the widget only
+    // redraws when its content changed. Widgets own their bounds exclusively, redrawing clears them first.
+    class widget {
+      public:
+        virtual ~widget() = default;
+
+        virtual void layout(const box& bounds);
+        const box& bounds() const;
+
+        void invalidate();
+        bool is_dirty() const;
+
+        // Redraws the widget if it is dirty. Returns true if anything was drawn.
+        virtual bool render(Adafruit_SSD1306* display);
+
+      protected:
+        virtual void draw(Adafruit_SSD1306* display) = 0;
+
+      private:
+        box _bounds;
+        bool _dirty = true;
+    };
+
+    // Single or multi-line text aligned within its bounds.
+    class label_widget : public widget {
+      public:
+        static constexpr size_t max_text_length = 160;
+
+        label_widget(uint8_t text_size, text_alignment horizontal_alignment, text_alignment vertical_alignment);
+
+        void set_text(const char* text);
+
+      protected:
+        void draw(Adafruit_SSD1306* display) override;
+
+      private:
+        uint8_t _text_size;
+        text_alignment _horizontal_alignment;
+        text_alignment _vertical_alignment;
+        char _text[max_text_length + 1] = {0};
+    };
+
+    // Local time with a blinking separator, or a blinking placeholder while the time is unknown.
+    class clock_widget : public label_widget {
+      public:
+        clock_widget();
+
+        void set_time(Timezone* timezone, bool is_valid);
+
+      private:
+        time_t _shown_time = 0;
+        bool _shown_valid = false;
+    };
+
+    // Row of 8x8 icons packed to the left, hidden icons leave no gap.
+    class icon_row_widget : public widget {
+      public:
+        static constexpr size_t max_icons = 4;
+
+        void set_icon(size_t slot, const uint8_t* bitmap8x8);
+        void set_visible(size_t slot, bool is_visible);
+
+      protected:
+        void draw(Adafruit_SSD1306* display) override;
+
+      private:
+        const uint8_t* _icons[max_icons] = {nullptr};
+        uint8_t _visible = 0; // One bit per slot
+    };
+
+    // Icons on the left and the clock on the right of a text row at the top of the screen.
+    class notification_bar_widget : public widget {
+      public:
+        static constexpr int32_t height = 8;
+
+        void layout(const box& bounds) override;
+        bool render(Adafruit_SSD1306* display) override;
+
+        icon_row_widget& icons();
+        clock_widget& clock();
+
+      protected:
+        void draw(Adafruit_SSD1306* display) override;
+
+      private:
+        icon_row_widget _icons;
+        clock_widget _clock;
+    };
+
+    // Horizontal bar filled from the left.
+    class progress_bar_widget : public widget {
+      public:
+        void set_progress(uint32_t value, uint32_t max_value);
+
+      protected:
+        void draw(Adafruit_SSD1306* display) override;
+
+      private:
+        int32_t _filled_width = 0;
+    };
+
+    // The widgets making up the current screen. Rendering only touches the dirty ones.
+    class widget_screen {
+      public:
+        static constexpr size_t max_widgets = 8;
+
+        void clear();
+        void add(widget* widget);
+
+        // Returns true if anything was drawn and the display needs a flush.
+        bool render(Adafruit_SSD1306* display);
+
+      private:
+        widget* _widgets[max_widgets] = {nullptr};
+        size_t _widget_count = 0;
+    };
+} // namespace mocca
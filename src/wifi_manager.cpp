@@ -0,0 +1,203 @@
+#include "wifi_manager.hpp"
+
+#include "logger.hpp"
+#include "util.hpp"
+
+namespace mocca {
+    namespace {
+        constexpr uint32_t attempt_timeout = MILLIS_PER_SEC * 15; // The driver doesn't always report a failure
+        constexpr uint32_t min_retry_delay = MILLIS_PER_SEC * 5;
+        constexpr uint32_t max_retry_delay = MILLIS_PER_MIN * 5;
+
+        // Keep the access point up for a while after connecting so the config page can show that it worked.
+        constexpr uint32_t ap_linger_after_connect = MILLIS_PER_MIN;
+    } // namespace
+
+    void wifi_manager::init(const char* fallback_ap_ssid) {
+        _fallback_ap_ssid = fallback_ap_ssid;
+
+        // Reconnects are driven from step() so that they back off.
+        WiFi.setAutoReconnect(false);
+        WiFi.onEvent([this](arduino_event_id_t event, arduino_event_info_t info) { on_event(event, info); });
+    }
+
+    void wifi_manager::connect(const char* ssid, const char* password, bool known_good) {
+        strlcpy(_ssid, ssid, sizeof(_ssid));
+        strlcpy(_password, password, sizeof(_password));
+        get_logger().set_secret(log_secret::wifi_password, _password);
+
+        portENTER_CRITICAL(&_event_lock);
+        _got_ip = false;
+        _disconnected = false;
+        portEXIT_CRITICAL(&_event_lock);
+
+        bool was_connected = _state == wifi_connection_state::connected;
+        _attempt = 0;
+        _retry_delay = 0;
+
+        if (_ssid[0] == '\0') {
+            WiFi.disconnect();
+            _state = wifi_connection_state::off;
+            start_ap();
+        } else {
+            WiFi.disconnect();
+            if (!known_good) {
+                // Nothing says these work, the config page shouldn't be out of reach for a whole attempt timeout.
+                _state = wifi_connection_state::connecting;
+                start_ap();
+            }
+            begin_attempt();
+        }
+
+        if (was_connected && _disconnected_callback) {
+            _disconnected_callback();
+        }
+    }
+
+    void wifi_manager::step() {
+        portENTER_CRITICAL(&_event_lock);
+        bool got_ip = _got_ip;
+        bool disconnected = _disconnected;
+        _got_ip = false;
+        _disconnected = false;
+        portEXIT_CRITICAL(&_event_lock);
+
+        uint32_t now = millis();
+
+        switch (_state) {
+        case wifi_connection_state::off:
+            break;
+        case wifi_connection_state::connecting:
+            if (got_ip) {
+                _state = wifi_connection_state::connected;
+                _attempt = 0;
+                _retry_delay = 0;
+                _connected_since = now;
+                if (_connected_callback) {
+                    _connected_callback();
+                }
+            } else if (disconnected || now - _attempt_start >= attempt_timeout) {
+                on_attempt_failed();
+            }
+            break;
+        case wifi_connection_state::connected:
+            if (disconnected) {
+                // Retry right away, the network was fine until now.
+                _state = wifi_connection_state::retry_wait;
+                _attempt_start = now;
+                _retry_delay = 0;
+                if (_disconnected_callback) {
+                    _disconnected_callback();
+                }
+            } else if (_ap_running && now - _connected_since >= ap_linger_after_connect) {
+                stop_ap();
+            }
+            break;
+        case wifi_connection_state::retry_wait:
+            if (now - _attempt_start >= _retry_delay) {
+                begin_attempt();
+            }
+            break;
+        }
+    }
+
+    void wifi_manager::set_connected_callback(wifi_event_callback callback) {
+        _connected_callback = callback;
+    }
+
+    void wifi_manager::set_disconnected_callback(wifi_event_callback callback) {
+        _disconnected_callback = callback;
+    }
+
+    wifi_connection_state wifi_manager::state() const {
+        return _state;
+    }
+
+    bool wifi_manager::is_connected() const {
+        return _state == wifi_connection_state::connected;
+    }
+
+    bool wifi_manager::is_ap_running() const {
+        return _ap_running;
+    }
+
+    const char* wifi_manager::ssid() const {
+        return _ssid;
+    }
+
+    const char* wifi_manager::password() const {
+        return _password;
+    }
+
+    uint32_t wifi_manager::attempt() const {
+        return _attempt;
+    }
+
+    uint32_t wifi_manager::millis_until_retry() const {
+        if (_state != wifi_connection_state::retry_wait) {
+            return 0;
+        }
+        uint32_t waited = millis() - _attempt_start;
+        return waited < _retry_delay ? _retry_delay - waited : 0;
+    }
+
+    void wifi_manager::on_event(arduino_event_id_t event, const arduino_event_info_t& info) {
+        // Runs on the WiFi event task.
+        portENTER_CRITICAL(&_event_lock);
+        switch (event) {
+        case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+            _got_ip = true;
+            break;
+        case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+            // Disconnects we asked for can arrive after the next attempt has already started.
+            if (info.wifi_sta_disconnected.reason != WIFI_REASON_ASSOC_LEAVE) {
+                _disconnected = true;
+            }
+            break;
+        case ARDUINO_EVENT_WIFI_STA_LOST_IP:
+            _disconnected = true;
+            break;
+        default:
+            break;
+        }
+        portEXIT_CRITICAL(&_event_lock);
+    }
+
+    void wifi_manager::begin_attempt() {
+        _attempt++;
+        _attempt_start = millis();
+        _state = wifi_connection_state::connecting;
+
+        WiFi.mode(_ap_running ? WIFI_AP_STA : WIFI_STA);
+        WiFi.begin(_ssid, _password);
+    }
+
+    void wifi_manager::on_attempt_failed() {
+        WiFi.disconnect();
+        start_ap();
+
+        _state = wifi_connection_state::retry_wait;
+        _attempt_start = millis();
+        _retry_delay = std::min(std::max(_retry_delay * 2, min_retry_delay), max_retry_delay);
+    }
+
+    void wifi_manager::start_ap() {
+        if (_ap_running || !_fallback_ap_ssid) {
+            return;
+        }
+
+        WiFi.mode(_state == wifi_connection_state::off ? WIFI_AP : WIFI_AP_STA);
+        WiFi.softAP(_fallback_ap_ssid);
+        _ap_running = true;
+    }
+
+    void wifi_manager::stop_ap() {
+        if (!_ap_running) {
+            return;
+        }
+
+        WiFi.softAPdisconnect();
+        WiFi.mode(WIFI_STA);
+        _ap_running = false;
+    }
+} // namespace mocca
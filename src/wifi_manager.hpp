@@ -0,0 +1,70 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+#include <functional>
+
+namespace mocca {
+    enum class wifi_connection_state {
+        off,        // No credentials, only the access point is up
+        connecting, // Waiting for an IP
+        connected,
+        retry_wait, // Last attempt failed, backing off before the next one
+    };
+
+    using wifi_event_callback = std::function<void(void)>;
+
+    // Connects to the configured network without ever blocking the caller. WiFi driver events are collected from the
+    // event task and acted upon in step(). Failed attempts are retried with exponential backoff, and while the station
+    // isn't connected the fallback access point runs alongside it (AP+STA) so the config page stays reachable. Without
+    // known good credentials the access point already comes up with the first attempt.
+    class wifi_manager {
+      public:
+        void init(const char* fallback_ap_ssid); // nullptr for no fallback access point
+
+        // Starts connecting with new credentials, dropping any current connection. They are only worth persisting once
+        // the connected callback fires, known_good tells whether they have connected before.
+        void connect(const char* ssid, const char* password, bool known_good);
+
+        void step();
+
+        void set_connected_callback(wifi_event_callback callback);
+        void set_disconnected_callback(wifi_event_callback callback);
+
+        wifi_connection_state state() const;
+        bool is_connected() const;
+        bool is_ap_running() const;
+        const char* ssid() const;
+        const char* password() const;
+        uint32_t attempt() const; // Attempts since the last successful connection, 1 for the first
+        uint32_t millis_until_retry() const;
+
+      private:
+        void on_event(arduino_event_id_t event, const arduino_event_info_t& info);
+
+        void begin_attempt();
+        void on_attempt_failed();
+        void start_ap();
+        void stop_ap();
+
+        const char* _fallback_ap_ssid = "";
+        char _ssid[33] = {0};
+        char _password[64] = {0};
+
+        wifi_connection_state _state = wifi_connection_state::off;
+        uint32_t _attempt = 0;
+        uint32_t _attempt_start = 0;
+        uint32_t _retry_delay = 0;
+        bool _ap_running = false;
+        uint32_t _connected_since = 0;
+
+        // Set by the WiFi event task, consumed by step().
+        portMUX_TYPE _event_lock = portMUX_INITIALIZER_UNLOCKED;
+        bool _got_ip = false;
+        bool _disconnected = false;
+
+        wifi_event_callback _connected_callback;
+        wifi_event_callback _disconnected_callback;
+    };
+} // namespace mocca
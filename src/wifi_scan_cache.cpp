@@ -0,0 +1,187 @@
+#include "wifi_scan_cache.hpp"
+
+#include "util.hpp"
+
+namespace mocca {
+    namespace {
+        constexpr uint32_t scan_after_request_window = MILLIS_PER_MIN; // Keep scanning for a minute after a request
+        constexpr uint32_t min_rescan_interval = MILLIS_PER_SEC * 10;
+        constexpr uint32_t max_rescan_interval = MILLIS_PER_MIN * 2;
+        constexpr uint32_t network_max_age = MILLIS_PER_MIN * 5; // Must be longer than max_rescan_interval
+
+        constexpr int32_t rssi_smoothing = 4; // Each scan moves the smoothed RSSI a quarter of the way
+
+        bool bssid_equal(const uint8_t* a, const uint8_t* b) {
+            return memcmp(a, b, sizeof(wifi_network_info::bssid)) == 0;
+        }
+    } // namespace
+
+    void wifi_network_info::format_bssid(char* out, size_t out_size) const {
+        snprintf(out, out_size, "%02X:%02X:%02X:%02X:%02X:%02X", bssid[0], bssid[1], bssid[2], bssid[3], bssid[4],
+                 bssid[5]);
+    }
+
+    void wifi_scan_cache::on_request(uint32_t now) {
+        // Only noted here, step() acts on it.
+        _request_time.store(now);
+        _request_count.fetch_add(1);
+    }
+
+    void wifi_scan_cache::step(uint32_t now) {
+        uint32_t request_count = _request_count.load();
+        if (request_count != _handled_request_count) {
+            uint32_t request_time = _request_time.load();
+            if (!_has_request || request_time - _last_request >= scan_after_request_window) {
+                // A client showed up after a quiet period, whatever is cached is stale so scan right away.
+                _has_scanned = false;
+                _rescan_interval = min_rescan_interval;
+            }
+
+            _has_request = true;
+            _last_request = request_time;
+            _requests_since_scan += request_count - _handled_request_count;
+            _handled_request_count = request_count;
+        }
+
+        if (remove_expired(now)) {
+            // Networks going away is a change like any other.
+            _rescan_interval = min_rescan_interval;
+            sort_and_merge();
+            publish();
+        }
+    }
+
+    bool wifi_scan_cache::should_scan(uint32_t now) const {
+        if (!_has_request || now - _last_request >= scan_after_request_window) {
+            return false;
+        }
+
+        // Nobody would see the results of another scan.
+        if (_requests_since_scan == 0) {
+            return false;
+        }
+
+        return !_has_scanned || now - _last_scan >= _rescan_interval;
+    }
+
+    void wifi_scan_cache::on_scan_started(uint32_t now) {
+        _has_scanned = true;
+        _last_scan = now;
+        _requests_since_scan = 0;
+    }
+
+    void wifi_scan_cache::update_from_scan(int16_t result_count, uint32_t now) {
+        bool changed = false;
+
+        for (int16_t network_item = 0; network_item < result_count; network_item++) {
+            const uint8_t* bssid = WiFi.BSSID(network_item);
+            String ssid = WiFi.SSID(network_item);
+            if (bssid == nullptr || ssid.length() == 0) {
+                continue;
+            }
+
+            wifi_network_info* existing = find(bssid);
+            if (existing) {
+                changed |= strcmp(existing->ssid, ssid.c_str()) != 0;
+                existing->rssi += (WiFi.RSSI(network_item) - existing->rssi) / rssi_smoothing;
+            } else {
+                wifi_network_info network;
+                memcpy(network.bssid, bssid, sizeof(network.bssid));
+                network.rssi = WiFi.RSSI(network_item);
+                insert(network);
+
+                existing = find(bssid);
+                if (!existing) {
+                    // Weaker than everything already cached.
+                    continue;
+                }
+                changed = true;
+            }
+
+            strlcpy(existing->ssid, ssid.c_str(), sizeof(existing->ssid));
+            existing->encryption = WiFi.encryptionType(network_item);
+            existing->channel = WiFi.channel(network_item);
+            existing->last_seen = now;
+        }
+
+        changed |= remove_expired(now);
+
+        sort_and_merge();
+        publish();
+
+        if (changed) {
+            _rescan_interval = min_rescan_interval;
+        } else {
+            _rescan_interval = std::min(std::max(_rescan_interval * 2, min_rescan_interval), max_rescan_interval);
+        }
+    }
+
+    size_t wifi_scan_cache::copy_networks(wifi_network_info* out, size_t out_size) const {
+        portENTER_CRITICAL(&_published_lock);
+        size_t count = std::min(_published_count, out_size);
+        std::copy(_published, _published + count, out);
+        portEXIT_CRITICAL(&_published_lock);
+        return count;
+    }
+
+    wifi_network_info* wifi_scan_cache::find(const uint8_t* bssid) {
+        for (size_t network_idx = 0; network_idx < _network_count; network_idx++) {
+            if (bssid_equal(_networks[network_idx].bssid, bssid)) {
+                return &_networks[network_idx];
+            }
+        }
+        return nullptr;
+    }
+
+    void wifi_scan_cache::insert(const wifi_network_info& network) {
+        if (_network_count < max_networks) {
+            _networks[_network_count++] = network;
+            return;
+        }
+
+        // Full, only keep the strongest networks.
+        wifi_network_info* weakest = std::min_element(
+            _networks, _networks + _network_count,
+            [](const wifi_network_info& a, const wifi_network_info& b) { return a.rssi < b.rssi; });
+        if (network.rssi > weakest->rssi) {
+            *weakest = network;
+        }
+    }
+
+    bool wifi_scan_cache::remove_expired(uint32_t now) {
+        wifi_network_info* new_end =
+            std::remove_if(_networks, _networks + _network_count, [now](const wifi_network_info& network) {
+                return now - network.last_seen >= network_max_age;
+            });
+        size_t count_before_expiry = _network_count;
+        _network_count = new_end - _networks;
+        return _network_count != count_before_expiry;
+    }
+
+    void wifi_scan_cache::sort_and_merge() {
+        std::sort(_networks, _networks + _network_count,
+                  [](const wifi_network_info& a, const wifi_network_info& b) { return a.rssi > b.rssi; });
+
+        for (size_t network_idx = 0; network_idx < _network_count; network_idx++) {
+            wifi_network_info& network = _networks[network_idx];
+            network.strongest_for_ssid = true;
+            for (size_t stronger_idx = 0; stronger_idx < network_idx; stronger_idx++) {
+                if (strcmp(_networks[stronger_idx].ssid, network.ssid) == 0) {
+                    network.strongest_for_ssid = false;
+                    break;
+                }
+            }
+        }
+    }
+
+    void wifi_scan_cache::publish() {
+        portENTER_CRITICAL(&_published_lock);
+        _published_count = 0;
+        for (size_t network_idx = 0; network_idx < _network_count; network_idx++) {
+            if (_networks[network_idx].strongest_for_ssid) {
+                _published[_published_count++] = _networks[network_idx];
+            }
+        }
+        portEXIT_CRITICAL(&_published_lock);
+    }
+} // namespace mocca
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+#include <atomic>
+
+namespace mocca {
+    struct wifi_network_info {
+        uint8_t bssid[6] = {0};
+        char ssid[33] = {0};
+        wifi_auth_mode_t encryption = WIFI_AUTH_OPEN;
+        int32_t rssi = 0; // Smoothed across scans.
+        int32_t channel = 0;
+        uint32_t last_seen = 0;
+        bool strongest_for_ssid = false; // Only the strongest BSSID of each SSID is reported to clients.
+
+        void format_bssid(char* out, size_t out_size) const;
+    };
+
+    // Holds the results of the last few WiFi scans keyed by BSSID and decides when another scan is worth the radio
+    // time. Scans only happen while clients are asking for the list, at most once per client request, and back off
+    // while the set of visible networks stays the same.
+    //
+    // on_request() and copy_networks() are for the web server task, everything else runs on the loop task.
+    class wifi_scan_cache {
+      public:
+        static constexpr size_t max_networks = 16;
+
+        void on_request(uint32_t now);
+        void step(uint32_t now);
+        bool should_scan(uint32_t now) const;
+        void on_scan_started(uint32_t now);
+        void update_from_scan(int16_t result_count, uint32_t now);
+
+        // Copies the strongest BSSID of each SSID, strongest first. Returns the number of networks copied.
+        size_t copy_networks(wifi_network_info* out, size_t out_size) const;
+
+      private:
+        wifi_network_info* find(const uint8_t* bssid);
+        void insert(const wifi_network_info& network);
+        bool remove_expired(uint32_t now);
+        void sort_and_merge();
+        void publish();
+
+        wifi_network_info _networks[max_networks];
+        size_t _network_count = 0;
+
+        // What clients get to see, replaced whenever the cache changes.
+        wifi_network_info _published[max_networks];
+        size_t _published_count = 0;
+        mutable portMUX_TYPE _published_lock = portMUX_INITIALIZER_UNLOCKED;
+
+        std::atomic<uint32_t> _request_time{0};
+        std::atomic<uint32_t> _request_count{0};
+        uint32_t _handled_request_count = 0;
+
+        bool _has_request = false;
+        uint32_t _last_request = 0;
+        uint32_t _requests_since_scan = 0;
+
+        bool _has_scanned = false;
+        uint32_t _last_scan = 0;
+        uint32_t _rescan_interval = 0;
+    };
+} // namespace mocca
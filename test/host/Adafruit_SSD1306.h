@@ -0,0 +1,78 @@
+#pragma once
+
+// A display that draws nothing but counts what it was asked to draw. Text is measured like the built in 6x8 font.
+
+#include <Arduino.h>
+
+#define SSD1306_BLACK 0
+#define SSD1306_WHITE 1
+#define SSD1306_INVERSE 2
+
+#define SSD1306_SWITCHCAPVCC 0x02
+#define SSD1306_CHARGEPUMP 0x8D
+#define SSD1306_DISPLAYOFF 0xAE
+#define SSD1306_DISPLAYON 0xAF
+
+class Adafruit_SSD1306 : public Print {
+  public:
+    struct draw_counts {
+        uint32_t text_runs = 0; // print() calls, one per label
+        uint32_t fills = 0;
+        uint32_t bitmaps = 0;
+    };
+
+    Adafruit_SSD1306(uint8_t w = 128, uint8_t h = 64) : _width(w), _height(h) {}
+
+    bool begin(uint8_t switchvcc = SSD1306_SWITCHCAPVCC, uint8_t i2caddr = 0) { return true; }
+    void display() {}
+    void clearDisplay() {}
+    void dim(bool dim) {}
+    void ssd1306_command(uint8_t c) {}
+    uint8_t* getBuffer() { return _buffer; }
+
+    int16_t width() const { return _width; }
+    int16_t height() const { return _height; }
+
+    void setTextSize(uint8_t size) { _text_size = size; }
+    void setTextWrap(bool wrap) {}
+    void setTextColor(uint16_t color) {}
+    void setCursor(int16_t x, int16_t y) {
+        _cursor_x = x;
+        _cursor_y = y;
+    }
+
+    void getTextBounds(const char* text, int16_t x, int16_t y, int16_t* x1, int16_t* y1, uint16_t* w, uint16_t* h) {
+        *x1 = x;
+        *y1 = y;
+        *w = strlen(text) * 6 * _text_size;
+        *h = 8 * _text_size;
+    }
+
+    void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) { _counts.fills++; }
+    void drawBitmap(int16_t x, int16_t y, const uint8_t* bitmap, int16_t w, int16_t h, uint16_t color, uint16_t bg) {
+        _counts.bitmaps++;
+    }
+
+    size_t write(uint8_t c) override {
+        _cursor_x += 6 * _text_size;
+        return 1;
+    }
+    size_t write(const uint8_t* buffer, size_t size) override {
+        _counts.text_runs++;
+        _cursor_x += size * 6 * _text_size;
+        return size;
+    }
+
+    // Test side.
+    const draw_counts& counts() const { return _counts; }
+    void reset_counts() { _counts = draw_counts(); }
+
+  private:
+    int16_t _width;
+    int16_t _height;
+    uint8_t _text_size = 1;
+    int16_t _cursor_x = 0;
+    int16_t _cursor_y = 0;
+    uint8_t _buffer[128 * 64 / 8] = {0};
+    draw_counts _counts;
+};
@@ -0,0 +1,236 @@
+#pragma once
+
+// Just enough of the Arduino core for the portable sources to build and run on the host, see [env:native].
+
+#include "freertos/FreeRTOS.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+
+#define IRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+
+#define LOW 0
+#define HIGH 1
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+namespace host {
+    inline std::chrono::steady_clock::time_point start_time() {
+        static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        return start;
+    }
+
+    // Time a test skipped ahead by, millis() and the rest run this much ahead of the host's clock.
+    inline std::atomic<uint64_t>& clock_warp() {
+        static std::atomic<uint64_t> warp{0};
+        return warp;
+    }
+
+    constexpr uint8_t pin_count = 49;
+
+    struct pin_state {
+        std::atomic<int> level{LOW};
+        void (*isr)(void*) = nullptr;
+        void* isr_arg = nullptr;
+        int isr_mode = 0;
+    };
+
+    inline pin_state* pins() {
+        static pin_state states[pin_count];
+        return states;
+    }
+
+    // Drives an input from the outside, running its interrupt handler on the calling thread like the GPIO peripheral
+    // would.
+    inline void set_pin(uint8_t pin, int level) {
+        pin_state& state = pins()[pin];
+        int previous = state.level.exchange(level);
+        bool fire = previous != level && state.isr &&
+                    (state.isr_mode == CHANGE || (state.isr_mode == RISING && level == HIGH) ||
+                     (state.isr_mode == FALLING && level == LOW));
+        if (fire) {
+            state.isr(state.isr_arg);
+        }
+    }
+} // namespace host
+
+inline void pinMode(uint8_t pin, uint8_t mode) {
+    if (mode == INPUT_PULLUP) {
+        host::pins()[pin].level = HIGH;
+    }
+}
+
+inline void digitalWrite(uint8_t pin, uint8_t level) {
+    host::pins()[pin].level = level;
+}
+
+inline int digitalRead(uint8_t pin) {
+    return host::pins()[pin].level;
+}
+
+inline int digitalPinToInterrupt(int pin) {
+    return pin;
+}
+
+inline void attachInterruptArg(uint8_t pin, void (*isr)(void*), void* arg, int mode) {
+    host::pin_state& state = host::pins()[pin];
+    state.isr = isr;
+    state.isr_arg = arg;
+    state.isr_mode = mode;
+}
+
+inline void detachInterrupt(uint8_t pin) {
+    host::pins()[pin].isr = nullptr;
+}
+
+inline uint64_t host_micros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() -
+                                                                 host::start_time())
+               .count() +
+           host::clock_warp().load();
+}
+
+inline uint32_t millis() {
+    return static_cast<uint32_t>(host_micros() / 1000);
+}
+
+inline uint32_t micros() {
+    return static_cast<uint32_t>(host_micros());
+}
+
+inline int64_t esp_timer_get_time() {
+    return static_cast<int64_t>(host_micros());
+}
+
+inline void delay(uint32_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+inline void delayMicroseconds(uint32_t us) {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+inline void yield() {
+    std::this_thread::yield();
+}
+
+inline bool setCpuFrequencyMhz(uint32_t mhz) {
+    return true;
+}
+
+inline long random(long howbig) {
+    return howbig > 0 ? ::random() % howbig : 0;
+}
+
+#if !defined(__GLIBC__) || __GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38)
+inline size_t strlcpy(char* dst, const char* src, size_t size) {
+    size_t length = strlen(src);
+    if (size > 0) {
+        size_t copy_length = std::min(length, size - 1);
+        memcpy(dst, src, copy_length);
+        dst[copy_length] = '\0';
+    }
+    return length;
+}
+
+inline size_t strlcat(char* dst, const char* src, size_t size) {
+    size_t dst_length = strnlen(dst, size);
+    if (dst_length == size) {
+        return size + strlen(src);
+    }
+    return dst_length + strlcpy(dst + dst_length, src, size - dst_length);
+}
+#endif
+
+class String {
+  public:
+    String(const char* value = "") : _value(value ? value : "") {}
+    String(const std::string& value) : _value(value) {}
+    String(int value) : _value(std::to_string(value)) {}
+    String(unsigned value) : _value(std::to_string(value)) {}
+    String(long value) : _value(std::to_string(value)) {}
+    String(unsigned long value) : _value(std::to_string(value)) {}
+
+    const char* c_str() const { return _value.c_str(); }
+    size_t length() const { return _value.size(); }
+    bool isEmpty() const { return _value.empty(); }
+
+    String& operator+=(const String& other) {
+        _value += other._value;
+        return *this;
+    }
+
+    friend String operator+(const String& a, const String& b) { return String(a._value + b._value); }
+    bool operator==(const String& other) const { return _value == other._value; }
+    bool operator!=(const String& other) const { return _value != other._value; }
+
+  private:
+    std::string _value;
+};
+
+class Print {
+  public:
+    virtual ~Print() = default;
+
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        size_t written = 0;
+        while (written < size && write(buffer[written])) {
+            written++;
+        }
+        return written;
+    }
+    size_t write(const char* text) { return write(reinterpret_cast<const uint8_t*>(text), strlen(text)); }
+
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+
+    size_t print(const char* text) { return write(text); }
+    size_t print(const String& text) { return write(text.c_str()); }
+    size_t println(const char* text = "") { return print(text) + print("\n"); }
+
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        char text[256];
+        va_list args;
+        va_start(args, format);
+        vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+        return write(text);
+    }
+};
+
+class EspClass {
+  public:
+    uint32_t getFreeHeap() { return 200 * 1024; }
+    uint32_t getMaxAllocHeap() { return 96 * 1024; }
+};
+
+inline EspClass ESP;
+
+class Stream : public Print {
+  public:
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual int peek() { return -1; }
+};
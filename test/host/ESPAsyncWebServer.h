@@ -0,0 +1,29 @@
+#pragma once
+
+// A request that tests can disconnect, the server itself isn't needed by the host tests.
+
+#include <Arduino.h>
+
+#include <functional>
+
+typedef std::function<void(void)> ArDisconnectHandler;
+
+class AsyncWebServerRequest {
+  public:
+    void onDisconnect(ArDisconnectHandler handler) { _on_disconnect = handler; }
+    size_t contentLength() const { return _content_length; }
+
+    // Test side: the Content-Length the client sent.
+    void set_content_length(size_t length) { _content_length = length; }
+
+    // Test side: the client went away.
+    void disconnect() {
+        if (_on_disconnect) {
+            _on_disconnect();
+        }
+    }
+
+  private:
+    ArDisconnectHandler _on_disconnect;
+    size_t _content_length = 0;
+};
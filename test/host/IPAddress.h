@@ -0,0 +1,39 @@
+#pragma once
+
+// IPv4 addresses stored the way the Arduino core stores them, the uint32_t is in network byte order.
+
+#include <Arduino.h>
+
+class IPAddress {
+  public:
+    IPAddress() : _bytes{0, 0, 0, 0} {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _bytes{a, b, c, d} {}
+    IPAddress(uint32_t address) { memcpy(_bytes, &address, sizeof(_bytes)); }
+
+    operator uint32_t() const {
+        uint32_t address;
+        memcpy(&address, _bytes, sizeof(address));
+        return address;
+    }
+
+    bool fromString(const char* address) {
+        unsigned parts[4];
+        char end;
+        if (sscanf(address, "%u.%u.%u.%u%c", &parts[0], &parts[1], &parts[2], &parts[3], &end) != 4) {
+            return false;
+        }
+        for (int part_idx = 0; part_idx < 4; part_idx++) {
+            if (parts[part_idx] > 255) {
+                return false;
+            }
+            _bytes[part_idx] = static_cast<uint8_t>(parts[part_idx]);
+        }
+        return true;
+    }
+
+    uint8_t operator[](int index) const { return _bytes[index]; }
+    bool operator==(const IPAddress& other) const { return uint32_t(*this) == uint32_t(other); }
+
+  private:
+    uint8_t _bytes[4];
+};
@@ -0,0 +1,18 @@
+#pragma once
+
+// The host is always online, the radio settings go nowhere.
+
+#include <IPAddress.h>
+
+typedef enum {
+    WIFI_PS_NONE,
+    WIFI_PS_MIN_MODEM,
+    WIFI_PS_MAX_MODEM,
+} wifi_ps_type_t;
+
+class WiFiClass {
+  public:
+    bool setSleep(wifi_ps_type_t type) { return true; }
+};
+
+inline WiFiClass WiFi;
@@ -0,0 +1,176 @@
+#pragma once
+
+// UDP over the host's sockets. Multicast stays on the loopback interface and is looped back, so every WiFiUDP in the
+// test process that joined a group hears the others, and itself, like nodes on one network would. Unicast works as
+// usual, between sockets of the test on 127.0.0.1 for one.
+
+#include <IPAddress.h>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <vector>
+
+namespace host {
+    // Share of received datagrams that parsePacket() throws away, to simulate a lossy network.
+    inline std::atomic<double>& udp_loss() {
+        static std::atomic<double> loss{0};
+        return loss;
+    }
+} // namespace host
+
+class WiFiUDP : public Stream {
+  public:
+    ~WiFiUDP() override { stop(); }
+
+    uint8_t begin(uint16_t port) {
+        stop();
+        _socket = socket(AF_INET, SOCK_DGRAM, 0);
+        if (_socket < 0) {
+            return 0;
+        }
+
+        int one = 1;
+        setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        sockaddr_in local = {};
+        local.sin_family = AF_INET;
+        local.sin_port = htons(port);
+        local.sin_addr.s_addr = htonl(INADDR_ANY);
+
+        if (bind(_socket, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0 ||
+            fcntl(_socket, F_SETFL, O_NONBLOCK) != 0) {
+            stop();
+            return 0;
+        }
+        return 1;
+    }
+
+    uint8_t beginMulticast(IPAddress group_address, uint16_t port) {
+        stop();
+        _socket = socket(AF_INET, SOCK_DGRAM, 0);
+        if (_socket < 0) {
+            return 0;
+        }
+
+        int one = 1;
+        setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(_socket, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+        sockaddr_in local = {};
+        local.sin_family = AF_INET;
+        local.sin_port = htons(port);
+        local.sin_addr.s_addr = htonl(INADDR_ANY);
+
+        ip_mreq membership = {};
+        membership.imr_multiaddr.s_addr = uint32_t(group_address);
+        membership.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+        in_addr interface_address = membership.imr_interface;
+        unsigned char loop = 1;
+
+        if (bind(_socket, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0 ||
+            setsockopt(_socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0 ||
+            setsockopt(_socket, IPPROTO_IP, IP_MULTICAST_IF, &interface_address, sizeof(interface_address)) != 0 ||
+            setsockopt(_socket, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) != 0 ||
+            fcntl(_socket, F_SETFL, O_NONBLOCK) != 0) {
+            stop();
+            return 0;
+        }
+
+        _group = group_address;
+        _port = port;
+        return 1;
+    }
+
+    void stop() {
+        if (_socket >= 0) {
+            close(_socket);
+        }
+        _socket = -1;
+    }
+
+    int beginPacket(IPAddress address, uint16_t port) {
+        _out.clear();
+        _destination = address;
+        _destination_port = port;
+        return _socket >= 0;
+    }
+
+    int beginMulticastPacket() {
+        return beginPacket(_group, _port);
+    }
+
+    size_t write(uint8_t c) override {
+        _out.push_back(c);
+        return 1;
+    }
+
+    size_t write(const uint8_t* buffer, size_t size) override {
+        _out.insert(_out.end(), buffer, buffer + size);
+        return size;
+    }
+
+    int endPacket() {
+        sockaddr_in remote = {};
+        remote.sin_family = AF_INET;
+        remote.sin_port = htons(_destination_port);
+        remote.sin_addr.s_addr = uint32_t(_destination);
+        ssize_t sent = sendto(_socket, _out.data(), _out.size(), 0, reinterpret_cast<sockaddr*>(&remote),
+                              sizeof(remote));
+        return sent == static_cast<ssize_t>(_out.size());
+    }
+
+    int parsePacket() {
+        uint8_t packet[1500];
+        for (;;) {
+            sockaddr_in remote = {};
+            socklen_t remote_size = sizeof(remote);
+            ssize_t size = _socket >= 0 ? recvfrom(_socket, packet, sizeof(packet), 0,
+                                                   reinterpret_cast<sockaddr*>(&remote), &remote_size)
+                                        : -1;
+            if (size <= 0) {
+                _in.clear();
+                return 0;
+            }
+            if (drand48() >= host::udp_loss().load()) {
+                _in.assign(packet, packet + size);
+                _in_position = 0;
+                _remote = IPAddress(static_cast<uint32_t>(remote.sin_addr.s_addr));
+                _remote_port = ntohs(remote.sin_port);
+                return static_cast<int>(size);
+            }
+        }
+    }
+
+    IPAddress remoteIP() const { return _remote; }
+    uint16_t remotePort() const { return _remote_port; }
+
+    int available() override { return static_cast<int>(_in.size() - _in_position); }
+
+    int read() override {
+        uint8_t c;
+        return read(&c, 1) == 1 ? c : -1;
+    }
+
+    int read(uint8_t* buffer, size_t size) {
+        size = std::min(size, _in.size() - _in_position);
+        memcpy(buffer, _in.data() + _in_position, size);
+        _in_position += size;
+        return static_cast<int>(size);
+    }
+
+  private:
+    int _socket = -1;
+    IPAddress _group;
+    uint16_t _port = 0;
+    IPAddress _destination;
+    uint16_t _destination_port = 0;
+    IPAddress _remote;
+    uint16_t _remote_port = 0;
+    std::vector<uint8_t> _out;
+    std::vector<uint8_t> _in;
+    size_t _in_position = 0;
+};
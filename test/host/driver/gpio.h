@@ -0,0 +1,19 @@
+#pragma once
+
+#include "esp_err.h"
+
+typedef enum {
+    GPIO_NUM_NC = -1,
+    GPIO_NUM_0 = 0,
+    GPIO_NUM_MAX = 49,
+} gpio_num_t;
+
+inline esp_err_t gpio_hold_en(gpio_num_t gpio_num) {
+    return ESP_OK;
+}
+
+inline esp_err_t gpio_hold_dis(gpio_num_t gpio_num) {
+    return ESP_OK;
+}
+
+inline void gpio_deep_sleep_hold_en() {}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "driver/gpio.h"
+
+inline esp_err_t rtc_gpio_pullup_en(gpio_num_t gpio_num) {
+    return ESP_OK;
+}
+
+inline esp_err_t rtc_gpio_pulldown_dis(gpio_num_t gpio_num) {
+    return ESP_OK;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+// The host has no flash partitions, whatever looks for one finds none.
+
+#include "esp_err.h"
+
+#include <cstddef>
+#include <cstdint>
+
+typedef enum {
+    ESP_PARTITION_TYPE_APP = 0x00,
+    ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+
+typedef enum {
+    ESP_PARTITION_SUBTYPE_ANY = 0xff,
+} esp_partition_subtype_t;
+
+typedef struct {
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+} esp_partition_t;
+
+inline const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                       const char* label) {
+    return nullptr;
+}
+
+inline esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size) {
+    return ESP_FAIL;
+}
+
+inline esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src,
+                                     size_t size) {
+    return ESP_FAIL;
+}
+
+inline esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+    return ESP_FAIL;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+// The host never sleeps, every boot is a regular one.
+
+#include "driver/gpio.h"
+
+#include <cstdint>
+#include <cstdlib>
+
+typedef enum {
+    ESP_SLEEP_WAKEUP_UNDEFINED,
+    ESP_SLEEP_WAKEUP_EXT0 = 2,
+    ESP_SLEEP_WAKEUP_TIMER = 4,
+} esp_sleep_source_t;
+
+inline esp_sleep_source_t esp_sleep_get_wakeup_cause() {
+    return ESP_SLEEP_WAKEUP_UNDEFINED;
+}
+
+inline esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us) {
+    return ESP_OK;
+}
+
+inline esp_err_t esp_sleep_enable_ext0_wakeup(gpio_num_t gpio_num, int level) {
+    return ESP_OK;
+}
+
+[[noreturn]] inline void esp_deep_sleep_start() {
+    abort();
+}
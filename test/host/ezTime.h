@@ -0,0 +1,146 @@
+#pragma once
+
+// The parts of ezTime the host tests need, with the C library's time zone rules standing in for ezTime's own. Names
+// like "Europe/Berlin" are handed to the C library as they are, so setLocation() works without the network.
+
+#include <Arduino.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <ctime>
+#include <mutex>
+#include <string>
+
+#define SECS_PER_MIN ((time_t)(60UL))
+#define SECS_PER_HOUR ((time_t)(3600UL))
+#define SECS_PER_DAY ((time_t)(SECS_PER_HOUR * 24UL))
+#define SECS_PER_WEEK ((time_t)(SECS_PER_DAY * 7UL))
+
+#define previousMidnight(_time_) (((_time_) / SECS_PER_DAY) * SECS_PER_DAY)
+
+#define LOCAL_TIME 1
+#define UTC_TIME 2
+
+typedef uint8_t ezLocalOrUTC_t;
+
+namespace host {
+    // Seconds added to the system clock by UTC.setTime().
+    inline std::atomic<time_t>& clock_offset() {
+        static std::atomic<time_t> offset{0};
+        return offset;
+    }
+
+    // TZ is process wide, conversions take turns.
+    inline std::mutex& tz_lock() {
+        static std::mutex lock;
+        return lock;
+    }
+} // namespace host
+
+namespace ezt {
+    inline time_t now() {
+        return time(nullptr) + host::clock_offset().load();
+    }
+
+    // The time of day and date characters of ezTime's format, anything else is copied as it is.
+    inline String dateTime(time_t t, String format) {
+        struct tm parts;
+        gmtime_r(&t, &parts);
+        int hour12 = parts.tm_hour % 12 == 0 ? 12 : parts.tm_hour % 12;
+
+        std::string text;
+        char field[16];
+        for (const char* c = format.c_str(); *c; c++) {
+            switch (*c) {
+            case 'g':
+                snprintf(field, sizeof(field), "%d", hour12);
+                break;
+            case 'h':
+                snprintf(field, sizeof(field), "%02d", hour12);
+                break;
+            case 'G':
+                snprintf(field, sizeof(field), "%d", parts.tm_hour);
+                break;
+            case 'H':
+                snprintf(field, sizeof(field), "%02d", parts.tm_hour);
+                break;
+            case 'i':
+                snprintf(field, sizeof(field), "%02d", parts.tm_min);
+                break;
+            case 's':
+                snprintf(field, sizeof(field), "%02d", parts.tm_sec);
+                break;
+            case 'a':
+                snprintf(field, sizeof(field), "%s", parts.tm_hour < 12 ? "am" : "pm");
+                break;
+            case 'A':
+                snprintf(field, sizeof(field), "%s", parts.tm_hour < 12 ? "AM" : "PM");
+                break;
+            case 'd':
+                snprintf(field, sizeof(field), "%02d", parts.tm_mday);
+                break;
+            case 'm':
+                snprintf(field, sizeof(field), "%02d", parts.tm_mon + 1);
+                break;
+            case 'Y':
+                snprintf(field, sizeof(field), "%d", parts.tm_year + 1900);
+                break;
+            default:
+                snprintf(field, sizeof(field), "%c", *c);
+                break;
+            }
+            text += field;
+        }
+        return String(text);
+    }
+} // namespace ezt
+
+class Timezone {
+  public:
+    explicit Timezone(const char* posix = "UTC0") : _posix(posix) {}
+
+    bool setPosix(const String& posix) {
+        _posix = posix.c_str();
+        return !_posix.empty();
+    }
+
+    bool setLocation(const String& location) {
+        std::string path = std::string("/usr/share/zoneinfo/") + location.c_str();
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file) {
+            return false;
+        }
+        fclose(file);
+        _posix = location.c_str();
+        return true;
+    }
+
+    String getPosix() { return String(_posix); }
+
+    void setTime(time_t t, uint16_t ms = 0) { host::clock_offset() = t - time(nullptr); }
+
+    time_t now() { return tzTime(ezt::now(), UTC_TIME); }
+
+    String dateTime(time_t t, String format) { return ezt::dateTime(t, format); } // t is local already
+
+    // UTC to local for UTC_TIME, local to UTC for LOCAL_TIME.
+    time_t tzTime(time_t t, ezLocalOrUTC_t local_or_utc = LOCAL_TIME) {
+        std::lock_guard<std::mutex> guard(host::tz_lock());
+        setenv("TZ", _posix.c_str(), 1);
+        tzset();
+
+        struct tm parts;
+        if (local_or_utc == UTC_TIME) {
+            localtime_r(&t, &parts);
+            return timegm(&parts);
+        }
+        gmtime_r(&t, &parts);
+        parts.tm_isdst = -1;
+        return mktime(&parts);
+    }
+
+  private:
+    std::string _posix;
+};
+
+inline Timezone UTC;
@@ -0,0 +1,149 @@
+#pragma once
+
+// FreeRTOS tasks as threads for the host tests. Critical sections only exclude each other, they don't stop the world.
+// Pinned tasks keep to their core and priority where the host allows it, see host::place_task().
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void (*TaskFunction_t)(void*);
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xffffffffu
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) (static_cast<TickType_t>(ms))
+#define tskNO_AFFINITY 0x7fffffff
+
+struct host_task {
+    std::mutex lock;
+    std::condition_variable notified;
+    uint32_t notifications = 0;
+};
+typedef host_task* TaskHandle_t;
+
+struct portMUX_TYPE {
+    std::recursive_mutex mutex;
+};
+#define portMUX_INITIALIZER_UNLOCKED {}
+
+#define portENTER_CRITICAL(mux) (mux)->mutex.lock()
+#define portEXIT_CRITICAL(mux) (mux)->mutex.unlock()
+#define portENTER_CRITICAL_ISR(mux) portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_ISR(mux) portEXIT_CRITICAL(mux)
+#define portYIELD_FROM_ISR(...) ((void)0)
+
+namespace host {
+    // Threads that weren't started through xTaskCreatePinnedToCore() get their task on first use, and keep it.
+    inline TaskHandle_t& current_task() {
+        thread_local TaskHandle_t task = nullptr;
+        return task;
+    }
+
+    // Set once a task got a host CPU for its core and its priority as SCHED_FIFO.
+    inline std::atomic<bool>& tasks_placed() {
+        static std::atomic<bool> placed{false};
+        return placed;
+    }
+
+    // Gives each of the two cores a host CPU of its own and each task its priority, so that a busy task only holds up
+    // the lower priority tasks of its own core like on the device. Needs two CPUs and real-time scheduling (root or
+    // CAP_SYS_NICE), without them the calling thread is left as it is and shares the CPUs with everything else.
+    inline bool place_task(UBaseType_t priority, BaseType_t core) {
+        if (core == tskNO_AFFINITY || std::thread::hardware_concurrency() < 2) {
+            return false;
+        }
+
+        sched_param param = {};
+        param.sched_priority = static_cast<int>(priority) + 1; // FreeRTOS' idle priority 0 is SCHED_FIFO's lowest
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+            return false;
+        }
+
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(core % 2, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+            param.sched_priority = 0;
+            pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+            return false;
+        }
+
+        tasks_placed() = true;
+        return true;
+    }
+} // namespace host
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+    TaskHandle_t& task = host::current_task();
+    if (!task) {
+        task = new host_task();
+    }
+    return task;
+}
+
+// Tasks run until the process exits, like they do on the device.
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task_main, const char* name, uint32_t stack_size, void* arg,
+                                          UBaseType_t priority, TaskHandle_t* handle, BaseType_t core) {
+    (void)name;
+    (void)stack_size;
+
+    TaskHandle_t task = new host_task();
+    if (handle) {
+        *handle = task;
+    }
+    std::thread([task_main, arg, task, priority, core]() {
+        host::current_task() = task;
+        host::place_task(priority, core);
+        task_main(arg);
+    }).detach();
+    return pdPASS;
+}
+
+inline void xTaskNotifyGive(TaskHandle_t task) {
+    std::lock_guard<std::mutex> guard(task->lock);
+    task->notifications++;
+    task->notified.notify_all();
+}
+
+inline void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higher_priority_task_woken) {
+    xTaskNotifyGive(task);
+    if (higher_priority_task_woken) {
+        *higher_priority_task_woken = pdFALSE;
+    }
+}
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait) {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> guard(task->lock);
+    auto has_notification = [task]() { return task->notifications > 0; };
+    if (ticks_to_wait == portMAX_DELAY) {
+        task->notified.wait(guard, has_notification);
+    } else {
+        task->notified.wait_for(guard, std::chrono::milliseconds(ticks_to_wait), has_notification);
+    }
+
+    uint32_t value = task->notifications;
+    if (clear_on_exit) {
+        task->notifications = 0;
+    } else if (value > 0) {
+        task->notifications--;
+    }
+    return value;
+}
+
+inline void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+// Resolves through the host's resolver, answering right away like a cache hit.
+
+#include "lwip/ip_addr.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define LWIP_DNS_ADDRTYPE_IPV4 0
+
+typedef void (*dns_found_callback)(const char* name, const ip_addr_t* ipaddr, void* callback_arg);
+
+inline err_t dns_gethostbyname_addrtype(const char* hostname, ip_addr_t* addr, dns_found_callback found,
+                                        void* callback_arg, uint8_t dns_addrtype) {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(hostname, nullptr, &hints, &result) != 0 || !result) {
+        return ERR_ARG;
+    }
+    addr->u_addr_ip4.addr = reinterpret_cast<sockaddr_in*>(result->ai_addr)->sin_addr.s_addr;
+    addr->type = 0;
+    freeaddrinfo(result);
+    return ERR_OK;
+}
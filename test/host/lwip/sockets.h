@@ -0,0 +1,11 @@
+#pragma once
+
+// lwIP's sockets are BSD sockets, the host's own stand in for them.
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
@@ -0,0 +1,14 @@
+#pragma once
+
+// Callbacks for the lwIP thread run on a thread of their own.
+
+#include "lwip/ip_addr.h"
+
+#include <thread>
+
+typedef void (*tcpip_callback_fn)(void* ctx);
+
+inline err_t tcpip_callback(tcpip_callback_fn function, void* ctx) {
+    std::thread(function, ctx).detach();
+    return ERR_OK;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+// SHA-256 (FIPS 180-4) behind the mbedtls API, SHA-224 isn't supported.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+struct mbedtls_sha256_context {
+    uint32_t state[8];
+    uint64_t length; // Bytes hashed so far
+    uint8_t block[64];
+    size_t block_used;
+};
+
+namespace host {
+    inline uint32_t rotate_right(uint32_t value, int bits) {
+        return (value >> bits) | (value << (32 - bits));
+    }
+
+    inline void sha256_block(mbedtls_sha256_context* ctx, const uint8_t* block) {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+        };
+
+        uint32_t w[64];
+        for (int word_idx = 0; word_idx < 16; word_idx++) {
+            w[word_idx] = static_cast<uint32_t>(block[word_idx * 4]) << 24 |
+                          static_cast<uint32_t>(block[word_idx * 4 + 1]) << 16 |
+                          static_cast<uint32_t>(block[word_idx * 4 + 2]) << 8 | block[word_idx * 4 + 3];
+        }
+        for (int word_idx = 16; word_idx < 64; word_idx++) {
+            uint32_t s0 = rotate_right(w[word_idx - 15], 7) ^ rotate_right(w[word_idx - 15], 18) ^
+                          (w[word_idx - 15] >> 3);
+            uint32_t s1 = rotate_right(w[word_idx - 2], 17) ^ rotate_right(w[word_idx - 2], 19) ^
+                          (w[word_idx - 2] >> 10);
+            w[word_idx] = w[word_idx - 16] + s0 + w[word_idx - 7] + s1;
+        }
+
+        uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3];
+        uint32_t e = ctx->state[4], f = ctx->state[5], g = ctx->state[6], h = ctx->state[7];
+        for (int round = 0; round < 64; round++) {
+            uint32_t s1 = rotate_right(e, 6) ^ rotate_right(e, 11) ^ rotate_right(e, 25);
+            uint32_t t1 = h + s1 + ((e & f) ^ (~e & g)) + k[round] + w[round];
+            uint32_t s0 = rotate_right(a, 2) ^ rotate_right(a, 13) ^ rotate_right(a, 22);
+            uint32_t t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        ctx->state[0] += a;
+        ctx->state[1] += b;
+        ctx->state[2] += c;
+        ctx->state[3] += d;
+        ctx->state[4] += e;
+        ctx->state[5] += f;
+        ctx->state[6] += g;
+        ctx->state[7] += h;
+    }
+} // namespace host
+
+inline void mbedtls_sha256_init(mbedtls_sha256_context* ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+inline void mbedtls_sha256_free(mbedtls_sha256_context* ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+inline int mbedtls_sha256_starts(mbedtls_sha256_context* ctx, int is224) {
+    if (is224) {
+        return -1;
+    }
+    static const uint32_t initial_state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(ctx->state, initial_state, sizeof(initial_state));
+    ctx->length = 0;
+    ctx->block_used = 0;
+    return 0;
+}
+
+inline int mbedtls_sha256_update(mbedtls_sha256_context* ctx, const unsigned char* input, size_t ilen) {
+    ctx->length += ilen;
+    while (ilen > 0) {
+        size_t length = ilen < sizeof(ctx->block) - ctx->block_used ? ilen : sizeof(ctx->block) - ctx->block_used;
+        memcpy(ctx->block + ctx->block_used, input, length);
+        ctx->block_used += length;
+        input += length;
+        ilen -= length;
+        if (ctx->block_used == sizeof(ctx->block)) {
+            host::sha256_block(ctx, ctx->block);
+            ctx->block_used = 0;
+        }
+    }
+    return 0;
+}
+
+inline int mbedtls_sha256_finish(mbedtls_sha256_context* ctx, unsigned char output[32]) {
+    uint64_t bit_length = ctx->length * 8;
+    uint8_t padding[72] = {0x80};
+    size_t padding_length = (ctx->block_used < 56 ? 56 : 120) - ctx->block_used;
+    for (int byte_idx = 0; byte_idx < 8; byte_idx++) {
+        padding[padding_length + byte_idx] = static_cast<uint8_t>(bit_length >> (56 - byte_idx * 8));
+    }
+    mbedtls_sha256_update(ctx, padding, padding_length + 8);
+
+    for (int word_idx = 0; word_idx < 8; word_idx++) {
+        output[word_idx * 4] = static_cast<uint8_t>(ctx->state[word_idx] >> 24);
+        output[word_idx * 4 + 1] = static_cast<uint8_t>(ctx->state[word_idx] >> 16);
+        output[word_idx * 4 + 2] = static_cast<uint8_t>(ctx->state[word_idx] >> 8);
+        output[word_idx * 4 + 3] = static_cast<uint8_t>(ctx->state[word_idx]);
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+// The system clock as a simulation, so that setting or slewing it never touches the host's clock. It starts at the
+// host's time of day and runs with host_micros(), skipping ahead with host::clock_warp(). A test can make its crystal
+// run fast or slow.
+
+#include_next <sys/time.h>
+
+#include <Arduino.h>
+
+#include <mutex>
+
+namespace host {
+    struct system_clock {
+        static constexpr int64_t slew_ppm = 500; // How fast adjtime() moves the clock, as on Linux
+
+        std::mutex lock;
+        bool started = false;
+        int64_t micros = 0;      // The system time at host_micros() == updated_at
+        uint64_t updated_at = 0;
+        int64_t outstanding = 0; // Slew adjtime() has yet to apply
+        double drift_ppm = 0;    // Positive when the clock runs fast
+        uint32_t steps = 0;      // settimeofday() calls
+
+        // Runs the clock up to now, with the lock held.
+        void update() {
+            uint64_t now = host_micros();
+            if (!started) {
+                timeval tv;
+                ::gettimeofday(&tv, nullptr);
+                micros = static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+                updated_at = now;
+                started = true;
+            }
+
+            int64_t elapsed = static_cast<int64_t>(now - updated_at);
+            int64_t max_slew = elapsed * slew_ppm / 1000000;
+            int64_t slew = std::min(std::max(outstanding, -max_slew), max_slew);
+            micros += elapsed + static_cast<int64_t>(elapsed * drift_ppm / 1e6) + slew;
+            outstanding -= slew;
+            updated_at = now;
+        }
+    };
+
+    inline system_clock& sys_clock() {
+        static system_clock clock;
+        return clock;
+    }
+
+    inline int gettimeofday(timeval* tv, void*) {
+        std::lock_guard<std::mutex> guard(sys_clock().lock);
+        sys_clock().update();
+        tv->tv_sec = sys_clock().micros / 1000000;
+        tv->tv_usec = sys_clock().micros % 1000000;
+        return 0;
+    }
+
+    inline int settimeofday(const timeval* tv, const void*) {
+        std::lock_guard<std::mutex> guard(sys_clock().lock);
+        sys_clock().update();
+        sys_clock().micros = static_cast<int64_t>(tv->tv_sec) * 1000000 + tv->tv_usec;
+        sys_clock().steps++;
+        return 0;
+    }
+
+    inline int adjtime(const timeval* delta, timeval* olddelta) {
+        std::lock_guard<std::mutex> guard(sys_clock().lock);
+        sys_clock().update();
+        if (olddelta) {
+            olddelta->tv_sec = sys_clock().outstanding / 1000000;
+            olddelta->tv_usec = sys_clock().outstanding % 1000000;
+        }
+        if (delta) {
+            sys_clock().outstanding = static_cast<int64_t>(delta->tv_sec) * 1000000 + delta->tv_usec;
+        }
+        return 0;
+    }
+} // namespace host
+
+#define gettimeofday(tv, tz) host::gettimeofday(tv, tz)
+#define settimeofday(tv, tz) host::settimeofday(tv, tz)
+#define adjtime(delta, olddelta) host::adjtime(delta, olddelta)
@@ -0,0 +1,185 @@
+#include "admission_control.hpp"
+
+#include <ESPAsyncWebServer.h>
+#include <unity.h>
+
+#include <memory>
+#include <vector>
+
+using namespace mocca;
+
+namespace {
+    constexpr uint32_t burst_requests = 10;
+    constexpr uint32_t refill_requests_per_sec = 3;
+
+    // Stands in for an HTTP client against the config web server, which answers the way admit_request() does.
+    class test_client {
+      public:
+        explicit test_client(uint32_t ip) : _ip(ip) {}
+
+        // Sends a request and, unless hold is set, waits for the response before returning.
+        int send(admission_control& admission, uint32_t now, bool hold = false) {
+            _requests.emplace_back(new AsyncWebServerRequest());
+            AsyncWebServerRequest* request = _requests.back().get();
+            switch (admission.admit(request, _ip, now)) {
+            case admission_result::admitted:
+                if (!hold) {
+                    admission.finish(request);
+                }
+                return 200;
+            case admission_result::rate_limited:
+                return 429;
+            case admission_result::overloaded:
+            default:
+                return 503;
+            }
+        }
+
+        // Responds to every held request.
+        void finish_all(admission_control& admission) {
+            for (const std::unique_ptr<AsyncWebServerRequest>& request : _requests) {
+                admission.finish(request.get());
+            }
+        }
+
+        uint32_t count(admission_control& admission, uint32_t now, uint32_t requests, int status) {
+            uint32_t matching = 0;
+            for (uint32_t request_idx = 0; request_idx < requests; request_idx++) {
+                if (send(admission, now) == status) {
+                    matching++;
+                }
+            }
+            return matching;
+        }
+
+      private:
+        uint32_t _ip;
+        std::vector<std::unique_ptr<AsyncWebServerRequest>> _requests;
+    };
+} // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_burst_then_refill() {
+    admission_control admission;
+    test_client client(0x0a000001);
+
+    TEST_ASSERT_EQUAL_UINT32(burst_requests, client.count(admission, 1000, burst_requests, 200));
+    TEST_ASSERT_EQUAL(429, client.send(admission, 1000));
+
+    TEST_ASSERT_EQUAL_UINT32(refill_requests_per_sec, client.count(admission, 2000, burst_requests, 200));
+    TEST_ASSERT_EQUAL(429, client.send(admission, 2000));
+}
+
+void test_clients_have_their_own_buckets() {
+    admission_control admission;
+    test_client greedy(0x0a000001);
+    test_client polite(0x0a000002);
+
+    TEST_ASSERT_EQUAL_UINT32(burst_requests, greedy.count(admission, 1000, burst_requests * 2, 200));
+    TEST_ASSERT_EQUAL(200, polite.send(admission, 1000));
+}
+
+void test_long_idle_refills_only_to_the_burst() {
+    admission_control admission;
+    test_client client(0x0a000001);
+
+    client.count(admission, 1000, burst_requests, 200);
+    TEST_ASSERT_EQUAL(429, client.send(admission, 1000));
+
+    // Far enough that an unclamped refill would overflow.
+    uint32_t later = 1000 + 0xf0000000u;
+    TEST_ASSERT_EQUAL_UINT32(burst_requests, client.count(admission, later, burst_requests * 2, 200));
+}
+
+void test_in_flight_cap() {
+    admission_control admission;
+    std::vector<std::unique_ptr<test_client>> clients;
+    for (uint32_t client_idx = 0; client_idx <= admission_control::max_in_flight; client_idx++) {
+        clients.emplace_back(new test_client(0x0a000001 + client_idx));
+    }
+
+    for (size_t client_idx = 0; client_idx < admission_control::max_in_flight; client_idx++) {
+        TEST_ASSERT_EQUAL(200, clients[client_idx]->send(admission, 1000, true));
+    }
+    TEST_ASSERT_EQUAL(503, clients.back()->send(admission, 1000));
+
+    clients.front()->finish_all(admission);
+    TEST_ASSERT_EQUAL(200, clients.back()->send(admission, 1000, true));
+    TEST_ASSERT_EQUAL(503, clients.front()->send(admission, 1000));
+
+    // A rejected request doesn't take a token, only admitted ones do.
+    for (const std::unique_ptr<test_client>& client : clients) {
+        client->finish_all(admission);
+    }
+    TEST_ASSERT_EQUAL_UINT32(burst_requests - 1, clients.front()->count(admission, 1000, burst_requests, 200));
+}
+
+void test_finishing_twice_or_unknown_requests_is_harmless() {
+    admission_control admission;
+    AsyncWebServerRequest unknown;
+    admission.finish(&unknown);
+    admission.finish(nullptr);
+
+    test_client client(0x0a000001);
+    for (size_t request_idx = 0; request_idx < admission_control::max_in_flight; request_idx++) {
+        TEST_ASSERT_EQUAL(200, client.send(admission, 1000, true));
+    }
+    client.finish_all(admission);
+    client.finish_all(admission);
+
+    for (size_t request_idx = 0; request_idx < admission_control::max_in_flight; request_idx++) {
+        TEST_ASSERT_EQUAL(200, client.send(admission, 1000, true));
+    }
+}
+
+void test_least_recently_seen_client_is_forgotten() {
+    admission_control admission;
+    test_client drained(0x0a000001);
+    drained.count(admission, 1000, burst_requests, 200);
+    TEST_ASSERT_EQUAL(429, drained.send(admission, 1000));
+
+    // Fills the rest of the table and then one more, which takes the drained client's entry.
+    for (uint32_t client_idx = 1; client_idx <= admission_control::max_clients; client_idx++) {
+        test_client other(0x0a000001 + client_idx);
+        TEST_ASSERT_EQUAL(200, other.send(admission, 1000 + client_idx));
+    }
+
+    // Back with a full bucket, and it pushed out the client seen longest ago rather than the newest.
+    TEST_ASSERT_EQUAL_UINT32(burst_requests, drained.count(admission, 1100, burst_requests, 200));
+    test_client newest(0x0a000001 + admission_control::max_clients);
+    TEST_ASSERT_EQUAL_UINT32(burst_requests - 1, newest.count(admission, 1100, burst_requests, 200));
+}
+
+void test_stats_count_every_outcome() {
+    admission_control admission;
+    test_client client(0x0a000001);
+    test_client other(0x0a000002);
+
+    client.count(admission, 1000, burst_requests + 2, 200);
+    for (size_t request_idx = 0; request_idx < admission_control::max_in_flight; request_idx++) {
+        other.send(admission, 1000, true);
+    }
+    other.send(admission, 1000);
+    admission.on_command_collapsed();
+
+    const admission_stats& stats = admission.stats();
+    TEST_ASSERT_EQUAL_UINT32(burst_requests + admission_control::max_in_flight, stats.admitted);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.rate_limited);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.overloaded);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.collapsed_commands);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_burst_then_refill);
+    RUN_TEST(test_clients_have_their_own_buckets);
+    RUN_TEST(test_long_idle_refills_only_to_the_burst);
+    RUN_TEST(test_in_flight_cap);
+    RUN_TEST(test_finishing_twice_or_unknown_requests_is_harmless);
+    RUN_TEST(test_least_recently_seen_client_is_forgotten);
+    RUN_TEST(test_stats_count_every_outcome);
+    return UNITY_END();
+}
@@ -0,0 +1,323 @@
+#include "boiler_supervisor.hpp"
+#include "control_loop.hpp"
+#include "features.hpp"
+#include "task_topology.hpp"
+
+#if MOCCA_FEATURE_WEB
+#include "admission_control.hpp"
+#include "command_handoff.hpp"
+#include "json_request.hpp"
+#endif
+
+#include <unity.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace mocca;
+
+namespace {
+    constexpr uint8_t water_pin = 1;
+    constexpr uint8_t pot_pin = 2;
+    constexpr uint8_t ssr_pin = 3;
+
+    constexpr int cutoff_rounds = 200;
+    constexpr int64_t poll_interval_micros = 10000;
+    constexpr int64_t open_micros = 2000;
+
+    // The supervisor's own bound is one poll interval, the rest is for the host scheduler under load.
+    constexpr int64_t max_cutoff_micros = poll_interval_micros + 40000;
+
+#if MOCCA_FEATURE_WEB
+    constexpr uint32_t http_load_millis = 3000;
+    constexpr int64_t brew_command_interval_micros = 5000;
+    constexpr uint32_t control_tick_millis = 10; // The control loop's interval in the active power tier
+    constexpr uint32_t http_clients = admission_control::max_clients * 4;
+
+    // A command wakes the control loop, most are decided on long before the next tick. None waits longer than the tick
+    // it arrived in, the rest is for the host scheduler.
+    constexpr int64_t max_median_decision_micros = 1000;
+    constexpr int64_t max_decision_micros = control_tick_millis * 1000 + 40000;
+#endif
+
+    boiler_supervisor supervisor;
+    binary_switch water_switch;
+    binary_switch pot_switch;
+
+    bool ssr_on() {
+        return digitalRead(ssr_pin) == HIGH;
+    }
+
+    // Microseconds until the SSR reaches the given state, or -1 after a second.
+    int64_t wait_for_ssr(bool on) {
+        int64_t start = esp_timer_get_time();
+        while (ssr_on() != on) {
+            if (esp_timer_get_time() - start > 1000000) {
+                return -1;
+            }
+            std::this_thread::yield();
+        }
+        return esp_timer_get_time() - start;
+    }
+
+    // Hammers the supervisor the way a busy control loop and the web server would, on as many threads as there are
+    // cores so that the supervisor task has to compete for CPU time.
+    class load {
+      public:
+        explicit load(bool request_heat) {
+            unsigned thread_count = std::max(2u, std::thread::hardware_concurrency());
+            for (unsigned thread_idx = 0; thread_idx < thread_count; thread_idx++) {
+                _threads.emplace_back([this, request_heat]() {
+                    volatile uint32_t work = 0;
+                    while (!_stop) {
+                        if (request_heat) {
+                            supervisor.request(true);
+                        }
+                        supervisor.get_stats();
+                        for (int spin = 0; spin < 1000; spin++) {
+                            work = work + spin;
+                        }
+                    }
+                });
+            }
+        }
+
+        ~load() {
+            _stop = true;
+            for (std::thread& thread : _threads) {
+                thread.join();
+            }
+        }
+
+      private:
+        std::atomic<bool> _stop{false};
+        std::vector<std::thread> _threads;
+    };
+
+    void measure_cutoffs(bool with_interrupt) {
+        int64_t worst_micros = 0;
+        for (int round = 0; round < cutoff_rounds; round++) {
+            supervisor.request(true);
+            TEST_ASSERT_GREATER_OR_EQUAL(0, wait_for_ssr(true));
+
+            uint8_t pin = round % 2 == 0 ? water_pin : pot_pin;
+            if (with_interrupt) {
+                host::set_pin(pin, HIGH);
+            } else {
+                digitalWrite(pin, HIGH);
+            }
+            int64_t cutoff_micros = wait_for_ssr(false);
+            TEST_ASSERT_GREATER_OR_EQUAL(0, cutoff_micros);
+            worst_micros = std::max(worst_micros, cutoff_micros);
+
+            // Requests keep coming while the switch is open, none of them may turn the SSR back on.
+            int64_t open_since = esp_timer_get_time();
+            while (esp_timer_get_time() - open_since < open_micros) {
+                TEST_ASSERT_FALSE(ssr_on());
+            }
+
+            if (with_interrupt) {
+                host::set_pin(pin, LOW);
+            } else {
+                digitalWrite(pin, LOW);
+            }
+        }
+
+        char message[64];
+        snprintf(message, sizeof(message), "worst cut-off %lld us", static_cast<long long>(worst_micros));
+        TEST_MESSAGE(message);
+        TEST_ASSERT_LESS_OR_EQUAL(max_cutoff_micros, worst_micros);
+        TEST_ASSERT_LESS_OR_EQUAL(max_cutoff_micros, supervisor.get_stats().worst_cutoff_micros);
+    }
+
+#if MOCCA_FEATURE_WEB
+    // The brew commands the control loop decided on and how long after their request was handled.
+    struct control_loop_stand_in {
+        brew_command_handoff commands;
+        std::atomic<bool> running{true};
+        std::atomic<bool> stopped{false};
+        std::vector<int64_t> decision_micros;
+        brew_command last_command = brew_command::none;
+    };
+
+    // What the Arduino loopTask does with brew commands: sleeps until the next tick or until a command wakes it, then
+    // hands the command to the supervisor.
+    void control_loop_main(void* arg) {
+        control_loop_stand_in* loop = static_cast<control_loop_stand_in*>(arg);
+        start_control_loop_pacing();
+        while (loop->running) {
+            wait_for_control_loop_wake(control_tick_millis);
+
+            int64_t received_micros = 0;
+            brew_command command = loop->commands.take(&received_micros);
+            if (command != brew_command::none) {
+                supervisor.request(command == brew_command::start);
+                loop->decision_micros.push_back(esp_timer_get_time() - received_micros);
+                loop->last_command = command;
+            }
+        }
+        loop->stopped = true;
+    }
+
+    struct http_load_counts {
+        uint32_t requests = 0;
+        uint32_t parsed = 0;
+        uint32_t brew_commands = 0;
+        uint32_t collapsed = 0;
+    };
+
+    struct async_tcp_stand_in {
+        control_loop_stand_in* loop;
+        std::atomic<bool> running{true};
+        std::atomic<bool> stopped{false};
+        http_load_counts counts;
+    };
+
+    // What the async_tcp task does for each request, as fast as it can: admission, then either a wake time body through
+    // the body buffer and the parser, or every few milliseconds a brew command handed to the control loop.
+    void async_tcp_main(void* arg) {
+        async_tcp_stand_in* server = static_cast<async_tcp_stand_in*>(arg);
+        static admission_control admission;
+        static request_body_buffer body;
+        static fixed_json_allocator allocator;
+        const char* wake_body = "{\"minute\":390}";
+        size_t wake_body_size = strlen(wake_body);
+
+        int64_t next_command_micros = esp_timer_get_time();
+        brew_command next_command = brew_command::start;
+        for (uint32_t request_number = 0; server->running; request_number++) {
+            AsyncWebServerRequest request;
+            uint32_t client_ip = 0x0a000100 + request_number % http_clients;
+            int64_t received_micros = esp_timer_get_time();
+            if (admission.admit(&request, client_ip, millis()) != admission_result::admitted) {
+                continue;
+            }
+            server->counts.requests++;
+
+            if (received_micros >= next_command_micros) {
+                if (!server->loop->commands.post(next_command, received_micros)) {
+                    server->counts.collapsed++;
+                }
+                server->counts.brew_commands++;
+                next_command = next_command == brew_command::start ? brew_command::cancel : brew_command::start;
+                next_command_micros = received_micros + brew_command_interval_micros;
+            } else {
+                request.set_content_length(wake_body_size);
+                body.append(&request, reinterpret_cast<const uint8_t*>(wake_body), wake_body_size, 0,
+                            wake_body_size);
+                JsonDocument json(&allocator);
+                DeserializationError error;
+                if (parse_request_body(&request, &body, &allocator, &json, &error) == body_parse_result::parsed) {
+                    server->counts.parsed += json["minute"].as<int>() == 390;
+                }
+            }
+            admission.finish(&request);
+        }
+        server->stopped = true;
+    }
+
+    void wait_until(const std::atomic<bool>& flag) {
+        while (!flag) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    int64_t percentile(const std::vector<int64_t>& sorted, size_t percent) {
+        return sorted[std::min(sorted.size() - 1, sorted.size() * percent / 100)];
+    }
+#endif
+} // namespace
+
+void setUp() {}
+
+void tearDown() {
+    supervisor.request(false);
+}
+
+void test_turning_off_does_not_wait_for_the_task() {
+    load background(false);
+    for (int round = 0; round < cutoff_rounds; round++) {
+        supervisor.request(true);
+        TEST_ASSERT_GREATER_OR_EQUAL(0, wait_for_ssr(true));
+        supervisor.request(false);
+        TEST_ASSERT_FALSE(ssr_on());
+        TEST_ASSERT_FALSE(supervisor.is_heating());
+    }
+}
+
+void test_switch_interrupt_cuts_off_under_load() {
+    load background(true);
+    measure_cutoffs(true);
+}
+
+void test_polling_cuts_off_without_interrupt_under_load() {
+    load background(true);
+    measure_cutoffs(false);
+    TEST_ASSERT_GREATER_OR_EQUAL(cutoff_rounds * 2, supervisor.get_stats().sensor_cutoffs);
+}
+
+// Brew commands come in through the request path the web server takes, on a task standing in for async_tcp at its core
+// and priority, while it handles wake time requests as fast as it can. The control loop, on its own core, has to decide
+// on each command within the tick it arrived in.
+void test_control_loop_decides_promptly_under_http_load() {
+#if MOCCA_FEATURE_WEB
+    static control_loop_stand_in loop;
+    static async_tcp_stand_in server;
+    server.loop = &loop;
+    loop.decision_micros.reserve(2 * http_load_millis * 1000 / brew_command_interval_micros);
+
+    BaseType_t created = xTaskCreatePinnedToCore(control_loop_main, "loopTask", 8192, &loop, control_task_priority,
+                                                 nullptr, control_core);
+    TEST_ASSERT_EQUAL(pdPASS, created);
+    std::this_thread::sleep_for(std::chrono::milliseconds(control_tick_millis));
+    created = xTaskCreatePinnedToCore(async_tcp_main, "async_tcp", 8192, &server, network_task_priority, nullptr,
+                                      network_core);
+    TEST_ASSERT_EQUAL(pdPASS, created);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(http_load_millis));
+    server.running = false;
+    wait_until(server.stopped);
+    std::this_thread::sleep_for(std::chrono::milliseconds(control_tick_millis * 2));
+    loop.running = false;
+    wake_control_loop();
+    wait_until(loop.stopped);
+
+    std::vector<int64_t> sorted = loop.decision_micros;
+    std::sort(sorted.begin(), sorted.end());
+    char message[160];
+    snprintf(message, sizeof(message),
+             "%u requests, %u brew commands, decided in p50 %lld us, p99 %lld us, worst %lld us (%s)",
+             server.counts.requests, server.counts.brew_commands, static_cast<long long>(percentile(sorted, 50)),
+             static_cast<long long>(percentile(sorted, 99)), static_cast<long long>(sorted.back()),
+             host::tasks_placed() ? "a host CPU per core" : "sharing the host CPUs");
+    TEST_MESSAGE(message);
+
+    TEST_ASSERT_GREATER_THAN_UINT32(http_load_millis * 10, server.counts.parsed);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, server.counts.brew_commands);
+    TEST_ASSERT_EQUAL_UINT32(server.counts.brew_commands - server.counts.collapsed, sorted.size());
+    TEST_ASSERT_LESS_OR_EQUAL(max_median_decision_micros, percentile(sorted, 50));
+    TEST_ASSERT_LESS_OR_EQUAL(max_decision_micros, sorted.back());
+    TEST_ASSERT_GREATER_OR_EQUAL(0, wait_for_ssr(loop.last_command == brew_command::start));
+#else
+    TEST_IGNORE_MESSAGE("No web server without the web feature.");
+#endif
+}
+
+int main(int argc, char** argv) {
+    water_switch.init(water_pin, INPUT_PULLUP, true);
+    pot_switch.init(pot_pin, INPUT_PULLUP, true);
+    digitalWrite(water_pin, LOW);
+    digitalWrite(pot_pin, LOW);
+    if (!supervisor.start(ssr_pin, &water_switch, &pot_switch)) {
+        return 1;
+    }
+
+    UNITY_BEGIN();
+    RUN_TEST(test_turning_off_does_not_wait_for_the_task);
+    RUN_TEST(test_switch_interrupt_cuts_off_under_load);
+    RUN_TEST(test_polling_cuts_off_without_interrupt_under_load);
+    RUN_TEST(test_control_loop_decides_promptly_under_http_load);
+    return UNITY_END();
+}
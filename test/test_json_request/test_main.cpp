@@ -0,0 +1,345 @@
+#include "admission_control.hpp"
+#include "json_request.hpp"
+
+#include <unity.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace mocca;
+
+namespace {
+    // Every heap allocation made by the test process, so that the steady state can be shown not to touch the heap.
+    std::atomic<uint32_t> heap_allocations{0};
+
+    constexpr uint32_t soak_requests = 20000;
+    constexpr uint32_t soak_warm_up_requests = 1000;
+    constexpr uint32_t soak_request_interval_millis = 50;
+    constexpr size_t soak_batch_size = admission_control::max_in_flight + 2;
+    constexpr uint32_t soak_clients = admission_control::max_clients * 2;
+
+    struct parse_counts {
+        uint32_t parsed = 0;
+        uint32_t too_large = 0;
+        uint32_t busy = 0;
+        uint32_t malformed = 0;
+    };
+
+    void append_body(request_body_buffer& body, AsyncWebServerRequest* request, const char* text, size_t chunk_size) {
+        size_t total = strlen(text);
+        request->set_content_length(total);
+        for (size_t index = 0; index < total; index += chunk_size) {
+            body.append(request, reinterpret_cast<const uint8_t*>(text) + index, std::min(chunk_size, total - index),
+                        index, total);
+        }
+    }
+
+    // What the web server's handlers do once the body is in, the document only lives as long as the handler.
+    void handle_request(AsyncWebServerRequest* request, request_body_buffer* body, fixed_json_allocator* allocator,
+                        parse_counts* counts) {
+        JsonDocument json(allocator);
+        DeserializationError error;
+        char command[16];
+        switch (parse_request_body(request, body, allocator, &json, &error)) {
+        case body_parse_result::parsed:
+            if (copy_json_string(json["command"], command, sizeof(command))) {
+                counts->parsed++;
+            }
+            break;
+        case body_parse_result::too_large:
+            counts->too_large++;
+            break;
+        case body_parse_result::busy:
+            counts->busy++;
+            break;
+        case body_parse_result::malformed:
+            counts->malformed++;
+            break;
+        }
+    }
+} // namespace
+
+void* operator new(size_t size) {
+    heap_allocations++;
+    void* ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_allocator_reuses_freed_last_block() {
+    static fixed_json_allocator allocator;
+    allocator.reset();
+
+    void* first = allocator.allocate(10);
+    void* second = allocator.allocate(20);
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_NOT_NULL(second);
+
+    allocator.deallocate(second);
+    TEST_ASSERT_EQUAL_PTR(second, allocator.allocate(20));
+
+    // Only the last block goes back, the first stays taken.
+    allocator.deallocate(first);
+    TEST_ASSERT_NOT_EQUAL(first, allocator.allocate(10));
+}
+
+void test_allocator_grows_last_block_in_place() {
+    static fixed_json_allocator allocator;
+    allocator.reset();
+
+    char* block = static_cast<char*>(allocator.allocate(8));
+    strcpy(block, "mocca");
+    TEST_ASSERT_EQUAL_PTR(block, allocator.reallocate(block, 100));
+    TEST_ASSERT_EQUAL_STRING("mocca", block);
+}
+
+void test_allocator_moves_earlier_block_on_reallocate() {
+    static fixed_json_allocator allocator;
+    allocator.reset();
+
+    char* block = static_cast<char*>(allocator.allocate(8));
+    strcpy(block, "mocca");
+    allocator.allocate(8);
+
+    char* moved = static_cast<char*>(allocator.reallocate(block, 32));
+    TEST_ASSERT_NOT_NULL(moved);
+    TEST_ASSERT_NOT_EQUAL(block, moved);
+    TEST_ASSERT_EQUAL_STRING("mocca", moved);
+}
+
+void test_allocator_fails_when_full_until_reset() {
+    static fixed_json_allocator allocator;
+    allocator.reset();
+
+    TEST_ASSERT_NULL(allocator.allocate(json_arena_size));
+    void* block = allocator.allocate(json_arena_size / 2);
+    TEST_ASSERT_NOT_NULL(block);
+    TEST_ASSERT_NULL(allocator.allocate(json_arena_size / 2));
+    TEST_ASSERT_NULL(allocator.reallocate(block, json_arena_size));
+
+    allocator.reset();
+    TEST_ASSERT_NOT_NULL(allocator.allocate(json_arena_size / 2));
+    TEST_ASSERT_LESS_OR_EQUAL(json_arena_size, allocator.high_water());
+}
+
+void test_body_buffer_assembles_chunks() {
+    static request_body_buffer body;
+    AsyncWebServerRequest request;
+    const char* text = "{\"command\":\"brew\",\"cups\":2}";
+
+    append_body(body, &request, text, 5);
+    TEST_ASSERT_TRUE(body.is_owned_by(&request));
+    TEST_ASSERT_EQUAL(strlen(text), body.size());
+    TEST_ASSERT_EQUAL_MEMORY(text, body.data(), strlen(text));
+
+    body.release(&request);
+    TEST_ASSERT_FALSE(body.is_owned_by(&request));
+    TEST_ASSERT_EQUAL(0, body.size());
+}
+
+void test_body_buffer_has_one_owner_at_a_time() {
+    static request_body_buffer body;
+    AsyncWebServerRequest first;
+    AsyncWebServerRequest second;
+
+    append_body(body, &first, "{\"a\":1}", 3);
+    append_body(body, &second, "{\"b\":2}", 3);
+    TEST_ASSERT_TRUE(body.is_owned_by(&first));
+    TEST_ASSERT_FALSE(body.is_owned_by(&second));
+    TEST_ASSERT_EQUAL_MEMORY("{\"a\":1}", body.data(), body.size());
+
+    // Releasing for a request that doesn't own the buffer changes nothing.
+    body.release(&second);
+    TEST_ASSERT_TRUE(body.is_owned_by(&first));
+    body.release(&first);
+}
+
+void test_body_buffer_drops_oversized_body() {
+    static request_body_buffer body;
+    AsyncWebServerRequest request;
+    static char text[max_request_body_size + 2];
+    memset(text, ' ', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+
+    append_body(body, &request, text, 64);
+    TEST_ASSERT_FALSE(body.is_owned_by(&request));
+}
+
+void test_body_buffer_released_on_disconnect() {
+    static request_body_buffer body;
+    AsyncWebServerRequest request;
+
+    body.append(&request, reinterpret_cast<const uint8_t*>("{\"a\""), 4, 0, 8);
+    TEST_ASSERT_TRUE(body.is_owned_by(&request));
+
+    request.disconnect();
+    TEST_ASSERT_FALSE(body.is_owned_by(&request));
+}
+
+void test_copy_json_string_checks_type_and_size() {
+    static fixed_json_allocator allocator;
+    allocator.reset();
+    JsonDocument json(&allocator);
+    const char* text = "{\"name\":\"kitchen\",\"cups\":2}";
+    TEST_ASSERT_FALSE(deserializeJson(json, text, strlen(text)));
+
+    char out[8];
+    TEST_ASSERT_TRUE(copy_json_string(json["name"], out, sizeof(out)));
+    TEST_ASSERT_EQUAL_STRING("kitchen", out);
+    TEST_ASSERT_FALSE(copy_json_string(json["name"], out, strlen("kitchen")));
+    TEST_ASSERT_FALSE(copy_json_string(json["cups"], out, sizeof(out)));
+    TEST_ASSERT_FALSE(copy_json_string(json["missing"], out, sizeof(out)));
+}
+
+void test_parse_request_body_reports_each_result() {
+    static request_body_buffer body;
+    static fixed_json_allocator allocator;
+    AsyncWebServerRequest first;
+    AsyncWebServerRequest second;
+    parse_counts counts;
+
+    append_body(body, &first, "{\"command\":\"brew\"}", 4);
+    append_body(body, &second, "{\"command\":\"stop\"}", 4);
+    handle_request(&second, &body, &allocator, &counts);
+    TEST_ASSERT_EQUAL_UINT32(1, counts.busy);
+    handle_request(&first, &body, &allocator, &counts);
+    TEST_ASSERT_EQUAL_UINT32(1, counts.parsed);
+    TEST_ASSERT_FALSE(body.is_owned_by(&first));
+
+    append_body(body, &first, "{\"command\":", 4);
+    handle_request(&first, &body, &allocator, &counts);
+    TEST_ASSERT_EQUAL_UINT32(1, counts.malformed);
+    TEST_ASSERT_FALSE(body.is_owned_by(&first));
+
+    static char oversized[max_request_body_size + 2];
+    memset(oversized, ' ', sizeof(oversized) - 1);
+    append_body(body, &first, oversized, 64);
+    handle_request(&first, &body, &allocator, &counts);
+    TEST_ASSERT_EQUAL_UINT32(1, counts.too_large);
+}
+
+// Runs requests through admission, the body buffer and parse_request_body() the way the web server does, with clients
+// that outrun their rate limit, more clients than the admission table holds, more requests than may be in flight,
+// oversized and malformed bodies, bodies that find the buffer taken and clients that go away mid body. Once warmed up
+// none of it may allocate, and the arena may not grow.
+void test_soak_steady_state_stays_off_the_heap() {
+    static admission_control admission;
+    static request_body_buffer body;
+    static fixed_json_allocator allocator;
+    static char oversized_body[max_request_body_size + 16];
+    memset(oversized_body, ' ', sizeof(oversized_body) - 1);
+    oversized_body[sizeof(oversized_body) - 1] = '\0';
+
+    const char* bodies[] = {
+        "{\"command\":\"brew\",\"cups\":1}",
+        "{\"command\":\"set_schedule\",\"days\":[1,2,3,4,5],\"hour\":6,\"minute\":45,\"enabled\":true}",
+        "{\"command\":",
+        oversized_body,
+        "{\"command\":\"stop\"}",
+    };
+    constexpr size_t body_count = sizeof(bodies) / sizeof(bodies[0]);
+
+    uint32_t allocations_before = 0;
+    size_t high_water_after_warm_up = 0;
+    parse_counts counts;
+    uint32_t now = 0;
+
+    for (uint32_t batch_start = 0; batch_start < soak_requests; batch_start += soak_batch_size) {
+        if (batch_start >= soak_warm_up_requests && high_water_after_warm_up == 0) {
+            high_water_after_warm_up = allocator.high_water();
+            allocations_before = heap_allocations.load();
+        }
+
+        AsyncWebServerRequest requests[soak_batch_size];
+        bool admitted[soak_batch_size] = {false};
+        for (size_t request_idx = 0; request_idx < soak_batch_size; request_idx++) {
+            uint32_t request_number = batch_start + request_idx;
+            // Every other request comes from client 0, well above its refill rate.
+            uint32_t client_ip = request_number % 2 == 0 ? 0x0a000001 : 0x0a000002 + request_number % soak_clients;
+            now += soak_request_interval_millis;
+            admitted[request_idx] =
+                admission.admit(&requests[request_idx], client_ip, now) == admission_result::admitted;
+        }
+
+        // Every third request is still waiting for its handler when the next body comes in, which then finds the
+        // buffer taken.
+        AsyncWebServerRequest* waiting = nullptr;
+        for (size_t request_idx = 0; request_idx < soak_batch_size; request_idx++) {
+            if (!admitted[request_idx]) {
+                continue;
+            }
+
+            AsyncWebServerRequest* request = &requests[request_idx];
+            uint32_t request_number = batch_start + request_idx;
+            const char* text = bodies[request_number % body_count];
+            append_body(body, request, text, 1 + request_number % 97);
+
+            if (request_number % 13 == 0) {
+                request->disconnect();
+            }
+
+            if (waiting) {
+                handle_request(waiting, &body, &allocator, &counts);
+                admission.finish(waiting);
+                waiting = nullptr;
+            }
+            if (request_number % 3 == 0) {
+                waiting = request;
+                continue;
+            }
+
+            handle_request(request, &body, &allocator, &counts);
+            admission.finish(request);
+        }
+        if (waiting) {
+            handle_request(waiting, &body, &allocator, &counts);
+            admission.finish(waiting);
+        }
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(0, heap_allocations.load() - allocations_before);
+    TEST_ASSERT_EQUAL(high_water_after_warm_up, allocator.high_water());
+    TEST_ASSERT_LESS_OR_EQUAL(json_arena_size, allocator.high_water());
+
+    const admission_stats& stats = admission.stats();
+    uint32_t total_requests = (soak_requests + soak_batch_size - 1) / soak_batch_size * soak_batch_size;
+    TEST_ASSERT_EQUAL_UINT32(total_requests, stats.admitted + stats.rate_limited + stats.overloaded);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, stats.rate_limited);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, stats.overloaded);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, counts.parsed);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, counts.too_large);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, counts.busy);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, counts.malformed);
+    TEST_ASSERT_LESS_THAN_UINT32(stats.admitted, counts.parsed);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_allocator_reuses_freed_last_block);
+    RUN_TEST(test_allocator_grows_last_block_in_place);
+    RUN_TEST(test_allocator_moves_earlier_block_on_reallocate);
+    RUN_TEST(test_allocator_fails_when_full_until_reset);
+    RUN_TEST(test_body_buffer_assembles_chunks);
+    RUN_TEST(test_body_buffer_has_one_owner_at_a_time);
+    RUN_TEST(test_body_buffer_drops_oversized_body);
+    RUN_TEST(test_body_buffer_released_on_disconnect);
+    RUN_TEST(test_copy_json_string_checks_type_and_size);
+    RUN_TEST(test_parse_request_body_reports_each_result);
+    RUN_TEST(test_soak_steady_state_stays_off_the_heap);
+    return UNITY_END();
+}
@@ -0,0 +1,231 @@
+#include "local_time.hpp"
+
+#include <unity.h>
+
+#include <cstdlib>
+#include <vector>
+
+using namespace mocca;
+
+namespace {
+    // Zones with DST on either hemisphere, half and quarter hour offsets, half hour DST, several changes a year, no DST
+    // at all and POSIX rules as the device gets them from ezTime.
+    const char* const zones[] = {
+        "America/Toronto",
+        "America/Los_Angeles",
+        "America/St_Johns",
+        "America/Santiago",
+        "Europe/London",
+        "Europe/Berlin",
+        "Africa/Casablanca",
+        "Asia/Kolkata",
+        "Asia/Tehran",
+        "Australia/Sydney",
+        "Australia/Lord_Howe",
+        "Pacific/Chatham",
+        "Pacific/Auckland",
+        "UTC",
+        "CET-1CEST,M3.5.0,M10.5.0/3",
+        "EST5EDT,M3.2.0,M11.1.0",
+        "AEST-10AEDT,M10.1.0,M4.1.0/3",
+    };
+
+    // 2026-01-01, the night before the 2026 spring forward in Europe, midsummer and 2031-10-01.
+    const time_t build_times[] = {1767225600, 1774738800, 1784073600, 1948838400};
+
+    constexpr time_t coarse_step_secs = 599;
+    constexpr time_t near_transition_secs = 2 * SECS_PER_DAY;
+    constexpr time_t exact_window_secs = SECS_PER_HOUR; // Wider than any gap or overlap of the zones above
+
+    // The C library's view of the zone, which the table has to agree with.
+    struct system_zone {
+        std::vector<time_t> transitions; // First second of each new offset
+        std::vector<time_t> exact_points; // Transitions and the local times they happen at, stepped through by second
+
+        static int32_t offset_at(time_t utc) {
+            struct tm parts;
+            localtime_r(&utc, &parts);
+            return parts.tm_gmtoff;
+        }
+
+        // Seconds to the next time worth checking, t is a UTC or a local time.
+        time_t step_after(time_t t) const {
+            time_t step = coarse_step_secs;
+            for (time_t point : exact_points) {
+                if (t > point - exact_window_secs && t < point + exact_window_secs) {
+                    return 1;
+                }
+                if (t > point - near_transition_secs && t < point + near_transition_secs) {
+                    step = SECS_PER_MIN;
+                }
+            }
+            return step;
+        }
+
+        // The first instant the local clock reads local, or for a time skipped by a spring forward the instant it
+        // would have been at the offset from before.
+        time_t to_utc(time_t local) const {
+            // A day earlier is before any transition near this local time and after the one before.
+            int32_t offset_before = offset_at(local - SECS_PER_DAY);
+            int32_t offset_after = offset_at(local + SECS_PER_DAY);
+
+            time_t first = local - std::max(offset_before, offset_after);
+            time_t second = local - std::min(offset_before, offset_after);
+            if (first + offset_at(first) == local) {
+                return first;
+            }
+            if (second + offset_at(second) == local) {
+                return second;
+            }
+            return local - offset_before;
+        }
+    };
+
+    struct zone_fixture {
+        Timezone timezone;
+        local_time_table table;
+        system_zone system;
+        time_t from = 0;
+        time_t until = 0; // Last day fully covered by the table
+        char name[128] = {0};
+    };
+
+    bool use_zone(zone_fixture* fixture, const char* zone, time_t build_time) {
+        bool posix = strchr(zone, ',') != nullptr;
+        if (!(posix ? fixture->timezone.setPosix(zone) : fixture->timezone.setLocation(zone))) {
+            return false;
+        }
+        fixture->table.build(&fixture->timezone, build_time);
+
+        setenv("TZ", zone, 1);
+        tzset();
+
+        fixture->from = build_time;
+        fixture->until = build_time + 365 * SECS_PER_DAY;
+        snprintf(fixture->name, sizeof(fixture->name), "%s from %lld", zone, static_cast<long long>(build_time));
+
+        fixture->system.transitions.clear();
+        fixture->system.exact_points.clear();
+        for (time_t hour = fixture->from - SECS_PER_DAY; hour < fixture->until + SECS_PER_DAY; hour += SECS_PER_HOUR) {
+            if (system_zone::offset_at(hour) == system_zone::offset_at(hour + SECS_PER_HOUR)) {
+                continue;
+            }
+            time_t before = hour;
+            time_t after = hour + SECS_PER_HOUR;
+            while (after - before > 1) {
+                time_t mid = before + (after - before) / 2;
+                if (system_zone::offset_at(mid) == system_zone::offset_at(after)) {
+                    after = mid;
+                } else {
+                    before = mid;
+                }
+            }
+            fixture->system.transitions.push_back(after);
+            fixture->system.exact_points.push_back(after);
+            fixture->system.exact_points.push_back(after + system_zone::offset_at(after - 1));
+            fixture->system.exact_points.push_back(after + system_zone::offset_at(after));
+        }
+        return true;
+    }
+
+    template <typename check>
+    void for_each_zone(check run) {
+        static zone_fixture fixture;
+        for (const char* zone : zones) {
+            for (time_t build_time : build_times) {
+                if (!use_zone(&fixture, zone, build_time)) {
+                    char message[128];
+                    snprintf(message, sizeof(message), "%s isn't in the system's zone database", zone);
+                    TEST_MESSAGE(message);
+                    continue;
+                }
+                run(fixture);
+            }
+        }
+    }
+
+    // Every second within an hour of a transition, as UTC and as local time, every minute for two days around it and a
+    // coarse sweep everywhere else.
+    template <typename check>
+    void for_each_time(const zone_fixture& fixture, check run) {
+        for (time_t t = fixture.from; t < fixture.until;) {
+            run(t);
+            t += fixture.system.step_after(t);
+        }
+    }
+} // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_table_covers_the_next_year() {
+    for_each_zone([](const zone_fixture& fixture) {
+        TEST_ASSERT_TRUE_MESSAGE(fixture.table.covers(fixture.from), fixture.name);
+        TEST_ASSERT_TRUE_MESSAGE(fixture.table.covers(fixture.until), fixture.name);
+        TEST_ASSERT_TRUE_MESSAGE(fixture.table.covers(fixture.from - SECS_PER_HOUR * 14), fixture.name);
+        TEST_ASSERT_FALSE_MESSAGE(fixture.table.covers(fixture.from + 368 * SECS_PER_DAY), fixture.name);
+    });
+}
+
+void test_offsets_match_the_system_rules() {
+    for_each_zone([](const zone_fixture& fixture) {
+        for_each_time(fixture, [&fixture](time_t utc) {
+            TEST_ASSERT_EQUAL_INT32_MESSAGE(system_zone::offset_at(utc), fixture.table.offset_at(utc), fixture.name);
+            TEST_ASSERT_EQUAL_INT64_MESSAGE(utc + system_zone::offset_at(utc), fixture.table.to_local(utc),
+                                            fixture.name);
+        });
+    });
+}
+
+void test_transitions_are_exact_to_the_second() {
+    for_each_zone([](const zone_fixture& fixture) {
+        for (time_t transition : fixture.system.transitions) {
+            if (!fixture.table.covers(transition - 1)) {
+                continue;
+            }
+            TEST_ASSERT_EQUAL_INT32_MESSAGE(system_zone::offset_at(transition - 1),
+                                            fixture.table.offset_at(transition - 1), fixture.name);
+            TEST_ASSERT_EQUAL_INT32_MESSAGE(system_zone::offset_at(transition), fixture.table.offset_at(transition),
+                                            fixture.name);
+        }
+    });
+}
+
+void test_local_times_resolve_to_the_first_occurrence_or_past_the_gap() {
+    for_each_zone([](const zone_fixture& fixture) {
+        for_each_time(fixture, [&fixture](time_t local) {
+            TEST_ASSERT_EQUAL_INT64_MESSAGE(fixture.system.to_utc(local), fixture.table.to_utc(local), fixture.name);
+        });
+    });
+}
+
+void test_next_local_time_of_day() {
+    for_each_zone([](const zone_fixture& fixture) {
+        for_each_time(fixture, [&fixture](time_t now) {
+            if (now >= fixture.until - 2 * SECS_PER_DAY) {
+                return;
+            }
+            // A different time of day every step, all of them get hit near transitions.
+            uint32_t secs = static_cast<uint32_t>((now / SECS_PER_MIN) * 7 % (SECS_PER_DAY / SECS_PER_MIN)) *
+                            SECS_PER_MIN;
+
+            time_t today = previousMidnight(now + system_zone::offset_at(now));
+            time_t expected = fixture.system.to_utc(today + secs);
+            if (expected <= now) {
+                expected = fixture.system.to_utc(today + SECS_PER_DAY + secs);
+            }
+            TEST_ASSERT_EQUAL_INT64_MESSAGE(expected, fixture.table.next_local_time_of_day(secs, now), fixture.name);
+        });
+    });
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_table_covers_the_next_year);
+    RUN_TEST(test_offsets_match_the_system_rules);
+    RUN_TEST(test_transitions_are_exact_to_the_second);
+    RUN_TEST(test_local_times_resolve_to_the_first_occurrence_or_past_the_gap);
+    RUN_TEST(test_next_local_time_of_day);
+    return UNITY_END();
+}
@@ -0,0 +1,172 @@
+#include "logger.hpp"
+
+#include <unity.h>
+
+#include <thread>
+#include <vector>
+
+using namespace mocca;
+
+namespace {
+    constexpr uint32_t torn_line_run_millis = 1000;
+    constexpr size_t filler_length = 100;
+    constexpr size_t writer_count = 2;
+
+    // Takes everything right away, so that the buffer keeps wrapping around.
+    class null_output : public Print {
+      public:
+        size_t write(uint8_t) override { return 1; }
+        size_t write(const uint8_t*, size_t size) override { return size; }
+        int availableForWrite() override { return 1 << 16; }
+    };
+
+    char filler_char(unsigned sequence) {
+        return 'a' + sequence % 26;
+    }
+
+    // "seq=<n> " followed by the filler for n, after the logger's prefix.
+    bool is_whole_line(const char* line, size_t length) {
+        const char* message = static_cast<const char*>(memmem(line, length, "seq=", 4));
+        if (!message) {
+            return false;
+        }
+        unsigned sequence = 0;
+        int consumed = 0;
+        if (sscanf(message, "seq=%u %n", &sequence, &consumed) != 1 || consumed == 0) {
+            return false;
+        }
+        const char* filler = message + consumed;
+        if (static_cast<size_t>(line + length - filler) != filler_length) {
+            return false;
+        }
+        for (size_t char_idx = 0; char_idx < filler_length; char_idx++) {
+            if (filler[char_idx] != filler_char(sequence)) {
+                return false;
+            }
+        }
+        return true;
+    }
+} // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_read_back_returns_written_lines() {
+    static logger log;
+    static null_output output;
+    TEST_ASSERT_TRUE(log.start(&output));
+
+    log.write(MOCCA_LOG_LEVEL_INFO, log_tag::core, "brewing %d cups", 4);
+    char text[logger::buffer_size];
+    size_t length = log.read(log.oldest(), text, log.newest() - log.oldest());
+    text[length] = '\0';
+    TEST_ASSERT_NOT_NULL(strstr(text, " I core: brewing 4 cups\n"));
+    TEST_ASSERT_EQUAL_UINT32(1, log.get_stats().written);
+}
+
+void test_secrets_are_redacted_as_whole_tokens() {
+    static logger log;
+    static null_output output;
+    TEST_ASSERT_TRUE(log.start(&output));
+
+    log.set_secret(log_secret::wifi_password, "correct-horse");
+    log.write(MOCCA_LOG_LEVEL_WARN, log_tag::wifi, "password=correct-horse, not correct-horses");
+    char text[logger::buffer_size];
+    size_t length = log.read(log.oldest(), text, log.newest() - log.oldest());
+    text[length] = '\0';
+    TEST_ASSERT_NOT_NULL(strstr(text, "password=***, not correct-horses\n"));
+}
+
+// The line a writer copies in goes in front of the head before the head moves, what read() hands out has to stay
+// clear of it.
+void test_reads_keep_clear_of_the_line_being_written() {
+    static logger log;
+    static null_output output;
+    TEST_ASSERT_TRUE(log.start(&output));
+
+    char filler[filler_length + 1];
+    memset(filler, 'x', filler_length);
+    filler[filler_length] = '\0';
+    while (log.newest() < 3 * logger::buffer_size) {
+        log.write(MOCCA_LOG_LEVEL_INFO, log_tag::core, "%s", filler);
+    }
+
+    uint32_t newest = log.newest();
+    uint32_t oldest = log.oldest();
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(logger::buffer_size - logger::max_line_length - 1, newest - oldest);
+
+    char text[logger::buffer_size];
+    TEST_ASSERT_EQUAL(newest - oldest, log.read(oldest, text, newest - oldest));
+    TEST_ASSERT_EQUAL(0, log.read(oldest - 1, text, 1));
+    TEST_ASSERT_EQUAL(0, log.read(newest - logger::buffer_size, text, 1));
+}
+
+// Writers keep wrapping around the buffer while a reader holds on to the oldest whole line and reads it again and
+// again until it's gone, like a slow /log response does. Each read must return the line as it was written or nothing,
+// never the start of a new line over the rest of the old one.
+void test_reads_never_return_torn_lines() {
+    static logger log;
+    static null_output output;
+    TEST_ASSERT_TRUE(log.start(&output));
+
+    std::atomic<bool> running{true};
+    std::vector<std::thread> writers;
+    for (size_t writer_idx = 0; writer_idx < writer_count; writer_idx++) {
+        writers.emplace_back([&running, writer_idx]() {
+            char filler[filler_length + 1];
+            for (unsigned sequence = writer_idx; running; sequence += writer_count) {
+                memset(filler, filler_char(sequence), filler_length);
+                filler[filler_length] = '\0';
+                log.write(MOCCA_LOG_LEVEL_INFO, log_tag::core, "seq=%u %s", sequence, filler);
+            }
+        });
+    }
+
+    uint32_t lines = 0;
+    uint32_t reads = 0;
+    uint32_t torn = 0;
+    uint32_t start = millis();
+    static char text[logger::buffer_size];
+    while (millis() - start < torn_line_run_millis) {
+        uint32_t position = log.oldest();
+        size_t length = log.read(position, text, log.newest() - position);
+        const char* newline = static_cast<const char*>(memchr(text, '\n', length));
+        const char* line_end = newline ? static_cast<const char*>(memchr(newline + 1, '\n', text + length -
+                                                                                                 newline - 1))
+                                       : nullptr;
+        if (!line_end) {
+            continue;
+        }
+        uint32_t line_start = position + (newline + 1 - text);
+        size_t line_length = line_end - newline; // With its newline
+        lines++;
+
+        char line[logger::max_line_length + 1];
+        while (log.read(line_start, line, line_length) == line_length) {
+            reads++;
+            if (line[line_length - 1] != '\n' || !is_whole_line(line, line_length - 1)) {
+                torn++;
+                break;
+            }
+        }
+    }
+
+    running = false;
+    for (std::thread& writer : writers) {
+        writer.join();
+    }
+
+    TEST_ASSERT_GREATER_THAN_UINT32(0, lines);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, reads);
+    TEST_ASSERT_EQUAL_UINT32(0, torn);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_read_back_returns_written_lines);
+    RUN_TEST(test_secrets_are_redacted_as_whole_tokens);
+    RUN_TEST(test_reads_keep_clear_of_the_line_being_written);
+    RUN_TEST(test_reads_never_return_torn_lines);
+    return UNITY_END();
+}
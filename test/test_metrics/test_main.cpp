@@ -0,0 +1,171 @@
+#include "features.hpp"
+#include "metrics.hpp"
+
+#include <unity.h>
+
+#include <string>
+
+using namespace mocca;
+
+namespace {
+#if MOCCA_FEATURE_DISPLAY
+    // As many states as the tracker keeps, with names as long as the labels take.
+    const char* const state_names[input_latency_tracker::max_states] = {
+        "state_name_00_xx", "state_name_01_xx", "state_name_02_xx", "state_name_03_xx",
+        "state_name_04_xx", "state_name_05_xx", "state_name_06_xx", "state_name_07_xx",
+        "state_name_08_xx", "state_name_09_xx", "state_name_10_xx", "state_name_11_xx",
+    };
+
+    void add_latency(input_latency_tracker* tracker, const char* state, network_load load, uint32_t latency_micros) {
+        uint32_t edge = 1000;
+        tracker->on_input_handled(edge);
+        tracker->on_frame_flushed(edge + latency_micros, state, load);
+    }
+#endif
+
+    char text[max_metrics_text_size];
+
+    // Every counter and gauge at its widest, every state and load with a sample in every bucket.
+    void fill_worst_case(runtime_metrics* metrics, input_latency_tracker* tracker) {
+        metrics->uptime_millis = UINT32_MAX;
+        metrics->boot_millis = UINT32_MAX;
+        metrics->loop_iterations_per_sec = UINT32_MAX;
+        metrics->wifi_rssi = INT32_MIN;
+        metrics->wifi_reconnects = UINT32_MAX;
+        metrics->ntp_sync_age_secs = INT32_MAX;
+        metrics->ntp_offset_micros = INT64_MIN;
+        metrics->persistent_data_commits = UINT32_MAX;
+        metrics->boiler_on_millis = UINT32_MAX;
+        metrics->last_ready_error_secs = INT32_MIN;
+        metrics->state = "alarm_days_set";
+        metrics->web_requests.admitted = UINT32_MAX;
+        metrics->web_requests.rate_limited = UINT32_MAX;
+        metrics->web_requests.overloaded = UINT32_MAX;
+        metrics->log.written = UINT32_MAX;
+        metrics->deep_sleep.sleep_count = UINT32_MAX;
+        metrics->deep_sleep.asleep_secs = UINT32_MAX;
+        metrics->deep_sleep.awake_secs = UINT32_MAX;
+        metrics->deep_sleep.last_lead_secs = UINT32_MAX;
+        metrics->deep_sleep.timed_boiler_ons = UINT32_MAX;
+        metrics->remote_commands.applied = UINT32_MAX;
+        metrics->remote_commands.total_ssr_micros = UINT64_MAX;
+
+#if MOCCA_FEATURE_DISPLAY
+        for (const char* state : state_names) {
+            for (size_t load_idx = 0; load_idx < network_load_count; load_idx++) {
+                for (size_t bucket_idx = 0; bucket_idx < latency_bucket_count - 1; bucket_idx++) {
+                    add_latency(tracker, state, static_cast<network_load>(load_idx),
+                                latency_bucket_bounds_millis[bucket_idx] * 1000);
+                }
+                add_latency(tracker, state, static_cast<network_load>(load_idx), 5000 * 1000);
+            }
+        }
+        metrics->input_latency = tracker;
+#endif
+    }
+
+    // Every line a comment or a sample, nothing cut off.
+    void assert_whole_lines(const char* out, size_t length) {
+        TEST_ASSERT_EQUAL(strlen(out), length);
+        TEST_ASSERT_EQUAL_INT('\n', out[length - 1]);
+        for (const char* line = out; line < out + length;) {
+            const char* end = strchr(line, '\n');
+            TEST_ASSERT_NOT_NULL(end);
+            TEST_ASSERT_TRUE(strncmp(line, "# HELP ", 7) == 0 || strncmp(line, "# TYPE ", 7) == 0 ||
+                             strncmp(line, "mocca_", 6) == 0);
+            if (line[0] != '#') {
+                const char* value = static_cast<const char*>(memrchr(line, ' ', end - line));
+                TEST_ASSERT_NOT_NULL(value);
+                TEST_ASSERT_TRUE(value + 1 < end);
+            }
+            line = end + 1;
+        }
+    }
+
+    bool contains(const char* out, const char* part) {
+        return strstr(out, part) != nullptr;
+    }
+} // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_worst_case_fits_the_buffer() {
+    static input_latency_tracker tracker;
+    runtime_metrics metrics;
+    fill_worst_case(&metrics, &tracker);
+
+    size_t length = format_metrics(metrics, text, sizeof(text));
+    assert_whole_lines(text, length);
+    TEST_ASSERT_TRUE(contains(text, "\nmocca_metrics_truncated 0\n"));
+    TEST_ASSERT_LESS_THAN(sizeof(text), length);
+#if MOCCA_FEATURE_DISPLAY
+    TEST_ASSERT_TRUE(contains(text, "mocca_input_latency_seconds_count{state=\"state_name_11_xx\"} 24\n"));
+#endif
+}
+
+void test_truncation_is_reported() {
+    static input_latency_tracker tracker;
+    runtime_metrics metrics;
+    fill_worst_case(&metrics, &tracker);
+
+    static char small[2048];
+    size_t length = format_metrics(metrics, small, sizeof(small));
+    assert_whole_lines(small, length);
+    TEST_ASSERT_LESS_THAN(sizeof(small), length);
+
+    const char* notice = "# HELP mocca_metrics_truncated";
+    TEST_ASSERT_TRUE(contains(small, notice));
+    TEST_ASSERT_EQUAL_STRING("mocca_metrics_truncated 1\n", small + length - strlen("mocca_metrics_truncated 1\n"));
+}
+
+void test_input_latency_is_one_histogram_per_state() {
+#if MOCCA_FEATURE_DISPLAY
+    static input_latency_tracker tracker;
+    add_latency(&tracker, "menu", network_load::quiet, 15 * 1000);
+    add_latency(&tracker, "menu", network_load::heavy, 150 * 1000);
+    add_latency(&tracker, "idle", network_load::heavy, 5 * 1000);
+
+    runtime_metrics metrics;
+    metrics.input_latency = &tracker;
+    format_metrics(metrics, text, sizeof(text));
+
+    TEST_ASSERT_TRUE(contains(text, "mocca_input_latency_seconds_bucket{state=\"menu\",le=\"0.010\"} 0\n"));
+    TEST_ASSERT_TRUE(contains(text, "mocca_input_latency_seconds_bucket{state=\"menu\",le=\"0.020\"} 1\n"));
+    TEST_ASSERT_TRUE(contains(text, "mocca_input_latency_seconds_bucket{state=\"menu\",le=\"0.200\"} 2\n"));
+    TEST_ASSERT_TRUE(contains(text, "mocca_input_latency_seconds_bucket{state=\"menu\",le=\"+Inf\"} 2\n"));
+    TEST_ASSERT_TRUE(contains(text, "mocca_input_latency_seconds_count{state=\"idle\"} 1\n"));
+    TEST_ASSERT_TRUE(contains(text, "mocca_input_latency_by_load_seconds_count{load=\"quiet\"} 1\n"));
+    TEST_ASSERT_TRUE(contains(text, "mocca_input_latency_by_load_seconds_count{load=\"light\"} 0\n"));
+    TEST_ASSERT_TRUE(contains(text, "mocca_input_latency_by_load_seconds_count{load=\"heavy\"} 2\n"));
+    TEST_ASSERT_FALSE(contains(text, "load=\"heavy\",le="));
+#else
+    TEST_IGNORE_MESSAGE("No input latency without the display.");
+#endif
+}
+
+void test_deep_sleep_wake_to_boiler_on_is_exported() {
+    runtime_metrics metrics;
+    metrics.deep_sleep.sleep_count = 3;
+    metrics.deep_sleep.last_lead_secs = 60;
+    metrics.deep_sleep.timed_boiler_ons = 2;
+    metrics.deep_sleep.last_boiler_on_millis = 60500;
+    metrics.deep_sleep.worst_boiler_on_late_millis = 1250;
+    format_metrics(metrics, text, sizeof(text));
+
+    TEST_ASSERT_TRUE(contains(text, "\nmocca_deep_sleeps_total 3\n"));
+    TEST_ASSERT_TRUE(contains(text, "\nmocca_deep_sleep_lead_seconds 60\n"));
+    TEST_ASSERT_TRUE(contains(text, "\nmocca_deep_sleep_boiler_ons_total 2\n"));
+    TEST_ASSERT_TRUE(contains(text, "\nmocca_deep_sleep_wake_to_boiler_on_seconds 60.500000\n"));
+    TEST_ASSERT_TRUE(contains(text, "\nmocca_deep_sleep_worst_boiler_on_late_seconds 1.250000\n"));
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_worst_case_fits_the_buffer);
+    RUN_TEST(test_truncation_is_reported);
+    RUN_TEST(test_input_latency_is_one_histogram_per_state);
+    RUN_TEST(test_deep_sleep_wake_to_boiler_on_is_exported);
+    return UNITY_END();
+}
@@ -0,0 +1,248 @@
+#include "mqtt_bridge.hpp"
+
+#include <lwip/sockets.h>
+#include <netdb.h>
+#include <unity.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace mocca;
+
+// Runs the bridge against a real broker, with a second client watching the topics and sending the commands. The
+// broker is MOCCA_TEST_MQTT_BROKER as host or host:port, 127.0.0.1:1883 by default. Without one the tests are skipped.
+namespace {
+    constexpr uint32_t delivery_timeout = 5000;
+    constexpr uint32_t batch_wait = 2500; // Past the bridge's batch window
+    constexpr uint32_t step_interval_millis = 5;
+
+    struct received_message {
+        std::string topic;
+        std::string payload;
+    };
+
+    struct command_log {
+        std::vector<brew_command> brews;
+        std::vector<std::pair<bool, uint32_t>> wakes;
+        std::vector<std::string> timezones;
+    };
+
+    std::string broker_host;
+    uint16_t broker_port = 1883;
+    char prefix[48];
+    char watch_filter[64];
+
+    std::unique_ptr<mqtt_bridge> bridge;
+    std::unique_ptr<socket_transport> observer_transport;
+    std::unique_ptr<mqtt_client> observer;
+    std::vector<received_message> received;
+    command_log commands;
+
+    bool broker_reachable() {
+        int probe = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* address = nullptr;
+        bool reachable = getaddrinfo(broker_host.c_str(), std::to_string(broker_port).c_str(), &hints, &address) == 0 &&
+                         connect(probe, address->ai_addr, address->ai_addrlen) == 0;
+        if (address) {
+            freeaddrinfo(address);
+        }
+        close(probe);
+        return reachable;
+    }
+
+    std::string topic(const char* name) {
+        return std::string(prefix) + "/" + name;
+    }
+
+    void step() {
+        uint32_t now = millis();
+        bridge->step(now, 1760000000);
+        observer->step(now);
+    }
+
+    template <typename Condition> bool step_until(Condition condition, uint32_t timeout) {
+        uint32_t start = millis();
+        while (millis() - start < timeout) {
+            step();
+            if (condition()) {
+                return true;
+            }
+            delay(step_interval_millis);
+        }
+        return false;
+    }
+
+    void step_for(uint32_t duration) {
+        step_until([]() { return false; }, duration);
+    }
+
+    const received_message* find_message(const std::string& topic_name, const char* payload_part) {
+        for (const received_message& message : received) {
+            if (message.topic == topic_name && message.payload.find(payload_part) != std::string::npos) {
+                return &message;
+            }
+        }
+        return nullptr;
+    }
+
+    bool wait_for_message(const std::string& topic_name, const char* payload_part) {
+        return step_until([&]() { return find_message(topic_name, payload_part) != nullptr; }, delivery_timeout);
+    }
+
+    void send_command(const char* name, const char* argument, bool retain = false) {
+        std::string command_topic = topic("cmd/") + name;
+        observer->publish(command_topic.c_str(), reinterpret_cast<const uint8_t*>(argument), strlen(argument),
+                          mqtt_qos::at_least_once, retain);
+    }
+
+    void start_bridge() {
+        bridge->start(broker_host.c_str(), broker_port);
+        TEST_ASSERT_TRUE_MESSAGE(wait_for_message(topic("status"), "online"), "The bridge never came online.");
+    }
+} // namespace
+
+void setUp() {
+    const char* broker = getenv("MOCCA_TEST_MQTT_BROKER");
+    broker_host = broker && *broker ? broker : "127.0.0.1";
+    size_t colon = broker_host.find(':');
+    if (colon != std::string::npos) {
+        broker_port = static_cast<uint16_t>(atoi(broker_host.c_str() + colon + 1));
+        broker_host.resize(colon);
+    }
+    if (!broker_reachable()) {
+        TEST_IGNORE_MESSAGE("No MQTT broker, set MOCCA_TEST_MQTT_BROKER to run these.");
+    }
+
+    // Topics of their own for every test, nothing retained by an earlier one shows up.
+    static uint32_t test_number = 0;
+    snprintf(prefix, sizeof(prefix), "mocca-test/%d-%u", static_cast<int>(getpid()), ++test_number);
+    snprintf(watch_filter, sizeof(watch_filter), "%s/#", prefix);
+    received.clear();
+    commands = command_log();
+
+    bridge.reset(new mqtt_bridge());
+    bridge->init(prefix, "mocca-test-bridge");
+    bridge->set_command_callbacks([](brew_command command, int64_t) { commands.brews.push_back(command); },
+                                  [](bool enabled, uint32_t secs) { commands.wakes.emplace_back(enabled, secs); },
+                                  [](const char* timezone) {
+                                      commands.timezones.push_back(timezone);
+                                      return true;
+                                  });
+
+    observer_transport.reset(new socket_transport());
+    observer.reset(new mqtt_client(observer_transport.get()));
+    observer->set_session("mocca-test-observer", 60, nullptr);
+    observer->subscribe(watch_filter);
+    observer->set_message_callback([](const char* topic_name, const uint8_t* payload, size_t size, bool) {
+        received.push_back({topic_name, std::string(reinterpret_cast<const char*>(payload), size)});
+    });
+    observer->start(broker_host.c_str(), broker_port);
+    TEST_ASSERT_TRUE_MESSAGE(step_until([]() { return observer->is_connected(); }, delivery_timeout),
+                             "The observer failed to connect.");
+}
+
+void tearDown() {
+    if (bridge) {
+        bridge->stop();
+    }
+    if (observer) {
+        observer->stop();
+    }
+    bridge.reset();
+    observer.reset();
+    observer_transport.reset();
+}
+
+void test_status_goes_online_and_offline() {
+    start_bridge();
+    TEST_ASSERT_EQUAL_UINT32(1, bridge->get_stats().connects);
+
+    bridge->stop();
+    TEST_ASSERT_TRUE(wait_for_message(topic("status"), "offline"));
+}
+
+void test_events_reach_subscriber() {
+    start_bridge();
+
+    bridge->report_state("heating");
+    bridge->report_switches(true, false);
+    bridge->report_switches(true, false); // No edge, no event
+    brew_event ended;
+    ended.kind = brew_event_kind::ended;
+    ended.boiler_on_secs = 312;
+    bridge->report_brew_event(ended);
+
+    TEST_ASSERT_TRUE(wait_for_message(topic("events"), "\"state\",\"heating\""));
+    const received_message* events = find_message(topic("events"), "\"state\",\"heating\"");
+    TEST_ASSERT_NOT_EQUAL(std::string::npos, events->payload.find("\"water\",1"));
+    TEST_ASSERT_NOT_EQUAL(std::string::npos, events->payload.find("\"pot\",0"));
+    TEST_ASSERT_NOT_EQUAL(std::string::npos, events->payload.find(",312]"));
+    TEST_ASSERT_NOT_EQUAL(std::string::npos, events->payload.find("\"time\":1760000000"));
+    TEST_ASSERT_TRUE(step_until([]() { return bridge->get_stats().published == 1; }, delivery_timeout));
+}
+
+void test_events_wait_for_the_broker() {
+    bridge->report_state("idle");
+    step_for(batch_wait);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, bridge->get_stats().queued_bytes);
+
+    start_bridge();
+    TEST_ASSERT_TRUE(wait_for_message(topic("events"), "\"state\",\"idle\""));
+    TEST_ASSERT_TRUE(step_until([]() { return bridge->get_stats().queued_bytes == 0; }, delivery_timeout));
+}
+
+void test_commands_reach_callbacks() {
+    start_bridge();
+
+    send_command("brew", "");
+    send_command("wake", "450");
+    send_command("wake", "1440"); // Not a minute of the day
+    send_command("wake", "off");
+    send_command("timezone", "Europe/Berlin");
+    send_command("cancel", "");
+    send_command("descale", "");
+
+    TEST_ASSERT_TRUE(step_until([]() { return commands.brews.size() == 2; }, delivery_timeout));
+    TEST_ASSERT_TRUE(commands.brews[0] == brew_command::start);
+    TEST_ASSERT_TRUE(commands.brews[1] == brew_command::cancel);
+
+    TEST_ASSERT_EQUAL(2, commands.wakes.size());
+    TEST_ASSERT_TRUE(commands.wakes[0].first);
+    TEST_ASSERT_EQUAL_UINT32(450 * SECS_PER_MIN, commands.wakes[0].second);
+    TEST_ASSERT_FALSE(commands.wakes[1].first);
+
+    TEST_ASSERT_EQUAL(1, commands.timezones.size());
+    TEST_ASSERT_EQUAL_STRING("Europe/Berlin", commands.timezones[0].c_str());
+}
+
+void test_retained_command_is_ignored() {
+    send_command("brew", "1", true);
+    step_for(100);
+
+    start_bridge();
+    send_command("cancel", "");
+    TEST_ASSERT_TRUE(step_until([]() { return !commands.brews.empty(); }, delivery_timeout));
+    step_for(100);
+
+    // Only the cancel, the retained brew was delivered first and dropped.
+    TEST_ASSERT_EQUAL(1, commands.brews.size());
+    TEST_ASSERT_TRUE(commands.brews[0] == brew_command::cancel);
+
+    // Clears the retained message on the broker.
+    observer->publish(topic("cmd/brew").c_str(), nullptr, 0, mqtt_qos::at_least_once, true);
+    step_for(100);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_status_goes_online_and_offline);
+    RUN_TEST(test_events_reach_subscriber);
+    RUN_TEST(test_events_wait_for_the_broker);
+    RUN_TEST(test_commands_reach_callbacks);
+    RUN_TEST(test_retained_command_is_ignored);
+    return UNITY_END();
+}
@@ -0,0 +1,291 @@
+#include "ota_updater.hpp"
+
+#include <unity.h>
+
+#include <string>
+#include <vector>
+
+using namespace mocca;
+
+namespace {
+    constexpr size_t image_size = 70001; // Not a whole number of chunks
+    constexpr size_t packet_size = 1436; // What a TCP segment carries
+
+    // The update slot as a buffer that can be told to fail.
+    class mock_flash : public ota_flash {
+      public:
+        size_t capacity() const override { return 100000; }
+
+        bool begin() override {
+            began++;
+            data.clear();
+            chunk_sizes.clear();
+            return !fail_begin;
+        }
+
+        bool write(const uint8_t* chunk, size_t size) override {
+            if (chunk_sizes.size() == fail_write_at) {
+                return false;
+            }
+            chunk_sizes.push_back(size);
+            data.insert(data.end(), chunk, chunk + size);
+            return true;
+        }
+
+        bool finish() override {
+            finished++;
+            return !reject_image;
+        }
+
+        void abort() override { aborted++; }
+
+        std::vector<uint8_t> data;
+        std::vector<size_t> chunk_sizes;
+        int began = 0;
+        int finished = 0;
+        int aborted = 0;
+
+        bool fail_begin = false;
+        size_t fail_write_at = SIZE_MAX;
+        bool reject_image = false;
+    };
+
+    std::vector<uint8_t> make_image(size_t size) {
+        std::vector<uint8_t> image(size);
+        for (size_t byte_idx = 0; byte_idx < size; byte_idx++) {
+            image[byte_idx] = static_cast<uint8_t>(byte_idx * 7 + byte_idx / 300);
+        }
+        return image;
+    }
+
+    std::string sha256_hex(const uint8_t* data, size_t size) {
+        mbedtls_sha256_context context;
+        mbedtls_sha256_init(&context);
+        mbedtls_sha256_starts(&context, 0);
+        mbedtls_sha256_update(&context, data, size);
+        uint8_t sha256[ota_sha256_size];
+        mbedtls_sha256_finish(&context, sha256);
+        mbedtls_sha256_free(&context);
+
+        char hex[ota_sha256_size * 2 + 1];
+        for (size_t byte_idx = 0; byte_idx < ota_sha256_size; byte_idx++) {
+            snprintf(hex + byte_idx * 2, 3, "%02x", sha256[byte_idx]);
+        }
+        return hex;
+    }
+
+    bool send(ota_updater* updater, const std::vector<uint8_t>& image, size_t from, size_t to) {
+        for (size_t offset = from; offset < to; offset += packet_size) {
+            if (!updater->write(image.data() + offset, std::min(packet_size, to - offset), offset)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Large enough that it shouldn't live on the stack of a test.
+    ota_updater* make_updater(mock_flash* flash) {
+        static ota_updater* updater = nullptr;
+        delete updater;
+        updater = new ota_updater(flash);
+        return updater;
+    }
+} // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_sha256_matches_known_answer() {
+    const char* text = "abc";
+    TEST_ASSERT_EQUAL_STRING("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+                             sha256_hex(reinterpret_cast<const uint8_t*>(text), strlen(text)).c_str());
+}
+
+void test_streams_image_in_whole_chunks() {
+    mock_flash flash;
+    ota_updater* updater = make_updater(&flash);
+    std::vector<uint8_t> image = make_image(image_size);
+
+    TEST_ASSERT_TRUE(updater->begin(image.size(), sha256_hex(image.data(), image.size()).c_str()));
+    TEST_ASSERT_EQUAL(ota_status::receiving, updater->status());
+    TEST_ASSERT_TRUE(send(updater, image, 0, image.size()));
+    TEST_ASSERT_EQUAL(image.size(), updater->received());
+    TEST_ASSERT_TRUE(updater->finish());
+
+    TEST_ASSERT_EQUAL(ota_status::ready, updater->status());
+    TEST_ASSERT_EQUAL(1, flash.finished);
+    TEST_ASSERT_EQUAL(0, flash.aborted);
+    TEST_ASSERT_TRUE(flash.data == image);
+    for (size_t chunk_idx = 0; chunk_idx + 1 < flash.chunk_sizes.size(); chunk_idx++) {
+        TEST_ASSERT_EQUAL(ota_updater::chunk_size, flash.chunk_sizes[chunk_idx]);
+    }
+    TEST_ASSERT_EQUAL(image.size() % ota_updater::chunk_size, flash.chunk_sizes.back());
+}
+
+void test_uppercase_hash_is_accepted() {
+    mock_flash flash;
+    ota_updater* updater = make_updater(&flash);
+    std::vector<uint8_t> image = make_image(ota_updater::chunk_size);
+    std::string hex = sha256_hex(image.data(), image.size());
+    for (char& c : hex) {
+        c = toupper(c);
+    }
+
+    TEST_ASSERT_TRUE(updater->begin(image.size(), hex.c_str()));
+    TEST_ASSERT_TRUE(send(updater, image, 0, image.size()));
+    TEST_ASSERT_TRUE(updater->finish());
+}
+
+void test_hash_mismatch_aborts() {
+    mock_flash flash;
+    ota_updater* updater = make_updater(&flash);
+    std::vector<uint8_t> image = make_image(image_size);
+    std::string hex = sha256_hex(image.data(), image.size());
+    hex[0] = hex[0] == '0' ? '1' : '0';
+
+    TEST_ASSERT_TRUE(updater->begin(image.size(), hex.c_str()));
+    TEST_ASSERT_TRUE(send(updater, image, 0, image.size()));
+    TEST_ASSERT_FALSE(updater->finish());
+
+    TEST_ASSERT_EQUAL(ota_status::failed, updater->status());
+    TEST_ASSERT_EQUAL_STRING("sha256 mismatch", updater->error());
+    TEST_ASSERT_EQUAL(1, flash.aborted);
+    TEST_ASSERT_EQUAL(0, flash.finished);
+}
+
+void test_gaps_and_overruns_abort() {
+    mock_flash flash;
+    ota_updater* updater = make_updater(&flash);
+    std::vector<uint8_t> image = make_image(image_size);
+    std::string hex = sha256_hex(image.data(), image.size());
+
+    TEST_ASSERT_TRUE(updater->begin(image.size(), hex.c_str()));
+    TEST_ASSERT_TRUE(send(updater, image, 0, packet_size));
+    TEST_ASSERT_FALSE(updater->write(image.data(), packet_size, packet_size * 2));
+    TEST_ASSERT_EQUAL(ota_status::failed, updater->status());
+    TEST_ASSERT_EQUAL(1, flash.aborted);
+
+    // Nothing is taken once the update failed.
+    TEST_ASSERT_FALSE(updater->write(image.data() + packet_size, packet_size, packet_size));
+    TEST_ASSERT_FALSE(updater->finish());
+
+    TEST_ASSERT_TRUE(updater->begin(10, hex.c_str()));
+    TEST_ASSERT_FALSE(updater->write(image.data(), 11, 0));
+    TEST_ASSERT_EQUAL(2, flash.aborted);
+}
+
+void test_incomplete_image_is_not_finished() {
+    mock_flash flash;
+    ota_updater* updater = make_updater(&flash);
+    std::vector<uint8_t> image = make_image(image_size);
+
+    TEST_ASSERT_TRUE(updater->begin(image.size(), sha256_hex(image.data(), image.size()).c_str()));
+    TEST_ASSERT_TRUE(send(updater, image, 0, image.size() - 1));
+    TEST_ASSERT_FALSE(updater->finish());
+    TEST_ASSERT_EQUAL_STRING("image incomplete", updater->error());
+    TEST_ASSERT_EQUAL(0, flash.finished);
+}
+
+void test_bad_parameters_never_start_the_flash() {
+    mock_flash flash;
+    ota_updater* updater = make_updater(&flash);
+    std::vector<uint8_t> image = make_image(16);
+    std::string hex = sha256_hex(image.data(), image.size());
+
+    TEST_ASSERT_FALSE(updater->begin(flash.capacity() + 1, hex.c_str()));
+    TEST_ASSERT_FALSE(updater->begin(0, hex.c_str()));
+    TEST_ASSERT_FALSE(updater->begin(image.size(), "abc"));
+    TEST_ASSERT_FALSE(updater->begin(image.size(), nullptr));
+    hex[5] = 'g';
+    TEST_ASSERT_FALSE(updater->begin(image.size(), hex.c_str()));
+
+    TEST_ASSERT_EQUAL(0, flash.began);
+    TEST_ASSERT_EQUAL(ota_status::failed, updater->status());
+}
+
+void test_flash_failures_abort() {
+    mock_flash flash;
+    ota_updater* updater = make_updater(&flash);
+    std::vector<uint8_t> image = make_image(image_size);
+    std::string hex = sha256_hex(image.data(), image.size());
+
+    flash.fail_begin = true;
+    TEST_ASSERT_FALSE(updater->begin(image.size(), hex.c_str()));
+    flash.fail_begin = false;
+
+    flash.fail_write_at = 3;
+    TEST_ASSERT_TRUE(updater->begin(image.size(), hex.c_str()));
+    TEST_ASSERT_FALSE(send(updater, image, 0, image.size()));
+    TEST_ASSERT_EQUAL_STRING("failed to write the update slot", updater->error());
+    TEST_ASSERT_EQUAL(1, flash.aborted);
+    flash.fail_write_at = SIZE_MAX;
+
+    flash.reject_image = true;
+    TEST_ASSERT_TRUE(updater->begin(image.size(), hex.c_str()));
+    TEST_ASSERT_TRUE(send(updater, image, 0, image.size()));
+    TEST_ASSERT_FALSE(updater->finish());
+    TEST_ASSERT_EQUAL(ota_status::failed, updater->status());
+    TEST_ASSERT_EQUAL_STRING("image rejected by the bootloader checks", updater->error());
+}
+
+void test_new_update_replaces_one_in_progress() {
+    mock_flash flash;
+    ota_updater* updater = make_updater(&flash);
+    std::vector<uint8_t> image = make_image(image_size);
+    std::string hex = sha256_hex(image.data(), image.size());
+
+    TEST_ASSERT_TRUE(updater->begin(image.size(), hex.c_str()));
+    TEST_ASSERT_TRUE(send(updater, image, 0, image.size() / 2));
+    TEST_ASSERT_TRUE(updater->begin(image.size(), hex.c_str()));
+    TEST_ASSERT_EQUAL(1, flash.aborted);
+    TEST_ASSERT_EQUAL(0, updater->received());
+
+    TEST_ASSERT_TRUE(send(updater, image, 0, image.size()));
+    TEST_ASSERT_TRUE(updater->finish());
+    TEST_ASSERT_TRUE(flash.data == image);
+}
+
+// Signatures from Python's hmac.new(key, bytes.fromhex(sha256_hex), hashlib.sha256).
+void test_signature_matches_known_answer() {
+    const char* sha256 = "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+    const char* signature = "99f0d2732f9dab5cc4115913e47a8cf5f3c328b5f7497239e228e156f1406a82";
+    TEST_ASSERT_TRUE(verify_ota_signature("kitchen-update-key", sha256, signature));
+    const char* uppercase_sha256 = "BA7816BF8F01CFEA414140DE5DAE2223B00361A396177A9CB410FF61F20015AD";
+    TEST_ASSERT_TRUE(verify_ota_signature("kitchen-update-key", uppercase_sha256, signature));
+
+    // Keys longer than a block are hashed first.
+    std::string long_key(100, 'k');
+    TEST_ASSERT_TRUE(verify_ota_signature(long_key.c_str(), sha256,
+                                          "90598e4dc2d96bc136efb9f61a04da2eaaf798682174fe396ad25ad1d2ffbdd8"));
+}
+
+void test_wrong_or_missing_signature_is_refused() {
+    const char* sha256 = "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+    std::string signature = "99f0d2732f9dab5cc4115913e47a8cf5f3c328b5f7497239e228e156f1406a82";
+
+    TEST_ASSERT_FALSE(verify_ota_signature("another-key", sha256, signature.c_str()));
+    TEST_ASSERT_FALSE(verify_ota_signature("", sha256, signature.c_str()));
+    TEST_ASSERT_FALSE(verify_ota_signature(nullptr, sha256, signature.c_str()));
+    TEST_ASSERT_FALSE(verify_ota_signature("kitchen-update-key", sha256, nullptr));
+    TEST_ASSERT_FALSE(verify_ota_signature("kitchen-update-key", nullptr, signature.c_str()));
+    TEST_ASSERT_FALSE(verify_ota_signature("kitchen-update-key", sha256, signature.substr(0, 62).c_str()));
+    signature[63] = signature[63] == '2' ? '3' : '2';
+    TEST_ASSERT_FALSE(verify_ota_signature("kitchen-update-key", sha256, signature.c_str()));
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_sha256_matches_known_answer);
+    RUN_TEST(test_streams_image_in_whole_chunks);
+    RUN_TEST(test_uppercase_hash_is_accepted);
+    RUN_TEST(test_hash_mismatch_aborts);
+    RUN_TEST(test_gaps_and_overruns_abort);
+    RUN_TEST(test_incomplete_image_is_not_finished);
+    RUN_TEST(test_bad_parameters_never_start_the_flash);
+    RUN_TEST(test_flash_failures_abort);
+    RUN_TEST(test_new_update_replaces_one_in_progress);
+    RUN_TEST(test_signature_matches_known_answer);
+    RUN_TEST(test_wrong_or_missing_signature_is_refused);
+    return UNITY_END();
+}
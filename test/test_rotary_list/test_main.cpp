@@ -0,0 +1,176 @@
+#include "rotary_menu.hpp"
+
+#include <unity.h>
+
+#include <chrono>
+
+using namespace mocca;
+
+namespace {
+    constexpr size_t benchmark_sizes[] = {10, 1000, 10000};
+    constexpr int benchmark_frames = 2000;
+    constexpr int benchmark_repeats = 5;
+
+    // Scrolling the list on a 128x64 panel below the notification bar, six rows fit.
+    const box list_area(0, 10, 128, 54);
+    constexpr size_t visible_rows = 6;
+
+    class counting_source : public rotary_list_source {
+      public:
+        explicit counting_source(size_t size) : _size(size) {}
+
+        size_t list_size() const override { return _size; }
+
+        void list_label(size_t row, char* out, size_t out_size) const override {
+            _label_calls++;
+            snprintf(out, out_size, "Network %zu with a name too long for the panel", row);
+        }
+
+        size_t label_calls() const { return _label_calls; }
+        void reset() { _label_calls = 0; }
+
+      private:
+        size_t _size;
+        mutable size_t _label_calls = 0;
+    };
+
+    // Best of a few runs, in nanoseconds per frame.
+    double frame_nanos(rotary_list* list, Adafruit_SSD1306* display) {
+        double best = 0;
+        for (int repeat = 0; repeat < benchmark_repeats; repeat++) {
+            auto start = std::chrono::steady_clock::now();
+            for (int frame = 0; frame < benchmark_frames; frame++) {
+                list->on_encoder_changed(frame % 2 == 0 ? 1 : -1, frame * 1000);
+                list->invalidate();
+                list->render(display);
+            }
+            std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+            double nanos = elapsed.count() / benchmark_frames;
+            best = repeat == 0 ? nanos : std::min(best, nanos);
+        }
+        return best;
+    }
+
+    // Detents it takes to go from the top to the bottom, turning one detent every interval_millis.
+    int detents_to_end(rotary_list* list, size_t size, uint32_t interval_millis) {
+        uint32_t now = 100000;
+        int detents = 0;
+        while (list->selected() < size - 1 && detents < 100000) {
+            now += interval_millis;
+            list->on_encoder_changed(1, now);
+            detents++;
+        }
+        return detents;
+    }
+} // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_frame_draws_only_visible_rows() {
+    Adafruit_SSD1306 display;
+    for (size_t size : benchmark_sizes) {
+        counting_source source(size);
+        rotary_list list;
+        list.layout(list_area);
+        list.open(&source, size / 2);
+
+        for (int frame = 0; frame < 100; frame++) {
+            source.reset();
+            display.reset_counts();
+            list.on_encoder_changed(frame % 3 - 1, frame * 1000);
+            list.invalidate();
+            list.render(&display);
+
+            size_t rows = std::min(size, visible_rows);
+            TEST_ASSERT_EQUAL(rows, source.label_calls());
+            TEST_ASSERT_EQUAL(rows, display.counts().text_runs);
+        }
+    }
+}
+
+void test_frame_cost_is_independent_of_length() {
+    Adafruit_SSD1306 display;
+    double nanos[sizeof(benchmark_sizes) / sizeof(benchmark_sizes[0])];
+    for (size_t size_idx = 0; size_idx < sizeof(benchmark_sizes) / sizeof(benchmark_sizes[0]); size_idx++) {
+        size_t size = benchmark_sizes[size_idx];
+        counting_source source(size);
+        rotary_list list;
+        list.layout(list_area);
+        list.open(&source, size / 2);
+        nanos[size_idx] = frame_nanos(&list, &display);
+
+        char message[64];
+        snprintf(message, sizeof(message), "%zu items: %.0f ns per frame", size, nanos[size_idx]);
+        TEST_MESSAGE(message);
+    }
+
+    // The same six rows get drawn either way, a wide margin keeps scheduler noise from failing the test.
+    TEST_ASSERT_LESS_THAN(nanos[0] * 3, nanos[2]);
+}
+
+void test_fast_turns_traverse_long_lists() {
+    counting_source source(10000);
+    rotary_list list;
+    list.layout(list_area);
+    list.open(&source);
+
+    // Flat out the whole list takes a few dozen detents, not ten thousand.
+    int fast_detents = detents_to_end(&list, source.list_size(), 10);
+    TEST_ASSERT_LESS_OR_EQUAL(200, fast_detents);
+    TEST_ASSERT_GREATER_OR_EQUAL(20, fast_detents);
+    TEST_ASSERT_EQUAL(source.list_size() - 1, list.selected());
+
+    // Stops at the end rather than wrapping around.
+    list.on_encoder_changed(1, 0);
+    TEST_ASSERT_EQUAL(source.list_size() - 1, list.selected());
+}
+
+void test_slow_turns_move_one_row_per_detent() {
+    counting_source source(10000);
+    rotary_list list;
+    list.layout(list_area);
+    list.open(&source, 5000);
+
+    uint32_t now = 100000;
+    for (int detent = 1; detent <= 50; detent++) {
+        now += 200;
+        list.on_encoder_changed(-1, now);
+        TEST_ASSERT_EQUAL(5000 - detent, list.selected());
+    }
+}
+
+void test_short_lists_never_accelerate() {
+    counting_source source(15);
+    rotary_list list;
+    list.layout(list_area);
+    list.open(&source);
+
+    TEST_ASSERT_EQUAL(source.list_size() - 1, detents_to_end(&list, source.list_size(), 5));
+}
+
+void test_empty_list_draws_nothing() {
+    Adafruit_SSD1306 display;
+    counting_source source(0);
+    rotary_list list;
+    list.layout(list_area);
+    list.open(&source);
+
+    list.on_encoder_changed(1, 1000);
+    list.render(&display);
+    TEST_ASSERT_TRUE(list.is_empty());
+    TEST_ASSERT_EQUAL(0, source.label_calls());
+    TEST_ASSERT_EQUAL(0, display.counts().text_runs);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_frame_draws_only_visible_rows);
+    RUN_TEST(test_frame_cost_is_independent_of_length);
+    RUN_TEST(test_fast_turns_traverse_long_lists);
+    RUN_TEST(test_slow_turns_move_one_row_per_detent);
+    RUN_TEST(test_short_lists_never_accelerate);
+    RUN_TEST(test_empty_list_draws_nothing);
+    return UNITY_END();
+}
@@ -0,0 +1,264 @@
+#include "schedule_sync.hpp"
+
+#include <unity.h>
+
+#include <memory>
+#include <vector>
+
+using namespace mocca;
+
+// A group of units in one process, talking multicast over the loopback interface. Every test gets a group name of its
+// own so that nothing left over from an earlier one gets in.
+namespace {
+    constexpr uint16_t sync_port = 4587;
+    constexpr size_t node_count = 5;
+    constexpr uint32_t first_node_id = 0x1000;
+    constexpr uint32_t lossless_timeout = 1000; // A change and its repeat go out within 250 ms
+    constexpr uint32_t lossy_timeout = 60000;   // Up to a few digest rounds
+    constexpr double lossy_share = 0.3;
+    constexpr size_t burst_changes = 50;
+    constexpr uint32_t max_burst_packets = 25; // The token bucket's burst plus 10 a second, with a little slack
+    constexpr uint32_t step_interval_millis = 1;
+
+    const IPAddress group_address(239, 255, 77, 87);
+
+    struct node {
+        persistent_data data;
+        schedule_sync sync;
+        bool running = false;
+    };
+
+    std::vector<std::unique_ptr<node>> nodes;
+    char group[32];
+    time_t utc = 1760000000;
+
+    bool multicast_works() {
+        WiFiUDP sender;
+        WiFiUDP receiver;
+        if (!sender.beginMulticast(group_address, sync_port) || !receiver.beginMulticast(group_address, sync_port)) {
+            return false;
+        }
+        const uint8_t probe[] = {'p', 'r', 'o', 'b', 'e'};
+        sender.beginMulticastPacket();
+        sender.write(probe, sizeof(probe));
+        if (!sender.endPacket()) {
+            return false;
+        }
+        for (int attempt = 0; attempt < 100; attempt++) {
+            if (receiver.parsePacket() == sizeof(probe)) {
+                return true;
+            }
+            delay(1);
+        }
+        return false;
+    }
+
+    // Applies records the way the firmware does, except that "Bad/Zone" doesn't load.
+    void init_node(node* unit, uint32_t node_id) {
+        strlcpy(unit->data.timezone, "America/New_York", sizeof(unit->data.timezone));
+        unit->sync.init(group, node_id, &unit->data);
+        unit->sync.set_callbacks(
+            [unit](time_t wake, uint32_t wake_secs) {
+                unit->data.current_wake = wake;
+                unit->data.last_wake_secs = wake_secs;
+                unit->sync.on_local_change(sync_record::wake);
+            },
+            [unit](const wake_alarm* alarms, size_t alarm_count) {
+                for (size_t alarm_idx = 0; alarm_idx < max_wake_alarms; alarm_idx++) {
+                    unit->data.wake_alarms[alarm_idx] = alarm_idx < alarm_count ? alarms[alarm_idx] : wake_alarm();
+                }
+                unit->sync.on_local_change(sync_record::alarms);
+            },
+            [unit](const char* timezone) {
+                if (strcmp(timezone, "Bad/Zone") == 0) {
+                    return false;
+                }
+                strlcpy(unit->data.timezone, timezone, sizeof(unit->data.timezone));
+                unit->sync.on_local_change(sync_record::timezone);
+                return true;
+            },
+            []() {});
+    }
+
+    void start_node(size_t node_idx) {
+        nodes[node_idx]->sync.start(group_address, sync_port);
+        nodes[node_idx]->running = true;
+    }
+
+    void step_all() {
+        uint32_t now = millis();
+        for (std::unique_ptr<node>& unit : nodes) {
+            if (unit->running) {
+                unit->sync.step(now, utc);
+            }
+        }
+    }
+
+    template <typename Condition> bool step_until(Condition condition, uint32_t timeout) {
+        uint32_t start = millis();
+        while (millis() - start < timeout) {
+            step_all();
+            if (condition()) {
+                return true;
+            }
+            delay(step_interval_millis);
+        }
+        return false;
+    }
+
+    void step_for(uint32_t duration) {
+        step_until([]() { return false; }, duration);
+    }
+
+    template <typename Check> bool all_running(Check check) {
+        for (std::unique_ptr<node>& unit : nodes) {
+            if (unit->running && !check(unit->data)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool all_wake(time_t wake) {
+        return all_running([wake](const persistent_data& data) { return data.current_wake == wake; });
+    }
+
+    bool all_timezone(const char* timezone) {
+        return all_running([timezone](const persistent_data& data) { return strcmp(data.timezone, timezone) == 0; });
+    }
+
+    bool all_alarm(uint16_t minute_of_day) {
+        return all_running([minute_of_day](const persistent_data& data) {
+            return data.wake_alarms[0].minute_of_day == minute_of_day;
+        });
+    }
+
+    void set_wake(node* unit, time_t wake) {
+        unit->data.current_wake = wake;
+        unit->data.last_wake_secs = wake % SECS_PER_DAY;
+        unit->sync.on_local_change(sync_record::wake);
+    }
+
+    void set_timezone(node* unit, const char* timezone) {
+        strlcpy(unit->data.timezone, timezone, sizeof(unit->data.timezone));
+        unit->sync.on_local_change(sync_record::timezone);
+    }
+} // namespace
+
+void setUp() {
+    if (!multicast_works()) {
+        TEST_IGNORE_MESSAGE("No multicast on the loopback interface.");
+    }
+
+    static uint32_t test_number = 0;
+    snprintf(group, sizeof(group), "test-%d-%u", static_cast<int>(getpid()), ++test_number);
+    host::udp_loss() = 0;
+    utc += SECS_PER_HOUR;
+
+    for (size_t node_idx = 0; node_idx < node_count; node_idx++) {
+        nodes.emplace_back(new node());
+        init_node(nodes.back().get(), first_node_id + node_idx);
+    }
+    // The last node joins late, where a test wants it to.
+    for (size_t node_idx = 0; node_idx + 1 < node_count; node_idx++) {
+        start_node(node_idx);
+    }
+    step_for(100);
+}
+
+void tearDown() {
+    for (std::unique_ptr<node>& unit : nodes) {
+        unit->sync.stop();
+    }
+    nodes.clear();
+    host::udp_loss() = 0;
+}
+
+void test_change_reaches_every_node() {
+    for (int change = 0; change < 10; change++) {
+        time_t wake = utc + SECS_PER_HOUR + change;
+        set_wake(nodes[change % 4].get(), wake);
+        TEST_ASSERT_TRUE(step_until([wake]() { return all_wake(wake); }, lossless_timeout));
+        utc++;
+    }
+
+    for (int node_idx = 0; node_idx < 4; node_idx++) {
+        sync_stats stats = nodes[node_idx]->sync.get_stats();
+        TEST_ASSERT_EQUAL_UINT32(0, stats.malformed);
+        TEST_ASSERT_EQUAL_UINT32(3, stats.peers);
+    }
+}
+
+void test_change_survives_packet_loss() {
+    host::udp_loss() = lossy_share;
+    for (int change = 0; change < 3; change++) {
+        node* unit = nodes[change % 4].get();
+        uint16_t minute_of_day = 400 + change;
+        unit->data.wake_alarms[0].minute_of_day = minute_of_day;
+        unit->data.wake_alarms[0].days = 0x3e;
+        unit->data.wake_alarms[0].enabled = 1;
+        unit->sync.on_local_change(sync_record::alarms);
+        TEST_ASSERT_TRUE(step_until([minute_of_day]() { return all_alarm(minute_of_day); }, lossy_timeout));
+        utc++;
+    }
+}
+
+void test_conflicting_edits_go_to_the_higher_node() {
+    // The same second, so the versions tie and the node id decides.
+    set_timezone(nodes[1].get(), "Europe/Berlin");
+    set_timezone(nodes[2].get(), "Asia/Tokyo");
+    TEST_ASSERT_TRUE(step_until([]() { return all_timezone("Asia/Tokyo"); }, lossless_timeout));
+
+    // A later edit wins over a higher node id.
+    utc++;
+    set_timezone(nodes[0].get(), "Europe/Berlin");
+    TEST_ASSERT_TRUE(step_until([]() { return all_timezone("Europe/Berlin"); }, lossless_timeout));
+}
+
+void test_late_joiner_catches_up() {
+    set_wake(nodes[0].get(), utc + SECS_PER_HOUR);
+    set_timezone(nodes[1].get(), "Asia/Tokyo");
+    TEST_ASSERT_TRUE(step_until([]() { return all_timezone("Asia/Tokyo"); }, lossless_timeout));
+
+    // start() asks for anything newer right away, well before the next digest round.
+    start_node(4);
+    time_t wake = nodes[0]->data.current_wake;
+    TEST_ASSERT_TRUE(step_until([wake]() { return all_timezone("Asia/Tokyo") && all_wake(wake); }, lossless_timeout));
+    TEST_ASSERT_EQUAL_STRING("Asia/Tokyo", nodes[4]->data.timezone);
+}
+
+void test_rejected_value_does_not_stick() {
+    set_timezone(nodes[0].get(), "Bad/Zone");
+    step_for(lossless_timeout);
+    TEST_ASSERT_EQUAL_STRING("America/New_York", nodes[1]->data.timezone);
+
+    // The peers didn't take the bad version, so the fix after it still gets through.
+    utc++;
+    set_timezone(nodes[0].get(), "Europe/Paris");
+    TEST_ASSERT_TRUE(step_until([]() { return all_timezone("Europe/Paris"); }, lossless_timeout));
+}
+
+void test_burst_is_rate_limited() {
+    node* unit = nodes[0].get();
+    uint32_t sent_before = unit->sync.get_stats().sent;
+    time_t wake = 0;
+    for (size_t change = 0; change < burst_changes; change++) {
+        wake = utc + SECS_PER_HOUR + change;
+        set_wake(unit, wake);
+        step_all();
+        delay(2);
+    }
+    TEST_ASSERT_TRUE(step_until([wake]() { return all_wake(wake); }, lossless_timeout * 5));
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(max_burst_packets, unit->sync.get_stats().sent - sent_before);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_change_reaches_every_node);
+    RUN_TEST(test_change_survives_packet_loss);
+    RUN_TEST(test_conflicting_edits_go_to_the_higher_node);
+    RUN_TEST(test_late_joiner_catches_up);
+    RUN_TEST(test_rejected_value_does_not_stick);
+    RUN_TEST(test_burst_is_rate_limited);
+    return UNITY_END();
+}
@@ -0,0 +1,321 @@
+#include "sntp_client.hpp"
+
+#include <sys/time.h>
+#include <unity.h>
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+using namespace mocca;
+
+// Runs the client against NTP servers on the loopback interface, on the simulated system clock. Time skips ahead a
+// second at a time between rounds and a millisecond at a time while packets are on their way, so a day of syncs takes
+// well under a second. The servers hold their answers back to simulate the network delay.
+namespace {
+    constexpr uint16_t first_server_port = 12370;
+    constexpr uint32_t ntp_to_unix_secs = 2208988800UL;
+    constexpr size_t packet_size = 48;
+
+    constexpr uint64_t fine_step_micros = 1000;
+    constexpr uint64_t coarse_step_micros = 1000000;
+    constexpr uint64_t round_micros = 3000000; // Resolving plus the query timeout
+    constexpr uint64_t micros_per_hour = 3600ULL * 1000000;
+
+    constexpr int64_t initial_error_micros = 3000000;
+    constexpr int64_t max_quantization_micros = fine_step_micros; // How much later the client sees an answer
+
+    int64_t true_offset = 0; // From host_micros() to the true time
+
+    int64_t true_micros() {
+        return static_cast<int64_t>(host_micros()) + true_offset;
+    }
+
+    int64_t system_micros() {
+        timeval tv;
+        gettimeofday(&tv, nullptr);
+        return static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+    }
+
+    int64_t clock_error_micros() {
+        return system_micros() - true_micros();
+    }
+
+    void write_be32(uint8_t* data, uint32_t value) {
+        data[0] = value >> 24;
+        data[1] = value >> 16;
+        data[2] = value >> 8;
+        data[3] = value;
+    }
+
+    void micros_to_ntp(int64_t micros, uint8_t* timestamp) {
+        write_be32(timestamp, static_cast<uint32_t>(micros / 1000000) + ntp_to_unix_secs);
+        write_be32(timestamp + 4, static_cast<uint32_t>(((micros % 1000000) << 32) / 1000000));
+    }
+
+    // An NTP server whose clock is off by error_micros, with answers that take one_way_micros each way.
+    struct fake_server {
+        uint16_t port = 0;
+        int64_t error_micros = 0;
+        int64_t one_way_micros = 5000;
+        uint32_t root_delay_micros = 1000;
+        uint32_t root_dispersion_micros = 1000;
+        uint8_t leap = 0;
+        uint8_t stratum = 2;
+        uint32_t requests = 0;
+
+        struct answer {
+            uint64_t due;
+            IPAddress address;
+            uint16_t port;
+            uint8_t packet[packet_size];
+        };
+
+        WiFiUDP udp;
+        std::deque<answer> answers;
+        uint64_t busy_until = 0;
+
+        // Takes in requests and sends the answers that are due, returns true while packets are on their way.
+        bool poll() {
+            while (udp.parsePacket() > 0) {
+                uint8_t request[packet_size];
+                if (udp.read(request, sizeof(request)) != static_cast<int>(sizeof(request))) {
+                    continue;
+                }
+                requests++;
+
+                answer reply = {};
+                reply.due = host_micros() + one_way_micros * 2;
+                reply.address = udp.remoteIP();
+                reply.port = udp.remotePort();
+                reply.packet[0] = (leap << 6) | (4 << 3) | 4; // Version 4, server mode
+                reply.packet[1] = stratum;
+                write_be32(reply.packet + 4, static_cast<uint32_t>((uint64_t(root_delay_micros) << 16) / 1000000));
+                write_be32(reply.packet + 8,
+                           static_cast<uint32_t>((uint64_t(root_dispersion_micros) << 16) / 1000000));
+                memcpy(reply.packet + 24, request + 40, 8);
+                int64_t server_micros = true_micros() + one_way_micros + error_micros;
+                micros_to_ntp(server_micros, reply.packet + 32);
+                micros_to_ntp(server_micros, reply.packet + 40);
+                answers.push_back(reply);
+                busy_until = host_micros() + round_micros;
+            }
+
+            while (!answers.empty() && answers.front().due <= host_micros()) {
+                udp.beginPacket(answers.front().address, answers.front().port);
+                udp.write(answers.front().packet, packet_size);
+                udp.endPacket();
+                answers.pop_front();
+            }
+            return host_micros() < busy_until;
+        }
+    };
+
+    std::unique_ptr<sntp_client> client;
+    std::vector<std::unique_ptr<fake_server>> servers;
+    std::vector<sntp_stats> syncs; // The stats after every sync
+
+    fake_server* add_server() {
+        servers.emplace_back(new fake_server());
+        fake_server* server = servers.back().get();
+        server->port = first_server_port + servers.size() - 1;
+        TEST_ASSERT_TRUE(server->udp.begin(server->port));
+        return server;
+    }
+
+    void start_client() {
+        static sntp_server list[sntp_client::max_servers];
+        for (size_t server_idx = 0; server_idx < servers.size(); server_idx++) {
+            list[server_idx] = {"127.0.0.1", servers[server_idx]->port};
+        }
+        client->set_servers(list, servers.size());
+        client->start();
+    }
+
+    void restart_client() {
+        client->stop();
+        client.reset(new sntp_client());
+        syncs.clear();
+        start_client();
+    }
+
+    void run_for(uint64_t duration) {
+        uint64_t end = host_micros() + duration;
+        while (host_micros() < end) {
+            for (std::unique_ptr<fake_server>& server : servers) {
+                server->poll();
+            }
+            if (client->step()) {
+                syncs.push_back(client->get_stats());
+            }
+            bool busy = false;
+            for (std::unique_ptr<fake_server>& server : servers) {
+                busy |= server->poll();
+            }
+            host::clock_warp() += busy ? fine_step_micros : coarse_step_micros;
+        }
+    }
+
+    void run_until_syncs(size_t count, uint64_t timeout) {
+        uint64_t end = host_micros() + timeout;
+        while (syncs.size() < count && host_micros() < end) {
+            run_for(coarse_step_micros);
+        }
+        TEST_ASSERT_EQUAL(count, syncs.size());
+    }
+} // namespace
+
+void setUp() {
+    host::system_clock& clock = host::sys_clock();
+    {
+        std::lock_guard<std::mutex> guard(clock.lock);
+        clock.update();
+        clock.drift_ppm = 0;
+        clock.outstanding = 0;
+    }
+    true_offset = system_micros() - static_cast<int64_t>(host_micros());
+
+    // Off by a few seconds, like after a cold boot.
+    timeval tv = {static_cast<time_t>((true_micros() + initial_error_micros) / 1000000), 0};
+    settimeofday(&tv, nullptr);
+    clock.steps = 0;
+
+    client.reset(new sntp_client());
+    syncs.clear();
+}
+
+void tearDown() {
+    client->stop();
+    client.reset();
+    servers.clear();
+}
+
+void test_first_sync_steps_to_the_closest_server() {
+    // Quick to answer but not sure of its own time.
+    fake_server* unsure = add_server();
+    unsure->error_micros = 30000;
+    unsure->one_way_micros = 2000;
+    unsure->root_dispersion_micros = 80000;
+
+    // The slowest to answer, but the shortest synchronization distance.
+    fake_server* closest = add_server();
+    closest->error_micros = -8000;
+    closest->one_way_micros = 20000;
+
+    // Even quicker, but unsynchronized.
+    fake_server* unsynchronized = add_server();
+    unsynchronized->error_micros = 500000;
+    unsynchronized->one_way_micros = 500;
+    unsynchronized->leap = 3;
+
+    start_client();
+    run_until_syncs(1, round_micros * 2);
+
+    TEST_ASSERT_TRUE(client->has_synced());
+    TEST_ASSERT_EQUAL_UINT32(1, host::sys_clock().steps);
+    for (std::unique_ptr<fake_server>& server : servers) {
+        TEST_ASSERT_EQUAL_UINT32(1, server->requests);
+    }
+    TEST_ASSERT_INT64_WITHIN(max_quantization_micros, closest->error_micros, clock_error_micros());
+    TEST_ASSERT_INT64_WITHIN(max_quantization_micros, closest->one_way_micros * 2, syncs[0].last_delay_micros);
+    TEST_ASSERT_EQUAL_UINT32(300, syncs[0].sync_interval_secs);
+}
+
+// Offsets below 128 ms are slewed, anything from there on steps the clock. Each is the first offset after the initial
+// sync, before the client takes any of it for drift.
+void test_small_offsets_slew_and_large_ones_step() {
+    fake_server* server = add_server();
+    start_client();
+    run_until_syncs(1, round_micros * 2);
+    TEST_ASSERT_EQUAL_UINT32(1, host::sys_clock().steps);
+
+    server->error_micros = 120000;
+    run_until_syncs(2, micros_per_hour);
+    TEST_ASSERT_EQUAL_UINT32(1, host::sys_clock().steps);
+    TEST_ASSERT_INT64_WITHIN(max_quantization_micros, 120000, syncs[1].last_offset_micros);
+    // adjtime() moves the clock at 500 ppm, 30 ms a minute.
+    TEST_ASSERT_INT64_WITHIN(max_quantization_micros, 0, clock_error_micros());
+    run_for(60 * coarse_step_micros);
+    TEST_ASSERT_INT64_WITHIN(max_quantization_micros * 2, 30000, clock_error_micros());
+
+    restart_client();
+    server->error_micros = 0;
+    run_until_syncs(1, round_micros * 2);
+    TEST_ASSERT_EQUAL_UINT32(2, host::sys_clock().steps);
+
+    server->error_micros = 136000;
+    run_until_syncs(2, micros_per_hour);
+    TEST_ASSERT_EQUAL_UINT32(3, host::sys_clock().steps);
+    TEST_ASSERT_INT64_WITHIN(max_quantization_micros, 136000, syncs[1].last_offset_micros);
+    TEST_ASSERT_INT64_WITHIN(max_quantization_micros, server->error_micros, clock_error_micros());
+    TEST_ASSERT_EQUAL_UINT32(300, syncs[1].sync_interval_secs);
+}
+
+// A crystal 60 ppm fast is found out within a few rounds, and the clock stays close while the rounds grow apart.
+void test_drift_is_estimated_and_corrected() {
+    {
+        std::lock_guard<std::mutex> guard(host::sys_clock().lock);
+        host::sys_clock().update();
+        host::sys_clock().drift_ppm = 60;
+    }
+    add_server();
+    start_client();
+    run_for(micros_per_hour * 24);
+
+    sntp_stats stats = client->get_stats();
+    TEST_ASSERT_FLOAT_WITHIN(3.0f, 60.0f, stats.drift_ppm);
+    TEST_ASSERT_EQUAL_UINT32(1, host::sys_clock().steps);
+    TEST_ASSERT_GREATER_THAN_UINT32(3600, stats.sync_interval_secs);
+
+    // Without the correction the clock would be off by over a second after these 8 hours.
+    int64_t worst_error = 0;
+    for (int hour = 0; hour < 8; hour++) {
+        run_for(micros_per_hour);
+        worst_error = std::max(worst_error, std::abs(clock_error_micros()));
+    }
+    TEST_ASSERT_LESS_THAN_INT64(20000, worst_error);
+}
+
+void test_interval_doubles_up_to_eight_hours() {
+    add_server();
+    start_client();
+    run_until_syncs(10, micros_per_hour * 30);
+
+    // The first sync steps the clock, every one after it finds it within a millisecond.
+    uint32_t expected_secs = 300;
+    for (size_t sync_idx = 0; sync_idx < syncs.size(); sync_idx++) {
+        TEST_ASSERT_EQUAL_UINT32(expected_secs, syncs[sync_idx].sync_interval_secs);
+        if (sync_idx > 0) {
+            TEST_ASSERT_INT64_WITHIN(max_quantization_micros, 0, syncs[sync_idx].last_offset_micros);
+        }
+        expected_secs = std::min<uint32_t>(expected_secs * 2, 8 * 3600);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, client->get_stats().failed_rounds);
+}
+
+void test_unanswered_rounds_back_off() {
+    fake_server* server = add_server();
+    start_client();
+    run_until_syncs(1, round_micros * 2);
+
+    // The server goes away, the retries spread out but never wait longer than a regular round.
+    server->udp.stop();
+    run_for(micros_per_hour * 2);
+    sntp_stats stats = client->get_stats();
+    TEST_ASSERT_GREATER_THAN_UINT32(3, stats.failed_rounds);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(2 * 3600 / 15, stats.failed_rounds);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.syncs);
+
+    TEST_ASSERT_TRUE(server->udp.begin(server->port));
+    run_until_syncs(2, micros_per_hour);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_first_sync_steps_to_the_closest_server);
+    RUN_TEST(test_small_offsets_slew_and_large_ones_step);
+    RUN_TEST(test_drift_is_estimated_and_corrected);
+    RUN_TEST(test_interval_doubles_up_to_eight_hours);
+    RUN_TEST(test_unanswered_rounds_back_off);
+    return UNITY_END();
+}